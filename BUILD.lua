@@ -26,7 +26,7 @@ local ducible = cc.binary {
     },
     includes = {"src"},
     warnings = {"all", "error"},
-    compiler_opts = {"-g"},
+    compiler_opts = {"-g", "-pthread"},
 }
 
 local ducible_exe = path.join(".", ducible:path())
@@ -60,7 +60,7 @@ local pdbdump = cc.binary {
     },
     includes = {"src"},
     warnings = {"all", "error"},
-    compiler_opts = {"-g"},
+    compiler_opts = {"-g", "-pthread"},
 }
 
 local pdbdump_exe = path.join(".", pdbdump:path())
@@ -0,0 +1,324 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2016 Jason White
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+"""
+Checks ducible and pdbdump against generated fixtures (see fixture.py).
+
+Unlike tests.py, this doesn't need Visual Studio. It is run by `make check`.
+"""
+
+import os
+import sys
+import shutil
+import zipfile
+import argparse
+import tempfile
+import unittest
+import subprocess
+
+import fixture
+
+
+bin_dir = '.'
+
+
+def ducible(*args):
+    return run('ducible', *args)
+
+
+def pdbdump(*args):
+    return run('pdbdump', *args)
+
+
+def run(program, *args):
+    """
+    Runs one of the programs. Returns its exit code and standard output.
+    """
+    path = os.path.join(os.path.abspath(bin_dir), program)
+    result = subprocess.run([path] + list(args),
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                            universal_newlines=True)
+    return result.returncode, result.stdout
+
+
+def read(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def write(path, data):
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+class FixtureTest(unittest.TestCase):
+    """
+    Runs each test in a directory of its own with two builds of the same
+    fixture: "a" and "b".
+    """
+
+    def setUp(self):
+        self.dir = tempfile.mkdtemp(prefix='ducible-check-')
+        fixture.write(self.path('a'), seed=1)
+        fixture.write(self.path('b'), seed=2)
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def path(self, name):
+        return os.path.join(self.dir, name)
+
+    def patch(self, stem, *args):
+        code, _ = ducible(self.path(stem + '.dll'), self.path(stem + '.pdb'),
+                          *args)
+        self.assertEqual(code, 0)
+
+    def copy(self, src, dest):
+        shutil.copyfile(self.path(src), self.path(dest))
+
+
+class TestPatch(FixtureTest):
+
+    def test_reproducible(self):
+        self.assertNotEqual(read(self.path('a.pdb')), read(self.path('b.pdb')))
+
+        self.patch('a')
+        self.patch('b')
+
+        self.assertEqual(read(self.path('a.dll')), read(self.path('b.dll')))
+        self.assertEqual(read(self.path('a.pdb')), read(self.path('b.pdb')))
+
+    def test_already_patched(self):
+        self.patch('a')
+
+        dll = read(self.path('a.dll'))
+        pdb = read(self.path('a.pdb'))
+
+        code, _ = ducible(self.path('a.dll'), self.path('a.pdb'),
+                          '--exit-code')
+        self.assertEqual(code, 2)
+
+        self.assertEqual(read(self.path('a.dll')), dll)
+        self.assertEqual(read(self.path('a.pdb')), pdb)
+
+    def test_not_an_image(self):
+        junk = b'\x34\x12' + bytes(62)
+        write(self.path('junk.obj'), junk)
+
+        code, _ = ducible(self.path('junk.obj'))
+        self.assertEqual(code, 1)
+        self.assertEqual(read(self.path('junk.obj')), junk)
+
+
+class TestPdbdump(FixtureTest):
+
+    def test_check(self):
+        code, out = pdbdump(self.path('a.pdb'), '--check')
+        self.assertEqual(code, 0, out)
+
+        self.patch('a', '--strip-private')
+
+        code, out = pdbdump(self.path('a.pdb'), '--check')
+        self.assertEqual(code, 0, out)
+
+    def test_check_corrupt(self):
+        pdb = bytearray(read(self.path('a.pdb')))
+
+        # Say that the file has fewer pages than the streams use.
+        pdb[40:44] = (4).to_bytes(4, 'little')
+        write(self.path('a.pdb'), pdb)
+
+        code, _ = pdbdump(self.path('a.pdb'), '--check')
+        self.assertEqual(code, 1)
+
+    def test_symbols(self):
+        self.patch('a')
+
+        code, out = pdbdump(self.path('a.pdb'), '--symbols')
+        self.assertEqual(code, 0)
+
+        self.assertIn('S_PUB32 [0001:00000030] flags=0x2 ?pub3@@YAXXZ', out)
+        self.assertIn('S_GDATA32 [0002:00000100] type=0x74 g_data', out)
+        self.assertIn("Module Name: 'c:\\build\\mod2.obj'", out)
+        self.assertIn(' func2\n', out)
+
+    def test_resolve(self):
+        self.patch('a')
+
+        index = self.path('a.idx')
+
+        code, _ = pdbdump(self.path('a.pdb'), '--index', index)
+        self.assertEqual(code, 0)
+
+        code, out = pdbdump('--resolve', index, '1:10', '1:25', '1034')
+        self.assertEqual(code, 0)
+        self.assertEqual(out.splitlines(), [
+            '1:10\t0001:00000010\tc:\\build\\mod1.obj\t?pub1@@YAXXZ',
+            '1:25\t0001:00000025\tc:\\build\\mod2.obj\t?pub2@@YAXXZ+0x5',
+            '1034\t0001:00000034\t?\t?pub3@@YAXXZ+0x4',
+        ])
+
+        code, _ = pdbdump('--resolve', index, 'not-an-address')
+        self.assertEqual(code, 1)
+
+
+class TestPlan(FixtureTest):
+
+    def test_apply(self):
+        self.copy('a.dll', 'c.dll')
+        self.copy('a.pdb', 'c.pdb')
+
+        plan = self.path('a.plan')
+        self.patch('a', '--emit-plan', plan)
+
+        code, _ = ducible('--apply-plan', plan, self.path('c.dll'),
+                          self.path('c.pdb'))
+        self.assertEqual(code, 0)
+
+        self.assertEqual(read(self.path('c.dll')), read(self.path('a.dll')))
+        self.assertEqual(read(self.path('c.pdb')), read(self.path('a.pdb')))
+
+    def test_wrong_image(self):
+        plan = self.path('a.plan')
+        self.patch('a', '--emit-plan', plan)
+
+        dll = read(self.path('b.dll'))
+
+        code, _ = ducible('--apply-plan', plan, self.path('b.dll'))
+        self.assertEqual(code, 1)
+        self.assertEqual(read(self.path('b.dll')), dll)
+
+    def test_corrupt(self):
+        self.copy('a.dll', 'c.dll')
+
+        plan = self.path('a.plan')
+        self.patch('a', '--emit-plan', plan)
+
+        data = bytearray(read(plan))
+        data[len(data) // 2] ^= 1
+        write(plan, data)
+
+        dll = read(self.path('c.dll'))
+
+        code, _ = ducible('--apply-plan', plan, self.path('c.dll'))
+        self.assertEqual(code, 1)
+        self.assertEqual(read(self.path('c.dll')), dll)
+
+
+class TestDelta(FixtureTest):
+
+    def setUp(self):
+        super().setUp()
+
+        self.base = self.path('base.pdb')
+        self.delta = self.path('a.pdb.delta')
+        self.output = self.path('out.pdb')
+
+        self.copy('a.pdb', 'base.pdb')
+        self.patch('a', '--delta-base', self.base)
+
+    def test_apply(self):
+        code, _ = ducible('--apply-delta', self.delta, self.base, self.output)
+        self.assertEqual(code, 0)
+
+        self.assertEqual(read(self.output), read(self.path('a.pdb')))
+
+    def test_wrong_base(self):
+        code, _ = ducible('--apply-delta', self.delta, self.path('b.pdb'),
+                          self.output)
+        self.assertEqual(code, 1)
+        self.assertFalse(os.path.exists(self.output))
+
+    def test_corrupt(self):
+        delta = read(self.delta)
+
+        for i in range(0, len(delta), 7):
+            corrupt = bytearray(delta)
+            corrupt[i] ^= 0x80
+            write(self.delta, corrupt)
+
+            code, _ = ducible('--apply-delta', self.delta, self.base,
+                              self.output)
+            self.assertEqual(code, 1, 'byte %d' % i)
+            self.assertFalse(os.path.exists(self.output))
+
+        write(self.delta, delta[:len(delta) // 2])
+
+        code, _ = ducible('--apply-delta', self.delta, self.base, self.output)
+        self.assertEqual(code, 1)
+
+
+class TestArchive(FixtureTest):
+
+    def package(self, stem):
+        """
+        Packs a build of the fixture into a NuGet package.
+        """
+        path = self.path(stem + '.nupkg')
+
+        with zipfile.ZipFile(path, 'w', zipfile.ZIP_DEFLATED) as z:
+            z.writestr('readme.txt', 'Stored as is.\n',
+                       compress_type=zipfile.ZIP_STORED)
+            z.write(self.path(stem + '.dll'), 'lib/net45/fixture.dll')
+            z.write(self.path(stem + '.pdb'), 'lib/net45/fixture.pdb')
+
+        return path
+
+    def test_reproducible(self):
+        a = self.package('a')
+        b = self.package('b')
+
+        self.assertEqual(ducible(a)[0], 0)
+        self.assertEqual(ducible(b)[0], 0)
+
+        self.assertEqual(read(a), read(b))
+
+        # The members must be what patching the files on their own gives.
+        self.patch('a')
+
+        with zipfile.ZipFile(a) as z:
+            self.assertIsNone(z.testzip())
+
+            self.assertEqual(z.read('readme.txt'), b'Stored as is.\n')
+            self.assertEqual(z.read('lib/net45/fixture.dll'),
+                             read(self.path('a.dll')))
+            self.assertEqual(z.read('lib/net45/fixture.pdb'),
+                             read(self.path('a.pdb')))
+
+
+if __name__ == '__main__':
+
+    parser = argparse.ArgumentParser(description='Runs checks')
+    parser.add_argument('bindir',
+            help='Directory of the Ducible and Pdbdump executables.')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+
+    bin_dir = args.bindir
+
+    suite = unittest.defaultTestLoader.loadTestsFromModule(
+        sys.modules[__name__])
+
+    result = unittest.TextTestRunner(verbosity=2 if args.verbose else 1)\
+            .run(suite)
+
+    sys.exit(0 if result.wasSuccessful() else 1)
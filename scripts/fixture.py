@@ -0,0 +1,364 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2016 Jason White
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+"""
+Generates a small DLL and its PDB without a compiler.
+
+The files are laid out the way the Microsoft linker lays them out, with the
+same kinds of nondeterminism: timestamps, a random PDB signature, temporary
+file names with GUIDs in them, garbage in padding, and streams scattered across
+the PDB. Two fixtures made with different seeds only differ in those things, so
+ducible must patch them into identical files.
+
+The DLL has one public symbol "?pub<N>@@YAXXZ" at 1:<N * 0x10> for each N, and
+each module has a procedure "func<N>".
+"""
+
+import random
+import struct
+
+
+PAGE_SIZE = 4096
+
+# Number of the first stream after the fixed ones (header, TPI, DBI, IPI).
+FIRST_NAMED_STREAM = 5
+
+S_OBJNAME = 0x1101
+S_GPROC32 = 0x1110
+S_PUB32 = 0x110e
+S_GDATA32 = 0x110d
+
+
+class Fixture:
+    """
+    Builds the DLL and PDB. Anything drawn from `noise` is what changes from
+    one link to the next. Everything else is the same every time.
+    """
+
+    def __init__(self, modules, publics, seed):
+        self.modules = modules
+        self.publics = publics
+        self.content = random.Random(0)
+        self.noise = random.Random(seed)
+
+        self.signature = bytes(self.noise.randrange(256) for _ in range(16))
+        self.age = self.noise.randrange(1, 100)
+
+        self.streams = {}
+
+    def guid(self, rng):
+        n = rng
+        return '{%08X-%04X-%04X-%04X-%012X}' % (
+            n.getrandbits(32), n.getrandbits(16), n.getrandbits(16),
+            n.getrandbits(16), n.getrandbits(48))
+
+    def symbol(self, kind, body):
+        record = struct.pack('<H', kind) + body
+        while (len(record) + 2) % 4:
+            record += b'\0'
+        return struct.pack('<H', len(record)) + record
+
+    def image(self):
+        dos = bytearray(0x40)
+        dos[0:2] = b'MZ'
+        struct.pack_into('<I', dos, 0x3c, 0x40)
+
+        timestamp = self.noise.getrandbits(31)
+        file_header = struct.pack('<HHIIIHH', 0x14c, 1, timestamp, 0, 0, 224,
+                                  0x2102)
+
+        data_dirs = [(0, 0)] * 16
+        data_dirs[6] = (0x1000, 28)  # Debug directory
+
+        optional = struct.pack(
+            '<HBBIIIIIIIIIHHHHHHIIIIHHIIIIII', 0x10b, 14, 0, 0x200, 0, 0,
+            0x1000, 0x1000, 0x1000, 0x10000000, 0x1000, 0x200, 6, 0, 0, 0, 6,
+            0, 0, 0x2000, 0x200, self.noise.getrandbits(31), 2, 0, 0x100000,
+            0x1000, 0x100000, 0x1000, 0, 16)
+        optional += b''.join(struct.pack('<II', *d) for d in data_dirs)
+
+        section = struct.pack('<8sIIIIIIHHI', b'.rdata', 0x200, 0x1000, 0x200,
+                              0x200, 0, 0, 0, 0, 0x40000040)
+
+        headers = bytes(dos) + b'PE\0\0' + file_header + optional + section
+
+        codeview = (b'RSDS' + self.signature + struct.pack('<I', self.age) +
+                    b'C:\\build\\fixture.pdb\0')
+        debug_dir = struct.pack('<IIHHIIII', 0, self.noise.getrandbits(31), 0,
+                                0, 2, len(codeview), 0x1040, 0x240)
+
+        rdata = debug_dir.ljust(0x40, b'\0') + codeview
+
+        return headers.ljust(0x200, b'\0') + rdata.ljust(0x200, b'\0')
+
+    def name_map(self, names):
+        strings = b''
+        entries = b''
+        for name, index in names:
+            entries += struct.pack('<II', len(strings), index)
+            strings += name.encode() + b'\0'
+
+        n = len(names)
+        return (struct.pack('<I', len(strings)) + strings +
+                struct.pack('<IIIII', n, n * 2, 1, (1 << n) - 1, 0) +
+                entries + struct.pack('<I', 0))
+
+    def type_stream(self, hash_stream):
+        return struct.pack('<IIIIIHHIIiIiIiI', 20040203, 56, 0x1000, 0x1000,
+                           0, hash_stream, 0xffff, 4, 0x3ffff, 0, 0, 0, 0, 0,
+                           0)
+
+    def section_contribution(self, module):
+        return struct.pack('<HHiIIHHII', 1, self.noise.getrandbits(16),
+                           0x10 * module, 0x10, 0x60000020, module,
+                           self.noise.getrandbits(16), 0, 0)
+
+    def gsi_hash(self, offsets):
+        records = b''.join(struct.pack('<ii', o + 1, 1) for o in offsets)
+        return struct.pack('<IIII', 0xffffffff, 0xeffe0000 + 19990810,
+                           len(records), 0) + records
+
+    def pdb_streams(self):
+        streams = self.streams
+
+        next_stream = [FIRST_NAMED_STREAM]
+
+        def allocate():
+            next_stream[0] += 1
+            return next_stream[0] - 1
+
+        module_streams = [allocate() for _ in range(self.modules)]
+        symbols = allocate()
+        publics = allocate()
+        globals_ = allocate()
+        names = allocate()
+        link_info = allocate()
+        section_headers = allocate()
+        src_header = allocate()
+        src_file = allocate()
+        type_hash = allocate()
+        self.stream_count = next_stream[0]
+
+        streams[1] = struct.pack('<III', 20000404,
+                                 self.noise.getrandbits(31), self.age)
+        streams[1] += self.signature
+        streams[1] += self.name_map([
+            ('/names', names),
+            ('/LinkInfo', link_info),
+            ('/src/headerblock', src_header),
+            ('/src/files/c:\\build\\main.c', src_file),
+        ])
+
+        streams[2] = self.type_stream(type_hash)
+        streams[4] = self.type_stream(0xffff)
+        streams[type_hash] = bytes(64)
+
+        for i, stream in enumerate(module_streams):
+            obj = ('C:\\Temp\\lnk%s.tmp' % self.guid(self.content)).encode()
+            obj += b'\0'
+            proc = struct.pack('<IIIIIIIIHB', 0, 0, 0, 0x20, 0, 0x1f, 0x1000,
+                               0x10 * i, 1, 0)
+            proc += ('func%d' % i).encode() + b'\0'
+            streams[stream] = (struct.pack('<I', 4) +
+                               self.symbol(S_OBJNAME,
+                                           struct.pack('<I', 0) + obj) +
+                               self.symbol(S_GPROC32, proc))
+
+        records = b''
+        public_offsets = []
+        for i in range(self.publics):
+            public_offsets.append(len(records))
+            records += self.symbol(
+                S_PUB32, struct.pack('<IIH', 2, 0x10 * i, 1) +
+                ('?pub%d@@YAXXZ' % i).encode() + b'\0')
+        global_offset = len(records)
+        records += self.symbol(S_GDATA32,
+                               struct.pack('<IIH', 0x74, 0x100, 2) +
+                               b'g_data\0')
+        streams[symbols] = records
+
+        hashes = self.gsi_hash(public_offsets)
+        address_map = b''.join(struct.pack('<I', o) for o in public_offsets)
+        streams[publics] = struct.pack('<IIIIHHiI', len(hashes),
+                                       len(address_map), 0, 0, 0, 0xabcd, 0,
+                                       0x12345) + hashes + address_map
+        streams[globals_] = self.gsi_hash([global_offset])
+
+        strings = b'\0'
+        offsets = []
+        for s in ['c:\\build\\main.c',
+                  'C:\\Temp\\lnk%s.tmp' % self.guid(self.noise),
+                  'c:\\build\\util.h']:
+            offsets.append(len(strings))
+            strings += s.encode() + b'\0'
+        buckets = offsets + [0]
+        self.content.shuffle(buckets)
+        streams[names] = (struct.pack('<III', 0xeffeeffe, 1, len(strings)) +
+                          strings + struct.pack('<I', len(buckets)) +
+                          b''.join(struct.pack('<I', o) for o in buckets) +
+                          struct.pack('<I', len(offsets)))
+
+        cwd = b'c:\\build\0'
+        command = b'link.exe /OUT:fixture.dll\0'
+        size = 24 + len(cwd) + len(command)
+        streams[link_info] = (
+            struct.pack('<IIIIII', size, 1, 24, 24 + len(cwd), 5, size) +
+            cwd + command +
+            bytes(self.noise.randrange(256) for _ in range(64)))
+
+        streams[section_headers] = struct.pack(
+            '<8sIIIIIIHHI', b'.rdata', 0x200, 0x1000, 0x200, 0x200, 0, 0, 0,
+            0, 0x40000040)
+
+        streams[src_file] = b'int main() { return 0; }\n'
+        streams[src_header] = struct.pack(
+            '<IIQI', 19991026, 64, self.noise.getrandbits(63),
+            self.noise.randrange(1, 100)) + bytes(44)
+
+        module_info = b''
+        for i, stream in enumerate(module_streams):
+            if i == 0:
+                name = obj = b'* Linker Generated Manifest RES *\0'
+                obj = b'\0'
+            else:
+                name = obj = ('c:\\build\\mod%d.obj' % i).encode() + b'\0'
+            info = (struct.pack('<I', 0) + self.section_contribution(i) +
+                    struct.pack('<HHIIIHHIII', 0, stream,
+                                len(streams[stream]), 0, 0, 1, 0,
+                                self.noise.getrandbits(32), 0, 0) +
+                    name + obj)
+            while len(info) % 4:
+                info += b'\0'
+            module_info += info
+
+        contributions = struct.pack('<I', 0xeffe0000 + 19970605)
+        for i in range(self.modules):
+            contributions += self.section_contribution(i)
+
+        section_map = struct.pack('<HH', 0, 0)
+
+        file_names = b''
+        file_offsets = []
+        for i in range(self.modules):
+            file_offsets.append(len(file_names))
+            file_names += ('c:\\build\\f%d.c' % i).encode() + b'\0'
+        file_info = struct.pack('<HH', self.modules, self.modules)
+        file_info += b''.join(struct.pack('<H', i)
+                              for i in range(self.modules))
+        file_info += struct.pack('<H', 1) * self.modules
+        file_info += b''.join(struct.pack('<I', o) for o in file_offsets)
+        file_info += file_names
+        while len(file_info) % 4:
+            file_info += b'\0'
+
+        debug_header = [-1] * 11
+        debug_header[5] = section_headers
+        debug_header = b''.join(struct.pack('<h', s) for s in debug_header)
+
+        streams[3] = struct.pack(
+            '<IIIHHHHHHIIIIIIIIHHI', 0xffffffff, 19990903, self.age, globals_,
+            0x8e00, publics, 0, symbols, 0, len(module_info),
+            len(contributions), len(section_map), len(file_info), 0, 0,
+            len(debug_header), 0, 0, 0x14c, 0)
+        streams[3] += (module_info + contributions + section_map + file_info +
+                       debug_header)
+
+    def pdb(self):
+        """
+        Lays out the streams in an MSF file. Streams are scattered across the
+        file and unused space is filled with garbage.
+        """
+        self.pdb_streams()
+
+        pages = [bytes(PAGE_SIZE)] * 3
+
+        def allocate(data):
+            numbers = []
+            for offset in range(0, len(data), PAGE_SIZE):
+                # Skip over the free page maps.
+                while len(pages) % PAGE_SIZE in (1, 2):
+                    pages.append(bytes(PAGE_SIZE))
+                numbers.append(len(pages))
+                fill = bytes([self.noise.randrange(256)])
+                pages.append(data[offset:offset + PAGE_SIZE].ljust(PAGE_SIZE,
+                                                                   fill))
+            return numbers
+
+        order = list(range(1, self.stream_count))
+        self.noise.shuffle(order)
+
+        page_lists = {0: []}
+        for i in order:
+            page_lists[i] = allocate(self.streams.get(i, b''))
+
+        sizes = [len(self.streams.get(i, b''))
+                 for i in range(self.stream_count)]
+
+        table = struct.pack('<I', self.stream_count)
+        table += b''.join(struct.pack('<I', s) for s in sizes)
+        for i in range(self.stream_count):
+            table += b''.join(struct.pack('<I', p) for p in page_lists[i])
+
+        table_pages = allocate(table)
+        table_page_list = allocate(b''.join(struct.pack('<I', p)
+                                            for p in table_pages))
+
+        header = b'Microsoft C/C++ MSF 7.00\r\n\x1a\x44\x53\0\0\0'
+        header += struct.pack('<IIIII', PAGE_SIZE, 1, len(pages), len(table),
+                              0)
+        header += b''.join(struct.pack('<I', p) for p in table_page_list)
+        pages[0] = header.ljust(PAGE_SIZE, b'\0')
+
+        free_page_map = bytearray(PAGE_SIZE)
+        for p in range(len(pages), PAGE_SIZE * 8):
+            free_page_map[p // 8] |= 1 << (p % 8)
+        pages[1] = bytes(free_page_map)
+
+        return b''.join(pages)
+
+
+def write(stem, modules=3, publics=50, seed=1):
+    """
+    Writes `<stem>.dll` and `<stem>.pdb`.
+    """
+    fixture = Fixture(modules, publics, seed)
+
+    with open(stem + '.dll', 'wb') as f:
+        f.write(fixture.image())
+
+    with open(stem + '.pdb', 'wb') as f:
+        f.write(fixture.pdb())
+
+
+if __name__ == '__main__':
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        description='Generates a small DLL and its PDB.')
+    parser.add_argument('stem', help='Path to write the files to, without '
+                        'an extension.')
+    parser.add_argument('--modules', type=int, default=3)
+    parser.add_argument('--publics', type=int, default=50)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    write(args.stem, args.modules, args.publics, args.seed)
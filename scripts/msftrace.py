@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2016 Jason White
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+"""
+Summarizes an MSF page access trace written with `ducible --trace-io`.
+
+For each MSF file in the trace, and for reads and writes separately, this
+prints how many accesses there were, how many of them had to seek, how many
+jumped backward, how much was read more than once, and a histogram of seek
+distances. It then prints a heatmap of each stream showing how often each part
+of it was accessed.
+
+See src/msf/trace.h for the format of the trace.
+"""
+
+import sys
+import argparse
+from collections import defaultdict, namedtuple
+
+Event = namedtuple('Event', 'op file stream stream_page page offset length')
+
+# Glyphs for the heatmap, from cold to hot.
+SHADES = ' .:-=+*#%@'
+
+
+def parse(f):
+    """Returns the page sizes of the files and the list of events."""
+    page_sizes = {}
+    events = []
+
+    for lineno, line in enumerate(f, 1):
+        fields = line.split()
+        if not fields:
+            continue
+
+        kind = fields[0]
+        if kind == 'T':
+            if fields[1:] != ['msftrace', '1']:
+                raise ValueError('unsupported trace version: %s' % line)
+        elif kind == 'F':
+            page_sizes[int(fields[1])] = int(fields[2])
+        elif kind in ('R', 'W'):
+            events.append(Event(kind, *map(int, fields[1:8])))
+        else:
+            raise ValueError('line %d: unknown record %r' % (lineno, kind))
+
+    return page_sizes, events
+
+
+def bucket(distance, page_size):
+    """Returns the histogram bucket for a seek distance in bytes."""
+    if distance == 0:
+        return (0, 'sequential')
+
+    pages = abs(distance) / page_size
+    direction = 'forward' if distance > 0 else 'backward'
+
+    if pages < 1:
+        return (1 if distance > 0 else -1, '%s < 1 page' % direction)
+
+    order = int(pages).bit_length()
+    lo, hi = 1 << (order - 1), 1 << order
+    if hi - lo == 1:
+        label = '%s 1 page' % direction
+    else:
+        label = '%s %d-%d pages' % (direction, lo, hi - 1)
+    return ((order + 1) if distance > 0 else -(order + 1), label)
+
+
+def summarize(events, page_size, out):
+    pos = None
+    seeks = 0
+    backward = 0
+    total = 0
+    reread_bytes = 0
+    reread_pages = set()
+    seen = set()
+    histogram = defaultdict(int)
+    labels = {}
+
+    for e in events:
+        start = e.page * page_size + e.offset
+
+        if pos is not None:
+            key, label = bucket(start - pos, page_size)
+            histogram[key] += 1
+            labels[key] = label
+            if start != pos:
+                seeks += 1
+            if start < pos:
+                backward += 1
+
+        pos = start + e.length
+        total += e.length
+
+        if e.page in seen:
+            reread_bytes += e.length
+            reread_pages.add(e.page)
+        else:
+            seen.add(e.page)
+
+    print('  accesses:        %d (%d bytes)' % (len(events), total), file=out)
+    print('  distinct pages:  %d' % len(seen), file=out)
+    print('  seeks:           %d' % seeks, file=out)
+    print('  backward jumps:  %d' % backward, file=out)
+    print('  pages revisited: %d (%d bytes)' % (len(reread_pages),
+                                                reread_bytes), file=out)
+
+    if not histogram:
+        return
+
+    print('  seek distances:', file=out)
+
+    width = max(len(l) for l in labels.values())
+    peak = max(histogram.values())
+    for key in sorted(histogram):
+        count = histogram[key]
+        bar = '#' * max(1, count * 40 // peak)
+        print('    %-*s %8d %s' % (width, labels[key], count, bar), file=out)
+
+
+def heatmap(events, width, out):
+    # Number of accesses to each page of each stream.
+    streams = defaultdict(lambda: defaultdict(int))
+    for e in events:
+        streams[e.stream][e.stream_page] += 1
+
+    peak = 0
+    rows = []
+    for stream in sorted(streams):
+        pages = streams[stream]
+        count = max(pages) + 1
+        cols = min(width, count)
+
+        cells = [0.0] * cols
+        for page, hits in pages.items():
+            cells[page * cols // count] += hits
+
+        # Average over the pages in each cell so that cells are comparable.
+        for i in range(cols):
+            lo = (i * count + cols - 1) // cols
+            hi = ((i + 1) * count + cols - 1) // cols
+            cells[i] /= max(1, hi - lo)
+
+        peak = max(peak, max(cells))
+        rows.append((stream, count, cells))
+
+    for stream, count, cells in rows:
+        line = ''.join(SHADES[min(len(SHADES) - 1,
+                                  int(c / peak * (len(SHADES) - 1) + 0.999))]
+                       for c in cells)
+        name = 'meta' if stream < 0 else str(stream)
+        print('  %6s %7d |%s|' % (name, count, line), file=out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    parser.add_argument('trace', help='Trace written with --trace-io')
+    parser.add_argument('--width', type=int, default=64,
+                        help='Width of the heatmap, in columns')
+    parser.add_argument('--no-heatmap', action='store_true',
+                        help="Don't print the heatmap")
+    args = parser.parse_args()
+
+    with open(args.trace) as f:
+        page_sizes, events = parse(f)
+
+    out = sys.stdout
+
+    for file_id in sorted(page_sizes):
+        for op, name in (('R', 'reads'), ('W', 'writes')):
+            selected = [e for e in events if e.file == file_id and e.op == op]
+            if not selected:
+                continue
+
+            print('file %d %s (page size %d):' % (file_id, name,
+                                                  page_sizes[file_id]),
+                  file=out)
+            summarize(selected, page_sizes[file_id], out)
+
+            if not args.no_heatmap:
+                print('  heatmap (stream, pages, accesses per page):', file=out)
+                heatmap(selected, args.width, out)
+
+            print(file=out)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
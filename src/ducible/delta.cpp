@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/delta.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+
+#include "util/md5.h"
+#include "util/output_file.h"
+
+namespace {
+
+// Streams are compared in chunks of this size. Identical chunks are skipped
+// with a single memcmp().
+const size_t kChunkSize = 4096;
+
+// Changed byte ranges that are at most this far apart are merged into one
+// patch. This is roughly the overhead of a patch header plus change.
+const size_t kMergeGap = 64;
+
+// The MSF writer always uses pages of this size.
+const size_t kMsfPageSize = 4096;
+
+typedef std::pair<size_t, size_t> Range;
+
+void writeAll(FileRef f, const void* data, size_t length) {
+    if (length > 0 && fwrite(data, 1, length, f.get()) != length) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing delta");
+    }
+}
+
+void readAll(FileRef f, void* data, size_t length) {
+    if (length > 0 && fread(data, 1, length, f.get()) != length) {
+        if (ferror(f.get())) {
+            throw std::system_error(errno, std::system_category(),
+                                    "failed reading delta");
+        }
+
+        throw InvalidDelta("delta is truncated");
+    }
+}
+
+void seek(FileRef f, long offset, int origin) {
+    if (fseek(f.get(), offset, origin) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "fseek() failed");
+    }
+}
+
+/**
+ * Computes the MD5 digest of the first `length` bytes of a file, or of the
+ * entire file if it is shorter. Any buffered writes are flushed first. The
+ * file position is left at the start of the file.
+ */
+void fileDigest(FileRef f, uint8_t digest[16], uint64_t length = UINT64_MAX) {
+    seek(f, 0, SEEK_SET);
+
+    md5_context ctx;
+    md5_starts(&ctx);
+
+    std::vector<uint8_t> buf(1 << 16);
+
+    while (length > 0) {
+        const size_t n = fread(buf.data(), 1,
+                               (size_t)std::min<uint64_t>(buf.size(), length),
+                               f.get());
+        if (n == 0) break;
+
+        md5_update(&ctx, buf.data(), n);
+        length -= n;
+    }
+
+    if (ferror(f.get())) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed reading file");
+    }
+
+    md5_finish(&ctx, digest);
+
+    rewind(f.get());
+}
+
+/**
+ * Returns the names of streams in the PDB header's name map, keyed by stream
+ * index. This is empty if the name map can't be read.
+ */
+std::map<size_t, std::string> streamNames(MsfFile& msf) {
+    std::map<size_t, std::string> names;
+
+    auto header = msf.getStream((size_t)PdbStreamType::header);
+    if (!header) return names;
+
+    MsfMemoryStream stream(header.get());
+
+    const uint8_t* data    = stream.data();
+    const uint8_t* dataEnd = data + stream.length();
+
+    if (size_t(dataEnd - data) < sizeof(PdbStream70)) return names;
+
+    try {
+        for (auto&& it : readNameMapTable(data + sizeof(PdbStream70), dataEnd))
+            names[it.second] = it.first;
+    } catch (const InvalidPdb&) {
+        names.clear();
+    }
+
+    return names;
+}
+
+/**
+ * Returns a copy of a stream. Streams that don't exist are empty.
+ */
+std::shared_ptr<MsfMemoryStream> copyStream(MsfFile& msf, size_t index) {
+    if (auto stream = msf.getStream(index))
+        return std::make_shared<MsfMemoryStream>(stream.get());
+
+    return std::make_shared<MsfMemoryStream>(0, nullptr);
+}
+
+/**
+ * Finds the byte ranges of `b` that differ from `a`, including anything that
+ * was appended.
+ */
+std::vector<Range> diff(const uint8_t* a, size_t aLength, const uint8_t* b,
+                        size_t bLength) {
+    std::vector<Range> ranges;
+
+    auto add = [&ranges](size_t begin, size_t end) {
+        if (!ranges.empty() && begin - ranges.back().second <= kMergeGap)
+            ranges.back().second = end;
+        else
+            ranges.push_back(Range(begin, end));
+    };
+
+    const size_t common = std::min(aLength, bLength);
+
+    for (size_t pos = 0; pos < common; pos += kChunkSize) {
+        const size_t n = std::min(kChunkSize, common - pos);
+
+        if (memcmp(a + pos, b + pos, n) == 0) continue;
+
+        // Narrow it down to the bytes that actually changed.
+        size_t begin = 0, end = n;
+        while (a[pos + begin] == b[pos + begin]) ++begin;
+        while (a[pos + end - 1] == b[pos + end - 1]) --end;
+
+        add(pos + begin, pos + end);
+    }
+
+    if (bLength > aLength) add(aLength, bLength);
+
+    return ranges;
+}
+
+void writeHeader(FileRef out, const DeltaHeader& header) {
+    seek(out, 0, SEEK_SET);
+    writeAll(out, &header, sizeof(header));
+}
+
+/**
+ * Reads the header of a delta and checks the digest at the end against the
+ * rest of the delta. Returns the number of bytes between the header and the
+ * digest. The file position is left just past the header.
+ */
+uint64_t readHeader(FileRef delta, DeltaHeader& header) {
+    seek(delta, 0, SEEK_END);
+
+    const long size = ftell(delta.get());
+    if (size < 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "ftell() failed");
+    }
+
+    seek(delta, 0, SEEK_SET);
+    readAll(delta, &header, sizeof(header));
+
+    if (memcmp(header.magic, deltaMagic, sizeof(deltaMagic)) != 0)
+        throw InvalidDelta("not a PDB delta");
+
+    if (header.version != deltaVersion)
+        throw InvalidDelta("unsupported delta version");
+
+    uint8_t digest[16], expected[16];
+
+    if ((uint64_t)size < sizeof(header) + sizeof(digest))
+        throw InvalidDelta("delta is truncated");
+
+    const uint64_t length = (uint64_t)size - sizeof(digest);
+
+    fileDigest(delta, digest, length);
+
+    seek(delta, (long)length, SEEK_SET);
+    readAll(delta, expected, sizeof(expected));
+
+    if (memcmp(digest, expected, sizeof(digest)) != 0)
+        throw InvalidDelta("delta is corrupt");
+
+    seek(delta, sizeof(header), SEEK_SET);
+
+    return length - sizeof(header);
+}
+
+/**
+ * Reads the body of a delta. Counts and lengths in the delta are checked
+ * against the number of bytes left before anything is allocated for them, so
+ * a bad delta can't make us allocate more than its own size.
+ */
+class DeltaReader {
+   private:
+    FileRef _f;
+    uint64_t _remaining;
+
+   public:
+    DeltaReader(FileRef f, uint64_t length) : _f(f), _remaining(length) {}
+
+    uint64_t remaining() const { return _remaining; }
+
+    /**
+     * Throws if there are fewer than `count` items of the given size left.
+     */
+    void expect(uint64_t count, size_t size) const {
+        if (count > _remaining / size) throw InvalidDelta("delta is truncated");
+    }
+
+    void read(void* data, size_t length) {
+        expect(length, 1);
+        readAll(_f, data, length);
+        _remaining -= length;
+    }
+};
+
+template <typename CharT>
+void applyDeltaImpl(const CharT* deltaPath, const CharT* basePath,
+                    const CharT* outputPath) {
+    auto delta = openFile(deltaPath, FileMode<CharT>::readExisting);
+    auto base  = openFile(basePath, FileMode<CharT>::readExisting);
+
+    OutputFile output(outputPath);
+
+    applyDelta(delta, base, output.file());
+
+    output.commit();
+}
+
+}  // namespace
+
+void writeDelta(FileRef baseFile, MsfFile& target, FileRef targetFile,
+                const MsfLayout& layout, FileRef out) {
+    DeltaHeader header = {};
+    memcpy(header.magic, deltaMagic, sizeof(deltaMagic));
+    header.version = deltaVersion;
+
+    fileDigest(baseFile, header.baseDigest);
+    fileDigest(targetFile, header.targetDigest);
+
+    header.streamCount = (uint32_t)target.streamCount();
+    header.alignment   = (uint32_t)layout.alignment;
+    header.orderCount  = (uint32_t)layout.order.size();
+
+    // The entry count is filled in at the end.
+    writeHeader(out, header);
+
+    const std::vector<uint32_t> order(layout.order.begin(),
+                                      layout.order.end());
+    writeAll(out, order.data(), order.size() * sizeof(order[0]));
+
+    MsfFile base(baseFile);
+
+    const auto names = streamNames(target);
+
+    for (size_t i = 0; i < target.streamCount(); ++i) {
+        auto targetStream = target.getStream(i);
+        auto baseStream =
+            i < base.streamCount() ? base.getStream(i) : MsfStreamRef();
+
+        DeltaEntry entry = {};
+        entry.index      = (uint32_t)i;
+
+        const auto name = names.find(i);
+        if (name != names.end())
+            entry.nameLength = (uint32_t)name->second.length();
+
+        std::vector<Range> ranges;
+        std::shared_ptr<MsfMemoryStream> data;
+
+        if (!targetStream) {
+            // Removed streams and empty streams are written out the same.
+            if (!baseStream || baseStream->length() == 0) continue;
+
+            entry.op = DeltaOp::remove;
+        } else {
+            data      = std::make_shared<MsfMemoryStream>(targetStream.get());
+            auto orig = copyStream(base, i);
+
+            ranges = diff(orig->data(), orig->length(), data->data(),
+                          data->length());
+
+            if (ranges.empty() && orig->length() == data->length()) continue;
+
+            entry.op         = DeltaOp::patch;
+            entry.length     = (uint32_t)data->length();
+            entry.patchCount = (uint32_t)ranges.size();
+        }
+
+        writeAll(out, &entry, sizeof(entry));
+
+        if (entry.nameLength > 0)
+            writeAll(out, name->second.data(), entry.nameLength);
+
+        for (auto&& range : ranges) {
+            DeltaPatch patch;
+            patch.offset = (uint32_t)range.first;
+            patch.length = (uint32_t)(range.second - range.first);
+
+            writeAll(out, &patch, sizeof(patch));
+            writeAll(out, data->data() + patch.offset, patch.length);
+        }
+
+        ++header.entryCount;
+    }
+
+    writeHeader(out, header);
+
+    // The digest covers everything before it, including the header.
+    uint8_t digest[16];
+    fileDigest(out, digest);
+
+    seek(out, 0, SEEK_END);
+    writeAll(out, digest, sizeof(digest));
+}
+
+void applyDelta(FileRef delta, FileRef baseFile, FileRef out) {
+    DeltaHeader header;
+    DeltaReader reader(delta, readHeader(delta, header));
+
+    if (header.streamCount >= invalidStream)
+        throw InvalidDelta("too many streams");
+
+    if (header.orderCount > header.streamCount)
+        throw InvalidDelta("stream order is longer than the stream count");
+
+    if (header.alignment % kMsfPageSize != 0)
+        throw InvalidDelta("stream alignment is not a multiple of the page size");
+
+    uint8_t digest[16];
+    fileDigest(baseFile, digest);
+
+    if (memcmp(digest, header.baseDigest, sizeof(digest)) != 0)
+        throw InvalidDelta("delta was made for a different PDB");
+
+    MsfLayout layout;
+    layout.alignment = header.alignment;
+
+    reader.expect(header.orderCount, sizeof(uint32_t));
+
+    std::vector<uint32_t> order(header.orderCount);
+    reader.read(order.data(), order.size() * sizeof(order[0]));
+    layout.order.assign(order.begin(), order.end());
+
+    reader.expect(header.entryCount, sizeof(DeltaEntry));
+
+    MsfFile base(baseFile);
+    base.setStreamCount(header.streamCount);
+
+    for (uint32_t i = 0; i < header.entryCount; ++i) {
+        DeltaEntry entry;
+        reader.read(&entry, sizeof(entry));
+
+        if (entry.index >= header.streamCount)
+            throw InvalidDelta("stream index out of range");
+
+        // The name is only informational.
+        reader.expect(entry.nameLength, 1);
+        std::string name(entry.nameLength, '\0');
+        reader.read(&name[0], name.length());
+
+        switch (entry.op) {
+            case DeltaOp::remove:
+                base.replaceStream(entry.index, nullptr);
+                break;
+
+            case DeltaOp::patch: {
+                auto stream = copyStream(base, entry.index);
+
+                // Anything past the old end of the stream comes from the
+                // patches.
+                if (entry.length > stream->length())
+                    reader.expect(entry.length - stream->length(), 1);
+
+                reader.expect(entry.patchCount, sizeof(DeltaPatch));
+
+                stream->resize(entry.length);
+
+                for (uint32_t j = 0; j < entry.patchCount; ++j) {
+                    DeltaPatch patch;
+                    reader.read(&patch, sizeof(patch));
+
+                    if (patch.offset > entry.length ||
+                        patch.length > entry.length - patch.offset)
+                        throw InvalidDelta("patch is out of bounds");
+
+                    reader.read(stream->data() + patch.offset, patch.length);
+                }
+
+                base.replaceStream(entry.index, stream);
+                break;
+            }
+
+            default:
+                throw InvalidDelta("unknown delta operation");
+        }
+    }
+
+    if (reader.remaining() != 0)
+        throw InvalidDelta("unexpected data at the end of the delta");
+
+    base.write(out, layout);
+
+    fileDigest(out, digest);
+
+    if (memcmp(digest, header.targetDigest, sizeof(digest)) != 0)
+        throw InvalidDelta("result doesn't match the delta");
+}
+
+#if defined(_WIN32) && defined(UNICODE)
+
+void applyDelta(const wchar_t* deltaPath, const wchar_t* basePath,
+                const wchar_t* outputPath) {
+    applyDeltaImpl(deltaPath, basePath, outputPath);
+}
+
+#else
+
+void applyDelta(const char* deltaPath, const char* basePath,
+                const char* outputPath) {
+    applyDeltaImpl(deltaPath, basePath, outputPath);
+}
+
+#endif
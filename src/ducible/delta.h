@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Stream-level deltas between two PDBs.
+ *
+ * A delta lists the streams of the new PDB that differ from the old one. Each
+ * changed stream is described by its new length and the byte ranges that
+ * differ. Streams that were removed are listed as such. Streams that didn't
+ * change aren't mentioned at all.
+ *
+ * The delta also records the order and alignment the new PDB was written with
+ * and the MD5 digests of both files. Since writing out an MSF file is
+ * deterministic, applying the delta to the old PDB gives back the exact bytes
+ * of the new PDB. This is checked against the digest before the output is
+ * committed. The whole delta is covered by an MD5 digest of its own, which is
+ * checked before anything else is read from it.
+ *
+ * File format (all integers are little-endian):
+ *
+ *   DeltaHeader
+ *   uint32_t order[orderCount]
+ *   entryCount entries, each:
+ *     DeltaEntry
+ *     char name[nameLength]          (from the PDB header's name map, if any)
+ *     patchCount patches, each:
+ *       DeltaPatch
+ *       uint8_t data[length]
+ *   uint8_t digest[16]               (MD5 of everything before it)
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "util/file.h"
+
+class MsfFile;
+struct MsfLayout;
+
+const char deltaMagic[8]   = {'D', 'U', 'C', 'D', 'E', 'L', 'T', 'A'};
+const uint32_t deltaVersion = 2;
+
+struct DeltaHeader {
+    char magic[8];
+    uint32_t version;
+
+    // MD5 digests of the old and new PDB files.
+    uint8_t baseDigest[16];
+    uint8_t targetDigest[16];
+
+    // Number of streams in the new PDB.
+    uint32_t streamCount;
+
+    // The layout that the new PDB was written with.
+    uint32_t alignment;
+    uint32_t orderCount;
+
+    uint32_t entryCount;
+};
+
+enum class DeltaOp : uint32_t {
+    // The stream was removed.
+    remove = 0,
+
+    // The stream is resized to the new length and the patches are applied to
+    // it. New streams are patched starting from an empty stream.
+    patch = 1,
+};
+
+struct DeltaEntry {
+    uint32_t index;
+    DeltaOp op;
+    uint32_t length;
+    uint32_t nameLength;
+    uint32_t patchCount;
+};
+
+struct DeltaPatch {
+    uint32_t offset;
+    uint32_t length;
+};
+
+/**
+ * Thrown when a delta is invalid or doesn't apply to the given PDB.
+ */
+class InvalidDelta {
+   private:
+    const char* _why;
+
+   public:
+    InvalidDelta(const char* why) : _why(why) {}
+
+    const char* why() const { return _why; }
+};
+
+/**
+ * Writes a delta from an old PDB to a new one.
+ *
+ * Params:
+ *   base       = The old PDB file.
+ *   target     = The new PDB.
+ *   targetFile = The file that the new PDB was written to.
+ *   layout     = The layout that the new PDB was written with.
+ *   out        = File to write the delta to.
+ */
+void writeDelta(FileRef base, MsfFile& target, FileRef targetFile,
+                const MsfLayout& layout, FileRef out);
+
+/**
+ * Applies a delta to the old PDB and writes out the new PDB.
+ *
+ * Throws: InvalidDelta if the delta is malformed, if it wasn't made for the
+ * given PDB, or if the result doesn't match the new PDB.
+ */
+void applyDelta(FileRef delta, FileRef base, FileRef out);
+
+/**
+ * Same as above, but with paths. The output only replaces the file at
+ * `outputPath` if the delta was applied successfully.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void applyDelta(const wchar_t* deltaPath, const wchar_t* basePath,
+                const wchar_t* outputPath);
+
+#else
+
+void applyDelta(const char* deltaPath, const char* basePath,
+                const char* outputPath);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/layout.h"
+
+#include <cstring>
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+
+namespace {
+
+/**
+ * Appends a stream index to the order if it refers to a stream that exists and
+ * isn't already in it. `seen` has an entry for every stream in the MSF file
+ * and tracks which ones are in the order.
+ */
+void addStream(std::vector<size_t>& order, std::vector<bool>& seen,
+               size_t index) {
+    if (index == invalidStream || index >= seen.size() || seen[index]) return;
+
+    seen[index] = true;
+    order.push_back(index);
+}
+
+/**
+ * Finds the index of the /names stream through the PDB header's name map.
+ * Returns `invalidStream` if it can't be found.
+ */
+size_t namesStream(MsfFile& msf) {
+    auto header = msf.getStream((size_t)PdbStreamType::header);
+    if (!header) return invalidStream;
+
+    MsfMemoryStream stream(header.get());
+
+    const uint8_t* data    = stream.data();
+    const uint8_t* dataEnd = data + stream.length();
+
+    if (size_t(dataEnd - data) < sizeof(PdbStream70)) return invalidStream;
+
+    try {
+        auto names = readNameMapTable(data + sizeof(PdbStream70), dataEnd);
+
+        auto it = names.find("/names");
+        if (it != names.end()) return it->second;
+    } catch (const InvalidPdb&) {
+        // The header pass reports this.
+    }
+
+    return invalidStream;
+}
+
+}  // namespace
+
+std::vector<size_t> debuggerStreamOrder(MsfFile& msf) {
+    const size_t streamCount = msf.streamCount();
+
+    std::vector<size_t> order;
+    std::vector<bool> seen(streamCount);
+
+    addStream(order, seen, (size_t)PdbStreamType::header);
+
+    auto dbi = msf.getStream((size_t)PdbStreamType::dbi);
+    if (!dbi) {
+        addStream(order, seen, namesStream(msf));
+        return order;
+    }
+
+    MsfMemoryStream stream(dbi.get());
+
+    const uint8_t* data   = stream.data();
+    const size_t length   = stream.length();
+    const DbiHeader* info = (const DbiHeader*)data;
+
+    if (length < sizeof(DbiHeader) || info->signature != dbiHeaderSignature ||
+        info->version != DbiVersion::v70) {
+        addStream(order, seen, namesStream(msf));
+        return order;
+    }
+
+    addStream(order, seen, (size_t)PdbStreamType::dbi);
+    addStream(order, seen, info->globalSymbolStream);
+    addStream(order, seen, info->publicSymbolStream);
+    addStream(order, seen, info->symbolRecordsStream);
+    addStream(order, seen, namesStream(msf));
+
+    // The optional debug header is at the end of the DBI stream, after all of
+    // the other substreams.
+    const uint64_t debugHeaderOffset =
+        (uint64_t)sizeof(DbiHeader) + info->gpModInfoSize +
+        info->sectionContributionSize + info->sectionMapSize +
+        info->fileInfoSize + info->typeServerMapSize + info->ecInfoSize;
+
+    const size_t debugStreams = info->debugHeaderSize / sizeof(uint16_t);
+
+    if (debugStreams > DebugTypes::sectionHdr &&
+        debugHeaderOffset + info->debugHeaderSize <= length) {
+        uint16_t sectionHdr;
+        memcpy(&sectionHdr,
+               data + debugHeaderOffset +
+                   DebugTypes::sectionHdr * sizeof(uint16_t),
+               sizeof(sectionHdr));
+        addStream(order, seen, sectionHdr);
+    }
+
+    // Module streams in the order the modules are listed. The module info is
+    // copied and padded with zeros so that unterminated module names can't run
+    // off the end.
+    if (sizeof(DbiHeader) + (uint64_t)info->gpModInfoSize <= length) {
+        std::vector<uint8_t> modInfo(data + sizeof(DbiHeader),
+                                     data + sizeof(DbiHeader) +
+                                         info->gpModInfoSize);
+        modInfo.resize(modInfo.size() + 2);
+
+        for (size_t i = 0; info->gpModInfoSize - i >= sizeof(ModuleInfo);) {
+            const ModuleInfo* module = (const ModuleInfo*)(modInfo.data() + i);
+
+            addStream(order, seen, module->stream);
+
+            i += module->size();
+            if (i > info->gpModInfoSize) break;
+        }
+    }
+
+    return order;
+}
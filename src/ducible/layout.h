@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+class MsfFile;
+
+/**
+ * Alignment of large streams with `--stable-layout`. This is a common block
+ * size for deduplicating storage and a multiple of the MSF page size.
+ */
+const size_t stableStreamAlignment = 64 * 1024;
+
+/**
+ * Returns the order in which to lay out the streams of a PDB so that a
+ * debugger loading symbols reads as few distinct parts of the file as possible.
+ *
+ * The streams needed to look up public and global symbols come first: the PDB
+ * header, the DBI stream, the global and public symbol hash streams, the symbol
+ * records, the /names stream, and the section header stream. These are followed
+ * by the module streams in the order they appear in the DBI stream. All other
+ * streams are left for the writer to place afterwards in index order.
+ *
+ * The order only depends on the contents of the PDB, so the output stays
+ * deterministic. Streams that can't be found (e.g., because the DBI stream is
+ * malformed) are simply left out.
+ */
+std::vector<size_t> debuggerStreamOrder(MsfFile& msf);
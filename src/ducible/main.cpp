@@ -21,18 +21,33 @@
  */
 
 #include <stdlib.h>
+#include <iomanip>
 #include <iostream>
+#include <new>
 #include <string>
 #include <system_error>
 #include <vector>
 
+#include "ducible/delta.h"
+#include "ducible/patch_archive.h"
 #include "ducible/patch_image.h"
+#include "ducible/patch_library.h"
+#include "ducible/plan.h"
+#include "ducible/watch.h"
 
 #include "msf/msf.h"
+#include "msf/trace.h"
 #include "pdb/format.h"
 #include "pdb/pdb.h"
 #include "pe/pe.h"
 
+#include "util/arena.h"
+#include "util/deflate.h"
+#include "util/io_policy.h"
+#include "util/perf_counters.h"
+#include "util/resource_usage.h"
+#include "util/zip.h"
+
 #include "version.h"
 
 /**
@@ -82,28 +97,114 @@ struct OptionNames {};
 
 template <>
 struct OptionNames<char> {
-    const char* helpLong    = "--help";
-    const char* helpShort   = "-h";
-    const char* versionLong = "--version";
-    const char* dryrunLong  = "--dryrun";
-    const char* dryrunShort = "-n";
-    const char* dashDash    = "--";
-    const char* forceLong   = "--force";
-    const char* forceShort  = "-f";
+    const char* helpLong         = "--help";
+    const char* helpShort        = "-h";
+    const char* versionLong      = "--version";
+    const char* dryrunLong       = "--dryrun";
+    const char* dryrunShort      = "-n";
+    const char* dashDash         = "--";
+    const char* forceLong        = "--force";
+    const char* forceShort       = "-f";
+    const char* statsLong        = "--stats";
+    const char* perfCountersLong = "--perf-counters";
+    const char* stableLayoutLong = "--stable-layout";
+    const char* stripPrivateLong = "--strip-private";
+    const char* deltaBaseLong    = "--delta-base";
+    const char* applyDeltaLong   = "--apply-delta";
+    const char* emitPlanLong     = "--emit-plan";
+    const char* applyPlanLong    = "--apply-plan";
+    const char* maxMemoryLong    = "--max-memory";
+    const char* traceIoLong      = "--trace-io";
+    const char* exitCodeLong     = "--exit-code";
+    const char* sumsLong         = "--sums";
+    const char* blockSumsLong    = "--block-sums";
+    const char* pipelineLong     = "--pipeline";
+    const char* ioPolicyLong     = "--io-policy";
+    const char* watchLong        = "--watch";
 };
 
 template <>
 struct OptionNames<wchar_t> {
-    const wchar_t* helpLong    = L"--help";
-    const wchar_t* helpShort   = L"-h";
-    const wchar_t* versionLong = L"--version";
-    const wchar_t* dryrunLong  = L"--dryrun";
-    const wchar_t* dryrunShort = L"-n";
-    const wchar_t* dashDash    = L"--";
-    const wchar_t* forceLong   = L"--force";
-    const wchar_t* forceShort  = L"-f";
+    const wchar_t* helpLong         = L"--help";
+    const wchar_t* helpShort        = L"-h";
+    const wchar_t* versionLong      = L"--version";
+    const wchar_t* dryrunLong       = L"--dryrun";
+    const wchar_t* dryrunShort      = L"-n";
+    const wchar_t* dashDash         = L"--";
+    const wchar_t* forceLong        = L"--force";
+    const wchar_t* forceShort       = L"-f";
+    const wchar_t* statsLong        = L"--stats";
+    const wchar_t* perfCountersLong = L"--perf-counters";
+    const wchar_t* stableLayoutLong = L"--stable-layout";
+    const wchar_t* stripPrivateLong = L"--strip-private";
+    const wchar_t* deltaBaseLong    = L"--delta-base";
+    const wchar_t* applyDeltaLong   = L"--apply-delta";
+    const wchar_t* emitPlanLong     = L"--emit-plan";
+    const wchar_t* applyPlanLong    = L"--apply-plan";
+    const wchar_t* maxMemoryLong    = L"--max-memory";
+    const wchar_t* traceIoLong      = L"--trace-io";
+    const wchar_t* exitCodeLong     = L"--exit-code";
+    const wchar_t* sumsLong         = L"--sums";
+    const wchar_t* blockSumsLong    = L"--block-sums";
+    const wchar_t* pipelineLong     = L"--pipeline";
+    const wchar_t* ioPolicyLong     = L"--io-policy";
+    const wchar_t* watchLong        = L"--watch";
 };
 
+/**
+ * Parses a size in bytes with an optional K, M, or G suffix.
+ */
+template <typename CharT>
+size_t parseSize(const CharT* arg) {
+    const CharT* p = arg;
+
+    size_t size = 0;
+    for (; *p >= '0' && *p <= '9'; ++p) size = size * 10 + (*p - '0');
+
+    if (p == arg) throw InvalidCommandLine("Invalid size");
+
+    switch (*p) {
+        case 'k':
+        case 'K':
+            size <<= 10;
+            ++p;
+            break;
+        case 'm':
+        case 'M':
+            size <<= 20;
+            ++p;
+            break;
+        case 'g':
+        case 'G':
+            size <<= 30;
+            ++p;
+            break;
+    }
+
+    if (*p != 0) throw InvalidCommandLine("Invalid size");
+
+    return size;
+}
+
+/**
+ * Parses the name of an I/O policy. See util/io_policy.h.
+ */
+template <typename CharT>
+IoPolicy parseIoPolicy(const CharT* arg) {
+    const auto is = [arg](const char* name) {
+        size_t i = 0;
+        for (; name[i] != 0; ++i) {
+            if (arg[i] != (CharT)name[i]) return false;
+        }
+        return arg[i] == 0;
+    };
+
+    if (is("normal")) return IoPolicy::normal;
+    if (is("dontneed")) return IoPolicy::dontNeed;
+
+    throw InvalidCommandLine("Invalid I/O policy");
+}
+
 /**
  * Command line options.
  */
@@ -117,8 +218,59 @@ class CommandOptions {
     const CharT* pdb;
     bool dryrun;
     bool force;
-
-    CommandOptions() : image(NULL), pdb(NULL), dryrun(false) {}
+    bool stats;
+    bool perfCounters;
+    bool stableLayout;
+    bool stripPrivate;
+    bool exitCode;
+    bool sums;
+    bool blockSums;
+    bool pipeline;
+    IoPolicy ioPolicy;
+    size_t maxMemory;
+    const CharT* deltaBase;
+    const CharT* emitPlan;
+    const CharT* traceIo;
+
+    // With --apply-plan, the plan to apply. The positional arguments are then
+    // the image and/or PDB to apply it to, in any order.
+    const CharT* applyPlan;
+
+    // With --watch, the directory to watch. There are no positional arguments
+    // then.
+    const CharT* watch;
+
+    // With --apply-delta, the delta, the PDB it applies to, and the path to
+    // write the result to.
+    bool applyDelta;
+    const CharT* delta;
+    const CharT* base;
+    const CharT* output;
+
+    CommandOptions()
+        : image(NULL),
+          pdb(NULL),
+          dryrun(false),
+          force(false),
+          stats(false),
+          perfCounters(false),
+          stableLayout(false),
+          stripPrivate(false),
+          exitCode(false),
+          sums(false),
+          blockSums(false),
+          pipeline(false),
+          ioPolicy(IoPolicy::normal),
+          maxMemory(0),
+          deltaBase(NULL),
+          emitPlan(NULL),
+          traceIo(NULL),
+          applyPlan(NULL),
+          watch(NULL),
+          applyDelta(false),
+          delta(NULL),
+          base(NULL),
+          output(NULL) {}
 
     /**
      * Parses the command line arguments.
@@ -163,6 +315,53 @@ class CommandOptions {
                 dryrun = true;
             } else if (arg == opt.forceLong || arg == opt.forceShort) {
                 force = true;
+            } else if (arg == opt.statsLong) {
+                stats = true;
+            } else if (arg == opt.perfCountersLong) {
+                perfCounters = true;
+            } else if (arg == opt.stableLayoutLong) {
+                stableLayout = true;
+            } else if (arg == opt.stripPrivateLong) {
+                stripPrivate = true;
+            } else if (arg == opt.exitCodeLong) {
+                exitCode = true;
+            } else if (arg == opt.sumsLong) {
+                sums = true;
+            } else if (arg == opt.blockSumsLong) {
+                sums      = true;
+                blockSums = true;
+            } else if (arg == opt.pipelineLong) {
+                pipeline = true;
+            } else if (arg == opt.ioPolicyLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--io-policy requires a policy");
+                ioPolicy = parseIoPolicy(argv[i]);
+            } else if (arg == opt.deltaBaseLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--delta-base requires a path");
+                deltaBase = argv[i];
+            } else if (arg == opt.applyDeltaLong) {
+                applyDelta = true;
+            } else if (arg == opt.maxMemoryLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--max-memory requires a size");
+                maxMemory = parseSize(argv[i]);
+            } else if (arg == opt.traceIoLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--trace-io requires a path");
+                traceIo = argv[i];
+            } else if (arg == opt.emitPlanLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--emit-plan requires a path");
+                emitPlan = argv[i];
+            } else if (arg == opt.applyPlanLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--apply-plan requires a path");
+                applyPlan = argv[i];
+            } else if (arg == opt.watchLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--watch requires a directory");
+                watch = argv[i];
             } else if (arg.length() > 0 && arg.front() == '-') {
                 throw UnknownOption<CharT>(argv[i]);
             } else {
@@ -170,6 +369,25 @@ class CommandOptions {
             }
         }
 
+        if (watch) {
+            if (!positional.empty())
+                throw InvalidCommandLine("Too many positional arguments given");
+            return;
+        }
+
+        if (applyDelta) {
+            if (positional.size() != 3) {
+                throw InvalidCommandLine(
+                    "--apply-delta requires a delta, a PDB, and an output "
+                    "path");
+            }
+
+            delta  = positional[0];
+            base   = positional[1];
+            output = positional[2];
+            return;
+        }
+
         switch (positional.size()) {
             case 2:
                 pdb = positional[1];
@@ -190,7 +408,17 @@ class CommandOptions {
 template <typename CharT>
 const OptionNames<CharT> CommandOptions<CharT>::opt = OptionNames<CharT>();
 
-const char* usage = "Usage: ducible image [pdb] [--help] [--dryrun]";
+const char* usage =
+    "Usage: ducible image [pdb] [--help] [--dryrun] [--force] [--stats]\n"
+    "                           [--perf-counters] [--exit-code]\n"
+    "                           [--sums] [--block-sums]\n"
+    "                           [--stable-layout] [--strip-private]\n"
+    "                           [--max-memory SIZE] [--pipeline]\n"
+    "                           [--io-policy POLICY] [--trace-io TRACE]\n"
+    "                           [--delta-base OLD.pdb] [--emit-plan PLAN]\n"
+    "       ducible --watch DIR [--stable-layout] [--strip-private]\n"
+    "       ducible --apply-plan PLAN image|pdb [image|pdb]\n"
+    "       ducible --apply-delta delta old.pdb output.pdb";
 
 const char* help =
     R"(
@@ -205,6 +433,10 @@ Files are modified in-place.
 
 Positional arguments:
   image         The PE or PE+ file to patch. This can be an .exe or .dll file.
+                It can also be a zip archive or NuGet package, in which case
+                every image in it is patched along with the PDB of the same
+                name next to it. Static and import libraries (.lib) and COFF
+                objects (.obj) are patched as well.
   pdb           The PDB file associated with the image. Optional.
 
 Optional arguments:
@@ -214,8 +446,136 @@ Optional arguments:
   --force, -f   Proceed even if the PDB signatures don't match. Useful if you
                 already know an image is compatible with a PDB even though the
                 signatures don't match.
+  --stats       Print memory usage and page fault counts when done.
+  --exit-code   Exit with 2 instead of 0 if the image and PDB were already
+                deterministic. They are never rewritten in that case, so their
+                modification times stay the same either way. Archives,
+                libraries, objects, and plans always count as changed.
+  --perf-counters
+                Sample hardware counters (cycles, instructions, branch misses,
+                cache misses, and page faults) around the checksum, symbol
+                record, DBI, and embedded source passes and print them with
+                IPC and bytes per cycle when done. Skipped if the counters are
+                not available.
+  --stable-layout
+                Align large PDB streams to 64 KiB boundaries. Streams that
+                didn't change between builds then end up in the same blocks
+                of the file, which helps storage that deduplicates by block.
+  --strip-private
+                Remove private symbol information from the PDB: type info,
+                module symbols, global symbols, and source file names. Only
+                public symbols are left. The result is a public PDB that is
+                much smaller and suitable for publishing on a symbol server.
+  --max-memory SIZE
+                Process PDB streams larger than SIZE (e.g., 512M) a window at
+                a time instead of copying them into memory, where possible.
+                This keeps memory usage down for very large PDBs.
+  --sums        Also write the CRC-32 of each PDB stream next to the PDB with
+                a ".sums" extension. Caches and replication can compare it
+                to find the streams that changed without reading the PDB.
+  --block-sums  Like --sums, but also write the CRC-32 of each 64 KiB block of
+                each stream.
+  --pipeline    Write the PDB while it is being patched. Streams that don't
+                need patching are written right away and patched streams as
+                soon as they are done, so reading, patching, and writing
+                overlap. The result is the same. However, the PDB is then
+                written even if it is already deterministic, only to be thrown
+                away.
+  --io-policy POLICY
+                How to treat the OS page cache. With "normal" (the default),
+                files stay cached like any other. With "dontneed", each file
+                is dropped from the cache once it has been patched, so that
+                patching many files doesn't push everything else on the
+                machine out of the cache. Ignored where not supported.
+  --trace-io TRACE
+                Record every page read from and written to the PDB in TRACE.
+                Use scripts/msftrace.py to summarize the access pattern.
+  --delta-base OLD.pdb
+                Also write a delta from OLD.pdb to the rewritten PDB. It is
+                written next to the PDB with a ".delta" extension.
+  --emit-plan PLAN
+                Also write a plan of the patches to PLAN. A plan can be applied
+                to the image or its PDB elsewhere without reading the image
+                again.
+  --apply-plan PLAN
+                Apply a plan written with --emit-plan to the given image
+                and/or PDB. The image must be the same one the plan was made
+                from.
+  --watch DIR   Watch DIR and patch each image and the PDB of the same name
+                next to it as soon as the linker is done writing them. An
+                empty "<image>.ducible" file is written next to each image
+                once it has been patched. Runs until killed. Only supported
+                on Linux.
+  --apply-delta delta old.pdb output.pdb
+                Apply a delta written with --delta-base to the old PDB and
+                write out the new PDB. The result is checked against the
+                digest in the delta.
 )";
 
+/**
+ * Prints resource usage statistics.
+ */
+void printStats(const Arena& arena) {
+    const ResourceUsage usage = getResourceUsage();
+
+    std::cout << "Peak RSS:    " << usage.peakRss / 1024 << " KiB\n"
+              << "Page faults: " << usage.minorFaults << " minor, "
+              << usage.majorFaults << " major\n"
+              << "Arena:       " << arena.peak() / 1024 << " KiB peak, "
+              << arena.reserved() / 1024 << " KiB reserved\n";
+}
+
+/**
+ * Prints a counter, or "n/a" if it wasn't counted.
+ */
+void printCounter(uint64_t value, int width) {
+    std::cout << std::setw(width);
+    if (value == kPerfNotCounted)
+        std::cout << "n/a";
+    else
+        std::cout << value;
+}
+
+/**
+ * Prints a ratio of two counters, or "n/a" if either wasn't counted.
+ */
+void printRatio(uint64_t num, uint64_t den, int width) {
+    std::cout << std::setw(width);
+    if (num == kPerfNotCounted || den == kPerfNotCounted || den == 0)
+        std::cout << "n/a";
+    else
+        std::cout << std::fixed << std::setprecision(2) << (double)num / den;
+}
+
+/**
+ * Prints the hardware counters of each region.
+ */
+void printPerfCounters() {
+    std::cout << std::left << std::setw(16) << "Region" << std::right
+              << std::setw(6) << "Calls" << std::setw(12) << "Bytes"
+              << std::setw(13) << "Cycles" << std::setw(13) << "Instructions"
+              << std::setw(6) << "IPC" << std::setw(8) << "B/cycle"
+              << std::setw(11) << "Br misses" << std::setw(11) << "LLC misses"
+              << std::setw(8) << "Faults" << "\n";
+
+    for (auto&& r : perfRegionStats()) {
+        const PerfSample& c = r.counters;
+
+        std::cout << std::left << std::setw(16) << r.name << std::right
+                  << std::setw(6) << r.calls << std::setw(12) << r.bytes;
+
+        printCounter(c.cycles, 13);
+        printCounter(c.instructions, 13);
+        printRatio(c.instructions, c.cycles, 6);
+        printRatio(r.bytes, c.cycles, 8);
+        printCounter(c.branchMisses, 11);
+        printCounter(c.cacheMisses, 11);
+        printCounter(c.pageFaults, 8);
+
+        std::cout << "\n";
+    }
+}
+
 template <typename CharT = char>
 int ducible(int argc, CharT** argv) {
     CommandOptions<CharT> opts;
@@ -240,8 +600,91 @@ int ducible(int argc, CharT** argv) {
         return 0;
     }
 
+    setIoPolicy(opts.ioPolicy);
+
+    if (opts.traceIo) {
+        try {
+            msfTraceStart(opts.traceIo);
+        } catch (const std::system_error& error) {
+            std::cerr << "Error: " << error.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (opts.perfCounters) {
+        std::string why;
+        if (!perfCountersEnable(why)) {
+            std::cerr << "Warning: Hardware counters are not available ("
+                      << why << ")\n";
+        }
+    }
+
+    if (opts.applyDelta) {
+        try {
+            applyDelta(opts.delta, opts.base, opts.output);
+            msfTraceStop();
+        } catch (const InvalidDelta& error) {
+            std::cerr << "Error: Invalid delta (" << error.why() << ")\n";
+            return 1;
+        } catch (const InvalidMsf& error) {
+            std::cerr << "Error: Invalid PDB MSF format (" << error.why()
+                      << ")\n";
+            return 1;
+        } catch (const std::system_error& error) {
+            std::cerr << "Error: " << error.what() << "\n";
+            return 1;
+        } catch (const std::bad_alloc&) {
+            std::cerr << "Error: Out of memory\n";
+            return 1;
+        }
+
+        return 0;
+    }
+
+    Arena arena;
+
+    PatchOptions options;
+    options.dryrun = opts.dryrun;
+    options.force  = opts.force;
+    options.arena  = &arena;
+
+    options.stableLayout = opts.stableLayout;
+    options.stripPrivate = opts.stripPrivate;
+    options.deltaBase    = opts.deltaBase;
+    options.emitPlan     = opts.emitPlan;
+    options.maxMemory    = opts.maxMemory;
+    options.streamSums   = opts.sums;
+    options.blockSums    = opts.blockSums;
+    options.pipeline     = opts.pipeline;
+
+    if (opts.watch) {
+        try {
+            watchDirectory(opts.watch, options);
+        } catch (const std::system_error& error) {
+            std::cerr << "Error: " << error.what() << "\n";
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Only set for images and PDBs patched in place.
+    bool changed = true;
+
     try {
-        patchImage(opts.image, opts.pdb, opts.dryrun, opts.force);
+        if (opts.applyPlan) {
+            applyPlan(opts.applyPlan, opts.image, options);
+            if (opts.pdb) applyPlan(opts.applyPlan, opts.pdb, options);
+        } else if (!opts.pdb && isArchive(opts.image))
+            patchArchive(opts.image, options);
+        else if (!opts.pdb && isLibrary(opts.image))
+            patchLibrary(opts.image, options);
+        else if (!opts.pdb && isObject(opts.image))
+            patchObject(opts.image, options);
+        else
+            changed = patchImage(opts.image, opts.pdb, options);
+
+        msfTraceStop();
     } catch (const InvalidImage& error) {
         std::cerr << "Error: Invalid image (" << error.why() << ")\n";
         return 1;
@@ -251,12 +694,27 @@ int ducible(int argc, CharT** argv) {
     } catch (const InvalidPdb& error) {
         std::cerr << "Error: Invalid PDB format (" << error.why() << ")\n";
         return 1;
+    } catch (const InvalidDelta& error) {
+        std::cerr << "Error: Invalid delta (" << error.why() << ")\n";
+        return 1;
+    } catch (const InvalidPlan& error) {
+        std::cerr << "Error: Invalid plan (" << error.why() << ")\n";
+        return 1;
+    } catch (const InvalidZip& error) {
+        std::cerr << "Error: Invalid archive (" << error.why() << ")\n";
+        return 1;
+    } catch (const InvalidDeflate& error) {
+        std::cerr << "Error: Invalid archive (" << error.why() << ")\n";
+        return 1;
     } catch (const std::system_error& error) {
         std::cerr << "Error: " << error.what() << "\n";
         return 1;
     }
 
-    return 0;
+    if (opts.stats) printStats(arena);
+    if (perfCountersEnabled()) printPerfCounters();
+
+    return (opts.exitCode && !changed) ? 2 : 0;
 }
 
 #if defined(_WIN32) && defined(UNICODE)
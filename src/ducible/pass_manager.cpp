@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/pass_manager.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include "msf/stream.h"
+
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+
+#include "util/probes.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+/**
+ * Resolves stream IDs to stream indices.
+ *
+ * This is done once, up front, using the original PDB header and DBI streams.
+ * None of the passes change the name map or the stream references in the DBI
+ * stream, so the result stays valid while the passes run.
+ */
+class StreamResolver {
+   private:
+    size_t _streamCount;
+
+    NameMapTable _names;
+
+    bool _hasDbi;
+    DbiHeader _dbi;
+
+    // (module name, stream) pairs for modules with an empty object name.
+    std::vector<std::pair<std::string, uint16_t>> _modules;
+
+    // Streams of all modules.
+    std::vector<uint16_t> _moduleStreams;
+
+    // Hash streams referenced by each type stream header.
+    std::map<size_t, std::vector<size_t>> _typeHashes;
+
+    void _readDbi(MsfStream* stream, Arena* arena);
+    void _readTypeHeader(MsfFile& msf, size_t index);
+
+   public:
+    StreamResolver(MsfFile& msf, Arena* arena);
+
+    /**
+     * Returns the indices of the streams that the given ID refers to. Streams
+     * that don't exist are not included.
+     */
+    std::vector<size_t> resolve(const StreamId& id) const;
+};
+
+StreamResolver::StreamResolver(MsfFile& msf, Arena* arena)
+    : _streamCount(msf.streamCount()), _hasDbi(false) {
+    auto header = msf.getStream((size_t)PdbStreamType::header);
+    if (!header) throw InvalidPdb("missing PDB header stream");
+
+    MsfMemoryStream headerStream(header.get(), arena);
+
+    const uint8_t* data    = headerStream.data();
+    const uint8_t* dataEnd = data + headerStream.length();
+
+    if (size_t(dataEnd - data) < sizeof(PdbStream70))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    _names = readNameMapTable(data + sizeof(PdbStream70), dataEnd);
+
+    if (auto dbi = msf.getStream((size_t)PdbStreamType::dbi))
+        _readDbi(dbi.get(), arena);
+
+    _readTypeHeader(msf, (size_t)PdbStreamType::tbi);
+    _readTypeHeader(msf, (size_t)PdbStreamType::ipi);
+}
+
+void StreamResolver::_readTypeHeader(MsfFile& msf, size_t index) {
+    auto stream = msf.getStream(index);
+    if (!stream) return;
+
+    // An empty or truncated type stream has no hash streams.
+    TpiHeader header;
+    if (stream->read(sizeof(header), &header) != sizeof(header)) return;
+
+    auto& hashes = _typeHashes[index];
+    hashes.push_back(header.hashStreamIndex);
+    hashes.push_back(header.hashAuxStreamIndex);
+}
+
+void StreamResolver::_readDbi(MsfStream* stream, Arena* arena) {
+    const size_t pos = stream->getPos();
+    stream->setPos(0);
+
+    // An invalid DBI header is reported by the pass that patches it. Until
+    // then, pretend there is no DBI stream.
+    if (stream->read(sizeof(_dbi), &_dbi) != sizeof(_dbi) ||
+        _dbi.signature != dbiHeaderSignature ||
+        _dbi.version != DbiVersion::v70) {
+        stream->setPos(pos);
+        return;
+    }
+
+    _hasDbi = true;
+
+    if (sizeof(_dbi) + _dbi.gpModInfoSize > stream->length())
+        throw InvalidPdb("DBI module info size exceeds stream length");
+
+    // Pad the buffer with zeros so that unterminated module names can't run
+    // off the end.
+    MsfMemoryStream modInfo(0, nullptr, arena);
+    modInfo.resize(_dbi.gpModInfoSize + 2);
+    if (stream->read(_dbi.gpModInfoSize, modInfo.data()) != _dbi.gpModInfoSize)
+        throw InvalidPdb("failed to read module info sub-stream");
+
+    stream->setPos(pos);
+
+    for (size_t i = 0; i < _dbi.gpModInfoSize;) {
+        if (_dbi.gpModInfoSize - i < sizeof(ModuleInfo))
+            throw InvalidPdb("got partial DBI module info");
+
+        const ModuleInfo* info = (const ModuleInfo*)(modInfo.data() + i);
+
+        if (strcmp(info->objectName(), "") == 0)
+            _modules.push_back(std::make_pair(info->moduleName(), info->stream));
+
+        _moduleStreams.push_back(info->stream);
+
+        i += info->size();
+    }
+}
+
+std::vector<size_t> StreamResolver::resolve(const StreamId& id) const {
+    std::vector<size_t> indices;
+
+    switch (id.kind) {
+        case StreamId::Kind::index:
+            indices.push_back(id.index);
+            break;
+
+        case StreamId::Kind::name: {
+            const auto it = _names.find(id.name);
+            if (it != _names.end()) indices.push_back(it->second);
+            break;
+        }
+
+        case StreamId::Kind::namePrefix:
+            for (auto it = _names.lower_bound(id.name);
+                 it != _names.end() &&
+                 it->first.compare(0, id.name.length(), id.name) == 0;
+                 ++it)
+                indices.push_back(it->second);
+            break;
+
+        case StreamId::Kind::symbolRecords:
+            if (_hasDbi) indices.push_back(_dbi.symbolRecordsStream);
+            break;
+
+        case StreamId::Kind::publicSymbols:
+            if (_hasDbi) indices.push_back(_dbi.publicSymbolStream);
+            break;
+
+        case StreamId::Kind::globalSymbols:
+            if (_hasDbi) indices.push_back(_dbi.globalSymbolStream);
+            break;
+
+        case StreamId::Kind::module:
+            for (auto&& module : _modules) {
+                if (module.first == id.name) indices.push_back(module.second);
+            }
+            break;
+
+        case StreamId::Kind::modules:
+            indices.assign(_moduleStreams.begin(), _moduleStreams.end());
+            break;
+
+        case StreamId::Kind::typeHashes: {
+            const auto it = _typeHashes.find(id.index);
+            if (it != _typeHashes.end()) indices = it->second;
+            break;
+        }
+    }
+
+    // Filter out streams that can't exist.
+    indices.erase(std::remove_if(indices.begin(), indices.end(),
+                                 [this](size_t i) {
+                                     return i == invalidStream ||
+                                            i >= _streamCount;
+                                 }),
+                  indices.end());
+
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+    return indices;
+}
+
+/**
+ * A single instance of a pass with its streams resolved.
+ */
+struct Job {
+    const PdbPass* pass;
+
+    std::vector<size_t> reads;
+    std::vector<size_t> writes;
+
+    // Jobs that can't start until this one is done.
+    std::vector<size_t> dependents;
+
+    // Number of jobs that must finish before this one can start.
+    size_t waiting;
+
+    Job(const PdbPass* pass) : pass(pass), waiting(0) {}
+};
+
+/**
+ * Resolves a list of stream IDs where each must refer to at most one stream.
+ * Returns false if any of them doesn't exist.
+ */
+bool resolveEach(const StreamResolver& resolver,
+                 const std::vector<StreamId>& ids, size_t first,
+                 std::vector<size_t>& out) {
+    for (size_t i = first; i < ids.size(); ++i) {
+        auto indices = resolver.resolve(ids[i]);
+        if (indices.empty()) return false;
+
+        assert(indices.size() == 1);
+
+        out.push_back(indices[0]);
+    }
+
+    return true;
+}
+
+}  // namespace
+
+PassContext::PassContext(std::vector<std::shared_ptr<MsfMemoryStream>> reads,
+                         std::vector<size_t> writeIndices,
+                         std::vector<MsfStreamRef> sources,
+                         std::mutex& fileLock, Arena* arena)
+    : _reads(reads),
+      _writeIndices(writeIndices),
+      _sources(sources),
+      _fileLock(fileLock),
+      _writes(writeIndices.size()),
+      _patched(writeIndices.size()),
+      _replaced(writeIndices.size()),
+      _removed(writeIndices.size(), false),
+      _arena(arena) {}
+
+MsfStreamRef PassContext::_current(size_t i) const {
+    if (_patched[i]) return _patched[i];
+    if (_replaced[i]) return _replaced[i];
+    return _sources[i];
+}
+
+MsfMemoryStream* PassContext::write(size_t i) {
+    if (!_writes[i]) {
+        std::lock_guard<std::mutex> lock(_fileLock);
+
+        // Keep any patches or replacement that were made before.
+        _writes[i] = std::make_shared<MsfMemoryStream>(_current(i).get(),
+                                                       _arena);
+        _patched[i].reset();
+        _replaced[i].reset();
+    }
+
+    return _writes[i].get();
+}
+
+size_t PassContext::readSource(size_t i, size_t offset, size_t length,
+                               void* buf) {
+    std::lock_guard<std::mutex> lock(_fileLock);
+
+    _sources[i]->setPos(offset);
+    return _sources[i]->read(length, buf);
+}
+
+void PassContext::patch(size_t i, size_t offset, size_t length,
+                        const void* data) {
+    if (_writes[i]) {
+        memcpy(_writes[i]->data() + offset, data, length);
+        return;
+    }
+
+    if (!_patched[i])
+        _patched[i] = std::make_shared<MsfPatchedStream>(_current(i));
+
+    _patched[i]->patch(offset, length, data);
+}
+
+void PassContext::replace(size_t i, MsfStreamRef stream) {
+    _writes[i].reset();
+    _patched[i].reset();
+    _replaced[i] = stream;
+}
+
+MsfStreamRef PassContext::result(size_t i) const {
+    if (_removed[i]) return nullptr;
+
+    if (_writes[i]) return _writes[i];
+
+    return _patched[i] ? _patched[i] : _replaced[i];
+}
+
+void PassManager::add(PdbPass pass) { _passes.push_back(pass); }
+
+void PassManager::run(MsfFile& msf, ThreadPool& pool,
+                      const StreamDone& streamDone) {
+    StreamResolver resolver(msf, _arena);
+
+    std::vector<Job> jobs;
+
+    for (auto&& pass : _passes) {
+        std::vector<size_t> reads;
+        if (!resolveEach(resolver, pass.reads, 0, reads)) continue;
+
+        std::vector<size_t> others;
+        if (!resolveEach(resolver, pass.writes, 1, others)) continue;
+
+        if (pass.writes.empty()) {
+            Job job(&pass);
+            job.reads = reads;
+            jobs.push_back(job);
+            continue;
+        }
+
+        // One job for each of the streams that the first stream ID matches.
+        for (size_t first : resolver.resolve(pass.writes[0])) {
+            Job job(&pass);
+            job.reads = reads;
+            job.writes.push_back(first);
+            job.writes.insert(job.writes.end(), others.begin(), others.end());
+            jobs.push_back(job);
+        }
+    }
+
+    // Build the dependency graph. Jobs are visited in the order they were
+    // added, so conflicting jobs keep that order.
+    std::map<size_t, size_t> lastWriter;
+    std::map<size_t, std::vector<size_t>> readers;
+
+    auto addDependency = [&](size_t from, size_t to) {
+        if (from == to) return;
+
+        auto& dependents = jobs[from].dependents;
+        if (std::find(dependents.begin(), dependents.end(), to) !=
+            dependents.end())
+            return;
+
+        dependents.push_back(to);
+        ++jobs[to].waiting;
+    };
+
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        for (size_t s : jobs[j].reads) {
+            auto it = lastWriter.find(s);
+            if (it != lastWriter.end()) addDependency(it->second, j);
+
+            readers[s].push_back(j);
+        }
+
+        for (size_t s : jobs[j].writes) {
+            auto it = lastWriter.find(s);
+            if (it != lastWriter.end()) addDependency(it->second, j);
+
+            for (size_t r : readers[s]) addDependency(r, j);
+
+            readers[s].clear();
+            lastWriter[s] = j;
+        }
+    }
+
+    // Number of jobs left that write to each stream.
+    std::vector<size_t> writers(msf.streamCount(), 0);
+    for (auto&& job : jobs) {
+        for (size_t s : job.writes) ++writers[s];
+    }
+
+    // Guards the MSF file, the job graph, and the failure flag. Reading
+    // streams from the MSF file goes through a shared file handle, so
+    // materializing streams is also done while holding this. It is shared
+    // with whoever streams are handed over to.
+    const auto fileLock = std::make_shared<std::mutex>();
+    std::mutex& mutex   = *fileLock;
+    bool failed         = false;
+
+    auto done = [&](size_t s) {
+        if (streamDone) streamDone(s, msf.getStream(s), fileLock);
+    };
+
+    std::function<void(size_t)> start;
+
+    auto execute = [&](size_t j) {
+        Job& job = jobs[j];
+
+        std::vector<std::shared_ptr<MsfMemoryStream>> reads;
+        std::vector<MsfStreamRef> sources;
+        bool skip = false;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (failed) return;
+
+            for (size_t s : job.reads) {
+                auto stream = msf.getStream(s);
+                if (!stream) {
+                    skip = true;
+                    break;
+                }
+                reads.push_back(
+                    std::make_shared<MsfMemoryStream>(stream.get(), _arena));
+            }
+
+            // Streams to write are only read if the pass asks for them.
+            for (size_t s : job.writes) {
+                auto stream = msf.getStream(s);
+                if (!stream) skip = true;
+                sources.push_back(stream);
+            }
+        }
+
+        if (!skip) {
+            PassContext ctx(reads, job.writes, sources, mutex, _arena);
+
+            const size_t stream = job.writes.empty() ? 0 : job.writes[0];
+
+            try {
+                DUCIBLE_PROBE2(pass_start, job.pass->name, stream);
+                job.pass->run(ctx);
+                DUCIBLE_PROBE2(pass_done, job.pass->name, stream);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed = true;
+                throw;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (size_t i = 0; i < job.writes.size(); ++i) {
+                if (ctx.changed(i))
+                    msf.replaceStream(job.writes[i], ctx.result(i));
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (failed) return;
+
+        for (size_t s : job.writes) {
+            if (--writers[s] == 0) done(s);
+        }
+
+        for (size_t d : job.dependents) {
+            if (--jobs[d].waiting == 0) start(d);
+        }
+    };
+
+    start = [&](size_t j) { pool.run([&execute, j] { execute(j); }); };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (size_t s = 0; s < writers.size(); ++s) {
+            if (writers[s] == 0) done(s);
+        }
+    }
+
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        if (jobs[j].waiting == 0) start(j);
+    }
+
+    pool.wait();
+}
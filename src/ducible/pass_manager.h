@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A small framework for running PDB normalization passes.
+ *
+ * Each pass declares which streams it reads and which streams it writes. From
+ * that, the pass manager builds a dependency graph: a pass depends on every
+ * pass registered before it that writes a stream it reads or writes, or that
+ * reads a stream it writes. Passes with no dependencies between them are run at
+ * the same time on a thread pool. Thus, new passes can be added without
+ * worrying about ordering them by hand.
+ *
+ * Streams written by a pass are copied into memory the first time the pass asks
+ * for them and are put back into the MSF file after it finishes. Streams that a
+ * pass only removes or patches are never copied. Passes whose streams don't
+ * exist are skipped.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "msf/patched_stream.h"
+
+class Arena;
+class ThreadPool;
+
+/**
+ * Identifies a stream that a pass reads or writes. Streams can be referred to
+ * by index, by name through the PDB header's name map, or by their role as
+ * recorded in the DBI stream.
+ */
+class StreamId {
+   public:
+    enum class Kind {
+        // A fixed stream index.
+        index,
+
+        // A stream in the PDB header's name map.
+        name,
+
+        // All streams in the PDB header's name map whose names start with the
+        // given prefix.
+        namePrefix,
+
+        // Well-known streams referenced by the DBI header.
+        symbolRecords,
+        publicSymbols,
+        globalSymbols,
+
+        // The streams of all modules in the DBI stream with the given module
+        // name and an empty object name.
+        module,
+
+        // The streams of all modules in the DBI stream.
+        modules,
+
+        // The hash streams referenced by the header of the type stream with
+        // the given index (i.e., the TPI or IPI stream).
+        typeHashes,
+    };
+
+    Kind kind;
+    size_t index;
+    std::string name;
+
+    StreamId(Kind kind, size_t index = 0, const std::string& name = "")
+        : kind(kind), index(index), name(name) {}
+
+    static StreamId fromIndex(size_t index) {
+        return StreamId(Kind::index, index);
+    }
+
+    static StreamId fromName(const std::string& name) {
+        return StreamId(Kind::name, 0, name);
+    }
+
+    static StreamId fromNamePrefix(const std::string& prefix) {
+        return StreamId(Kind::namePrefix, 0, prefix);
+    }
+
+    static StreamId symbolRecords() { return StreamId(Kind::symbolRecords); }
+    static StreamId publicSymbols() { return StreamId(Kind::publicSymbols); }
+    static StreamId globalSymbols() { return StreamId(Kind::globalSymbols); }
+
+    static StreamId module(const std::string& moduleName) {
+        return StreamId(Kind::module, 0, moduleName);
+    }
+
+    static StreamId modules() { return StreamId(Kind::modules); }
+
+    static StreamId typeHashes(size_t typeStream) {
+        return StreamId(Kind::typeHashes, typeStream);
+    }
+};
+
+/**
+ * Gives a running pass access to its streams.
+ *
+ * A stream to write can either be copied into memory with `write()` or, for
+ * large streams that only need a few bytes changed, read a piece at a time
+ * with `readSource()` and changed with `patch()`. Patches are applied as the
+ * stream is written out, so the stream is never held in memory. Large streams
+ * that change throughout can be rebuilt elsewhere (e.g., in a temporary file)
+ * and handed back with `replace()`.
+ */
+class PassContext {
+   private:
+    std::vector<std::shared_ptr<MsfMemoryStream>> _reads;
+
+    std::vector<size_t> _writeIndices;
+
+    // Streams to write as they were before the pass. Reading these goes
+    // through the MSF file, which must be done while holding the lock.
+    std::vector<MsfStreamRef> _sources;
+    std::mutex& _fileLock;
+
+    // Streams that were copied into memory, patched, replaced, or removed.
+    std::vector<std::shared_ptr<MsfMemoryStream>> _writes;
+    std::vector<std::shared_ptr<MsfPatchedStream>> _patched;
+    std::vector<MsfStreamRef> _replaced;
+    std::vector<bool> _removed;
+
+    // The i'th stream to write as it is so far, unless it was copied into
+    // memory.
+    MsfStreamRef _current(size_t i) const;
+
+    Arena* _arena;
+
+   public:
+    PassContext(std::vector<std::shared_ptr<MsfMemoryStream>> reads,
+                std::vector<size_t> writeIndices,
+                std::vector<MsfStreamRef> sources, std::mutex& fileLock,
+                Arena* arena);
+
+    /**
+     * Returns a copy of the i'th stream in the pass's list of streams to read.
+     */
+    MsfMemoryStream* read(size_t i = 0) { return _reads[i].get(); }
+
+    /**
+     * Returns the i'th stream in the pass's list of streams to write. Changes
+     * to this stream are committed to the MSF file once the pass finishes.
+     */
+    MsfMemoryStream* write(size_t i = 0);
+
+    /**
+     * Returns the stream index of the i'th stream to write.
+     */
+    size_t writeIndex(size_t i = 0) const { return _writeIndices[i]; }
+
+    /**
+     * Returns the length of the i'th stream to write as it was before the
+     * pass.
+     */
+    size_t sourceLength(size_t i = 0) const { return _sources[i]->length(); }
+
+    /**
+     * Reads part of the i'th stream to write as it was before the pass, without
+     * copying the whole stream into memory. Returns the number of bytes read.
+     */
+    size_t readSource(size_t i, size_t offset, size_t length, void* buf);
+
+    /**
+     * Replaces bytes in the i'th stream to write. Patches must not overlap.
+     */
+    void patch(size_t i, size_t offset, size_t length, const void* data);
+
+    /**
+     * Replaces the i'th stream to write with another stream. Anything written
+     * to or patched in the stream before is discarded.
+     */
+    void replace(size_t i, MsfStreamRef stream);
+
+    /**
+     * Removes the i'th stream to write from the MSF file.
+     */
+    void remove(size_t i = 0) { _removed[i] = true; }
+
+    /**
+     * Returns true if the i'th stream to write was written to, patched,
+     * replaced, or removed.
+     */
+    bool changed(size_t i) const {
+        return _removed[i] || _writes[i] || _patched[i] || _replaced[i];
+    }
+
+    /**
+     * Returns the stream to commit back to the MSF file for the i'th stream to
+     * write. This is null if the stream was removed.
+     */
+    MsfStreamRef result(size_t i) const;
+};
+
+/**
+ * A normalization pass.
+ *
+ * If the first stream to write resolves to more than one stream (e.g., several
+ * modules with the same name), then the pass is run once for each of them. All
+ * other streams must resolve to at most one stream.
+ */
+class PdbPass {
+   public:
+    typedef std::function<void(PassContext&)> Function;
+
+    // Name of the pass. Useful to see what's going on.
+    const char* name;
+
+    // Streams that are only read.
+    std::vector<StreamId> reads;
+
+    // Streams that are modified.
+    std::vector<StreamId> writes;
+
+    // The function that does the work.
+    Function run;
+
+    PdbPass(const char* name, std::vector<StreamId> reads,
+            std::vector<StreamId> writes, Function run)
+        : name(name), reads(reads), writes(writes), run(run) {}
+};
+
+/**
+ * Schedules and runs passes over an MSF file.
+ */
+class PassManager {
+   private:
+    std::vector<PdbPass> _passes;
+    Arena* _arena;
+
+   public:
+    /**
+     * Called once no pass is going to change a stream anymore, with the stream
+     * as it ends up. The stream is null if it was removed. Streams that no pass
+     * writes to are handed over before any pass starts.
+     *
+     * The stream may still read from the MSF file through the handle that the
+     * passes share, so it must only be read while holding `fileLock`. This is
+     * called while holding the lock, so it must not wait on anything.
+     */
+    typedef std::function<void(size_t index, MsfStreamRef stream,
+                               std::shared_ptr<std::mutex> fileLock)>
+        StreamDone;
+
+    /**
+     * Params:
+     *   arena = Arena to allocate stream buffers from. It must outlive the MSF
+     *           file that the passes are run on. If null, the heap is used.
+     */
+    PassManager(Arena* arena = nullptr) : _arena(arena) {}
+
+    /**
+     * Registers a pass. Passes that conflict with each other over a stream run
+     * in the order that they were added.
+     */
+    void add(PdbPass pass);
+
+    /**
+     * Runs all of the passes. Stream names and DBI stream references are
+     * resolved against the MSF file before any pass runs.
+     *
+     * If any pass throws an exception, no more passes are started and the first
+     * exception is rethrown once the running passes finish. Streams that were
+     * not done by then are never handed to `streamDone`.
+     */
+    void run(MsfFile& msf, ThreadPool& pool,
+             const StreamDone& streamDone = nullptr);
+};
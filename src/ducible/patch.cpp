@@ -31,14 +31,16 @@ Patch::Patch(size_t offset, size_t length, const uint8_t* data,
              const char* name)
     : offset(offset), length(length), data(data), name(name) {}
 
-void Patch::apply(uint8_t* buf, bool dryRun) {
+bool Patch::apply(uint8_t* buf, bool dryRun) {
     // Only apply the patch if necessary. This makes it easier to see what
     // actually changed in the output.
-    if (memcmp(buf + offset, data, length) == 0) return;
+    if (memcmp(buf + offset, data, length) == 0) return false;
 
     std::cout << *this << std::endl;
 
     if (!dryRun) memcpy(buf + offset, data, length);
+
+    return true;
 }
 
 std::ostream& operator<<(std::ostream& os, const Patch& patch) {
@@ -61,8 +61,11 @@ class Patch {
     /**
      * Applies the patch. Note that no bounds checking is done. It is assumed
      * that it has already been done.
+     *
+     * Returns true if the data was different. If not, nothing is written, so
+     * that a memory mapped file isn't touched.
      */
-    void apply(uint8_t* buf, bool dryRun);
+    bool apply(uint8_t* buf, bool dryRun);
 
     friend std::ostream& operator<<(std::ostream& os, const Patch& patch);
 
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "ducible/patch_archive.h"
+#include "ducible/patch_image.h"
+
+#include "msf/format.h"
+
+#include "util/crc32.h"
+#include "util/deflate.h"
+#include "util/file.h"
+#include "util/memmap.h"
+#include "util/output_file.h"
+#include "util/thread_pool.h"
+#include "util/zip.h"
+
+namespace {
+
+const size_t kNoMember = (size_t)-1;
+
+/**
+ * Member names are compared without regard to case since they end up on
+ * Windows file systems.
+ */
+std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](char c) { return (char)tolower((unsigned char)c); });
+    return s;
+}
+
+bool hasExtension(const std::string& name, const char* ext) {
+    const size_t n = strlen(ext);
+    return name.length() > n &&
+           toLower(name.substr(name.length() - n)) == ext;
+}
+
+/**
+ * Returns the name without its extension, in lower case.
+ */
+std::string stem(const std::string& name) {
+    const size_t dot   = name.rfind('.');
+    const size_t slash = name.rfind('/');
+
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash))
+        return toLower(name);
+
+    return toLower(name.substr(0, dot));
+}
+
+/**
+ * An image in the archive and the PDB that goes with it, if any.
+ */
+struct ArchiveJob {
+    size_t image;
+    size_t pdb;
+};
+
+/**
+ * The new contents of a member.
+ */
+struct NewMember {
+    bool changed;
+
+    // Compressed with `method`.
+    std::vector<uint8_t> data;
+    uint16_t method;
+
+    uint32_t crc32;
+    uint32_t uncompressedSize;
+
+    NewMember()
+        : changed(false), method(kZipStored), crc32(0), uncompressedSize(0) {}
+};
+
+/**
+ * Compresses the new contents of a member. It is stored as is if compressing
+ * doesn't make it any smaller.
+ */
+void compressMember(const std::vector<uint8_t>& contents, NewMember& member) {
+    if (contents.size() > 0xFFFFFFFF)
+        throw InvalidZip("member is too large without ZIP64");
+
+    member.changed          = true;
+    member.crc32            = crc32(0, contents.data(), contents.size());
+    member.uncompressedSize = (uint32_t)contents.size();
+
+    member.data.clear();
+    deflate(contents.data(), contents.size(), member.data);
+    member.method = kZipDeflated;
+
+    if (member.data.size() >= contents.size()) {
+        member.data   = contents;
+        member.method = kZipStored;
+    }
+}
+
+void writeAll(FileRef f, const std::vector<uint8_t>& data) {
+    if (fwrite(data.data(), 1, data.size(), f.get()) != data.size() ||
+        fflush(f.get()) != 0 || fseek(f.get(), 0, SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing scratch file");
+    }
+}
+
+void readAll(FileRef f, std::vector<uint8_t>& data) {
+    if (fflush(f.get()) != 0 || fseek(f.get(), 0, SEEK_END) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed reading scratch file");
+    }
+
+    data.resize((size_t)ftell(f.get()));
+
+    if (fseek(f.get(), 0, SEEK_SET) != 0 ||
+        fread(data.data(), 1, data.size(), f.get()) != data.size()) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed reading scratch file");
+    }
+}
+
+/**
+ * Patches an image and its PDB from the archive.
+ */
+template <typename CharT>
+void patchMembers(const CharT* archivePath, const uint8_t* buf,
+                  const std::vector<ZipEntry>& entries, const ArchiveJob& job,
+                  const PatchOptions& options,
+                  std::vector<NewMember>& members) {
+    std::vector<uint8_t> image;
+    extractZipEntry(buf, entries[job.image], image);
+
+    // Not everything named .exe or .dll is an image.
+    if (image.size() < 2 || image[0] != 'M' || image[1] != 'Z') return;
+
+    const std::vector<uint8_t> originalImage(image);
+
+    std::vector<uint8_t> pdb;
+    if (job.pdb != kNoMember) {
+        extractZipEntry(buf, entries[job.pdb], pdb);
+
+        // Portable PDBs (for .NET assemblies) aren't MSF files and don't need
+        // patching.
+        if (pdb.size() < sizeof(kMsfHeaderMagic) ||
+            memcmp(pdb.data(), kMsfHeaderMagic, sizeof(kMsfHeaderMagic)) != 0)
+            pdb.clear();
+    }
+
+    if (pdb.empty()) {
+        patchImage(image.data(), image.size(), nullptr, nullptr, options);
+    } else {
+        // The PDB code reads and writes files, so give it a couple of scratch
+        // files. These are never committed.
+        OutputFile pdbIn(archivePath);
+        OutputFile pdbOut(archivePath);
+
+        writeAll(pdbIn.file(), pdb);
+
+        patchImage(image.data(), image.size(), pdbIn.file(), pdbOut.file(),
+                   options);
+
+        std::vector<uint8_t> newPdb;
+        readAll(pdbOut.file(), newPdb);
+
+        pdbIn.discard();
+        pdbOut.discard();
+
+        if (newPdb != pdb) compressMember(newPdb, members[job.pdb]);
+    }
+
+    if (image != originalImage) compressMember(image, members[job.image]);
+}
+
+template <typename CharT>
+void patchArchiveImpl(const CharT* path, const PatchOptions& options) {
+    std::unique_ptr<OutputFile> output;
+
+    {
+        MemMap archive(path);
+
+        const uint8_t* buf = (const uint8_t*)archive.buf();
+
+        std::string comment;
+        const std::vector<ZipEntry> entries =
+            readZipDirectory(buf, archive.length(), &comment);
+
+        // Members are written out in order of name so that the order doesn't
+        // depend on whatever created the archive.
+        std::vector<size_t> order(entries.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return entries[a].name < entries[b].name;
+        });
+
+        // Pair up images with their PDBs. A PDB only goes with one image.
+        std::map<std::string, size_t> pdbs;
+        for (size_t i : order) {
+            if (hasExtension(entries[i].name, ".pdb"))
+                pdbs.insert(std::make_pair(stem(entries[i].name), i));
+        }
+
+        std::vector<ArchiveJob> jobs;
+        for (size_t i : order) {
+            const std::string& name = entries[i].name;
+            if (!hasExtension(name, ".dll") && !hasExtension(name, ".exe"))
+                continue;
+
+            ArchiveJob job = {i, kNoMember};
+
+            auto it = pdbs.find(stem(name));
+            if (it != pdbs.end()) {
+                job.pdb = it->second;
+                pdbs.erase(it);
+            }
+
+            jobs.push_back(job);
+        }
+
+        // The arena can't be shared between threads, and the rest only makes
+        // sense for files on disk. Members are already patched in parallel, so
+        // each one runs its PDB passes on a single thread of its own rather
+        // than on a full pool.
+        PatchOptions memberOptions = options;
+        memberOptions.arena        = nullptr;
+        memberOptions.threads      = 1;
+        memberOptions.deltaBase    = nullptr;
+        memberOptions.emitPlan     = nullptr;
+        memberOptions.outputs      = nullptr;
+
+        std::vector<NewMember> members(entries.size());
+
+        std::mutex mutex;
+        ThreadPool pool(options.threads);
+
+        for (auto&& job : jobs) {
+            pool.run([&, job] {
+                try {
+                    patchMembers(path, buf, entries, job, memberOptions,
+                                 members);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    std::cerr << "Error: failed to patch '"
+                              << entries[job.image].name << "' in archive\n";
+                    throw;
+                }
+            });
+        }
+
+        pool.wait();
+
+        if (options.dryrun) return;
+
+        output.reset(new OutputFile(path));
+
+        ZipWriter writer(output->file());
+
+        for (size_t i : order) {
+            ZipEntry entry      = entries[i];
+            const uint8_t* data = buf + entry.dataOffset;
+
+            const NewMember& member = members[i];
+            if (member.changed) {
+                entry.method           = member.method;
+                entry.crc32            = member.crc32;
+                entry.compressedSize   = (uint32_t)member.data.size();
+                entry.uncompressedSize = member.uncompressedSize;
+                data                   = member.data.data();
+            }
+
+            writer.add(entry, data);
+        }
+
+        writer.finish(comment);
+    }
+
+    // The archive must be unmapped before it can be replaced on Windows.
+    if (options.outputs)
+        options.outputs->add(std::move(output));
+    else
+        output->commit();
+}
+
+template <typename CharT>
+bool isArchiveImpl(const CharT* path) {
+    auto f = openFile(path, FileMode<CharT>::readExisting);
+
+    uint8_t magic[4];
+    if (fread(magic, 1, sizeof(magic), f.get()) != sizeof(magic)) return false;
+
+    const uint32_t signature = magic[0] | (magic[1] << 8) | (magic[2] << 16) |
+                               ((uint32_t)magic[3] << 24);
+
+    return signature == kZipLocalHeaderSignature;
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+bool isArchive(const wchar_t* path) { return isArchiveImpl(path); }
+
+void patchArchive(const wchar_t* path, const PatchOptions& options) {
+    patchArchiveImpl(path, options);
+}
+
+#else
+
+bool isArchive(const char* path) { return isArchiveImpl(path); }
+
+void patchArchive(const char* path, const PatchOptions& options) {
+    patchArchiveImpl(path, options);
+}
+
+#endif
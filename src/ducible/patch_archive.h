@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "ducible/patch_options.h"
+
+/**
+ * Returns true if the file starts like a zip archive (e.g., a NuGet package).
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+bool isArchive(const wchar_t* path);
+
+#else
+
+bool isArchive(const char* path);
+
+#endif
+
+/**
+ * Patches the images and PDBs inside a zip archive without extracting it.
+ *
+ * An image is paired with the PDB next to it that has the same name (e.g.,
+ * "lib/net45/foo.dll" and "lib/net45/foo.pdb"). Each pair is patched in memory
+ * in parallel with the others. The archive is then rewritten in place with
+ * its members sorted by name and with fixed timestamps. Members that didn't
+ * change are copied over without being recompressed.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void patchArchive(const wchar_t* path,
+                  const PatchOptions& options = PatchOptions());
+
+#else
+
+void patchArchive(const char* path,
+                  const PatchOptions& options = PatchOptions());
+
+#endif
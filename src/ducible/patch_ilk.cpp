@@ -58,7 +58,12 @@ void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
 
     // Map the ilk file into memory.
     try {
-        MemMap ilk(ilkPath.c_str());
+        // The search goes from front to back and usually stops early, so
+        // don't read in the whole file up front.
+        MemMapOptions mapOptions;
+        mapOptions.sequential = true;
+
+        MemMap ilk(ilkPath.c_str(), 0, mapOptions);
 
         uint8_t* buf    = (uint8_t*)ilk.buf();
         uint8_t* bufEnd = buf + ilk.length();
@@ -67,8 +72,9 @@ void patchIlkImpl(const CharT* imagePath, const uint8_t oldSignature[16],
         uint8_t* it =
             std::find_first_of(buf, bufEnd, oldSignature, oldSignature + 16);
 
-        // Replace
-        if (it != bufEnd) {
+        // Replace. Writing the same signature back would still dirty the
+        // mapping and bump the modification time.
+        if (it != bufEnd && memcmp(oldSignature, newSignature, 16) != 0) {
             std::cout << "Replacing old PDB signature in ILK file.\n";
 
             if (!dryrun) memcpy(it, newSignature, 16);
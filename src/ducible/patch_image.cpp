@@ -75,49 +75,28 @@
 #include <algorithm>
 #include <cstring>
 #include <iostream>
-#include <map>
-#include <regex>
+#include <memory>
 #include <vector>
 
 #include "ducible/patch_ilk.h"
 #include "ducible/patch_image.h"
+#include "ducible/patch_pdb.h"
 
 #include "ducible/patches.h"
+#include "ducible/plan.h"
 
 #include "pe/pe.h"
 
-#include "util/file.h"
-
-#include "msf/memory_stream.h"
-#include "msf/msf.h"
-#include "msf/stream.h"
-
 #include "pdb/cvinfo.h"
-#include "pdb/format.h"
-#include "pdb/pdb.h"
 
 #include "util/md5.h"
 #include "util/memmap.h"
+#include "util/output_file.h"
+#include "util/perf_counters.h"
+#include "util/probes.h"
 
 namespace {
 
-// Helpers for CharT generalization
-template <typename CharT>
-struct Strings {
-    static const CharT tmpExtension[];
-    static const CharT nullGuid[];
-};
-
-template <>
-const char Strings<char>::tmpExtension[] = ".tmp";
-template <>
-const char Strings<char>::nullGuid[] = "{00000000-0000-0000-0000-000000000000}";
-template <>
-const wchar_t Strings<wchar_t>::tmpExtension[] = L".tmp";
-template <>
-const wchar_t Strings<wchar_t>::nullGuid[] =
-    L"{00000000-0000-0000-0000-000000000000}";
-
 /**
  * There are 0 or more debug data directories. We need to patch the timestamp in
  * all of them.
@@ -204,6 +183,10 @@ void patchOptionalHeader(const PEFile& pe, Patches& patches,
  */
 void calculateChecksum(const uint8_t* buf, const size_t length,
                        const std::vector<Patch>& patches, uint8_t output[16]) {
+    PerfRegion region("checksum", length);
+
+    DUCIBLE_PROBE1(hash_start, length);
+
     size_t pos = 0;
 
     md5_context ctx;
@@ -224,591 +207,15 @@ void calculateChecksum(const uint8_t* buf, const size_t length,
     md5_update(&ctx, buf + pos, length - pos);
 
     md5_finish(&ctx, output);
-}
-
-/**
- * Compares the PE and PDB signatures to see if they match.
- */
-bool matchingSignatures(const CV_INFO_PDB70& pdbInfo,
-                        const PdbStream70& pdbHeader) {
-    if (pdbInfo.Age != pdbHeader.age ||
-        memcmp(pdbInfo.Signature, pdbHeader.sig70, sizeof(pdbHeader.sig70)) !=
-            0) {
-        return false;
-    }
-
-    return true;
-}
-
-/**
- * Returns a temporary PDB path name. The PDB will be written here first and
- * then renamed to the original after everything succeeds.
- */
-template <typename CharT>
-std::basic_string<CharT> getTempPdbPath(const CharT* pdbPath) {
-    std::basic_string<CharT> temp(pdbPath);
-    temp.append(Strings<CharT>::tmpExtension);
-    return temp;
-}
-
-/**
- * Helper function for normalizing a GUID in a NULL terminated file name.
- */
-template <typename CharT>
-void normalizeFileNameGuid(CharT* path, size_t length) {
-    static const std::regex guidRegex(
-        "\\{"
-        "[0-9a-fA-F]{8}-"
-        "[0-9a-fA-F]{4}-"
-        "[0-9a-fA-F]{4}-"
-        "[0-9a-fA-F]{4}-"
-        "[0-9a-fA-F]{12}"
-        "\\}");
-
-    std::match_results<const CharT*> match;
-
-    if (std::regex_search((const CharT*)path, (const CharT*)path + length,
-                          match, guidRegex)) {
-        memcpy(path + match.position(0), Strings<CharT>::nullGuid,
-               sizeof(Strings<CharT>::nullGuid));
-    }
-}
-
-/**
- * Patches the "/LinkInfo" named stream.
- */
-void patchLinkInfoStream(MsfMemoryStream* stream) {
-    uint8_t* data       = stream->data();
-    const size_t length = stream->length();
-
-    if (length == 0) return;
-
-    if (length < sizeof(LinkInfo))
-        throw InvalidPdb("got partial LinkInfo stream");
-
-    const LinkInfo* linkInfo = (LinkInfo*)data;
-
-    if (linkInfo->size > length)
-        throw InvalidPdb("LinkInfo size too large for stream");
-
-    // The rest of the stream appears to be garbage. Thus, we truncate it.
-    stream->resize(linkInfo->size);
-}
-
-/**
- * Patches the "/names" stream.
- */
-void patchNamesStream(MsfMemoryStream* stream) {
-    uint8_t* data    = stream->data();
-    uint8_t* dataEnd = data + stream->length();
-
-    // Parse the header
-    if (size_t(dataEnd - data) < sizeof(StringTableHeader))
-        throw InvalidPdb("missing string table header");
-
-    StringTableHeader* header = (StringTableHeader*)data;
-
-    data += sizeof(*header);
-
-    if (header->signature != kHashTableSignature)
-        throw InvalidPdb("got invalid string table signature");
-
-    if (header->version != 1 && header->version != 2)
-        throw InvalidPdb("got invalid or unsupported string table version");
-
-    if (size_t(dataEnd - data) < header->stringsSize)
-        throw InvalidPdb("got partial string table data");
-
-    data += header->stringsSize;
-
-    if (size_t(dataEnd - data) < sizeof(uint32_t))
-        throw InvalidPdb("missing string table offset array length");
-
-    // Offsets array length
-    uint32_t offsetsLength = *(uint32_t*)data;
-
-    data += sizeof(offsetsLength);
-
-    if (size_t(dataEnd - data) < offsetsLength * sizeof(uint32_t))
-        throw InvalidPdb("got partial string table offsets array");
-
-    uint32_t* offsets = (uint32_t*)data;
-
-    data += offsetsLength * sizeof(uint32_t);
-
-    // Sort the offsets. There is some non-determinism creeping in here somehow.
-    std::sort(offsets, offsets + offsetsLength);
-
-    for (size_t i = 0; i < offsetsLength; ++i) {
-        const size_t offset = offsets[i];
-
-        if (offset == 0) continue;
-
-        if (offset >= header->stringsSize)
-            throw InvalidPdb("got invalid offset into string table");
-
-        char* str  = &header->strings[offset];
-        size_t len = strlen(str);
-
-        if (offset + len + 1 > header->stringsSize)
-            throw InvalidPdb("got invalid offset into string table");
-
-        normalizeFileNameGuid(str, len);
-    }
-}
-
-/**
- * Patches the PDB header stream.
- */
-void patchHeaderStream(MsfFile& msf, MsfMemoryStream* stream,
-                       const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
-                       const uint8_t signature[16], bool force) {
-    uint8_t* data          = stream->data();
-    const uint8_t* dataEnd = stream->data() + stream->length();
-
-    if (size_t(dataEnd - data) < sizeof(PdbStream70))
-        throw InvalidPdb("missing PDB 7.0 header");
-
-    PdbStream70* header = (PdbStream70*)data;
-
-    data += sizeof(*header);
-
-    if (header->version < PdbVersion::vc70)
-        throw InvalidPdb("unsupported PDB implementation version");
-
-    // Check that this PDB matches what the PE file expects. Don't do the check
-    // if `force` was specified.
-    if (!force && (!pdbInfo || !matchingSignatures(*pdbInfo, *header)))
-        throw InvalidPdb("PE and PDB signatures do not match");
-
-    // Patch the PDB header stream
-    header->timestamp = timestamp;
-    header->age       = 1;
-    memcpy(header->sig70, signature, sizeof(header->sig70));
-
-    const auto table = readNameMapTable(data, dataEnd);
-
-    // Patch the LinkInfo stream.
-    {
-        const auto it = table.find("/LinkInfo");
-        if (it != table.end()) {
-            auto origLinkInfoStream = msf.getStream(it->second);
-            if (!origLinkInfoStream)
-                throw InvalidPdb("missing '/LinkInfo' stream");
-
-            auto linkInfoStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origLinkInfoStream.get()));
-
-            patchLinkInfoStream(linkInfoStream.get());
-
-            msf.replaceStream(it->second, linkInfoStream);
-        }
-    }
-
-    // Rewrite /names hash table
-    {
-        const auto it = table.find("/names");
-        if (it != table.end()) {
-            auto origNamesStream = msf.getStream(it->second);
-            if (!origNamesStream) throw InvalidPdb("missing '/names' stream");
-
-            auto namesStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origNamesStream.get()));
-
-            patchNamesStream(namesStream.get());
-
-            msf.replaceStream(it->second, namesStream);
-        }
-    }
-}
-
-/**
- * Patches a module stream.
- */
-void patchModuleStream(MsfMemoryStream* stream) {
-    uint8_t* data          = stream->data();
-    const uint8_t* dataEnd = stream->data() + stream->length();
-
-    if (size_t(dataEnd - data) < sizeof(uint16_t))
-        throw InvalidPdb("got partial module info stream");
-
-    uint32_t type = *(uint32_t*)data;
-    data += sizeof(type);
-
-    if (type != CV_SIGNATURE_C13) return;
-
-    if (size_t(dataEnd - data) < sizeof(SymbolRecord))
-        throw InvalidPdb("missing symbol record in module info stream");
-
-    const SymbolRecord* sym = (const SymbolRecord*)data;
-
-    // We're only concerned about objects here
-    if (sym->type != S_OBJNAME) return;
-
-    // Recast now that we know the type.
-    OBJNAMESYM* objsym = (OBJNAMESYM*)data;
-
-    // The signature always seems to be 0.
-    if (objsym->signature != 0)
-        throw InvalidPdb("got invalid OBJNAMESYM symbol record signature");
-
-    if (size_t(dataEnd - data) < objsym->reclen)
-        throw InvalidPdb("got partial OBJNAMESYM symbol record");
-
-    size_t namelen = strlen((const char*)objsym->name);
-
-    if ((uint8_t*)objsym->name + namelen + 1 > dataEnd)
-        throw InvalidPdb("object path in symbol record is not null-terminated");
-
-    normalizeFileNameGuid((char*)objsym->name, namelen);
-}
-
-const char* kIncLinkWarning =
-    "\
-Warning: /INCREMENTAL was specified in the linker options. Incremental linking \
-is known to not work with Ducible.";
-
-/**
- * Patches the DBI stream.
- */
-void patchDbiStream(MsfFile& msf, MsfMemoryStream* stream) {
-    if (stream->length() < sizeof(DbiHeader))
-        throw InvalidPdb("DBI stream too short");
-
-    uint8_t* data       = stream->data();
-    const size_t length = stream->length();
-    size_t offset       = 0;
-
-    DbiHeader* dbi = (DbiHeader*)data;
-
-    // Sanity checks
-    if (dbi->signature != dbiHeaderSignature)
-        throw InvalidPdb("invalid DBI header signature");
-
-    if (dbi->version != DbiVersion::v70)
-        throw InvalidPdb("Unsupported DBI stream version");
-
-    // Display a warning about incrementally linking
-    if (dbi->flags.incLink) std::cout << kIncLinkWarning << std::endl;
-
-    // Patch the age. This must match the age in the PDB stream.
-    dbi->age = 1;
-
-    offset += sizeof(*dbi);
-
-    // The module info immediately follows the header.
-
-    // Check bounds
-    if (offset + dbi->gpModInfoSize > length)
-        throw InvalidPdb("DBI module info size exceeds stream length");
-
-    // Number of modules
-    size_t moduleCount = 0;
-
-    // Patch the module info entries
-    for (size_t i = 0; i < dbi->gpModInfoSize;) {
-        if (dbi->gpModInfoSize - i < sizeof(ModuleInfo))
-            throw InvalidPdb("got partial DBI module info");
-
-        ModuleInfo* info = (ModuleInfo*)(data + offset + i);
-
-        info->sc.padding1 = 0;
-        info->sc.padding2 = 0;
-
-        // Patch the offsets "array". This is not used directly by Microsoft's
-        // DBI implementation and may contain non-deterministic data (e.g., the
-        // memory address of the actual allocated array). Thus, we need to zero
-        // it out.
-        info->offsets = 0;
-
-        // There is one entry that contains a path with a GUID. We need to patch
-        // this. It is often the first module info entry, but it is safer to
-        // find it by name.
-        if (strcmp(info->moduleName(), "* Linker Generated Manifest RES *") ==
-                0 &&
-            strcmp(info->objectName(), "") == 0) {
-            auto origModuleStream = msf.getStream(info->stream);
-            if (!origModuleStream) continue;
-
-            auto moduleStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origModuleStream.get()));
-
-            patchModuleStream(moduleStream.get());
-
-            msf.replaceStream(info->stream, moduleStream);
-        }
-
-        i += info->size();
-        ++moduleCount;
-    }
 
-    offset += dbi->gpModInfoSize;
-
-    // The section contributions follow the module info entries. These contain
-    // garbage due to struct alignment. They needed to be zeroed out.
-
-    if (offset + dbi->sectionContributionSize > length) {
-        throw InvalidPdb(
-            "DBI section contributions size exceeds stream length");
-    }
-
-    const SectionContribVersion scVersion =
-        *(SectionContribVersion*)(data + offset);
-    offset += sizeof(scVersion);
-
-    if (scVersion != SectionContribVersion::v1 &&
-        scVersion != SectionContribVersion::v2) {
-        throw InvalidPdb("got invalid section contribution substream version");
-    }
-
-    const size_t scCount = (dbi->sectionContributionSize - sizeof(scVersion)) /
-                           sizeof(SectionContribution);
-
-    SectionContribution* sectionContribs =
-        (SectionContribution*)(data + offset);
-
-    for (size_t i = 0; i < scCount; ++i) {
-        SectionContribution& sc = sectionContribs[i];
-        sc.padding1             = 0;
-        sc.padding2             = 0;
-    }
-
-    offset += dbi->sectionContributionSize - sizeof(scVersion);
-
-    // Skip over the section map
-    offset += dbi->sectionMapSize;
-
-    // In the list of files, there are some temporary files with random GUIDs in
-    // the name.
-    if (dbi->fileInfoSize > 0) {
-        if (offset + dbi->fileInfoSize > length)
-            throw InvalidPdb("Missing file info in DBI stream");
-
-        uint8_t* p    = data + offset;
-        uint8_t* pEnd = p + dbi->fileInfoSize;
-
-        // Skip over the header as it doesn't always provide correct
-        // information.
-        p += sizeof(FileInfoHeader);
-
-        // Skip over file indices array. We don't need them.
-        p += moduleCount * sizeof(uint16_t);
-
-        // File counts array
-        uint16_t* fileCounts = (uint16_t*)p;
-        p += moduleCount * sizeof(*fileCounts);
-
-        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
-
-        uint32_t* offsets = (uint32_t*)p;
-
-        uint32_t offsetCount = 0;
-        for (size_t i = 0; i < moduleCount; ++i) offsetCount += fileCounts[i];
-
-        p += offsetCount * sizeof(*offsets);
-
-        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
-
-        char* names = (char*)p;
-
-        for (size_t i = 0; i < offsetCount; ++i) {
-            const uint32_t& off = offsets[i];
-
-            if ((uint8_t*)names + off + 1 > pEnd)
-                throw InvalidPdb("invalid offset for file info name");
-
-            char* name = names + off;
-            size_t len = strlen(name);
-
-            if ((uint8_t*)name + len + 1 > pEnd)
-                throw InvalidPdb("file name exceeds file info section size");
-
-            normalizeFileNameGuid(name, len);
-        }
-    }
-
-    // Skip past the file info
-    offset += dbi->fileInfoSize;
-
-    // Skip past the TSM substream
-    offset += dbi->typeServerMapSize;
-
-    // Skip past the EC info
-    offset += dbi->ecInfoSize;
-
-    // Skip past the debug header. This should be the last substream in the DBI
-    // stream.
-    offset += dbi->debugHeaderSize;
-}
-
-/**
- * Patches the symbol record stream.
- *
- * There is up to 3 bytes of padding at the end of each symbol record. Since
- * garbage just lives there, it needs to be zeroed out.
- */
-void patchSymbolRecordsStream(MsfMemoryStream* stream) {
-    uint8_t* data       = stream->data();
-    const size_t length = stream->length();
-
-    for (size_t i = 0; i < length;) {
-        if (length - i < sizeof(SymbolRecord))
-            throw InvalidPdb("got partial symbol record");
-
-        SymbolRecord* rec = (SymbolRecord*)(data + i);
-
-        // The symbol record length must be at least the size of
-        // SymbolRecord::type and the size of the entire record must be a
-        // multiple of 4.
-        if (rec->length < sizeof(rec->type) ||
-            (rec->length + sizeof(rec->length)) % 4 != 0) {
-            throw InvalidPdb("invalid symbol record size");
-        }
-
-        const size_t dataLength = rec->length - sizeof(rec->type);
-
-        // Bounds check.
-        if (i + sizeof(SymbolRecord) + dataLength > length)
-            throw InvalidPdb("symbol record size too large");
-
-        // There is a maximum of 3 bytes of padding at the end of the data.
-        // Note that if the data length is < 3 and this overflows,
-        size_t tail = dataLength - 3;
-
-        // Find the null terminator at the end. The padding (if any) will be
-        // after this point.
-        while (tail + 1 < dataLength && rec->data[tail] != 0) ++tail;
-
-        // Zero out the padding.
-        while (tail < dataLength) rec->data[tail++] = 0;
-
-        // Skip to next symbol record
-        i += sizeof(SymbolRecord) + dataLength;
-    }
-}
-
-/**
- * Patch the public symbol info stream.
- */
-void patchPublicSymbolStream(MsfMemoryStream* stream) {
-    // The public symbol info stream starts with the public symbol header
-    // followed by the (Global Symbol Info) GSI hash header. We only care about
-    // the public symbol header.
-    if (stream->length() < sizeof(PublicSymbolHeader))
-        throw InvalidPdb("public symbol stream too short");
-
-    PublicSymbolHeader* header = (PublicSymbolHeader*)stream->data();
-
-    // Struct alignment padding
-    header->padding1 = 0;
-
-    // Microsoft's PDB writer has a bug where this field is not initialized in
-    // the constructor. However, there are other code paths that do initialize
-    // this value, but only sometimes. Thus, since Microsoft's tools are already
-    // broken because of this, we zero this out without worrying about it.
-    //
-    // Since fixing this would be a trivial one-liner for Microsoft, this patch
-    // could become silently obsolete in the future.
-    header->sectionCount = 0;
-}
-
-/**
- * Rewrites a PDB, eliminating non-determinism.
- */
-void patchPDB(MsfFile& msf, const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
-              const uint8_t signature[16], bool force) {
-    msf.replaceStream((size_t)PdbStreamType::streamTable, nullptr);
-
-    // Read the PDB header
-    auto origPdbHeaderStream = msf.getStream((size_t)PdbStreamType::header);
-    if (!origPdbHeaderStream) throw InvalidPdb("missing PDB header stream");
-
-    auto pdbHeaderStream = std::shared_ptr<MsfMemoryStream>(
-        new MsfMemoryStream(origPdbHeaderStream.get()));
-
-    patchHeaderStream(msf, pdbHeaderStream.get(), pdbInfo, timestamp, signature,
-                      force);
-
-    msf.replaceStream((size_t)PdbStreamType::header, pdbHeaderStream);
-
-    // Patch the DBI stream
-    if (auto origDbiStream = msf.getStream((size_t)PdbStreamType::dbi)) {
-        auto dbiStream = std::make_shared<MsfMemoryStream>(origDbiStream.get());
-
-        patchDbiStream(msf, dbiStream.get());
-
-        msf.replaceStream((size_t)PdbStreamType::dbi, dbiStream);
-
-        // We need the DBI header to get the symbol record stream. Note that
-        // bounds checking has already been done at this point.
-        const DbiHeader* dbiHeader = (const DbiHeader*)dbiStream->data();
-
-        // Patch the symbol records stream
-        if (auto origSymRecStream =
-                msf.getStream(dbiHeader->symbolRecordsStream)) {
-            auto symRecStream =
-                std::make_shared<MsfMemoryStream>(origSymRecStream.get());
-
-            patchSymbolRecordsStream(symRecStream.get());
-
-            msf.replaceStream(dbiHeader->symbolRecordsStream, symRecStream);
-        }
-
-        // Patch the public symbols info stream
-        if (auto origPubSymStream =
-                msf.getStream(dbiHeader->publicSymbolStream)) {
-            auto pubSymStream = std::shared_ptr<MsfMemoryStream>(
-                new MsfMemoryStream(origPubSymStream.get()));
-
-            patchPublicSymbolStream(pubSymStream.get());
-
-            msf.replaceStream(dbiHeader->publicSymbolStream, pubSymStream);
-        }
-    }
+    DUCIBLE_PROBE1(hash_done, length);
 }
 
 /**
- * Patches a PDB file.
+ * Finds everything in the image that needs to be patched and calculates the
+ * new PDB signature. Returns the image's CodeView info, if it has any.
  */
-template <typename CharT>
-void patchPDB(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
-              uint32_t timestamp, const uint8_t signature[16], bool dryrun,
-              bool force) {
-    auto tmpPdbPath = getTempPdbPath(pdbPath);
-
-    {
-        auto pdb    = openFile(pdbPath, FileMode<CharT>::readExisting);
-        auto tmpPdb = openFile(tmpPdbPath.c_str(), FileMode<CharT>::writeEmpty);
-
-        MsfFile msf(pdb);
-
-        patchPDB(msf, pdbInfo, timestamp, signature, force);
-
-        // Write out the rewritten PDB to disk.
-        msf.write(tmpPdb);
-    }
-
-    if (dryrun) {
-        // Delete the temporary file
-        deleteFile(tmpPdbPath.c_str());
-    } else {
-        // Rename the new PDB file over the old one
-        renameFile(tmpPdbPath.c_str(), pdbPath);
-    }
-}
-
-template <typename CharT>
-void patchImageImpl(const CharT* imagePath, const CharT* pdbPath, bool dryrun,
-                    bool force) {
-    MemMap image(imagePath);
-
-    uint8_t* buf        = (uint8_t*)image.buf();
-    const size_t length = image.length();
-
-    PEFile pe = PEFile(buf, length);
-
-    Patches patches(buf);
-
+const CV_INFO_PDB70* findImagePatches(PEFile& pe, Patches& patches) {
     patches.add(&pe.fileHeader->TimeDateStamp, &pe.timestamp,
                 "IMAGE_FILE_HEADER.TimeDateStamp");
 
@@ -840,37 +247,120 @@ void patchImageImpl(const CharT* imagePath, const CharT* pdbPath, bool dryrun,
     // Calculate the checksum of the PE file. Note that the checksum is stored
     // in the PDB signature. When the patches are applied, this checksum is what
     // will be set in the file.
-    calculateChecksum(buf, length, patches.patches, pe.pdbSignature);
+    calculateChecksum(pe.buf, pe.length, patches.patches, pe.pdbSignature);
+
+    return pdbInfo;
+}
+
+template <typename CharT>
+bool patchImageImpl(const CharT* imagePath, const CharT* pdbPath,
+                    const PatchOptions& options) {
+    // The whole image gets hashed, so fault it all in up front instead of one
+    // page at a time.
+    MemMapOptions mapOptions;
+    mapOptions.populate  = true;
+    mapOptions.hugePages = true;
+
+    DUCIBLE_PROBE1(image_map_start, imagePath);
+
+    MemMap image(imagePath, 0, mapOptions);
+
+    uint8_t* buf        = (uint8_t*)image.buf();
+    const size_t length = image.length();
+
+    DUCIBLE_PROBE2(image_map_done, imagePath, length);
+
+    DUCIBLE_PROBE1(pe_parse_start, length);
+    PEFile pe = PEFile(buf, length);
+    DUCIBLE_PROBE1(pe_parse_done, length);
+
+    Patches patches(buf);
+
+    const CV_INFO_PDB70* pdbInfo = findImagePatches(pe, patches);
+
+    // The PDB and everything written next to it (its delta and checksums, and
+    // the plan) are committed together so that they share the cost of syncing.
+    // Unless the caller batches them, that happens before the image is patched
+    // so that the image never refers to a PDB that isn't on disk yet.
+    OutputBatch batch;
+    PatchOptions pdbOptions = options;
+    if (!pdbOptions.outputs) pdbOptions.outputs = &batch;
+
+    // The plan records the image as it is before patching.
+    if (options.emitPlan) {
+        std::unique_ptr<OutputFile> plan(new OutputFile(options.emitPlan));
+        writePlan(plan->file(), buf, length, patches.patches, pdbInfo,
+                  pe.timestamp, pe.pdbSignature);
+
+        if (options.dryrun)
+            plan->discard();
+        else
+            pdbOptions.outputs->add(std::move(plan));
+    }
+
+    bool changed = false;
 
     // Patch the PDB file.
     if (pdbPath) {
-        patchPDB(pdbPath, pdbInfo, pe.timestamp, pe.pdbSignature, dryrun,
-                 force);
+        changed = patchPDB(pdbPath, pdbInfo, pe.timestamp, pe.pdbSignature,
+                           pdbOptions);
     }
 
+    batch.commit();
+
+    if (changed && !options.dryrun && options.fileWritten &&
+        pdbOptions.outputs == &batch)
+        options.fileWritten(pdbPath);
+
     // Patch the ilk file with the new PDB signature. If we don't do this,
     // incremental linking will fail due to a signature mismatch.
     if (pdbInfo) {
-        patchIlk(imagePath, pdbInfo->Signature, pe.pdbSignature, dryrun);
+        patchIlk(imagePath, pdbInfo->Signature, pe.pdbSignature,
+                 options.dryrun);
+    }
+
+    if (patches.apply(options.dryrun)) {
+        changed = true;
+
+        if (!options.dryrun && options.fileWritten)
+            options.fileWritten(imagePath);
     }
 
-    patches.apply(dryrun);
+    return changed;
 }
 
 }  // namespace
 
 #if defined(_WIN32) && defined(UNICODE)
 
-void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath, bool dryrun,
-                bool force) {
-    patchImageImpl(imagePath, pdbPath, dryrun, force);
+bool patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+                const PatchOptions& options) {
+    return patchImageImpl(imagePath, pdbPath, options);
 }
 
 #else
 
-void patchImage(const char* imagePath, const char* pdbPath, bool dryrun,
-                bool force) {
-    patchImageImpl(imagePath, pdbPath, dryrun, force);
+bool patchImage(const char* imagePath, const char* pdbPath,
+                const PatchOptions& options) {
+    return patchImageImpl(imagePath, pdbPath, options);
 }
 
 #endif
+
+void patchImage(uint8_t* buf, size_t length, FileRef pdbIn, FileRef pdbOut,
+                const PatchOptions& options) {
+    DUCIBLE_PROBE1(pe_parse_start, length);
+    PEFile pe = PEFile(buf, length);
+    DUCIBLE_PROBE1(pe_parse_done, length);
+
+    Patches patches(buf);
+
+    const CV_INFO_PDB70* pdbInfo = findImagePatches(pe, patches);
+
+    if (pdbIn) {
+        patchPDB(pdbIn, pdbOut, pdbInfo, pe.timestamp, pe.pdbSignature,
+                 options);
+    }
+
+    patches.apply(options.dryrun);
+}
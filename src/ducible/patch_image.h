@@ -21,18 +21,36 @@
  */
 #pragma once
 
+#include <stdint.h>
+
+#include "ducible/patch_options.h"
+
+#include "util/file.h"
+
 /**
  * Patches the given image and its associated PDB to eliminate the
  * non-deterministic parts of the files.
+ *
+ * Returns true if either file was changed. Files that are already
+ * deterministic are left untouched.
  */
 #if defined(_WIN32) && defined(UNICODE)
 
-void patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
-                bool dryrun = true, bool force = false);
+bool patchImage(const wchar_t* imagePath, const wchar_t* pdbPath,
+                const PatchOptions& options = PatchOptions());
 
 #else
 
-void patchImage(const char* imagePath, const char* pdbPath, bool dryrun = true,
-                bool force = false);
+bool patchImage(const char* imagePath, const char* pdbPath,
+                const PatchOptions& options = PatchOptions());
 
 #endif
+
+/**
+ * Patches an image that is already in memory, along with its PDB, if any. The
+ * PDB is read from `pdbIn` and the rewritten PDB is written to `pdbOut`. This
+ * is for files that don't live on disk by themselves, such as archive members.
+ * Incremental linker files are not touched.
+ */
+void patchImage(uint8_t* buf, size_t length, FileRef pdbIn, FileRef pdbOut,
+                const PatchOptions& options = PatchOptions());
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Static and import libraries are ar archives. Each member has a header with a
+ * modification date, followed by either a COFF object, an import description,
+ * or an anonymous object (e.g., /bigobj or /GL objects). All of these have a
+ * timestamp as well. The first members are the linker members, which hold the
+ * symbol index, and the long names member.
+ *
+ * None of the patches change the size of anything, so the library is patched
+ * in place just like an image.
+ *
+ * References:
+ * - https://msdn.microsoft.com/en-us/library/windows/desktop/ms680547.aspx
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+#include "ducible/patch_library.h"
+#include "ducible/patches.h"
+
+#include "pe/format.h"
+#include "pe/pe.h"
+
+#include "util/file.h"
+#include "util/memmap.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+// The same timestamp that images are patched with. See PEFile::timestamp.
+const uint32_t kTimestamp = 1262304000;
+
+// The member header date is the same timestamp, but in decimal.
+const uint8_t kMemberDate[12] = {'1', '2', '6', '2', '3', '0',
+                                 '4', '0', '0', '0', ' ', ' '};
+
+struct LibraryMember {
+    const IMAGE_ARCHIVE_MEMBER_HEADER* header;
+    const uint8_t* data;
+    size_t size;
+};
+
+/**
+ * Parses a decimal member header field. Fields are padded on the right with
+ * spaces.
+ */
+bool parseDecimal(const uint8_t* field, size_t length, size_t& value) {
+    size_t i = 0;
+
+    value = 0;
+    for (; i < length && isdigit(field[i]); ++i)
+        value = value * 10 + (field[i] - '0');
+
+    if (i == 0) return false;
+
+    for (; i < length; ++i) {
+        if (field[i] != ' ') return false;
+    }
+
+    return true;
+}
+
+/**
+ * Returns true if this is one of the special members (i.e., the linker members
+ * or the long names member). Names of the form "/123" are references into the
+ * long names member and belong to regular members.
+ */
+bool isSpecialMember(const IMAGE_ARCHIVE_MEMBER_HEADER* header) {
+    return header->Name[0] == '/' && !isdigit(header->Name[1]);
+}
+
+/**
+ * Returns true if the data starts with an import description or an anonymous
+ * object header.
+ */
+bool isAnonObject(const uint8_t* data, size_t size) {
+    if (size < sizeof(IMPORT_OBJECT_HEADER)) return false;
+
+    auto header = (const IMPORT_OBJECT_HEADER*)data;
+
+    return header->Sig1 == IMAGE_FILE_MACHINE_UNKNOWN &&
+           header->Sig2 == IMPORT_OBJECT_HDR_SIG2;
+}
+
+/**
+ * Returns true if the machine type is one that a COFF object can have.
+ * Anonymous objects and import descriptions are the only ones that use
+ * IMAGE_FILE_MACHINE_UNKNOWN, so it isn't accepted here.
+ */
+bool isKnownMachine(uint16_t machine) {
+    switch (machine) {
+        case IMAGE_FILE_MACHINE_I386:
+        case IMAGE_FILE_MACHINE_R3000:
+        case IMAGE_FILE_MACHINE_R4000:
+        case IMAGE_FILE_MACHINE_R10000:
+        case IMAGE_FILE_MACHINE_WCEMIPSV2:
+        case IMAGE_FILE_MACHINE_ALPHA:
+        case IMAGE_FILE_MACHINE_SH3:
+        case IMAGE_FILE_MACHINE_SH3DSP:
+        case IMAGE_FILE_MACHINE_SH3E:
+        case IMAGE_FILE_MACHINE_SH4:
+        case IMAGE_FILE_MACHINE_SH5:
+        case IMAGE_FILE_MACHINE_ARM:
+        case IMAGE_FILE_MACHINE_THUMB:
+        case IMAGE_FILE_MACHINE_ARMNT:
+        case IMAGE_FILE_MACHINE_AM33:
+        case IMAGE_FILE_MACHINE_POWERPC:
+        case IMAGE_FILE_MACHINE_POWERPCFP:
+        case IMAGE_FILE_MACHINE_IA64:
+        case IMAGE_FILE_MACHINE_MIPS16:
+        case IMAGE_FILE_MACHINE_ALPHA64:
+        case IMAGE_FILE_MACHINE_MIPSFPU:
+        case IMAGE_FILE_MACHINE_MIPSFPU16:
+        case IMAGE_FILE_MACHINE_TRICORE:
+        case IMAGE_FILE_MACHINE_CEF:
+        case IMAGE_FILE_MACHINE_EBC:
+        case IMAGE_FILE_MACHINE_AMD64:
+        case IMAGE_FILE_MACHINE_M32R:
+        case IMAGE_FILE_MACHINE_CEE:
+        case IMAGE_FILE_MACHINE_ARM64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Returns the size of the file header plus the section table that follows it.
+ */
+uint64_t coffHeadersSize(const IMAGE_FILE_HEADER* header) {
+    return sizeof(IMAGE_FILE_HEADER) +
+           (uint64_t)header->NumberOfSections * IMAGE_SIZEOF_SECTION_HEADER;
+}
+
+/**
+ * Returns true if the data looks like the start of a COFF object of the given
+ * size. COFF objects have no signature, so this can only check that the
+ * headers make sense. If the headers fit in the size, the data must hold all
+ * of them (see coffHeadersSize).
+ */
+bool isCoffObject(const uint8_t* data, size_t size) {
+    if (size < sizeof(IMAGE_FILE_HEADER)) return false;
+
+    auto header = (const IMAGE_FILE_HEADER*)data;
+
+    if (!isKnownMachine(header->Machine)) return false;
+
+    if (header->SizeOfOptionalHeader != 0) return false;
+
+    if (coffHeadersSize(header) > size) return false;
+
+    // Symbol table entries are 18 bytes each.
+    if (header->PointerToSymbolTable != 0 &&
+        header->PointerToSymbolTable + (uint64_t)header->NumberOfSymbols * 18 >
+            size)
+        return false;
+
+    // Relocations are 10 bytes each. Uninitialized sections have no raw data
+    // and a null pointer to it.
+    auto sections =
+        (const IMAGE_SECTION_HEADER*)(data + sizeof(IMAGE_FILE_HEADER));
+    for (size_t i = 0; i < header->NumberOfSections; ++i) {
+        const IMAGE_SECTION_HEADER& section = sections[i];
+
+        if (section.PointerToRawData != 0 &&
+            (uint64_t)section.PointerToRawData + section.SizeOfRawData > size)
+            return false;
+
+        if (section.PointerToRelocations != 0 &&
+            section.PointerToRelocations +
+                    (uint64_t)section.NumberOfRelocations * 10 >
+                size)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Finds the timestamp to patch in an object. Members that aren't objects
+ * (e.g., LLVM bitcode) are left alone.
+ */
+void findObjectPatches(const uint8_t* data, size_t size, Patches& patches) {
+    if (isAnonObject(data, size)) {
+        // Import descriptions and anonymous objects have the timestamp in the
+        // same place.
+        auto header = (const IMPORT_OBJECT_HEADER*)data;
+        if (header->TimeDateStamp != 0)
+            patches.add(&header->TimeDateStamp, &kTimestamp,
+                        header->Version == 0
+                            ? "IMPORT_OBJECT_HEADER.TimeDateStamp"
+                            : "ANON_OBJECT_HEADER.TimeDateStamp");
+    } else if (isCoffObject(data, size)) {
+        auto header = (const IMAGE_FILE_HEADER*)data;
+        if (header->TimeDateStamp != 0)
+            patches.add(&header->TimeDateStamp, &kTimestamp,
+                        "IMAGE_FILE_HEADER.TimeDateStamp");
+    }
+}
+
+void findMemberPatches(const LibraryMember& member, Patches& patches) {
+    patches.add(&member.header->Date, &kMemberDate, "Archive member date");
+
+    if (!isSpecialMember(member.header))
+        findObjectPatches(member.data, member.size, patches);
+}
+
+/**
+ * Starts reading in the member headers listed in the first linker member. For
+ * a library that isn't in the page cache, this lets the OS read the headers in
+ * any order instead of one at a time as they are walked.
+ */
+void prefetchMembers(MemMap& library, const LibraryMember& linkerMember) {
+    if (linkerMember.size < 4) return;
+
+    const uint8_t* p = linkerMember.data;
+
+    // Unlike everything else, the first linker member is big-endian.
+    auto readBE32 = [](const uint8_t* p) -> uint32_t {
+        return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    };
+
+    const size_t count = readBE32(p);
+    if (count > (linkerMember.size - 4) / 4) return;
+
+    std::vector<uint32_t> offsets(count);
+    for (size_t i = 0; i < count; ++i) offsets[i] = readBE32(p + 4 + i * 4);
+
+    std::sort(offsets.begin(), offsets.end());
+    offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+
+    for (auto offset : offsets)
+        library.prefetch(offset, IMAGE_SIZEOF_ARCHIVE_MEMBER_HDR +
+                                     sizeof(ANON_OBJECT_HEADER));
+}
+
+/**
+ * Finds all of the members in the library. The size of each member is in its
+ * header, so this has to be done in one sequential pass.
+ */
+std::vector<LibraryMember> indexLibrary(MemMap& library) {
+    const uint8_t* buf  = (const uint8_t*)library.buf();
+    const size_t length = library.length();
+
+    if (length < IMAGE_ARCHIVE_START_SIZE ||
+        memcmp(buf, IMAGE_ARCHIVE_START, IMAGE_ARCHIVE_START_SIZE) != 0)
+        throw InvalidImage("missing archive signature");
+
+    std::vector<LibraryMember> members;
+
+    size_t offset = IMAGE_ARCHIVE_START_SIZE;
+
+    while (offset < length) {
+        if (length - offset < IMAGE_SIZEOF_ARCHIVE_MEMBER_HDR)
+            throw InvalidImage("truncated archive member header");
+
+        auto header = (const IMAGE_ARCHIVE_MEMBER_HEADER*)(buf + offset);
+
+        if (memcmp(header->EndHeader, IMAGE_ARCHIVE_END,
+                   sizeof(header->EndHeader)) != 0)
+            throw InvalidImage("invalid archive member header");
+
+        size_t size;
+        if (!parseDecimal(header->Size, sizeof(header->Size), size))
+            throw InvalidImage("invalid archive member size");
+
+        offset += IMAGE_SIZEOF_ARCHIVE_MEMBER_HDR;
+
+        if (size > length - offset)
+            throw InvalidImage("archive member extends past the end of file");
+
+        LibraryMember member = {header, buf + offset, size};
+        members.push_back(member);
+
+        if (members.size() == 1 && isSpecialMember(header))
+            prefetchMembers(library, member);
+
+        // Members are aligned to 2 bytes.
+        offset += size + (size & 1);
+    }
+
+    return members;
+}
+
+template <typename CharT>
+void patchLibraryImpl(const CharT* path, const PatchOptions& options) {
+    MemMap library(path);
+
+    uint8_t* buf = (uint8_t*)library.buf();
+
+    const std::vector<LibraryMember> members = indexLibrary(library);
+
+    ThreadPool pool(options.threads);
+
+    // Members are split up into chunks that each get their own list of
+    // patches. There are a few chunks per thread to even out the load.
+    const size_t chunks    = std::min(members.size(), pool.size() * 4);
+    const size_t chunkSize =
+        chunks ? (members.size() + chunks - 1) / chunks : 0;
+
+    std::vector<Patches> patches(chunks, Patches(buf));
+
+    for (size_t i = 0; i < chunks; ++i) {
+        pool.run([&, i] {
+            const size_t end = std::min(members.size(), (i + 1) * chunkSize);
+            for (size_t j = i * chunkSize; j < end; ++j)
+                findMemberPatches(members[j], patches[i]);
+        });
+    }
+
+    pool.wait();
+
+    // The chunks are in file order, so the patches are too.
+    for (auto&& p : patches) p.apply(options.dryrun);
+}
+
+template <typename CharT>
+void patchObjectImpl(const CharT* path, const PatchOptions& options) {
+    MemMap object(path);
+
+    uint8_t* buf = (uint8_t*)object.buf();
+
+    Patches patches(buf);
+    findObjectPatches(buf, object.length(), patches);
+
+    patches.apply(options.dryrun);
+}
+
+template <typename CharT>
+bool isLibraryImpl(const CharT* path) {
+    auto f = openFile(path, FileMode<CharT>::readExisting);
+
+    char magic[IMAGE_ARCHIVE_START_SIZE];
+    if (fread(magic, 1, sizeof(magic), f.get()) != sizeof(magic)) return false;
+
+    return memcmp(magic, IMAGE_ARCHIVE_START, sizeof(magic)) == 0;
+}
+
+template <typename CharT>
+bool isObjectImpl(const CharT* path) {
+    auto f = openFile(path, FileMode<CharT>::readExisting);
+
+    if (fseek(f.get(), 0, SEEK_END) != 0) return false;
+    const long size = ftell(f.get());
+    if (size < 0 || fseek(f.get(), 0, SEEK_SET) != 0) return false;
+
+    std::vector<uint8_t> headers(sizeof(IMAGE_FILE_HEADER));
+    if (fread(headers.data(), 1, headers.size(), f.get()) != headers.size())
+        return false;
+
+    if (isAnonObject(headers.data(), headers.size())) return true;
+
+    // The section table is needed to check that the sections are inside the
+    // file.
+    const uint64_t headersSize =
+        coffHeadersSize((const IMAGE_FILE_HEADER*)headers.data());
+    if (headersSize > (uint64_t)size) return false;
+
+    headers.resize((size_t)headersSize);
+    const size_t rest = headers.size() - sizeof(IMAGE_FILE_HEADER);
+    if (fread(headers.data() + sizeof(IMAGE_FILE_HEADER), 1, rest, f.get()) !=
+        rest)
+        return false;
+
+    return isCoffObject(headers.data(), (size_t)size);
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+bool isLibrary(const wchar_t* path) { return isLibraryImpl(path); }
+
+void patchLibrary(const wchar_t* path, const PatchOptions& options) {
+    patchLibraryImpl(path, options);
+}
+
+bool isObject(const wchar_t* path) { return isObjectImpl(path); }
+
+void patchObject(const wchar_t* path, const PatchOptions& options) {
+    patchObjectImpl(path, options);
+}
+
+#else
+
+bool isLibrary(const char* path) { return isLibraryImpl(path); }
+
+void patchLibrary(const char* path, const PatchOptions& options) {
+    patchLibraryImpl(path, options);
+}
+
+bool isObject(const char* path) { return isObjectImpl(path); }
+
+void patchObject(const char* path, const PatchOptions& options) {
+    patchObjectImpl(path, options);
+}
+
+#endif
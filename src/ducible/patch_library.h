@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "ducible/patch_options.h"
+
+/**
+ * Returns true if the file is an ar archive, such as a static or import
+ * library (.lib).
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+bool isLibrary(const wchar_t* path);
+
+#else
+
+bool isLibrary(const char* path);
+
+#endif
+
+/**
+ * Patches the timestamps in a library. This includes the date in each member's
+ * header and the timestamp in each COFF object or import description.
+ *
+ * The library is patched in place. Since no member changes size, the symbol
+ * index at the start of the library stays valid as it is. Members are indexed
+ * in a single pass and then examined in parallel.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void patchLibrary(const wchar_t* path,
+                  const PatchOptions& options = PatchOptions());
+
+#else
+
+void patchLibrary(const char* path,
+                  const PatchOptions& options = PatchOptions());
+
+#endif
+
+/**
+ * Returns true if the file looks like a COFF object (.obj).
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+bool isObject(const wchar_t* path);
+
+#else
+
+bool isObject(const char* path);
+
+#endif
+
+/**
+ * Patches the timestamp in a COFF object.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void patchObject(const wchar_t* path,
+                 const PatchOptions& options = PatchOptions());
+
+#else
+
+void patchObject(const char* path,
+                 const PatchOptions& options = PatchOptions());
+
+#endif
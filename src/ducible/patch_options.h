@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <functional>
+
+class Arena;
+class OutputBatch;
+
+/**
+ * Options that control how an image and its PDB are patched.
+ */
+struct PatchOptions {
+    // If true, nothing is modified. Only what would have been patched is
+    // printed.
+    bool dryrun;
+
+    // If true, the PDB is patched even if its signature doesn't match the
+    // image.
+    bool force;
+
+    // Arena for PDB stream buffers. It is reset before each PDB is rewritten,
+    // so it can be reused across many runs. If null, a temporary arena is used.
+    Arena* arena;
+
+    // If true, large PDB streams are aligned to 64 KiB boundaries in the
+    // rewritten PDB so that unchanged streams land on the same blocks across
+    // builds.
+    bool stableLayout;
+
+    // If true, private symbol information (types, module symbols, global
+    // symbols, and source file names) is removed from the PDB, leaving a
+    // public PDB for symbol servers.
+    bool stripPrivate;
+
+    // If nonzero, PDB streams larger than this many bytes are not copied into
+    // memory by passes that can process them a window at a time. Other large
+    // streams are still copied.
+    size_t maxMemory;
+
+    // Number of threads that the PDB passes and library members are patched
+    // on. If 0, one thread per CPU is used.
+    size_t threads;
+
+    // If true, the PDB is written out while it is being patched. Streams are
+    // written as soon as all passes are done with them. The PDB is then
+    // written even if it turns out to be unchanged, only to be thrown away.
+    bool pipeline;
+
+    // If true, a ".sums" sidecar with a checksum of each stream is written
+    // next to the rewritten PDB. See msf/stream_sums.h.
+    bool streamSums;
+
+    // If true, the sidecar also has a checksum of each 64 KiB block of each
+    // stream.
+    bool blockSums;
+
+    // If set, a delta from this PDB to the rewritten PDB is written next to the
+    // rewritten PDB with a ".delta" extension.
+#if defined(_WIN32) && defined(UNICODE)
+    const wchar_t* deltaBase;
+#else
+    const char* deltaBase;
+#endif
+
+    // If set, a plan of the patches is written to this path. See plan.h.
+#if defined(_WIN32) && defined(UNICODE)
+    const wchar_t* emitPlan;
+#else
+    const char* emitPlan;
+#endif
+
+    // If set, output files (the rewritten PDB, its delta and checksums, the
+    // plan, or a rewritten archive) are added to this batch instead of being
+    // committed right away. The caller must then commit the batch. Otherwise,
+    // patchImage() commits the outputs for an image and its PDB in a batch of
+    // its own.
+    OutputBatch* outputs;
+
+    // If set, called with the path of the image or the PDB right after we have
+    // written to it: once the rewritten PDB is in place, and once the image is
+    // patched. This lets the caller tell our own changes to the files apart
+    // from any that come after. Not called for a PDB left in `outputs`.
+#if defined(_WIN32) && defined(UNICODE)
+    std::function<void(const wchar_t* path)> fileWritten;
+#else
+    std::function<void(const char* path)> fileWritten;
+#endif
+
+    PatchOptions()
+        : dryrun(true),
+          force(false),
+          arena(nullptr),
+          stableLayout(false),
+          stripPrivate(false),
+          maxMemory(0),
+          threads(0),
+          pipeline(false),
+          streamSums(false),
+          blockSums(false),
+          deltaBase(nullptr),
+          emitPlan(nullptr),
+          outputs(nullptr),
+          fileWritten(nullptr) {}
+};
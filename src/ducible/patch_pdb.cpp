@@ -0,0 +1,1235 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * This file contains the logic for rewriting a PDB file so that it is
+ * deterministic.
+ *
+ * Each stream that needs patching is handled by a pass registered with the
+ * pass manager. See pass_manager.h for how passes are scheduled.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "ducible/delta.h"
+#include "ducible/layout.h"
+#include "ducible/pass_manager.h"
+#include "ducible/patch_pdb.h"
+#include "ducible/stream_pipe.h"
+
+#include "util/arena.h"
+#include "util/file.h"
+#include "util/io_policy.h"
+#include "util/output_file.h"
+#include "util/perf_counters.h"
+#include "util/thread_pool.h"
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "msf/stream.h"
+#include "msf/stream_sums.h"
+#include "msf/temp_stream.h"
+
+#include "pdb/cvinfo.h"
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+
+namespace {
+
+// Helpers for CharT generalization
+template <typename CharT>
+struct Strings {
+    static const CharT nullGuid[];
+    static const CharT deltaExtension[];
+    static const CharT sumsExtension[];
+};
+
+template <>
+const char Strings<char>::nullGuid[] = "{00000000-0000-0000-0000-000000000000}";
+template <>
+const wchar_t Strings<wchar_t>::nullGuid[] =
+    L"{00000000-0000-0000-0000-000000000000}";
+
+template <>
+const char Strings<char>::deltaExtension[] = ".delta";
+template <>
+const wchar_t Strings<wchar_t>::deltaExtension[] = L".delta";
+
+template <>
+const char Strings<char>::sumsExtension[] = ".sums";
+template <>
+const wchar_t Strings<wchar_t>::sumsExtension[] = L".sums";
+
+/**
+ * Compares the PE and PDB signatures to see if they match.
+ */
+bool matchingSignatures(const CV_INFO_PDB70& pdbInfo,
+                        const PdbStream70& pdbHeader) {
+    if (pdbInfo.Age != pdbHeader.age ||
+        memcmp(pdbInfo.Signature, pdbHeader.sig70, sizeof(pdbHeader.sig70)) !=
+            0) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Helper function for normalizing a GUID in a NULL terminated file name.
+ */
+template <typename CharT>
+void normalizeFileNameGuid(CharT* path, size_t length) {
+    static const std::regex guidRegex(
+        "\\{"
+        "[0-9a-fA-F]{8}-"
+        "[0-9a-fA-F]{4}-"
+        "[0-9a-fA-F]{4}-"
+        "[0-9a-fA-F]{4}-"
+        "[0-9a-fA-F]{12}"
+        "\\}");
+
+    std::match_results<const CharT*> match;
+
+    if (std::regex_search((const CharT*)path, (const CharT*)path + length,
+                          match, guidRegex)) {
+        memcpy(path + match.position(0), Strings<CharT>::nullGuid,
+               sizeof(Strings<CharT>::nullGuid));
+    }
+}
+
+/**
+ * Patches the "/LinkInfo" named stream.
+ */
+void patchLinkInfoStream(MsfMemoryStream* stream) {
+    uint8_t* data       = stream->data();
+    const size_t length = stream->length();
+
+    if (length == 0) return;
+
+    if (length < sizeof(LinkInfo))
+        throw InvalidPdb("got partial LinkInfo stream");
+
+    const LinkInfo* linkInfo = (LinkInfo*)data;
+
+    if (linkInfo->size > length)
+        throw InvalidPdb("LinkInfo size too large for stream");
+
+    // The rest of the stream appears to be garbage. Thus, we truncate it.
+    stream->resize(linkInfo->size);
+}
+
+/**
+ * Patches the "/names" stream.
+ */
+void patchNamesStream(MsfMemoryStream* stream) {
+    uint8_t* data    = stream->data();
+    uint8_t* dataEnd = data + stream->length();
+
+    // Parse the header
+    if (size_t(dataEnd - data) < sizeof(StringTableHeader))
+        throw InvalidPdb("missing string table header");
+
+    StringTableHeader* header = (StringTableHeader*)data;
+
+    data += sizeof(*header);
+
+    if (header->signature != kHashTableSignature)
+        throw InvalidPdb("got invalid string table signature");
+
+    if (header->version != 1 && header->version != 2)
+        throw InvalidPdb("got invalid or unsupported string table version");
+
+    if (size_t(dataEnd - data) < header->stringsSize)
+        throw InvalidPdb("got partial string table data");
+
+    data += header->stringsSize;
+
+    if (size_t(dataEnd - data) < sizeof(uint32_t))
+        throw InvalidPdb("missing string table offset array length");
+
+    // Offsets array length
+    uint32_t offsetsLength = *(uint32_t*)data;
+
+    data += sizeof(offsetsLength);
+
+    if (size_t(dataEnd - data) < offsetsLength * sizeof(uint32_t))
+        throw InvalidPdb("got partial string table offsets array");
+
+    uint32_t* offsets = (uint32_t*)data;
+
+    data += offsetsLength * sizeof(uint32_t);
+
+    // Sort the offsets. There is some non-determinism creeping in here somehow.
+    std::sort(offsets, offsets + offsetsLength);
+
+    for (size_t i = 0; i < offsetsLength; ++i) {
+        const size_t offset = offsets[i];
+
+        if (offset == 0) continue;
+
+        if (offset >= header->stringsSize)
+            throw InvalidPdb("got invalid offset into string table");
+
+        char* str  = &header->strings[offset];
+        size_t len = strlen(str);
+
+        if (offset + len + 1 > header->stringsSize)
+            throw InvalidPdb("got invalid offset into string table");
+
+        normalizeFileNameGuid(str, len);
+    }
+}
+
+/**
+ * Patches the "/src/headerblock" named stream.
+ */
+void patchSrcHeaderBlockStream(MsfMemoryStream* stream) {
+    if (stream->length() == 0) return;
+
+    if (stream->length() < sizeof(SrcHeaderBlock))
+        throw InvalidPdb("got partial source header block stream");
+
+    SrcHeaderBlock* header = (SrcHeaderBlock*)stream->data();
+
+    header->fileTime = 0;
+    header->age      = 1;
+}
+
+/**
+ * Patches an embedded source file stream.
+ *
+ * These can be arbitrarily large, so the stream is scanned a chunk at a time
+ * and only the bytes that change are patched. The only thing normalized is
+ * the GUID in the names of the linker's temporary files (e.g., for the
+ * manifest resource). Other GUIDs are left alone since they are likely to be
+ * meaningful (e.g., COM interface IDs).
+ */
+void patchSrcFileStream(PassContext& ctx) {
+    static const char prefix[]  = "lnk{";
+    static const char pattern[] = "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}";
+
+    const size_t prefixLength  = sizeof(prefix) - 1;
+    const size_t patternLength = sizeof(pattern) - 1;
+    const size_t matchLength   = prefixLength + patternLength;
+
+    // Consecutive chunks overlap so that matches straddling a chunk boundary
+    // are found.
+    const size_t chunkSize = 64 * 1024;
+    std::vector<char> chunk(chunkSize + matchLength - 1);
+
+    const size_t length = ctx.sourceLength();
+
+    PerfRegion region("guid scan", length);
+
+    for (size_t offset = 0; offset < length; offset += chunkSize) {
+        const size_t n =
+            ctx.readSource(0, offset, std::min(chunk.size(), length - offset),
+                           chunk.data());
+
+        const char* begin = chunk.data();
+        const char* end   = begin + n;
+
+        // Only matches starting in this chunk's own range are considered. The
+        // rest are found with the next chunk.
+        const char* last = begin + std::min(n, chunkSize);
+
+        for (const char* p = begin; p < last && p + matchLength <= end;) {
+            p = (const char*)memchr(p, prefix[0], last - p);
+            if (!p || p + matchLength > end) break;
+
+            if (memcmp(p, prefix, prefixLength) != 0) {
+                ++p;
+                continue;
+            }
+
+            const char* guid = p + prefixLength;
+
+            bool matched = true;
+            for (size_t i = 0; i < patternLength && matched; ++i) {
+                if (pattern[i] == 'x')
+                    matched = isxdigit((unsigned char)guid[i]) != 0;
+                else
+                    matched = guid[i] == pattern[i];
+            }
+
+            if (matched) {
+                // Skip the opening brace of the null GUID.
+                ctx.patch(0, offset + (guid - begin), patternLength,
+                          Strings<char>::nullGuid + 1);
+                p += matchLength;
+            } else {
+                p += prefixLength;
+            }
+        }
+    }
+}
+
+/**
+ * Patches the PDB header stream.
+ */
+void patchHeaderStream(MsfMemoryStream* stream, const CV_INFO_PDB70* pdbInfo,
+                       uint32_t timestamp, const uint8_t signature[16],
+                       bool force) {
+    if (stream->length() < sizeof(PdbStream70))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    PdbStream70* header = (PdbStream70*)stream->data();
+
+    if (header->version < PdbVersion::vc70)
+        throw InvalidPdb("unsupported PDB implementation version");
+
+    // Check that this PDB matches what the PE file expects. Don't do the check
+    // if `force` was specified.
+    if (!force && (!pdbInfo || !matchingSignatures(*pdbInfo, *header)))
+        throw InvalidPdb("PE and PDB signatures do not match");
+
+    // Patch the PDB header stream
+    header->timestamp = timestamp;
+    header->age       = 1;
+    memcpy(header->sig70, signature, sizeof(header->sig70));
+}
+
+/**
+ * Patches a module stream.
+ */
+void patchModuleStream(MsfMemoryStream* stream) {
+    uint8_t* data          = stream->data();
+    const uint8_t* dataEnd = stream->data() + stream->length();
+
+    if (size_t(dataEnd - data) < sizeof(uint16_t))
+        throw InvalidPdb("got partial module info stream");
+
+    uint32_t type = *(uint32_t*)data;
+    data += sizeof(type);
+
+    if (type != CV_SIGNATURE_C13) return;
+
+    if (size_t(dataEnd - data) < sizeof(SymbolRecord))
+        throw InvalidPdb("missing symbol record in module info stream");
+
+    const SymbolRecord* sym = (const SymbolRecord*)data;
+
+    // We're only concerned about objects here
+    if (sym->type != S_OBJNAME) return;
+
+    // Recast now that we know the type.
+    OBJNAMESYM* objsym = (OBJNAMESYM*)data;
+
+    // The signature always seems to be 0.
+    if (objsym->signature != 0)
+        throw InvalidPdb("got invalid OBJNAMESYM symbol record signature");
+
+    if (size_t(dataEnd - data) < objsym->reclen)
+        throw InvalidPdb("got partial OBJNAMESYM symbol record");
+
+    size_t namelen = strlen((const char*)objsym->name);
+
+    if ((uint8_t*)objsym->name + namelen + 1 > dataEnd)
+        throw InvalidPdb("object path in symbol record is not null-terminated");
+
+    normalizeFileNameGuid((char*)objsym->name, namelen);
+}
+
+const char* kIncLinkWarning =
+    "\
+Warning: /INCREMENTAL was specified in the linker options. Incremental linking \
+is known to not work with Ducible.";
+
+/**
+ * Patches the DBI stream.
+ */
+void patchDbiStream(MsfMemoryStream* stream) {
+    if (stream->length() < sizeof(DbiHeader))
+        throw InvalidPdb("DBI stream too short");
+
+    PerfRegion region("dbi", stream->length());
+
+    uint8_t* data       = stream->data();
+    const size_t length = stream->length();
+    size_t offset       = 0;
+
+    DbiHeader* dbi = (DbiHeader*)data;
+
+    // Sanity checks
+    if (dbi->signature != dbiHeaderSignature)
+        throw InvalidPdb("invalid DBI header signature");
+
+    if (dbi->version != DbiVersion::v70)
+        throw InvalidPdb("Unsupported DBI stream version");
+
+    // Display a warning about incrementally linking
+    if (dbi->flags.incLink) std::cout << kIncLinkWarning << std::endl;
+
+    // Patch the age. This must match the age in the PDB stream.
+    dbi->age = 1;
+
+    offset += sizeof(*dbi);
+
+    // The module info immediately follows the header.
+
+    // Check bounds
+    if (offset + dbi->gpModInfoSize > length)
+        throw InvalidPdb("DBI module info size exceeds stream length");
+
+    // Number of modules
+    size_t moduleCount = 0;
+
+    // Patch the module info entries
+    for (size_t i = 0; i < dbi->gpModInfoSize;) {
+        if (dbi->gpModInfoSize - i < sizeof(ModuleInfo))
+            throw InvalidPdb("got partial DBI module info");
+
+        ModuleInfo* info = (ModuleInfo*)(data + offset + i);
+
+        info->sc.padding1 = 0;
+        info->sc.padding2 = 0;
+
+        // Patch the offsets "array". This is not used directly by Microsoft's
+        // DBI implementation and may contain non-deterministic data (e.g., the
+        // memory address of the actual allocated array). Thus, we need to zero
+        // it out.
+        info->offsets = 0;
+
+        i += info->size();
+        ++moduleCount;
+    }
+
+    offset += dbi->gpModInfoSize;
+
+    // The section contributions follow the module info entries. These contain
+    // garbage due to struct alignment. They needed to be zeroed out.
+
+    if (offset + dbi->sectionContributionSize > length) {
+        throw InvalidPdb(
+            "DBI section contributions size exceeds stream length");
+    }
+
+    const SectionContribVersion scVersion =
+        *(SectionContribVersion*)(data + offset);
+    offset += sizeof(scVersion);
+
+    if (scVersion != SectionContribVersion::v1 &&
+        scVersion != SectionContribVersion::v2) {
+        throw InvalidPdb("got invalid section contribution substream version");
+    }
+
+    const size_t scCount = (dbi->sectionContributionSize - sizeof(scVersion)) /
+                           sizeof(SectionContribution);
+
+    SectionContribution* sectionContribs =
+        (SectionContribution*)(data + offset);
+
+    for (size_t i = 0; i < scCount; ++i) {
+        SectionContribution& sc = sectionContribs[i];
+        sc.padding1             = 0;
+        sc.padding2             = 0;
+    }
+
+    offset += dbi->sectionContributionSize - sizeof(scVersion);
+
+    // Skip over the section map
+    offset += dbi->sectionMapSize;
+
+    // In the list of files, there are some temporary files with random GUIDs in
+    // the name.
+    if (dbi->fileInfoSize > 0) {
+        if (offset + dbi->fileInfoSize > length)
+            throw InvalidPdb("Missing file info in DBI stream");
+
+        uint8_t* p    = data + offset;
+        uint8_t* pEnd = p + dbi->fileInfoSize;
+
+        // Skip over the header as it doesn't always provide correct
+        // information.
+        p += sizeof(FileInfoHeader);
+
+        // Skip over file indices array. We don't need them.
+        p += moduleCount * sizeof(uint16_t);
+
+        // File counts array
+        uint16_t* fileCounts = (uint16_t*)p;
+        p += moduleCount * sizeof(*fileCounts);
+
+        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
+
+        uint32_t* offsets = (uint32_t*)p;
+
+        uint32_t offsetCount = 0;
+        for (size_t i = 0; i < moduleCount; ++i) offsetCount += fileCounts[i];
+
+        p += offsetCount * sizeof(*offsets);
+
+        if (p >= pEnd) throw InvalidPdb("got partial file info in DBI stream");
+
+        char* names = (char*)p;
+
+        for (size_t i = 0; i < offsetCount; ++i) {
+            const uint32_t& off = offsets[i];
+
+            if ((uint8_t*)names + off + 1 > pEnd)
+                throw InvalidPdb("invalid offset for file info name");
+
+            char* name = names + off;
+            size_t len = strlen(name);
+
+            if ((uint8_t*)name + len + 1 > pEnd)
+                throw InvalidPdb("file name exceeds file info section size");
+
+            normalizeFileNameGuid(name, len);
+        }
+    }
+
+    // Skip past the file info
+    offset += dbi->fileInfoSize;
+
+    // Skip past the TSM substream
+    offset += dbi->typeServerMapSize;
+
+    // Skip past the EC info
+    offset += dbi->ecInfoSize;
+
+    // Skip past the debug header. This should be the last substream in the DBI
+    // stream.
+    offset += dbi->debugHeaderSize;
+}
+
+/**
+ * Zeroes out the padding in a buffer of symbol records. Returns the number of
+ * bytes that were processed. Unless `last` is true, a partial record at the end
+ * of the buffer is left for the next buffer.
+ *
+ * There is up to 3 bytes of padding at the end of each symbol record. Since
+ * garbage just lives there, it needs to be zeroed out.
+ */
+size_t scrubSymbolRecords(uint8_t* data, const size_t length, bool last) {
+    size_t i = 0;
+
+    while (i < length) {
+        if (length - i < sizeof(SymbolRecord)) {
+            if (!last) break;
+            throw InvalidPdb("got partial symbol record");
+        }
+
+        SymbolRecord* rec = (SymbolRecord*)(data + i);
+
+        // The symbol record length must be at least the size of
+        // SymbolRecord::type and the size of the entire record must be a
+        // multiple of 4.
+        if (rec->length < sizeof(rec->type) ||
+            (rec->length + sizeof(rec->length)) % 4 != 0) {
+            throw InvalidPdb("invalid symbol record size");
+        }
+
+        const size_t dataLength = rec->length - sizeof(rec->type);
+
+        // Bounds check.
+        if (i + sizeof(SymbolRecord) + dataLength > length) {
+            if (!last) break;
+            throw InvalidPdb("symbol record size too large");
+        }
+
+        // There is a maximum of 3 bytes of padding at the end of the data.
+        // Note that if the data length is < 3 and this overflows,
+        size_t tail = dataLength - 3;
+
+        // Find the null terminator at the end. The padding (if any) will be
+        // after this point.
+        while (tail + 1 < dataLength && rec->data[tail] != 0) ++tail;
+
+        // Zero out the padding.
+        while (tail < dataLength) rec->data[tail++] = 0;
+
+        // Skip to next symbol record
+        i += sizeof(SymbolRecord) + dataLength;
+    }
+
+    return i;
+}
+
+/**
+ * Patches the symbol record stream.
+ */
+void patchSymbolRecordsStream(MsfMemoryStream* stream) {
+    PerfRegion region("symbol records", stream->length());
+
+    scrubSymbolRecords(stream->data(), stream->length(), true);
+}
+
+/**
+ * Same as above, but for a symbol record stream too large to copy into memory.
+ * The stream is read one window at a time and the result is written out to a
+ * temporary file. A record that doesn't fit in what is left of a window is
+ * carried over to the start of the next one.
+ */
+void patchSymbolRecordsStream(PassContext& ctx, size_t windowSize) {
+    const size_t length = ctx.sourceLength();
+
+    PerfRegion region("symbol records", length);
+
+    auto result = std::make_shared<MsfTempStream>();
+
+    std::vector<uint8_t> window(windowSize);
+
+    for (size_t offset = 0; offset < length;) {
+        const size_t n = ctx.readSource(
+            0, offset, std::min(windowSize, length - offset), window.data());
+
+        const bool last = offset + n == length;
+
+        const size_t done = scrubSymbolRecords(window.data(), n, last);
+
+        // Windows are always larger than the largest possible record.
+        if (done == 0) throw InvalidPdb("got partial symbol record");
+
+        result->write(done, window.data());
+        offset += done;
+    }
+
+    ctx.replace(0, result);
+}
+
+/**
+ * Patch the public symbol info stream.
+ *
+ * Only the header changes, so the rest of the stream is never copied.
+ */
+void patchPublicSymbolStream(PassContext& ctx) {
+    // The public symbol info stream starts with the public symbol header
+    // followed by the (Global Symbol Info) GSI hash header. We only care about
+    // the public symbol header.
+    PublicSymbolHeader header;
+    if (ctx.readSource(0, 0, sizeof(header), &header) != sizeof(header))
+        throw InvalidPdb("public symbol stream too short");
+
+    // Struct alignment padding
+    header.padding1 = 0;
+
+    // Microsoft's PDB writer has a bug where this field is not initialized in
+    // the constructor. However, there are other code paths that do initialize
+    // this value, but only sometimes. Thus, since Microsoft's tools are already
+    // broken because of this, we zero this out without worrying about it.
+    //
+    // Since fixing this would be a trivial one-liner for Microsoft, this patch
+    // could become silently obsolete in the future.
+    header.sectionCount = 0;
+
+    ctx.patch(0, 0, sizeof(header), &header);
+}
+
+/**
+ * Returns the size of the windows to process large streams in with the given
+ * memory budget. Several passes can be running at once, so each one only gets
+ * a fraction of the budget. Windows are always larger than the largest symbol
+ * record.
+ */
+size_t windowSize(size_t maxMemory) {
+    const size_t minWindow = 256 * 1024;
+    const size_t maxWindow = 16 * 1024 * 1024;
+
+    return std::max(minWindow, std::min(maxWindow, maxMemory / 8));
+}
+
+/**
+ * Replaces a TPI or IPI stream with one that has no type records and no hash
+ * streams.
+ */
+void stripTypeStream(MsfMemoryStream* stream) {
+    // Nothing to strip.
+    if (stream->length() == 0) return;
+
+    TpiHeader header;
+    if (stream->length() < sizeof(header))
+        throw InvalidPdb("TPI stream too short");
+
+    memcpy(&header, stream->data(), sizeof(header));
+
+    if (header.headerSize != sizeof(header))
+        throw InvalidPdb("unsupported TPI stream header size");
+
+    header.typeIndexEnd       = header.typeIndexBegin;
+    header.typeRecordBytes    = 0;
+    header.hashStreamIndex    = invalidStream;
+    header.hashAuxStreamIndex = invalidStream;
+    header.hashValueBuffer    = TpiBuffer();
+    header.indexOffsetBuffer  = TpiBuffer();
+    header.hashAdjBuffer      = TpiBuffer();
+
+    stream->resize(sizeof(header));
+    memcpy(stream->data(), &header, sizeof(header));
+}
+
+/**
+ * Detaches all modules from their streams and marks the DBI stream as
+ * stripped. The object file name of each module and the file info, which lists
+ * the source files of every module, are dropped. This runs after
+ * patchDbiStream(), which checks the module info and file info.
+ */
+void stripDbiStream(MsfMemoryStream* stream) {
+    const uint8_t* data = stream->data();
+    const size_t length = stream->length();
+
+    DbiHeader dbi = *(const DbiHeader*)data;
+
+    std::vector<uint8_t> result(data, data + sizeof(dbi));
+
+    const uint8_t* modInfo = data + sizeof(dbi);
+
+    for (size_t i = 0; i < dbi.gpModInfoSize;) {
+        const ModuleInfo* info = (const ModuleInfo*)(modInfo + i);
+
+        // Keep the module name, but leave the object name empty.
+        const size_t offset     = result.size();
+        const size_t nameLength = strlen(info->moduleName());
+        result.insert(result.end(), (const uint8_t*)info,
+                      (const uint8_t*)info->names + nameLength + 1);
+        result.resize((result.size() + 1 + 3) & -4);
+
+        ModuleInfo* stripped   = (ModuleInfo*)(result.data() + offset);
+        stripped->stream       = invalidStream;
+        stripped->symbolsSize  = 0;
+        stripped->linesSize    = 0;
+        stripped->c13LinesSize = 0;
+        stripped->fileCount    = 0;
+
+        i += info->size();
+    }
+
+    // Section contributions and the section map are kept as they are.
+    const size_t sectionsBegin = sizeof(dbi) + dbi.gpModInfoSize;
+    const size_t sectionsEnd =
+        sectionsBegin + dbi.sectionContributionSize + dbi.sectionMapSize;
+
+    // Everything after the file info.
+    const size_t restBegin = sectionsEnd + dbi.fileInfoSize;
+
+    if (restBegin > length) throw InvalidPdb("DBI substreams exceed stream");
+
+    dbi.gpModInfoSize  = (uint32_t)(result.size() - sizeof(dbi));
+    dbi.fileInfoSize   = 0;
+    dbi.flags.stripped = 1;
+
+    result.insert(result.end(), data + sectionsBegin, data + sectionsEnd);
+    result.insert(result.end(), data + restBegin, data + length);
+
+    memcpy(result.data(), &dbi, sizeof(dbi));
+
+    stream->resize(result.size());
+    memcpy(stream->data(), result.data(), result.size());
+}
+
+/**
+ * New offsets of the symbol records kept by stripSymbolRecords(), by their old
+ * offsets, in increasing order.
+ */
+typedef std::vector<std::pair<uint32_t, uint32_t>> SymbolOffsetMap;
+
+/**
+ * Drops everything but public symbols (S_PUB32) from the symbol record stream.
+ * The rest (global data, UDTs, constants, procedure references, etc.) name
+ * private things and refer to the type info and module streams, which are
+ * stripped as well. The stream is read a window at a time, so only the public
+ * symbols are held in memory.
+ */
+SymbolOffsetMap stripSymbolRecords(PassContext& ctx, size_t windowSize) {
+    const size_t length = ctx.sourceLength();
+
+    auto result = std::make_shared<MsfMemoryStream>(0, nullptr);
+
+    SymbolOffsetMap offsets;
+
+    std::vector<uint8_t> window(windowSize);
+
+    for (size_t offset = 0; offset < length;) {
+        const size_t n = ctx.readSource(
+            0, offset, std::min(windowSize, length - offset), window.data());
+
+        // The records were already checked by patchSymbolRecordsStream().
+        size_t i = 0;
+        while (n - i >= sizeof(SymbolRecord)) {
+            const SymbolRecord* rec = (const SymbolRecord*)(window.data() + i);
+            const size_t recLength  = sizeof(rec->length) + rec->length;
+
+            if (n - i < recLength) break;
+
+            if (rec->type == S_PUB32) {
+                offsets.push_back({(uint32_t)(offset + i),
+                                   (uint32_t)result->length()});
+                result->write(recLength, rec);
+            }
+
+            i += recLength;
+        }
+
+        // Windows are always larger than the largest possible record.
+        if (i == 0) throw InvalidPdb("got partial symbol record");
+
+        offset += i;
+    }
+
+    ctx.replace(0, result);
+
+    return offsets;
+}
+
+/**
+ * Returns the new offset of a public symbol record.
+ */
+uint32_t strippedSymbolOffset(const SymbolOffsetMap& offsets,
+                              uint32_t offset) {
+    auto it = std::lower_bound(offsets.begin(), offsets.end(),
+                               std::make_pair(offset, (uint32_t)0));
+
+    if (it == offsets.end() || it->first != offset)
+        throw InvalidPdb("public symbol refers to a non-public symbol record");
+
+    return it->second;
+}
+
+/**
+ * Points the public symbol hash table and address map at the public symbol
+ * records that are left after stripSymbolRecords(). The records keep their
+ * order, so the hash buckets stay the same.
+ */
+void stripPublicSymbolStream(MsfMemoryStream* stream,
+                             const SymbolOffsetMap& offsets) {
+    uint8_t* data       = stream->data();
+    const size_t length = stream->length();
+
+    if (length < sizeof(PublicSymbolHeader) + sizeof(GsiHashHeader))
+        throw InvalidPdb("public symbol stream too short");
+
+    const PublicSymbolHeader* header = (const PublicSymbolHeader*)data;
+
+    if (header->hashTableSize < sizeof(GsiHashHeader) ||
+        sizeof(*header) + header->hashTableSize + header->addrMapSize >
+            length) {
+        throw InvalidPdb("public symbol hash table exceeds stream length");
+    }
+
+    const GsiHashHeader* hash = (const GsiHashHeader*)(header + 1);
+
+    if (hash->signature != gsiHashSignature ||
+        hash->version != gsiHashVersion) {
+        throw InvalidPdb("unsupported public symbol hash table version");
+    }
+
+    if (sizeof(*hash) + hash->recordsSize > header->hashTableSize)
+        throw InvalidPdb("public symbol hash records exceed hash table size");
+
+    // Hash record offsets are one past the offset of the symbol record.
+    HashRecord* records = (HashRecord*)(hash + 1);
+    for (size_t i = 0; i < hash->recordsSize / sizeof(HashRecord); ++i) {
+        records[i].offset =
+            strippedSymbolOffset(offsets, records[i].offset - 1) + 1;
+    }
+
+    uint32_t* addrMap =
+        (uint32_t*)(data + sizeof(*header) + header->hashTableSize);
+    for (size_t i = 0; i < header->addrMapSize / sizeof(uint32_t); ++i)
+        addrMap[i] = strippedSymbolOffset(offsets, addrMap[i]);
+}
+
+/**
+ * Replaces the global symbol stream with an empty hash table. All of the
+ * global symbols are private.
+ */
+void stripGlobalSymbolStream(PassContext& ctx) {
+    std::vector<uint8_t> buf(sizeof(GsiHashHeader) + gsiHashBitmapSize);
+
+    GsiHashHeader* hash = (GsiHashHeader*)buf.data();
+    hash->signature     = gsiHashSignature;
+    hash->version       = gsiHashVersion;
+    hash->recordsSize   = 0;
+    hash->bucketsSize   = gsiHashBitmapSize;
+
+    ctx.replace(0, std::make_shared<MsfMemoryStream>(buf.size(), buf.data()));
+}
+
+/**
+ * Rewrites a PDB, eliminating non-determinism.
+ */
+void patchPDB(MsfFile& msf, const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
+              const uint8_t signature[16], const PatchOptions& options,
+              Arena& arena,
+              const PassManager::StreamDone& streamDone = nullptr) {
+    msf.replaceStream((size_t)PdbStreamType::streamTable, nullptr);
+
+    PassManager passes(&arena);
+
+    passes.add(PdbPass("PDB header", {},
+                       {StreamId::fromIndex((size_t)PdbStreamType::header)},
+                       [&](PassContext& ctx) {
+                           patchHeaderStream(ctx.write(), pdbInfo, timestamp,
+                                             signature, options.force);
+                       }));
+
+    passes.add(PdbPass(
+        "LinkInfo", {}, {StreamId::fromName("/LinkInfo")},
+        [](PassContext& ctx) { patchLinkInfoStream(ctx.write()); }));
+
+    passes.add(PdbPass("names", {}, {StreamId::fromName("/names")},
+                       [](PassContext& ctx) { patchNamesStream(ctx.write()); }));
+
+    passes.add(PdbPass("DBI", {},
+                       {StreamId::fromIndex((size_t)PdbStreamType::dbi)},
+                       [](PassContext& ctx) { patchDbiStream(ctx.write()); }));
+
+    passes.add(PdbPass(
+        "source header block", {}, {StreamId::fromName("/src/headerblock")},
+        [](PassContext& ctx) { patchSrcHeaderBlockStream(ctx.write()); }));
+
+    // Embedded source files are never copied into memory and each one is
+    // patched independently of the others.
+    passes.add(PdbPass("source files", {},
+                       {StreamId::fromNamePrefix("/src/files/")},
+                       patchSrcFileStream));
+
+    // There is one module that contains a path with a GUID. It is often the
+    // first module info entry, but it is safer to find it by name. If private
+    // symbols are stripped, it goes away with the rest of the module streams.
+    if (!options.stripPrivate) {
+        passes.add(PdbPass(
+            "manifest module", {},
+            {StreamId::module("* Linker Generated Manifest RES *")},
+            [](PassContext& ctx) { patchModuleStream(ctx.write()); }));
+    }
+
+    // The symbol record stream can be several gigabytes. With a memory budget,
+    // it is patched a window at a time instead.
+    passes.add(PdbPass("symbol records", {}, {StreamId::symbolRecords()},
+                       [&](PassContext& ctx) {
+                           if (options.maxMemory &&
+                               ctx.sourceLength() > options.maxMemory) {
+                               patchSymbolRecordsStream(
+                                   ctx, windowSize(options.maxMemory));
+                           } else {
+                               patchSymbolRecordsStream(ctx.write());
+                           }
+                       }));
+
+    passes.add(PdbPass("public symbols", {}, {StreamId::publicSymbols()},
+                       patchPublicSymbolStream));
+
+    if (options.stripPrivate) {
+        // Leave only what is needed to resolve public symbols: type info,
+        // module symbols, global symbols, and source file names go, publics
+        // and section info stay.
+        passes.add(PdbPass("strip modules", {}, {StreamId::modules()},
+                           [](PassContext& ctx) { ctx.remove(); }));
+
+        for (auto type : {PdbStreamType::tbi, PdbStreamType::ipi}) {
+            passes.add(PdbPass(
+                "strip types", {}, {StreamId::fromIndex((size_t)type)},
+                [](PassContext& ctx) { stripTypeStream(ctx.write()); }));
+
+            passes.add(PdbPass("strip type hashes", {},
+                               {StreamId::typeHashes((size_t)type)},
+                               [](PassContext& ctx) { ctx.remove(); }));
+        }
+
+        passes.add(PdbPass(
+            "strip symbols", {},
+            {StreamId::symbolRecords(), StreamId::publicSymbols()},
+            [&](PassContext& ctx) {
+                const SymbolOffsetMap offsets =
+                    stripSymbolRecords(ctx, windowSize(options.maxMemory));
+                stripPublicSymbolStream(ctx.write(1), offsets);
+            }));
+
+        passes.add(PdbPass("strip global symbols", {},
+                           {StreamId::globalSymbols()},
+                           stripGlobalSymbolStream));
+
+        passes.add(PdbPass("strip DBI", {},
+                           {StreamId::fromIndex((size_t)PdbStreamType::dbi)},
+                           [](PassContext& ctx) {
+                               stripDbiStream(ctx.write());
+                           }));
+    }
+
+    ThreadPool pool(options.threads);
+    passes.run(msf, pool, streamDone);
+}
+
+/**
+ * Returns the layout to write the PDB out with: the streams needed to load
+ * symbols grouped together at the front.
+ */
+MsfLayout pdbLayout(MsfFile& msf, const PatchOptions& options) {
+    MsfLayout layout;
+    layout.order = debuggerStreamOrder(msf);
+    if (options.stableLayout) layout.alignment = stableStreamAlignment;
+
+    return layout;
+}
+
+/**
+ * Patches the PDB and returns the layout to write it out with: the streams
+ * needed to load symbols grouped together at the front.
+ */
+MsfLayout patchPDBLayout(MsfFile& msf, const CV_INFO_PDB70* pdbInfo,
+                         uint32_t timestamp, const uint8_t signature[16],
+                         const PatchOptions& options, Arena& arena) {
+    patchPDB(msf, pdbInfo, timestamp, signature, options, arena);
+
+    return pdbLayout(msf, options);
+}
+
+/**
+ * Patches the PDB while writing it out to `out` on another thread and returns
+ * the layout it was written with. Streams that no pass changes are written
+ * right away, and patched streams as soon as they are done, in layout order.
+ * The result is the same as writing the PDB out after patching it.
+ *
+ * The layout is decided before any pass runs. It only depends on the stream
+ * references in the PDB header and DBI stream, which the passes leave alone,
+ * except that stripping private symbols detaches the module streams. Those are
+ * removed, so they take up no space wherever they are placed.
+ */
+MsfLayout patchAndWritePDB(MsfFile& msf, FileRef out,
+                           const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
+                           const uint8_t signature[16],
+                           const PatchOptions& options, Arena& arena,
+                           MsfStreamSums* sums = nullptr) {
+    const MsfLayout layout = pdbLayout(msf, options);
+
+    StreamPipe pipe(msf.streamCount());
+    std::exception_ptr writeError;
+
+    std::thread writer([&] {
+        try {
+            msf.write(out, layout, sums,
+                      [&](size_t i) { return pipe.get(i); });
+        } catch (...) {
+            writeError = std::current_exception();
+        }
+    });
+
+    try {
+        patchPDB(msf, pdbInfo, timestamp, signature, options, arena,
+                 [&](size_t i, MsfStreamRef stream,
+                     std::shared_ptr<std::mutex> fileLock) {
+                     pipe.put(i, stream, fileLock);
+                 });
+    } catch (...) {
+        pipe.abort();
+        writer.join();
+        throw;
+    }
+
+    writer.join();
+
+    if (writeError) std::rethrow_exception(writeError);
+
+    return layout;
+}
+
+/**
+ * Returns an output file with the given contents, or null if the file already
+ * has exactly these contents. Leaving it alone keeps its modification time.
+ */
+template <typename CharT>
+std::unique_ptr<OutputFile> outputIfChanged(const CharT* path,
+                                            const std::vector<uint8_t>& data) {
+    try {
+        auto f = openFile(path, FileMode<CharT>::readExisting);
+
+        // Read one byte more than expected to catch files that are too long.
+        std::vector<uint8_t> existing(data.size() + 1);
+        const size_t n = fread(existing.data(), 1, existing.size(), f.get());
+
+        if (n == data.size() &&
+            std::equal(data.begin(), data.end(), existing.begin()))
+            return nullptr;
+    } catch (const std::system_error&) {
+        // It doesn't exist yet.
+    }
+
+    std::unique_ptr<OutputFile> output(new OutputFile(path));
+
+    if (!data.empty() &&
+        fwrite(data.data(), 1, data.size(), output->file().get()) !=
+            data.size()) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing file");
+    }
+
+    return output;
+}
+
+}  // namespace
+
+/**
+ * Patches a PDB file.
+ */
+template <typename CharT>
+bool patchPDBImpl(const CharT* pdbPath, const CV_INFO_PDB70* pdbInfo,
+                  uint32_t timestamp, const uint8_t signature[16],
+                  const PatchOptions& options) {
+    // All stream buffers are allocated from this. The previous PDB, if any, is
+    // done with it by now.
+    Arena tmpArena;
+    Arena& arena = options.arena ? *options.arena : tmpArena;
+    arena.reset();
+
+    // The new PDB only replaces the old one once it is completely written.
+    std::unique_ptr<OutputFile> output;
+    std::unique_ptr<OutputFile> delta;
+    std::unique_ptr<OutputFile> sumsOutput;
+
+    {
+        auto pdb = openFile(pdbPath, FileMode<CharT>::readExisting);
+
+        MsfFile msf(pdb);
+
+        std::unique_ptr<MsfStreamSums> sums;
+        if (options.streamSums)
+            sums.reset(new MsfStreamSums(options.blockSums));
+
+        // If the PDB would come out the same, it is left alone so that its
+        // modification time doesn't change. Build systems can then skip
+        // whatever depends on it.
+        FileRef target = pdb;
+        MsfLayout layout;
+
+        if (options.pipeline) {
+            output.reset(new OutputFile(pdbPath));
+            layout = patchAndWritePDB(msf, output->file(), pdbInfo, timestamp,
+                                      signature, options, arena, sums.get());
+
+            // The sums are of what was written, which is the same either way.
+            if (msf.isUnchanged(layout)) {
+                output->discard();
+                output.reset();
+            } else {
+                target = output->file();
+            }
+        } else {
+            layout = patchPDBLayout(msf, pdbInfo, timestamp, signature,
+                                    options, arena);
+
+            if (!msf.isUnchanged(layout)) {
+                output.reset(new OutputFile(pdbPath));
+                msf.write(output->file(), layout, sums.get());
+                target = output->file();
+            } else if (sums) {
+                // Nothing was written, so the checksums have to be computed
+                // from the streams as they are.
+                sums->setStreamCount(msf.streamCount());
+                for (size_t i = 0; i < msf.streamCount(); ++i) {
+                    if (auto stream = msf.getStream(i))
+                        sums->update(i, stream.get());
+                }
+            }
+        }
+
+        if (sums) {
+            std::basic_string<CharT> sumsPath(pdbPath);
+            sumsPath += Strings<CharT>::sumsExtension;
+
+            sumsOutput = outputIfChanged(sumsPath.c_str(), sums->serialize());
+        }
+
+        if (options.deltaBase) {
+            std::basic_string<CharT> deltaPath(pdbPath);
+            deltaPath += Strings<CharT>::deltaExtension;
+
+            delta.reset(new OutputFile(deltaPath.c_str()));
+
+            auto base = openFile(options.deltaBase,
+                                 FileMode<CharT>::readExisting);
+
+            writeDelta(base, msf, target, layout, delta->file());
+
+            doneWithFile(base.get());
+        }
+
+        doneWithFile(pdb.get());
+    }
+
+    const bool changed = output != nullptr;
+
+    if (options.dryrun) {
+        if (output) output->discard();
+        if (delta) delta->discard();
+        if (sumsOutput) sumsOutput->discard();
+    } else if (options.outputs) {
+        if (output) options.outputs->add(std::move(output));
+        if (delta) options.outputs->add(std::move(delta));
+        if (sumsOutput) options.outputs->add(std::move(sumsOutput));
+    } else {
+        if (output) output->commit();
+        if (delta) delta->commit();
+        if (sumsOutput) sumsOutput->commit();
+    }
+
+    return changed;
+}
+
+#if defined(_WIN32) && defined(UNICODE)
+
+bool patchPDB(const wchar_t* pdbPath, const CV_INFO_PDB70* pdbInfo,
+              uint32_t timestamp, const uint8_t signature[16],
+              const PatchOptions& options) {
+    return patchPDBImpl(pdbPath, pdbInfo, timestamp, signature, options);
+}
+
+#else
+
+bool patchPDB(const char* pdbPath, const CV_INFO_PDB70* pdbInfo,
+              uint32_t timestamp, const uint8_t signature[16],
+              const PatchOptions& options) {
+    return patchPDBImpl(pdbPath, pdbInfo, timestamp, signature, options);
+}
+
+#endif
+
+void patchPDB(FileRef in, FileRef out, const CV_INFO_PDB70* pdbInfo,
+              uint32_t timestamp, const uint8_t signature[16],
+              const PatchOptions& options) {
+    Arena tmpArena;
+    Arena& arena = options.arena ? *options.arena : tmpArena;
+    arena.reset();
+
+    MsfFile msf(in);
+
+    if (options.pipeline) {
+        patchAndWritePDB(msf, out, pdbInfo, timestamp, signature, options,
+                         arena);
+    } else {
+        msf.write(out, patchPDBLayout(msf, pdbInfo, timestamp, signature,
+                                      options, arena));
+    }
+}
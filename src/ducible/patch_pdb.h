@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "ducible/patch_options.h"
+
+#include "pe/format.h"
+
+#include "util/file.h"
+
+/**
+ * Patches the given PDB to eliminate the non-deterministic parts of the file.
+ *
+ * Params:
+ *   pdbPath   = Path to the PDB file.
+ *   pdbInfo   = CodeView info from the image. Used to check that the PDB
+ *               matches the image. May be null.
+ *   timestamp = New timestamp for the PDB header.
+ *   signature = New signature for the PDB header.
+ *   options   = Patching options.
+ *
+ * Returns true if the PDB was changed. If it would come out exactly the same,
+ * it is left untouched, so its modification time doesn't change either.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+bool patchPDB(const wchar_t* pdbPath, const CV_INFO_PDB70* pdbInfo,
+              uint32_t timestamp, const uint8_t signature[16],
+              const PatchOptions& options);
+
+#else
+
+bool patchPDB(const char* pdbPath, const CV_INFO_PDB70* pdbInfo,
+              uint32_t timestamp, const uint8_t signature[16],
+              const PatchOptions& options);
+
+#endif
+
+/**
+ * Same as above, but reads the PDB from one file and writes the rewritten PDB
+ * to another. Neither file is committed or replaced; that is up to the caller.
+ */
+void patchPDB(FileRef in, FileRef out, const CV_INFO_PDB70* pdbInfo,
+              uint32_t timestamp, const uint8_t signature[16],
+              const PatchOptions& options);
@@ -30,6 +30,8 @@ void Patches::add(Patch patch) { patches.push_back(patch); }
 
 void Patches::sort() { std::sort(patches.begin(), patches.end()); }
 
-void Patches::apply(bool dryRun) {
-    for (auto&& patch : patches) patch.apply(_buf, dryRun);
+bool Patches::apply(bool dryRun) {
+    bool changed = false;
+    for (auto&& patch : patches) changed |= patch.apply(_buf, dryRun);
+    return changed;
 }
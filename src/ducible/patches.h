@@ -58,7 +58,7 @@ class Patches {
     void sort();
 
     /**
-     * Applies the patches.
+     * Applies the patches. Returns true if any of them changed anything.
      */
-    void apply(bool dryRun = false);
+    bool apply(bool dryRun = false);
 };
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/plan.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#include "ducible/patch_ilk.h"
+#include "ducible/patch_pdb.h"
+
+#include "msf/format.h"
+#include "msf/msf.h"
+#include "msf/stream.h"
+
+#include "pdb/format.h"
+
+#include "util/md5.h"
+#include "util/memmap.h"
+
+namespace {
+
+struct PlanEntry {
+    PlanPatch patch;
+    std::string name;
+    const uint8_t* original;
+    const uint8_t* data;
+};
+
+void append(std::vector<uint8_t>& buf, const void* data, size_t length) {
+    if (length == 0) return;
+
+    const uint8_t* p = (const uint8_t*)data;
+    buf.insert(buf.end(), p, p + length);
+}
+
+/**
+ * Reads in the whole plan and checks its digest.
+ */
+std::vector<uint8_t> readPlan(FileRef f) {
+    std::vector<uint8_t> buf;
+
+    uint8_t chunk[4096];
+    while (size_t n = fread(chunk, 1, sizeof(chunk), f.get()))
+        append(buf, chunk, n);
+
+    if (ferror(f.get())) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed reading plan");
+    }
+
+    if (buf.size() < sizeof(PlanHeader) + 16)
+        throw InvalidPlan("plan is truncated");
+
+    if (memcmp(buf.data(), planMagic, sizeof(planMagic)) != 0)
+        throw InvalidPlan("not a patch plan");
+
+    uint8_t digest[16];
+
+    md5_context ctx;
+    md5_starts(&ctx);
+    md5_update(&ctx, buf.data(), buf.size() - sizeof(digest));
+    md5_finish(&ctx, digest);
+
+    if (memcmp(digest, buf.data() + buf.size() - sizeof(digest),
+               sizeof(digest)) != 0)
+        throw InvalidPlan("plan is corrupt");
+
+    buf.resize(buf.size() - sizeof(digest));
+
+    return buf;
+}
+
+/**
+ * Parses the patches that follow the header.
+ */
+std::vector<PlanEntry> planEntries(const std::vector<uint8_t>& buf) {
+    const PlanHeader* header = (const PlanHeader*)buf.data();
+
+    const uint8_t* p   = buf.data() + sizeof(PlanHeader);
+    const uint8_t* end = buf.data() + buf.size();
+
+    std::vector<PlanEntry> entries;
+
+    for (uint32_t i = 0; i < header->patchCount; ++i) {
+        PlanEntry entry;
+
+        if (size_t(end - p) < sizeof(PlanPatch))
+            throw InvalidPlan("plan is truncated");
+
+        memcpy(&entry.patch, p, sizeof(PlanPatch));
+        p += sizeof(PlanPatch);
+
+        const size_t length = entry.patch.length;
+        if (size_t(end - p) < entry.patch.nameLength + 2 * length)
+            throw InvalidPlan("plan is truncated");
+
+        entry.name.assign((const char*)p, entry.patch.nameLength);
+        p += entry.patch.nameLength;
+
+        entry.original = p;
+        entry.data     = p + length;
+        p += 2 * length;
+
+        if (entry.patch.offset > header->imageLength ||
+            length > header->imageLength - entry.patch.offset)
+            throw InvalidPlan("patch is out of bounds");
+
+        entries.push_back(entry);
+    }
+
+    if (p != end) throw InvalidPlan("unexpected data at the end of the plan");
+
+    return entries;
+}
+
+template <typename CharT>
+bool isPdb(const CharT* path) {
+    auto f = openFile(path, FileMode<CharT>::readExisting);
+
+    char magic[sizeof(kMsfHeaderMagic)];
+    if (fread(magic, 1, sizeof(magic), f.get()) != sizeof(magic)) return false;
+
+    return memcmp(magic, kMsfHeaderMagic, sizeof(magic)) == 0;
+}
+
+/**
+ * Returns true if the plan was already applied to the PDB. The PDB then has
+ * the new signature instead of the one recorded in the plan.
+ */
+template <typename CharT>
+bool isPdbPatched(const CharT* pdbPath, const PlanHeader& header) {
+    MsfFile msf(openFile(pdbPath, FileMode<CharT>::readExisting));
+
+    auto stream = msf.getStream((size_t)PdbStreamType::header);
+
+    PdbStream70 pdb;
+    if (!stream || stream->read(sizeof(pdb), &pdb) != sizeof(pdb))
+        return false;
+
+    // Patched PDBs always have an age of 1.
+    return pdb.age == 1 &&
+           memcmp(pdb.sig70, header.signature, sizeof(pdb.sig70)) == 0;
+}
+
+template <typename CharT>
+void applyPlanToImage(const PlanHeader& header,
+                      const std::vector<PlanEntry>& entries,
+                      const CharT* imagePath, const PatchOptions& options) {
+    MemMap image(imagePath);
+
+    uint8_t* buf = (uint8_t*)image.buf();
+
+    if (image.length() != header.imageLength)
+        throw InvalidPlan("image size doesn't match the plan");
+
+    Patches patches(buf);
+
+    for (auto&& entry : entries) {
+        const uint8_t* p    = buf + entry.patch.offset;
+        const size_t length = entry.patch.length;
+
+        // It's fine if the plan was already applied.
+        if (memcmp(p, entry.original, length) != 0 &&
+            memcmp(p, entry.data, length) != 0)
+            throw InvalidPlan("image doesn't match the plan");
+
+        patches.add(Patch(entry.patch.offset, length, entry.data,
+                          entry.name.c_str()));
+    }
+
+    if (header.flags & planHasPdbInfo) {
+        patchIlk(imagePath, header.pdbSignature, header.signature,
+                 options.dryrun);
+    }
+
+    patches.apply(options.dryrun);
+}
+
+template <typename CharT>
+void applyPlanImpl(const CharT* planPath, const CharT* path,
+                   const PatchOptions& options) {
+    const std::vector<uint8_t> plan =
+        readPlan(openFile(planPath, FileMode<CharT>::readExisting));
+
+    const PlanHeader& header = *(const PlanHeader*)plan.data();
+
+    if (header.version != planVersion)
+        throw InvalidPlan("unsupported plan version");
+
+    const std::vector<PlanEntry> entries = planEntries(plan);
+
+    if (!isPdb(path)) {
+        applyPlanToImage(header, entries, path, options);
+        return;
+    }
+
+    CV_INFO_PDB70 pdbInfo;
+    pdbInfo.CvSignature    = CV_INFO_SIGNATURE_PDB70;
+    pdbInfo.Age            = header.pdbAge;
+    pdbInfo.PdbFileName[0] = '\0';
+    memcpy(pdbInfo.Signature, header.pdbSignature, sizeof(pdbInfo.Signature));
+
+    // Like patching an image and PDB a second time, applying a plan a second
+    // time changes nothing.
+    if (isPdbPatched(path, header)) {
+        pdbInfo.Age = 1;
+        memcpy(pdbInfo.Signature, header.signature, sizeof(pdbInfo.Signature));
+    }
+
+    patchPDB(path, (header.flags & planHasPdbInfo) ? &pdbInfo : nullptr,
+             header.timestamp, header.signature, options);
+}
+
+}  // namespace
+
+void writePlan(FileRef out, const uint8_t* image, size_t length,
+               const std::vector<Patch>& patches,
+               const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
+               const uint8_t signature[16]) {
+    if (length > UINT32_MAX) throw InvalidPlan("image is too large");
+
+    PlanHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, planMagic, sizeof(planMagic));
+    header.version     = planVersion;
+    header.imageLength = (uint32_t)length;
+    header.timestamp   = timestamp;
+    header.patchCount  = (uint32_t)patches.size();
+    memcpy(header.signature, signature, sizeof(header.signature));
+
+    if (pdbInfo) {
+        header.flags |= planHasPdbInfo;
+        memcpy(header.pdbSignature, pdbInfo->Signature,
+               sizeof(header.pdbSignature));
+        header.pdbAge = pdbInfo->Age;
+    }
+
+    std::vector<uint8_t> buf;
+    append(buf, &header, sizeof(header));
+
+    for (auto&& patch : patches) {
+        PlanPatch p;
+        p.offset     = (uint32_t)patch.offset;
+        p.length     = (uint32_t)patch.length;
+        p.nameLength = patch.name ? (uint32_t)strlen(patch.name) : 0;
+
+        append(buf, &p, sizeof(p));
+        append(buf, patch.name, p.nameLength);
+        append(buf, image + patch.offset, patch.length);
+        append(buf, patch.data, patch.length);
+    }
+
+    uint8_t digest[16];
+
+    md5_context ctx;
+    md5_starts(&ctx);
+    md5_update(&ctx, buf.data(), buf.size());
+    md5_finish(&ctx, digest);
+
+    append(buf, digest, sizeof(digest));
+
+    if (fwrite(buf.data(), 1, buf.size(), out.get()) != buf.size()) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing plan");
+    }
+}
+
+#if defined(_WIN32) && defined(UNICODE)
+
+void applyPlan(const wchar_t* planPath, const wchar_t* path,
+               const PatchOptions& options) {
+    applyPlanImpl(planPath, path, options);
+}
+
+#else
+
+void applyPlan(const char* planPath, const char* path,
+               const PatchOptions& options) {
+    applyPlanImpl(planPath, path, options);
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Patch plans.
+ *
+ * A plan records what patching an image does: the patches to the image and
+ * the values that its PDB gets patched with. The image only has to be read and
+ * hashed once, where the plan is made. The plan can then be applied to the
+ * image, or to its PDB, on another machine. Applying a plan takes time in
+ * proportion to the number of patches for the image. The PDB is still rewritten
+ * as usual.
+ *
+ * Before an image is patched, the bytes under each patch are checked against
+ * the bytes recorded in the plan (or the patched bytes, if the plan was
+ * already applied). The whole plan is covered by an MD5 digest.
+ *
+ * File format (all integers are little-endian):
+ *
+ *   PlanHeader
+ *   patchCount patches, each:
+ *     PlanPatch
+ *     char name[nameLength]
+ *     uint8_t original[length]
+ *     uint8_t data[length]
+ *   uint8_t digest[16]               (MD5 of everything before it)
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "ducible/patch_options.h"
+#include "ducible/patches.h"
+
+#include "pe/format.h"
+
+#include "util/file.h"
+
+const char planMagic[8]   = {'D', 'U', 'C', 'I', 'P', 'L', 'A', 'N'};
+const uint32_t planVersion = 1;
+
+enum PlanFlags : uint32_t {
+    // The image has CodeView info, so the PDB can be checked against it.
+    planHasPdbInfo = 1,
+};
+
+struct PlanHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+
+    // Length of the image. Images can't be larger than 4 GiB.
+    uint32_t imageLength;
+
+    // The image's CodeView info before it was patched.
+    uint8_t pdbSignature[16];
+    uint32_t pdbAge;
+
+    // What the image and PDB are patched with.
+    uint32_t timestamp;
+    uint8_t signature[16];
+
+    uint32_t patchCount;
+};
+
+struct PlanPatch {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t nameLength;
+};
+
+/**
+ * Thrown when a plan is invalid or doesn't apply to the given file.
+ */
+class InvalidPlan {
+   private:
+    const char* _why;
+
+   public:
+    InvalidPlan(const char* why) : _why(why) {}
+
+    const char* why() const { return _why; }
+};
+
+/**
+ * Writes out a plan.
+ *
+ * Params:
+ *   out       = File to write the plan to.
+ *   image     = The image before any patches are applied.
+ *   length    = Length of the image.
+ *   patches   = The sorted patches for the image.
+ *   pdbInfo   = The image's CodeView info, if any.
+ *   timestamp = Timestamp that the image and PDB are patched with.
+ *   signature = Signature that the image and PDB are patched with.
+ */
+void writePlan(FileRef out, const uint8_t* image, size_t length,
+               const std::vector<Patch>& patches,
+               const CV_INFO_PDB70* pdbInfo, uint32_t timestamp,
+               const uint8_t signature[16]);
+
+/**
+ * Applies a plan to either an image or its PDB. Which one it is is decided by
+ * looking at the file. Applying a plan to an image also patches its .ilk file,
+ * if there is one.
+ *
+ * Throws: InvalidPlan if the plan is malformed or doesn't match the image.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void applyPlan(const wchar_t* planPath, const wchar_t* path,
+               const PatchOptions& options = PatchOptions());
+
+#else
+
+void applyPlan(const char* planPath, const char* path,
+               const PatchOptions& options = PatchOptions());
+
+#endif
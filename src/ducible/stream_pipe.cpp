@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/stream_pipe.h"
+
+#include "msf/stream.h"
+
+namespace {
+
+/**
+ * Reads another stream while holding a lock. The position is kept separately
+ * so that others can read the same stream in the meantime.
+ */
+class LockedStream : public MsfStream {
+   private:
+    MsfStreamRef _stream;
+    std::shared_ptr<std::mutex> _lock;
+    size_t _pos;
+
+   public:
+    LockedStream(MsfStreamRef stream, std::shared_ptr<std::mutex> lock)
+        : _stream(stream), _lock(lock), _pos(0) {}
+
+    size_t length() const { return _stream->length(); }
+
+    size_t getPos() const { return _pos; }
+
+    void setPos(size_t p) { _pos = p; }
+
+    size_t read(size_t length, void* buf) {
+        std::lock_guard<std::mutex> lock(*_lock);
+
+        const size_t pos = _stream->getPos();
+
+        _stream->setPos(_pos);
+        const size_t bytesRead = _stream->read(length, buf);
+        _stream->setPos(pos);
+
+        _pos += bytesRead;
+        return bytesRead;
+    }
+
+    size_t read(void* buf) { return read(length() - _pos, buf); }
+
+    size_t write(size_t length, const void* buf) {
+        // Read-only
+        (void)length;
+        (void)buf;
+        return 0;
+    }
+};
+
+}  // namespace
+
+StreamPipe::StreamPipe(size_t streamCount)
+    : _streams(streamCount), _done(streamCount, false), _aborted(false) {}
+
+void StreamPipe::put(size_t index, MsfStreamRef stream,
+                     std::shared_ptr<std::mutex> fileLock) {
+    if (stream) stream = std::make_shared<LockedStream>(stream, fileLock);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _streams[index] = stream;
+        _done[index]    = true;
+    }
+
+    _ready.notify_all();
+}
+
+MsfStreamRef StreamPipe::get(size_t index) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _ready.wait(lock, [&] { return _done[index] || _aborted; });
+
+    if (!_done[index]) throw StreamPipeAborted();
+
+    return _streams[index];
+}
+
+void StreamPipe::abort() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+    }
+
+    _ready.notify_all();
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "msf/msf.h"
+
+/**
+ * Thrown when waiting on a stream that is never going to be ready.
+ */
+class StreamPipeAborted {
+   public:
+    const char* why() const { return "stream pipe aborted"; }
+};
+
+/**
+ * Hands streams over from the passes to a thread that writes them out.
+ *
+ * The passes put each stream in as soon as they are done with it, and the
+ * writer takes them out in the order that it lays them out in the file, waiting
+ * for any that aren't done yet. Thus, streams that no pass touches are written
+ * right away, and patched streams are written while other passes are still
+ * running.
+ */
+class StreamPipe {
+   private:
+    std::mutex _mutex;
+    std::condition_variable _ready;
+
+    std::vector<MsfStreamRef> _streams;
+    std::vector<bool> _done;
+    bool _aborted;
+
+   public:
+    StreamPipe(size_t streamCount);
+
+    /**
+     * Hands over a finished stream. The stream is only ever read while holding
+     * `fileLock`, since it may read from the same file handle as the passes.
+     * See PassManager::StreamDone.
+     */
+    void put(size_t index, MsfStreamRef stream,
+             std::shared_ptr<std::mutex> fileLock);
+
+    /**
+     * Waits until the stream with the given index is done and returns it.
+     * Returns nullptr if it was removed.
+     *
+     * Throws: StreamPipeAborted if the pipe was aborted first.
+     */
+    MsfStreamRef get(size_t index);
+
+    /**
+     * Wakes up the writer if it is waiting on a stream that is never going to
+     * be handed over, such as when a pass fails.
+     */
+    void abort();
+};
@@ -0,0 +1,570 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ducible/watch.h"
+
+#include <system_error>
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "ducible/patch_image.h"
+
+#include "msf/format.h"
+#include "msf/msf.h"
+#include "msf/stream.h"
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pe/pe.h"
+
+#include "util/file.h"
+#include "util/memmap.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * How long neither file of a pair must be written to before it is patched.
+ * Linkers may close and reopen a file several times while writing it.
+ */
+const std::chrono::milliseconds kQuietPeriod(500);
+
+/**
+ * Extension of the file written next to an image once it has been patched.
+ */
+const char kSentinelExtension[] = ".ducible";
+
+/**
+ * File names are compared without regard to case since the files usually end
+ * up on Windows file systems.
+ */
+std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](char c) { return (char)tolower((unsigned char)c); });
+    return s;
+}
+
+bool hasExtension(const std::string& name, const char* ext) {
+    const size_t n = strlen(ext);
+    return name.length() > n &&
+           toLower(name.substr(name.length() - n)) == ext;
+}
+
+/**
+ * Returns the name without its extension.
+ */
+std::string stem(const std::string& name) {
+    const size_t dot = name.rfind('.');
+    if (dot == std::string::npos) return name;
+    return name.substr(0, dot);
+}
+
+/**
+ * Identifies a version of a file. If a file still has the identity it had
+ * after we patched it, then nobody else has written to it since.
+ */
+struct FileIdentity {
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    FileIdentity() : exists(false), dev(0), ino(0), size(0), mtime() {}
+
+    bool operator==(const FileIdentity& rhs) const {
+        if (!exists || !rhs.exists) return exists == rhs.exists;
+
+        return dev == rhs.dev && ino == rhs.ino && size == rhs.size &&
+               mtime.tv_sec == rhs.mtime.tv_sec &&
+               mtime.tv_nsec == rhs.mtime.tv_nsec;
+    }
+};
+
+FileIdentity identify(const std::string& path) {
+    FileIdentity id;
+
+    struct stat st;
+    if (path.empty() || stat(path.c_str(), &st) != 0) return id;
+
+    id.exists = true;
+    id.dev    = st.st_dev;
+    id.ino    = st.st_ino;
+    id.size   = st.st_size;
+    id.mtime  = st.st_mtim;
+    return id;
+}
+
+/**
+ * Returns true if the file is an MSF file. Portable PDBs (for .NET assemblies)
+ * aren't and don't need patching.
+ */
+bool isMsf(const std::string& path) {
+    try {
+        auto f = openFile(path.c_str(), FileMode<char>::readExisting);
+
+        char magic[sizeof(kMsfHeaderMagic)];
+        return fread(magic, 1, sizeof(magic), f.get()) == sizeof(magic) &&
+               memcmp(magic, kMsfHeaderMagic, sizeof(magic)) == 0;
+    } catch (const std::system_error&) {
+        return false;
+    }
+}
+
+/**
+ * Returns the CodeView record of the image, or null if it has none.
+ */
+const CV_INFO_PDB70* codeViewInfo(const PEFile& pe) {
+    switch (pe.magic()) {
+        case IMAGE_NT_OPTIONAL_HDR32_MAGIC:
+            return pe.pdbInfo(pe.optionalHeader<IMAGE_OPTIONAL_HEADER32>());
+        case IMAGE_NT_OPTIONAL_HDR64_MAGIC:
+            return pe.pdbInfo(pe.optionalHeader<IMAGE_OPTIONAL_HEADER64>());
+        default:
+            throw InvalidImage("unsupported IMAGE_NT_HEADERS.OptionalHeader");
+    }
+}
+
+/**
+ * Returns true if the image and the PDB on disk go together. That is, either
+ * the image doesn't refer to a PDB, or the PDB's signature and age are the
+ * ones in the image's CodeView record. Files that can't be read (e.g., because
+ * they are still being written) don't go together.
+ */
+bool pdbMatchesImage(const std::string& image, const std::string& pdb) {
+    try {
+        MemMapOptions mapOptions;
+        mapOptions.readOnly = true;
+
+        MemMap map(image.c_str(), 0, mapOptions);
+
+        PEFile pe((const uint8_t*)map.buf(), map.length());
+
+        const CV_INFO_PDB70* cvInfo = codeViewInfo(pe);
+        if (!cvInfo || cvInfo->CvSignature != CV_INFO_SIGNATURE_PDB70)
+            return true;
+
+        if (pdb.empty()) return false;
+
+        MsfFile msf(openFile(pdb.c_str(), FileMode<char>::readExisting));
+
+        MsfStreamRef stream = msf.getStream((size_t)PdbStreamType::header);
+
+        PdbStream70 header;
+        if (!stream || stream->read(sizeof(header), &header) != sizeof(header))
+            return false;
+
+        return header.age == cvInfo->Age &&
+               memcmp(header.sig70, cvInfo->Signature, sizeof(header.sig70)) ==
+                   0;
+    } catch (...) {
+        return false;
+    }
+}
+
+/**
+ * An image and its PDB, by the name of the image without its extension.
+ */
+struct Pair {
+    // File names as they were last seen. The PDB may not have been seen.
+    std::string image;
+    std::string pdb;
+
+    // True if either file was written to since the pair was last looked at.
+    bool pending;
+
+    // True if the file was written to since we last tried to patch the pair.
+    bool imageClosed;
+    bool pdbClosed;
+
+    // True while the pair is being patched.
+    bool busy;
+
+    Clock::time_point lastWrite;
+
+    // The files as we left them the last time we tried to patch the pair.
+    // Anything written to them after that is somebody else's doing.
+    FileIdentity patchedImage;
+    FileIdentity patchedPdb;
+
+    Pair()
+        : pending(false), imageClosed(false), pdbClosed(false), busy(false) {}
+};
+
+class Watcher {
+   private:
+    const std::string _dir;
+    PatchOptions _options;
+
+    int _fd;
+
+    // Guards the pairs and standard output.
+    std::mutex _mutex;
+    std::map<std::string, Pair> _pairs;
+
+    ThreadPool _pool;
+
+    std::string _path(const std::string& name) const {
+        return _dir + "/" + name;
+    }
+
+    void _readEvents();
+    void _changed(const std::string& name);
+    int _timeout();
+    void _startReady();
+    void _patch(const std::string& key, const std::string& image,
+                const std::string& pdb);
+    bool _patchPair(const std::string& image, const std::string& pdb,
+                    FileIdentity& imageId, FileIdentity& pdbId);
+
+   public:
+    Watcher(const char* dir, const PatchOptions& options);
+    ~Watcher();
+
+    void run();
+};
+
+Watcher::Watcher(const char* dir, const PatchOptions& options)
+    : _dir(dir), _options(options), _fd(-1) {
+    // Pairs are patched in parallel, so they can't share an arena. The other
+    // outputs are for a single image and make no sense here.
+    _options.arena       = nullptr;
+    _options.outputs     = nullptr;
+    _options.deltaBase   = nullptr;
+    _options.emitPlan    = nullptr;
+    _options.fileWritten = nullptr;
+
+    _fd = inotify_init1(IN_CLOEXEC);
+    if (_fd == -1) {
+        throw std::system_error(errno, std::system_category(),
+                                "inotify_init1() failed");
+    }
+
+    // Linkers either write files in place or write them elsewhere and move
+    // them into place.
+    if (inotify_add_watch(_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        const int err = errno;
+        close(_fd);
+        throw std::system_error(err, std::system_category(),
+                                "Failed to watch '" + _dir + "'");
+    }
+}
+
+Watcher::~Watcher() {
+    // Wait for any pairs still being patched before closing up.
+    try {
+        _pool.wait();
+    } catch (...) {
+        // Errors are already reported by each task.
+    }
+
+    close(_fd);
+}
+
+void Watcher::run() {
+    while (true) {
+        struct pollfd pfd;
+        pfd.fd     = _fd;
+        pfd.events = POLLIN;
+
+        const int n = poll(&pfd, 1, _timeout());
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::system_category(),
+                                    "poll() failed");
+        }
+
+        if (n > 0) _readEvents();
+
+        _startReady();
+    }
+}
+
+void Watcher::_readEvents() {
+    alignas(struct inotify_event) char buf[4096];
+
+    const ssize_t length = read(_fd, buf, sizeof(buf));
+    if (length == -1) {
+        if (errno == EINTR || errno == EAGAIN) return;
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to read inotify events");
+    }
+
+    for (ssize_t i = 0; i < length;) {
+        const struct inotify_event* event =
+            (const struct inotify_event*)(buf + i);
+
+        i += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_IGNORED) {
+            throw std::system_error(ENOENT, std::system_category(),
+                                    "'" + _dir + "' is no longer watched");
+        }
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::cerr << "Warning: Too many changes in '" << _dir
+                      << "'. Some files may not be patched.\n";
+            continue;
+        }
+
+        if (event->len > 0) _changed(event->name);
+    }
+}
+
+void Watcher::_changed(const std::string& name) {
+    const bool image = hasExtension(name, ".exe") || hasExtension(name, ".dll");
+    const bool pdb   = hasExtension(name, ".pdb");
+
+    if (!image && !pdb) return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Pair& pair = _pairs[toLower(stem(name))];
+
+    if (image) {
+        pair.image       = name;
+        pair.imageClosed = true;
+    } else {
+        pair.pdb       = name;
+        pair.pdbClosed = true;
+    }
+
+    pair.pending   = true;
+    pair.lastWrite = Clock::now();
+}
+
+int Watcher::_timeout() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto now = Clock::now();
+
+    int timeout = -1;
+
+    for (auto&& it : _pairs) {
+        const Pair& pair = it.second;
+
+        // A PDB on its own waits for its image.
+        if (!pair.pending || pair.image.empty()) continue;
+
+        // Pairs being patched are checked on again later.
+        int wait = (int)kQuietPeriod.count();
+        if (!pair.busy) {
+            const auto left = pair.lastWrite + kQuietPeriod - now;
+            wait = std::max(0, (int)std::chrono::duration_cast<
+                                   std::chrono::milliseconds>(left)
+                                   .count());
+        }
+
+        if (timeout == -1 || wait < timeout) timeout = wait;
+    }
+
+    return timeout;
+}
+
+void Watcher::_startReady() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto now = Clock::now();
+
+    for (auto&& it : _pairs) {
+        Pair& pair = it.second;
+
+        if (!pair.pending || pair.busy || pair.image.empty() ||
+            now - pair.lastWrite < kQuietPeriod)
+            continue;
+
+        pair.pending = false;
+
+        const std::string image = _path(pair.image);
+
+        // If the PDB wasn't written to, there may still be one from before.
+        std::string pdb =
+            _path(pair.pdb.empty() ? stem(pair.image) + ".pdb" : pair.pdb);
+
+        if (!identify(pdb).exists) pdb.clear();
+
+        // Files that are as we left them were last written by us.
+        const bool imageChanged =
+            pair.imageClosed && !(identify(image) == pair.patchedImage);
+        const bool pdbChanged =
+            pair.pdbClosed && !(identify(pdb) == pair.patchedPdb);
+
+        if (!imageChanged && !pdbChanged) {
+            pair.imageClosed = false;
+            pair.pdbClosed   = false;
+            continue;
+        }
+
+        // The linker may still be writing the other file. Unless both have
+        // been written since the last attempt, wait for the other one until
+        // the PDB on disk is the one the image refers to.
+        if (!(imageChanged && pdbChanged) && !pdbMatchesImage(image, pdb))
+            continue;
+
+        pair.busy        = true;
+        pair.imageClosed = false;
+        pair.pdbClosed   = false;
+
+        const std::string key = it.first;
+        _pool.run([this, key, image, pdb] { _patch(key, image, pdb); });
+    }
+}
+
+void Watcher::_patch(const std::string& key, const std::string& image,
+                     const std::string& pdb) {
+    const std::string sentinel = image + kSentinelExtension;
+
+    try {
+        deleteFile(sentinel.c_str());
+    } catch (const std::system_error&) {
+        // It didn't exist.
+    }
+
+    // The files as we leave them. A file that we write to is identified right
+    // after we write to it, so that the linker writing to it again later is
+    // never mistaken for our own change. The rest are as we found them. Even if
+    // patching failed, there is no point in trying again until somebody else
+    // writes to the files.
+    FileIdentity imageId = identify(image);
+    FileIdentity pdbId   = identify(pdb);
+
+    const bool ok = _patchPair(image, pdb, imageId, pdbId);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        Pair& pair        = _pairs[key];
+        pair.busy         = false;
+        pair.patchedImage = imageId;
+        pair.patchedPdb   = pdbId;
+    }
+
+    if (!ok || _options.dryrun) return;
+
+    try {
+        openFile(sentinel.c_str(), FileMode<char>::writeEmpty);
+    } catch (const std::system_error& error) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::cerr << "Error: " << error.what() << "\n";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::cout << "Patched '" << image << "'" << std::endl;
+}
+
+bool Watcher::_patchPair(const std::string& image, const std::string& pdb,
+                         FileIdentity& imageId, FileIdentity& pdbId) {
+    const char* what;
+    std::string why;
+
+    PatchOptions options = _options;
+    options.fileWritten  = [&](const char* path) {
+        if (image != path) {
+            pdbId = identify(pdb);
+            return;
+        }
+
+        // The image is patched in place. If it is a different file by now, it
+        // was replaced while we were patching the old one.
+        const FileIdentity id = identify(image);
+        if (id.dev == imageId.dev && id.ino == imageId.ino) imageId = id;
+    };
+
+    try {
+        patchImage(image.c_str(),
+                   (!pdb.empty() && isMsf(pdb)) ? pdb.c_str() : nullptr,
+                   options);
+        return true;
+    } catch (const InvalidImage& error) {
+        what = "Invalid image";
+        why  = error.why();
+    } catch (const InvalidMsf& error) {
+        what = "Invalid PDB MSF format";
+        why  = error.why();
+    } catch (const InvalidPdb& error) {
+        what = "Invalid PDB format";
+        why  = error.why();
+    } catch (const std::exception& error) {
+        what = "Failed";
+        why  = error.what();
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::cerr << "Error: " << what << " (" << why << ") patching '" << image
+              << "'\n";
+    return false;
+}
+
+}  // namespace
+
+void watchDirectory(const char* dir, const PatchOptions& options) {
+    Watcher(dir, options).run();
+}
+
+#else
+
+namespace {
+
+void notSupported() {
+    throw std::system_error(
+        std::make_error_code(std::errc::function_not_supported),
+        "Watching directories is only supported on Linux");
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+void watchDirectory(const wchar_t* dir, const PatchOptions& options) {
+    (void)dir;
+    (void)options;
+    notSupported();
+}
+
+#else
+
+void watchDirectory(const char* dir, const PatchOptions& options) {
+    (void)dir;
+    (void)options;
+    notSupported();
+}
+
+#endif
+
+#endif
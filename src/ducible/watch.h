@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "ducible/patch_options.h"
+
+/**
+ * Watches a directory and patches images and their PDBs as soon as the linker
+ * is done writing them, instead of after the build step that links them.
+ *
+ * An image (.exe or .dll) is paired with the PDB next to it that has the same
+ * name. A pair is patched once the image has been closed after writing (or
+ * moved into the directory) and neither file has been written to for a short
+ * while. Pairs are patched in parallel on a thread pool while the directory
+ * is watched for more.
+ *
+ * When a pair is done, an empty "<image>.ducible" file is written next to the
+ * image so that whatever waits on it knows it can go on. It is deleted before
+ * the pair is patched again, and it isn't written if patching fails. Changes
+ * that we make to the files ourselves don't trigger patching them again.
+ *
+ * This runs until the process is killed. Only Linux (inotify) is supported.
+ *
+ * Throws: std::system_error if the directory can't be watched.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void watchDirectory(const wchar_t* dir,
+                    const PatchOptions& options = PatchOptions());
+
+#else
+
+void watchDirectory(const char* dir,
+                    const PatchOptions& options = PatchOptions());
+
+#endif
@@ -28,10 +28,15 @@
 #include <iostream>
 
 MsfFileStream::MsfFileStream(FileRef f, size_t pageSize, size_t length,
-                             const uint32_t* pages)
-    : _f(f), _pageSize(pageSize), _pos(0), _length(length) {
-    _pages.assign(pages, pages + ::pageCount(pageSize, length));
-}
+                             std::shared_ptr<const uint32_t> pages,
+                             size_t index)
+    : _f(f),
+      _pageSize(pageSize),
+      _pos(0),
+      _length(length),
+      _pages(pages),
+      _pageCount(::pageCount(pageSize, length)),
+      _index(index) {}
 
 size_t MsfFileStream::length() const { return _length; }
 
@@ -53,16 +58,26 @@ size_t MsfFileStream::readFromPage(size_t page, size_t length, void* buf,
 size_t MsfFileStream::read(size_t length, void* buf) {
     size_t bytesRead = 0;
 
+    // Don't read past the end of the stream into the rest of the last page.
+    if (_pos >= _length) return 0;
+    length = std::min(length, _length - _pos);
+
     while (length > 0) {
         size_t i         = _pos / _pageSize;
         size_t offset    = _pos % _pageSize;
         size_t chunkSize = std::min(length, _pageSize - offset);
 
-        if (i >= _pages.size()) break;
+        if (i >= _pageCount) break;
 
-        size_t chunkRead = readFromPage(_pages[i], chunkSize, buf, offset);
+        size_t chunkRead =
+            readFromPage(_pages.get()[i], chunkSize, buf, offset);
         bytesRead += chunkRead;
 
+        if (msfTraceEnabled()) {
+            msfTrace(MsfTraceOp::read, _f.get(), _pageSize, _index, i,
+                     _pages.get()[i], offset, chunkRead);
+        }
+
         _pos += chunkRead;
 
         if (chunkRead != chunkSize) break;
@@ -22,9 +22,10 @@
 #pragma once
 
 #include <stdint.h>
-#include <vector>
+#include <memory>
 
 #include "msf/stream.h"
+#include "msf/trace.h"
 #include "util/file.h"
 
 /**
@@ -36,7 +37,9 @@ class MsfFileStream : public MsfStream {
     size_t _pageSize;
     size_t _pos;
     size_t _length;
-    std::vector<uint32_t> _pages;
+    std::shared_ptr<const uint32_t> _pages;
+    size_t _pageCount;
+    size_t _index;
 
    public:
     /**
@@ -45,10 +48,15 @@ class MsfFileStream : public MsfStream {
      *   pageSize = Length of one page, in bytes.
      *   length   = Length of the stream, in bytes.
      *   pages    = List of pages. The length of this array is calculated using
-     *              the page size and stream length.
+     *              the page size and stream length. The list is shared, not
+     *              copied. It usually points into the MSF file's page
+     *              directory.
+     *   index    = Index of the stream in the MSF file. This is only used to
+     *              attribute page accesses when tracing. See trace.h.
      */
     MsfFileStream(FileRef f, size_t pageSize, size_t length,
-                  const uint32_t* pages);
+                  std::shared_ptr<const uint32_t> pages,
+                  size_t index = kMsfTraceNoStream);
 
     /**
      * Returns the length of the stream, in bytes.
@@ -97,7 +105,12 @@ class MsfFileStream : public MsfStream {
     /**
      * Returns the pages in the stream. This is useful for diagnostic purposes.
      */
-    const std::vector<uint32_t>& pages() const { return _pages; }
+    const uint32_t* pages() const { return _pages.get(); }
+
+    /**
+     * Returns the number of pages in the stream.
+     */
+    size_t pageCount() const { return _pageCount; }
 
    private:
     /**
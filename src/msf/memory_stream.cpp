@@ -20,63 +20,103 @@
  * SOFTWARE.
  */
 
+#include <stdlib.h>
+
 #include <algorithm>
 #include <cstring>
+#include <new>
 
 #include "msf/memory_stream.h"
 
-MsfMemoryStream::MsfMemoryStream(size_t length, const void* buf) : _pos(0) {
-    _data.resize(length);
-    memcpy(_data.data(), buf, length);
+#include "util/arena.h"
+
+MsfMemoryStream::MsfMemoryStream(size_t length, const void* buf, Arena* arena)
+    : _pos(0), _length(0), _capacity(0), _data(NULL), _arena(arena) {
+    _reserve(length);
+    if (length > 0) memcpy(_data, buf, length);
+    _length = length;
 }
 
-MsfMemoryStream::MsfMemoryStream(MsfStream* stream) : _pos(0) {
+MsfMemoryStream::MsfMemoryStream(MsfStream* stream, Arena* arena)
+    : _pos(0), _length(0), _capacity(0), _data(NULL), _arena(arena) {
     const size_t length = stream->length();
 
-    _data.resize(length);
+    // No need to initialize this. It is overwritten right away.
+    _reserve(length);
 
     const size_t pos = stream->getPos();
     stream->setPos(0);
 
-    stream->read(length, _data.data());
+    _length = stream->read(length, _data);
 
     stream->setPos(pos);
 }
 
-size_t MsfMemoryStream::length() const { return _data.size(); }
+MsfMemoryStream::~MsfMemoryStream() {
+    if (!_arena) free(_data);
+}
+
+void MsfMemoryStream::_reserve(size_t capacity) {
+    if (capacity <= _capacity) return;
 
-void MsfMemoryStream::resize(size_t length) { _data.resize(length); }
+    // Grow geometrically so that many small writes don't each reallocate.
+    capacity = std::max(capacity, _capacity + _capacity / 2);
+
+    if (_arena) {
+        // The old buffer is reclaimed when the arena is reset.
+        uint8_t* data = (uint8_t*)_arena->allocate(capacity);
+        if (_length > 0) memcpy(data, _data, _length);
+        _data = data;
+    } else {
+        uint8_t* data = (uint8_t*)realloc(_data, capacity);
+        if (!data) throw std::bad_alloc();
+        _data = data;
+    }
+
+    _capacity = capacity;
+}
+
+size_t MsfMemoryStream::length() const { return _length; }
+
+void MsfMemoryStream::resize(size_t length) {
+    if (length > _length) {
+        _reserve(length);
+        memset(_data + _length, 0, length - _length);
+    }
+
+    _length = length;
+    _pos    = std::min(_pos, _length);
+}
 
 size_t MsfMemoryStream::getPos() const { return _pos; }
 
 void MsfMemoryStream::setPos(size_t pos) {
     // Don't allow setting the position past the end of the stream.
-    _pos = std::min(_data.size(), pos);
+    _pos = std::min(_length, pos);
 }
 
 size_t MsfMemoryStream::read(size_t length, void* buf) {
-    if (_pos >= _data.size()) return 0;
+    if (_pos >= _length) return 0;
 
-    size_t available = std::min(_data.size() - _pos, length);
+    size_t available = std::min(_length - _pos, length);
 
-    memcpy(buf, &_data[_pos], available);
+    memcpy(buf, _data + _pos, available);
 
     _pos += available;
 
     return available;
 }
 
-size_t MsfMemoryStream::read(void* buf) {
-    return read(_data.size() - _pos, buf);
-}
+size_t MsfMemoryStream::read(void* buf) { return read(_length - _pos, buf); }
 
 size_t MsfMemoryStream::write(size_t length, const void* buf) {
-    const size_t available = _data.size() - _pos;
-
     // Not enough room, need to grow the stream.
-    if (available < length) _data.resize(_pos + length);
+    if (_pos + length > _length) {
+        _reserve(_pos + length);
+        _length = _pos + length;
+    }
 
-    memcpy(&_data[_pos], buf, length);
+    memcpy(_data + _pos, buf, length);
 
     _pos += length;
 
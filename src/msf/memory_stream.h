@@ -22,17 +22,30 @@
 #pragma once
 
 #include <stdint.h>
-#include <vector>
 
 #include "msf/stream.h"
 
+class Arena;
+
 /**
  * Represents an MSF file stream.
+ *
+ * The data can optionally be allocated from an arena. In that case, the arena
+ * must outlive the stream.
  */
 class MsfMemoryStream : public MsfStream {
    private:
     size_t _pos;
-    std::vector<uint8_t> _data;
+    size_t _length;
+    size_t _capacity;
+    uint8_t* _data;
+    Arena* _arena;
+
+    /**
+     * Makes sure there is room for at least `capacity` bytes. The contents of
+     * the stream are preserved.
+     */
+    void _reserve(size_t capacity);
 
    public:
     /**
@@ -41,13 +54,19 @@ class MsfMemoryStream : public MsfStream {
      * Params:
      *   length = Length of the buffer, in bytes.
      *   buf    = The buffer.
+     *   arena  = Arena to allocate from. If null, the heap is used.
      */
-    MsfMemoryStream(size_t length, const void* buf);
+    MsfMemoryStream(size_t length, const void* buf, Arena* arena = nullptr);
 
     /**
      * Initialize the stream with another stream.
      */
-    MsfMemoryStream(MsfStream* stream);
+    MsfMemoryStream(MsfStream* stream, Arena* arena = nullptr);
+
+    ~MsfMemoryStream();
+
+    MsfMemoryStream(const MsfMemoryStream&) = delete;
+    MsfMemoryStream& operator=(const MsfMemoryStream&) = delete;
 
     /**
      * Returns the length of the stream, in bytes.
@@ -55,14 +74,15 @@ class MsfMemoryStream : public MsfStream {
     size_t length() const;
 
     /**
-     * Truncates the stream to the given length.
+     * Truncates the stream to the given length. If the stream grows, the new
+     * bytes are zeroed.
      */
     void resize(size_t length);
 
     /**
      * Returns a pointer to the underlying data.
      */
-    uint8_t* data() { return _data.data(); }
+    uint8_t* data() { return _data; }
 
     /**
      * Gets the current position, in bytes, in the stream.
@@ -22,21 +22,30 @@
 
 #include "msf.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <system_error>
 
 #include "util/file.h"
+#include "util/probes.h"
 
 #include "msf/file_stream.h"
 #include "msf/readonly_stream.h"
+#include "msf/stream_sums.h"
+#include "msf/trace.h"
 
 namespace {
 
 // A good page size to use when writing out the MSF.
 const size_t kPageSize = 4096;
 
+// With an aligned layout, small streams are packed in groups of this many stream
+// indices. Each group starts on a block boundary.
+const size_t kStreamsPerBlockGroup = 16;
+
 // A blank page. Used to write uninitialized pages to the MSF file.
 const uint8_t kBlankPage[kPageSize] = {0};
 
@@ -96,48 +105,115 @@ bool isFpmPage(size_t page, size_t pageSize = kPageSize) noexcept {
 }
 
 /**
- * Writes a page to the given file handle.
+ * Writes pages to the end of an MSF file.
+ *
+ * Free page map pages are skipped over with blank pages as they come up. They
+ * are never handed out to streams.
+ *
+ * If the file is null, pages are only counted. This finds out where everything
+ * would be written without writing anything.
+ *
+ * If given checksums, the data of each stream is added to them as it is
+ * written.
  */
-void writePage(FileRef f, const uint8_t* data, size_t pageSize,
-               std::vector<uint32_t>& pagesWritten, uint32_t& pageCount) {
-    if (fwrite(data, 1, pageSize, f.get()) != pageSize) {
-        throw std::system_error(errno, std::system_category(),
-                                "failed writing page");
+class PageWriter {
+   private:
+    FileRef _f;
+    uint32_t _pageCount;
+    MsfStreamSums* _sums;
+
+    void _write(const uint8_t* data, size_t stream = kMsfTraceNoStream,
+                size_t streamPage = 0) {
+        if (_f) {
+            if (fwrite(data, 1, kPageSize, _f.get()) != kPageSize) {
+                throw std::system_error(errno, std::system_category(),
+                                        "failed writing page");
+            }
+
+            if (msfTraceEnabled()) {
+                msfTrace(MsfTraceOp::write, _f.get(), kPageSize, stream,
+                         streamPage, _pageCount, 0, kPageSize);
+            }
+        }
+
+        ++_pageCount;
     }
 
-    pagesWritten.push_back(pageCount++);
-}
+   public:
+    PageWriter(FileRef f, MsfStreamSums* sums = nullptr)
+        : _f(f), _pageCount(0), _sums(sums) {}
 
-/**
- * Writes a stream to the given file handle.
- *
- * The pages that are written are appended to the given vector and the page
- * count is incremented appropriately.
- */
-void writeStream(FileRef f, MsfStreamRef stream,
-                 std::vector<uint32_t>& pagesWritten, uint32_t& pageCount) {
+    /**
+     * Number of pages written so far.
+     */
+    uint32_t pageCount() const { return _pageCount; }
+
+    /**
+     * Writes a blank page that doesn't belong to any stream.
+     */
+    void writeBlank() { _write(kBlankPage); }
+
+    /**
+     * Writes blank pages until the page count is a multiple of the given
+     * number of pages. The page numbers of the blank pages are appended to the
+     * given vector so that they can be marked as free.
+     */
+    void alignTo(size_t pages, std::vector<uint32_t>& padding) {
+        while (_pageCount % pages != 0) {
+            if (!isFpmPage(_pageCount)) padding.push_back(_pageCount);
+            _write(kBlankPage);
+        }
+    }
+
+    /**
+     * Writes a page of stream data and returns the page number it was written
+     * to. The stream index and the index of the page within the stream are
+     * only used for tracing.
+     */
+    uint32_t writeData(const uint8_t* data, size_t stream = kMsfTraceNoStream,
+                       size_t streamPage = 0) {
+        while (isFpmPage(_pageCount)) _write(kBlankPage);
+
+        const uint32_t page = _pageCount;
+        _write(data, stream, streamPage);
+        return page;
+    }
+
+    /**
+     * Writes a stream. The pages that are written are appended to the given
+     * vector.
+     */
+    void writeStream(MsfStreamRef stream, std::vector<uint32_t>& pagesWritten,
+                     size_t index = kMsfTraceNoStream);
+};
+
+void PageWriter::writeStream(MsfStreamRef stream,
+                             std::vector<uint32_t>& pagesWritten,
+                             size_t index) {
     if (!stream || stream->length() == 0) return;
 
+    if (!_f) {
+        for (size_t n = ::pageCount(kPageSize, stream->length()); n > 0; --n)
+            pagesWritten.push_back(writeData(nullptr));
+        return;
+    }
+
     uint8_t buf[kPageSize];
 
     stream->setPos(0);
 
+    size_t streamPage = 0;
+
     while (size_t bytesRead = stream->read(kPageSize, buf)) {
         assert(bytesRead <= kPageSize);
 
-        size_t leftOver = kPageSize - bytesRead;
+        if (_sums && index != kMsfTraceNoStream)
+            _sums->update(index, buf, bytesRead);
 
         // Pad the rest of the buffer with zeros
-        memset(buf + bytesRead, 0, leftOver);
+        memset(buf + bytesRead, 0, kPageSize - bytesRead);
 
-        if (isFpmPage(pageCount)) {
-            writePage(f, kBlankPage, sizeof(kBlankPage), pagesWritten,
-                      pageCount);
-            writePage(f, kBlankPage, sizeof(kBlankPage), pagesWritten,
-                      pageCount);
-        }
-
-        writePage(f, buf, sizeof(buf), pagesWritten, pageCount);
+        pagesWritten.push_back(writeData(buf, index, streamPage++));
     }
 }
 
@@ -172,12 +248,33 @@ class FreePageMap {
      */
     void setUsed(size_t page) { _data[page / 8] &= ~(1 << (page % 8)); }
 
+    /**
+     * Returns the number of pages the FPM takes up.
+     */
+    size_t pageCount(size_t pageSize = kPageSize) const {
+        return ::pageCount(pageSize, _data.size());
+    }
+
+    /**
+     * Gets the i'th page of the FPM. The unused bits of the last page are set
+     * to 1 to indicate free pages.
+     */
+    void page(size_t i, uint8_t* buf, size_t pageSize = kPageSize) const;
+
     /**
      * Writes the FPM to the MSF.
      */
     void write(FILE* f, size_t pageSize = kPageSize) const;
 };
 
+void FreePageMap::page(size_t i, uint8_t* buf, size_t pageSize) const {
+    const size_t offset = i * pageSize;
+    const size_t length = std::min(pageSize, _data.size() - offset);
+
+    memcpy(buf, _data.data() + offset, length);
+    memset(buf + length, 0xFF, pageSize - length);
+}
+
 void FreePageMap::write(FILE* f, size_t pageSize) const {
     // The FPM is spread out across the MSF at regular intervals. There are two
     // FPM pages every 4096 pages (or whatever the page size is), starting at
@@ -192,14 +289,12 @@ void FreePageMap::write(FILE* f, size_t pageSize) const {
     // file. This is due to a bug in Microsoft's PDB implementation and is
     // unlikely to be fixed in the future.
 
+    std::vector<uint8_t> buf(pageSize);
+
     // Start at the first page.
     size_t page = 1;
 
-    size_t chunks = _data.size() / pageSize;
-
-    const uint8_t* data = _data.data();
-
-    for (size_t i = 0; i < chunks; ++i) {
+    for (size_t i = 0; i < pageCount(pageSize); ++i) {
         // Seek to the FPM page
         if (fseek(f, (long)(page * pageSize), SEEK_SET) != 0) {
             throw std::system_error(errno, std::system_category(),
@@ -207,50 +302,198 @@ void FreePageMap::write(FILE* f, size_t pageSize) const {
         }
 
         // Write a page of the FPM
-        if (fwrite(data, 1, pageSize, f) != pageSize) {
-            ;
+        this->page(i, buf.data(), pageSize);
+        if (fwrite(buf.data(), 1, pageSize, f) != pageSize) {
             throw std::system_error(errno, std::system_category(),
                                     "Failed to write FPM page");
         }
 
+        if (msfTraceEnabled()) {
+            msfTrace(MsfTraceOp::write, f, pageSize, kMsfTraceNoStream, i, page,
+                     0, pageSize);
+        }
+
         page += pageSize;
-        data += pageSize;
     }
+}
 
-    // Write the remainder of the FPM and fill with 0xFF.
-    if (const size_t leftOver = _data.size() % pageSize) {
-        // Seek to the FPM page
-        if (fseek(f, (long)(page * pageSize), SEEK_SET) != 0) {
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to seek to final MSF page");
-        }
+/**
+ * Writes out the streams in the order given by the layout, followed by any
+ * remaining streams in index order. The pages of each stream are added to
+ * `streamPages` and the blank pages used to align streams to `padding`.
+ */
+void writeStreams(PageWriter& writer, size_t streamCount,
+                  const MsfStreamSource& openStream, const MsfLayout& layout,
+                  std::vector<std::vector<uint32_t>>& streamPages,
+                  std::vector<uint32_t>& padding) {
+    assert(layout.alignment % kPageSize == 0);
 
-        // Write a partial page of the FPM
-        if (fwrite(data, 1, leftOver, f) != leftOver) {
-            ;
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to write final FPM page");
-        }
+    const size_t alignmentPages = layout.alignment / kPageSize;
 
-        // Fill the rest with 1s to indicate free pages.
-        std::vector<uint8_t> ones(pageSize - leftOver, 0xFF);
-        if (fwrite(ones.data(), 1, ones.size(), f) != ones.size()) {
-            ;
-            throw std::system_error(errno, std::system_category(),
-                                    "Failed to write final FPM page");
-        }
+    std::vector<bool> written(streamCount, false);
+
+    auto writeStream = [&](size_t i) {
+        if (i >= streamCount || written[i]) return;
+
+        written[i] = true;
+
+        auto stream = openStream(i);
+
+        // Large streams always start on a boundary. Smaller streams are packed
+        // together, but every so often one starts on a boundary anyway. Thus,
+        // if a stream grows or shrinks, the streams after it only move up to
+        // the next such stream, or by whole blocks.
+        if (alignmentPages > 1 && stream && stream->length() > 0 &&
+            (stream->length() >= layout.alignment ||
+             i % kStreamsPerBlockGroup == 0))
+            writer.alignTo(alignmentPages, padding);
+
+        writer.writeStream(stream, streamPages[i], i);
+    };
+
+    for (size_t i : layout.order) writeStream(i);
+    for (size_t i = 0; i < streamCount; ++i) writeStream(i);
+}
+
+/**
+ * Builds the stream table: the stream count, the size of each stream, and then
+ * the pages of each stream. This is always in stream index order regardless of
+ * where the streams ended up in the file.
+ */
+std::vector<uint32_t> buildStreamTable(
+    size_t streamCount, const MsfStreamSource& openStream,
+    const std::vector<std::vector<uint32_t>>& streamPages) {
+    std::vector<uint32_t> streamTable;
+    streamTable.push_back((uint32_t)streamCount);
+
+    for (size_t i = 0; i < streamCount; ++i) {
+        if (auto stream = openStream(i))
+            streamTable.push_back((uint32_t)stream->length());
+        else
+            streamTable.push_back(0);
+    }
+
+    for (auto&& pages : streamPages)
+        streamTable.insert(streamTable.end(), pages.begin(), pages.end());
+
+    return streamTable;
+}
+
+/**
+ * Creates the MSF header for a file that is written out.
+ */
+MSF_HEADER makeHeader(uint32_t pageCount, size_t streamTableSize) {
+    MSF_HEADER header = {};
+    memcpy(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic));
+    header.pageSize              = kPageSize;
+    header.freePageMap           = 1;
+    header.pageCount             = pageCount;
+    header.streamTableInfo.size  = (uint32_t)streamTableSize;
+    header.streamTableInfo.index = 0;
+    return header;
+}
+
+/**
+ * Builds the free page map of a file that is written out. Only the superfluous
+ * page, the pages of the old stream table (stream 0), and padding are free.
+ */
+FreePageMap buildFreePageMap(
+    uint32_t pageCount, const std::vector<std::vector<uint32_t>>& streamPages,
+    const std::vector<uint32_t>& padding) {
+    FreePageMap fpm(pageCount);
+    fpm.setFree(3);  // The omnipresent superfluous page
+
+    // Mark stream 0 pages as free
+    if (!streamPages.empty()) {
+        for (uint32_t page : streamPages[0]) fpm.setFree(page);
+    }
+
+    for (uint32_t page : padding) fpm.setFree(page);
+
+    return fpm;
+}
+
+/**
+ * Checks that a page of an MSF file is the same as the given data. Pages that
+ * can't be read don't match.
+ */
+bool pageMatches(FILE* f, uint32_t page, const uint8_t* expected,
+                 size_t stream = kMsfTraceNoStream, size_t streamPage = 0) {
+    uint8_t buf[kPageSize];
+
+    if (fseek(f, (long)(page * kPageSize), SEEK_SET) != 0 ||
+        fread(buf, 1, kPageSize, f) != kPageSize)
+        return false;
+
+    if (msfTraceEnabled()) {
+        msfTrace(MsfTraceOp::read, f, kPageSize, stream, streamPage, page, 0,
+                 kPageSize);
+    }
+
+    return memcmp(buf, expected, kPageSize) == 0;
+}
+
+/**
+ * Checks that the pages of an MSF file hold the given stream as it would be
+ * written out.
+ */
+bool streamMatches(FILE* f, MsfStreamRef stream,
+                   const std::vector<uint32_t>& pages,
+                   size_t index = kMsfTraceNoStream) {
+    uint8_t buf[kPageSize];
+
+    stream->setPos(0);
+
+    for (size_t i = 0; i < pages.size(); ++i) {
+        const size_t bytesRead = stream->read(kPageSize, buf);
+        memset(buf + bytesRead, 0, kPageSize - bytesRead);
+
+        if (!pageMatches(f, pages[i], buf, index, i)) return false;
     }
+
+    return true;
+}
+
+/**
+ * Checks that the unused part of the last page of a stream is blank, as it
+ * would be written out.
+ */
+bool tailIsBlank(FILE* f, size_t length, const std::vector<uint32_t>& pages,
+                 size_t index) {
+    const size_t offset = length % kPageSize;
+    if (offset == 0 || pages.empty()) return true;
+
+    const size_t tailLength = kPageSize - offset;
+    uint8_t buf[kPageSize];
+
+    if (fseek(f, (long)(pages.back() * kPageSize + offset), SEEK_SET) != 0 ||
+        fread(buf, 1, tailLength, f) != tailLength)
+        return false;
+
+    if (msfTraceEnabled()) {
+        msfTrace(MsfTraceOp::read, f, kPageSize, index, pages.size() - 1,
+                 pages.back(), offset, tailLength);
+    }
+
+    return memcmp(buf, kBlankPage, tailLength) == 0;
 }
 
 }  // namespace
 
-MsfFile::MsfFile(FileRef f) {
-    MSF_HEADER header;
+MsfFile::MsfFile(FileRef f) : _f(f), _streamCount(0) {
+    DUCIBLE_PROBE(pdb_open_start);
+
+    MSF_HEADER& header = _header;
 
     // Read the header
     if (fread(&header, sizeof(header), 1, f.get()) != 1)
         throw InvalidMsf("Missing MSF header");
 
+    if (msfTraceEnabled()) {
+        msfTrace(MsfTraceOp::read, f.get(), header.pageSize, kMsfTraceNoStream,
+                 0, 0, 0, sizeof(header));
+    }
+
     // Check that this is indeed an MSF header
     if (memcmp(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic)) != 0)
         throw InvalidMsf("Invalid MSF header");
@@ -259,57 +502,72 @@ MsfFile::MsfFile(FileRef f) {
     if (header.pageSize * header.pageCount != getFileSize(f.get()))
         throw InvalidMsf("Invalid MSF file length");
 
+    _pageSize = header.pageSize;
+
     // The number of pages required to store the pages of the stream table
     // stream.
     size_t stPagesPagesCount =
         ::pageCount(header.pageSize, header.streamTableInfo.size);
 
     // Read the stream table page directory
-    std::unique_ptr<uint32_t> streamTablePagesPages(
-        new uint32_t[stPagesPagesCount]);
+    auto streamTablePagesPages =
+        std::make_shared<std::vector<uint32_t>>(stPagesPagesCount);
 
-    if (fread(streamTablePagesPages.get(), sizeof(uint32_t), stPagesPagesCount,
-              f.get()) != stPagesPagesCount) {
+    if (fread(streamTablePagesPages->data(), sizeof(uint32_t),
+              stPagesPagesCount, f.get()) != stPagesPagesCount) {
         throw InvalidMsf("Missing root MSF stream table page list");
     }
 
-    MsfFileStream streamTablePagesStream(f, header.pageSize,
-                                         stPagesPagesCount * sizeof(uint32_t),
-                                         streamTablePagesPages.get());
+    if (msfTraceEnabled()) {
+        msfTrace(MsfTraceOp::read, f.get(), header.pageSize, kMsfTraceNoStream,
+                 0, 0, sizeof(header), stPagesPagesCount * sizeof(uint32_t));
+    }
+
+    MsfFileStream streamTablePagesStream(
+        f, header.pageSize, stPagesPagesCount * sizeof(uint32_t),
+        std::shared_ptr<const uint32_t>(streamTablePagesPages,
+                                        streamTablePagesPages->data()));
 
     // Read the list of stream table pages.
-    std::vector<uint32_t> streamTablePages(stPagesPagesCount);
-    if (streamTablePagesStream.read(&streamTablePages[0]) !=
+    auto streamTablePages =
+        std::make_shared<std::vector<uint32_t>>(stPagesPagesCount);
+    if (streamTablePagesStream.read(streamTablePages->data()) !=
         stPagesPagesCount * sizeof(uint32_t)) {
         throw InvalidMsf("failed to read stream table page list");
     }
 
-    // Finally, read the stream table itself
+    // Finally, read the stream table itself. This becomes the page directory
+    // for all of the streams.
     MsfFileStream streamTableStream(
-        f, header.pageSize, header.streamTableInfo.size, &streamTablePages[0]);
-    std::vector<uint32_t> streamTable(header.streamTableInfo.size /
-                                      sizeof(uint32_t));
-    if (streamTableStream.read(&streamTable[0]) != header.streamTableInfo.size)
+        f, header.pageSize, header.streamTableInfo.size,
+        std::shared_ptr<const uint32_t>(streamTablePages,
+                                        streamTablePages->data()));
+    auto streamTable = std::make_shared<std::vector<uint32_t>>(
+        header.streamTableInfo.size / sizeof(uint32_t));
+    if (streamTable->empty() ||
+        streamTableStream.read(streamTable->data()) !=
+            header.streamTableInfo.size)
         throw InvalidMsf("failed to read stream table");
 
     // The first element in the stream table is the total number of streams.
-    const uint32_t& streamCount = streamTable[0];
+    const uint32_t streamCount = (*streamTable)[0];
+
+    // If we were given a bogus stream count, we could potentially overflow the
+    // stream table vector. Detect that here.
+    if (streamCount >= streamTable->size())
+        throw InvalidMsf("invalid stream count in stream table");
 
     // The sizes of each stream then follow.
-    const uint32_t* streamSizes = &streamTable[1];
+    const uint32_t* streamSizes = streamTable->data() + 1;
 
     // After all the sizes, there are the lists of pages for each stream. We
     // calculate the number of pages required for the stream using the stream
     // size.
-    const uint32_t* streamPages = streamSizes + streamCount;
+    uint32_t pagesIndex = 1 + streamCount;
 
-    uint32_t pagesIndex = 0;
-    for (uint32_t i = 0; i < streamCount; ++i) {
-        // If we were given a bogus stream count, we could potentially overflow
-        // the stream table vector. Detect that here.
-        if (pagesIndex >= streamTable.size())
-            throw InvalidMsf("invalid stream count in stream table");
+    _pageOffsets.resize(streamCount);
 
+    for (uint32_t i = 0; i < streamCount; ++i) {
         uint32_t size = streamSizes[i];
 
         // Microsoft's PDB implementation sometimes sets the size of a stream to
@@ -317,71 +575,98 @@ MsfFile::MsfFile(FileRef f) {
         // IDs everywhere. Instead, just set it to a length of 0.
         if (size == (uint32_t)-1) size = 0;
 
-        addStream(new MsfFileStream(f, header.pageSize, size,
-                                    streamPages + pagesIndex));
+        _pageOffsets[i] = pagesIndex;
+
+        pagesIndex += (uint32_t)::pageCount(header.pageSize, size);
 
-        pagesIndex += ::pageCount(header.pageSize, size);
+        if (pagesIndex > streamTable->size())
+            throw InvalidMsf("invalid stream count in stream table");
     }
+
+    _directory   = streamTable;
+    _streamCount = streamCount;
+
+    _streamTablePages = *streamTablePages;
+    _streamTablePagesPages.assign(
+        streamTablePagesPages->begin(),
+        streamTablePagesPages->begin() +
+            ::pageCount<size_t>(header.pageSize,
+                                stPagesPagesCount * sizeof(uint32_t)));
+
+    DUCIBLE_PROBE2(pdb_open_done, header.pageSize * header.pageCount,
+                   streamCount);
 }
 
 MsfFile::~MsfFile() {}
 
+MsfStreamRef MsfFile::_openStream(size_t index) const {
+    if (index >= _streamCount) return nullptr;
+
+    const auto it = _replaced.find(index);
+    if (it != _replaced.end()) return it->second;
+
+    uint32_t size = (*_directory)[1 + index];
+    if (size == (uint32_t)-1) size = 0;
+
+    // The handle shares ownership of the directory.
+    return std::make_shared<MsfFileStream>(
+        _f, _pageSize, size,
+        std::shared_ptr<const uint32_t>(
+            _directory, _directory->data() + _pageOffsets[index]),
+        index);
+}
+
 size_t MsfFile::addStream(MsfStream* stream) {
-    _streams.push_back(MsfStreamRef(stream));
-    return _streams.size() - 1;
+    _replaced[_streamCount] = MsfStreamRef(stream);
+    return _streamCount++;
 }
 
-MsfStreamRef MsfFile::getStream(size_t index) {
-    if (index < _streams.size()) {
-        return _streams[index];
-    }
+MsfStreamRef MsfFile::getStream(size_t index) { return _openStream(index); }
 
-    return nullptr;
+void MsfFile::replaceStream(size_t index, MsfStreamRef stream) {
+    _replaced[index] = stream;
 }
 
-void MsfFile::replaceStream(size_t index, MsfStreamRef stream) {
-    _streams[index] = stream;
+size_t MsfFile::streamCount() const { return _streamCount; }
+
+void MsfFile::setStreamCount(size_t count) {
+    _replaced.erase(_replaced.lower_bound(count), _replaced.end());
+
+    // New streams must never fall through to the page directory.
+    for (size_t i = _streamCount; i < count; ++i) _replaced[i] = nullptr;
+
+    _streamCount = count;
+}
+
+void MsfFile::write(FileRef f, const MsfLayout& layout,
+                    MsfStreamSums* sums) const {
+    write(f, layout, sums, [this](size_t i) { return _openStream(i); });
 }
 
-size_t MsfFile::streamCount() const { return _streams.size(); }
+void MsfFile::write(FileRef f, const MsfLayout& layout, MsfStreamSums* sums,
+                    const MsfStreamSource& source) const {
+    DUCIBLE_PROBE1(msf_write_start, _streamCount);
 
-void MsfFile::write(FileRef f) const {
-    uint32_t pageCount = 0;
+    if (sums) sums->setStreamCount(_streamCount);
+
+    PageWriter writer(f, sums);
 
     // Write out 4 blank pages: one for the header, two for the FPM, and one
     // superfluous blank page. We'll come back at the end and write in the
     // header and free page map. We can't do it now, because we don't have that
     // information yet.
-    for (; pageCount < 4; ++pageCount) {
-        if (fwrite(kBlankPage, 1, kPageSize, f.get()) != kPageSize) {
-            throw std::system_error(errno, std::system_category(),
-                                    "failed writing MSF preamble");
-        }
-    }
+    while (writer.pageCount() < 4) writer.writeBlank();
 
-    // Initialize the stream table.
-    std::vector<uint32_t> streamTable;
-    streamTable.push_back((uint32_t)streamCount());
-
-    for (auto&& stream : _streams) {
-        if (stream)
-            streamTable.push_back((uint32_t)stream->length());
-        else
-            streamTable.push_back(0);
-    }
+    // Note that stream 0 is special, we need to keep track of which pages it
+    // was written to so we can mark them as free later. The same goes for any
+    // padding used to align streams.
+    std::vector<std::vector<uint32_t>> streamPages(_streamCount);
+    std::vector<uint32_t> padding;
 
-    // Write out each stream and add the stream's page numbers to the stream
-    // table. Note that stream 0 is special, we need to keep track of which
-    // pages it was written to so we can mark them as free later.
-    size_t streamZeroStart = streamTable.size();
-    if (_streams.size() > 0) {
-        writeStream(f, _streams[0], streamTable, pageCount);
-    }
-    size_t streamZeroEnd = streamTable.size();
+    writeStreams(writer, _streamCount, source, layout, streamPages, padding);
 
-    for (size_t i = 1; i < _streams.size(); ++i) {
-        writeStream(f, _streams[i], streamTable, pageCount);
-    }
+    const std::vector<uint32_t> streamTable =
+        buildStreamTable(_streamCount, source, streamPages);
 
     // Write the stream table stream at the end of the file, keeping track of
     // which pages were written.
@@ -389,7 +674,7 @@ void MsfFile::write(FileRef f) const {
     MsfStreamRef streamTableStream(new MsfReadOnlyStream(
         streamTable.size() * sizeof(streamTable[0]), streamTable.data()));
 
-    writeStream(f, streamTableStream, streamTablePages, pageCount);
+    writer.writeStream(streamTableStream, streamTablePages);
 
     // Write the stream table pages, keeping track of which pages were written.
     // These pages in turn will be written after the MSF header.
@@ -397,17 +682,13 @@ void MsfFile::write(FileRef f) const {
     MsfStreamRef streamTableStreamPages(new MsfReadOnlyStream(
         streamTablePages.size() * sizeof(uint32_t), streamTablePages.data()));
 
-    writeStream(f, streamTableStreamPages, streamTablePgPg, pageCount);
+    writer.writeStream(streamTableStreamPages, streamTablePgPg);
+
+    const uint32_t pageCount = writer.pageCount();
 
     // Write the header
-    MSF_HEADER header = {};
-    memcpy(header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic));
-    header.pageSize    = kPageSize;
-    header.freePageMap = 1;
-    header.pageCount   = pageCount;
-    header.streamTableInfo.size =
-        (uint32_t)streamTable.size() * sizeof(streamTable[0]);
-    header.streamTableInfo.index = 0;
+    const MSF_HEADER header =
+        makeHeader(pageCount, streamTable.size() * sizeof(streamTable[0]));
 
     if (fseek(f.get(), 0, SEEK_SET) != 0) {
         throw std::system_error(errno, std::system_category(),
@@ -419,6 +700,11 @@ void MsfFile::write(FileRef f) const {
                                 "failed writing MSF header");
     }
 
+    if (msfTraceEnabled()) {
+        msfTrace(MsfTraceOp::write, f.get(), kPageSize, kMsfTraceNoStream, 0, 0,
+                 0, sizeof(header));
+    }
+
     // Make sure there aren't too many root stream table pages. This could only
     // happen for ridiculously large PDBs or if there is a bug in this program.
     const size_t streamTablePgPgLength =
@@ -436,15 +722,125 @@ void MsfFile::write(FileRef f) const {
                                 "failed writing MSF header");
     }
 
-    // Construct the free page map.
-    FreePageMap fpm(pageCount);
-    fpm.setFree(3);  // The omnipresent superfluous page
-
-    // Mark stream 0 pages as free
-    for (size_t i = streamZeroStart; i < streamZeroEnd; ++i) {
-        fpm.setFree(streamTable[i]);
+    if (msfTraceEnabled()) {
+        msfTrace(MsfTraceOp::write, f.get(), kPageSize, kMsfTraceNoStream, 0, 0,
+                 sizeof(header), streamTablePgPgLength);
     }
 
     // Write the free page map.
-    fpm.write(f.get());
+    buildFreePageMap(pageCount, streamPages, padding).write(f.get());
+
+    DUCIBLE_PROBE1(msf_write_done, pageCount);
+}
+
+bool MsfFile::isUnchanged(const MsfLayout& layout) const {
+    // Only a file that was written out the same way can come out the same.
+    if (_pageSize != kPageSize || _header.freePageMap != 1 ||
+        _header.streamTableInfo.index != 0)
+        return false;
+
+    // Find out where everything would be written without writing it.
+    PageWriter writer(nullptr);
+    while (writer.pageCount() < 4) writer.writeBlank();
+
+    const auto openStream = [this](size_t i) { return _openStream(i); };
+
+    std::vector<std::vector<uint32_t>> streamPages(_streamCount);
+    std::vector<uint32_t> padding;
+
+    writeStreams(writer, _streamCount, openStream, layout, streamPages,
+                 padding);
+
+    const std::vector<uint32_t> streamTable =
+        buildStreamTable(_streamCount, openStream, streamPages);
+
+    // The stream table holds the length and pages of every stream. If it is
+    // the same, then every stream would stay where it is.
+    if (streamTable != *_directory) return false;
+
+    std::vector<uint32_t> streamTablePages;
+    MsfStreamRef streamTableStream(new MsfReadOnlyStream(
+        streamTable.size() * sizeof(streamTable[0]), streamTable.data()));
+
+    writer.writeStream(streamTableStream, streamTablePages);
+
+    std::vector<uint32_t> streamTablePgPg;
+    MsfStreamRef streamTableStreamPages(new MsfReadOnlyStream(
+        streamTablePages.size() * sizeof(uint32_t), streamTablePages.data()));
+
+    writer.writeStream(streamTableStreamPages, streamTablePgPg);
+
+    const uint32_t pageCount = writer.pageCount();
+
+    if (pageCount != _header.pageCount ||
+        streamTablePages != _streamTablePages ||
+        streamTablePgPg != _streamTablePagesPages)
+        return false;
+
+    // Everything is in the same place. Now check the contents of the pages,
+    // starting with the cheapest.
+    FILE* f = _f.get();
+    uint8_t buf[kPageSize];
+
+    const MSF_HEADER header =
+        makeHeader(pageCount, streamTable.size() * sizeof(streamTable[0]));
+    const size_t streamTablePgPgLength =
+        streamTablePgPg.size() * sizeof(streamTablePgPg[0]);
+
+    if (streamTablePgPgLength > kPageSize - sizeof(header)) return false;
+
+    memset(buf, 0, kPageSize);
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), streamTablePgPg.data(),
+           streamTablePgPgLength);
+
+    if (!pageMatches(f, 0, buf)) return false;
+
+    // Only the first page of each FPM pair is written to. The rest are blank.
+    const FreePageMap fpm = buildFreePageMap(pageCount, streamPages, padding);
+
+    for (size_t page = 1; page < pageCount; page += kPageSize) {
+        const size_t i = page / kPageSize;
+        if (i < fpm.pageCount())
+            fpm.page(i, buf);
+        else
+            memset(buf, 0, kPageSize);
+
+        if (!pageMatches(f, (uint32_t)page, buf)) return false;
+
+        if (page + 1 < pageCount &&
+            !pageMatches(f, (uint32_t)page + 1, kBlankPage))
+            return false;
+    }
+
+    if (!pageMatches(f, 3, kBlankPage)) return false;
+
+    for (uint32_t page : padding) {
+        if (!pageMatches(f, page, kBlankPage)) return false;
+    }
+
+    // Streams that weren't replaced are read from the same pages of this file,
+    // so only the unused part of their last page can differ.
+    for (size_t i = 0; i < _streamCount; ++i) {
+        if (_replaced.count(i) != 0) continue;
+
+        uint32_t length = (*_directory)[1 + i];
+        if (length == (uint32_t)-1) length = 0;
+
+        if (!tailIsBlank(f, length, streamPages[i], i)) return false;
+    }
+
+    if (!streamMatches(f, streamTableStream, streamTablePages) ||
+        !streamMatches(f, streamTableStreamPages, streamTablePgPg))
+        return false;
+
+    // Streams that were replaced have to be compared in full.
+    for (auto&& it : _replaced) {
+        if (it.first >= _streamCount || !it.second) continue;
+
+        if (!streamMatches(f, it.second, streamPages[it.first], it.first))
+            return false;
+    }
+
+    return true;
 }
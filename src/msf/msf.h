@@ -23,6 +23,8 @@
 
 #include <stdint.h>
 #include <stdio.h>  // For FILE*
+#include <functional>
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -43,12 +45,78 @@ class InvalidMsf {
 };
 
 class MsfStream;
+class MsfStreamSums;
 
 typedef std::shared_ptr<MsfStream> MsfStreamRef;
 
+/**
+ * Gets the stream with the given index to write out. Returns nullptr if it
+ * doesn't exist.
+ */
+typedef std::function<MsfStreamRef(size_t)> MsfStreamSource;
+
+/**
+ * Controls where streams are placed when writing out an MSF file.
+ */
+struct MsfLayout {
+    // Streams to write first, in this order. Streams that are not in the list
+    // follow in index order.
+    std::vector<size_t> order;
+
+    // If nonzero, the file is divided into blocks of this many bytes. Streams
+    // at least one block long start on a block boundary. Smaller streams are
+    // packed together in groups that start on a block boundary. The gaps are
+    // filled with free pages. Must be a multiple of the page size.
+    //
+    // A stream that changes size then either moves the streams after it by
+    // whole blocks or only up to the end of its group. Streams that didn't
+    // change between two builds usually end up in identical blocks of the
+    // file, which helps storage that deduplicates by block.
+    size_t alignment;
+
+    MsfLayout() : alignment(0) {}
+};
+
+/**
+ * An MSF file.
+ *
+ * The page directory from the stream table is kept as one flat array shared by
+ * all of the streams read from the file. Stream objects for these are only
+ * created when asked for. Streams that are added or replaced are kept
+ * separately.
+ */
 class MsfFile {
    private:
-    std::vector<MsfStreamRef> _streams;
+    FileRef _f;
+    size_t _pageSize;
+
+    // The header as it was read from the file.
+    MSF_HEADER _header;
+
+    // The pages of the stream table and the pages that list them, as they were
+    // read from the file.
+    std::vector<uint32_t> _streamTablePages;
+    std::vector<uint32_t> _streamTablePagesPages;
+
+    // The stream table as it was read from the file: the stream count, the size
+    // of each stream, and then the pages of each stream back-to-back.
+    std::shared_ptr<const std::vector<uint32_t>> _directory;
+
+    // Index into the directory of the first page of each stream.
+    std::vector<uint32_t> _pageOffsets;
+
+    // Total number of streams, including ones that have been added.
+    size_t _streamCount;
+
+    // Streams that have been added or replaced. A null stream means it was
+    // removed.
+    std::map<size_t, MsfStreamRef> _replaced;
+
+    /**
+     * Returns the stream with the given index, creating a new handle for it if
+     * it comes from the page directory.
+     */
+    MsfStreamRef _openStream(size_t index) const;
 
    public:
     MsfFile(FileRef f);
@@ -64,6 +132,9 @@ class MsfFile {
     /**
      * Returns the stream with the given index. Returns nullptr if it doesn't
      * exist.
+     *
+     * Streams that haven't been replaced are returned as a new handle each
+     * time, each with its own position.
      */
     MsfStreamRef getStream(size_t index);
 
@@ -77,11 +148,49 @@ class MsfFile {
      */
     size_t streamCount() const;
 
+    /**
+     * Changes the number of streams. Streams past the new count are dropped.
+     * New streams start out empty.
+     */
+    void setStreamCount(size_t count);
+
     /**
      * Writes this MsfFile out to a new file. A new header, FPM, and stream
      * table will be created.
      *
+     * Streams are laid out in the file according to the given layout. Stream
+     * indices are not affected by this, only where the stream data ends up in
+     * the file.
+     *
+     * If `sums` is not null, the checksums of every stream are computed along
+     * the way.
+     *
      * Throws: MsfWriteError if the write fails.
      */
-    void write(FileRef f) const;
+    void write(FileRef f, const MsfLayout& layout = MsfLayout(),
+               MsfStreamSums* sums = nullptr) const;
+
+    /**
+     * Like write(), but gets the streams from `source` instead of from this
+     * MsfFile. Only the stream count is taken from this MsfFile.
+     *
+     * Streams are asked for in the order that they are written out, so
+     * `source` can wait until a stream is ready. Thus, a stream can be written
+     * while others are still being worked on.
+     */
+    void write(FileRef f, const MsfLayout& layout, MsfStreamSums* sums,
+               const MsfStreamSource& source) const;
+
+    /**
+     * Returns true if writing this MsfFile out with the given layout would
+     * produce exactly the file it was read from. Then, there is no need to
+     * write it at all.
+     *
+     * Streams that were not replaced are not read, since they would be copied
+     * from the same pages. Only the end of their last page is checked. Streams
+     * that were replaced are compared page by page, stopping at the first
+     * difference. The header, free page map, and stream table are checked as
+     * well. Anything that can't be read counts as a difference.
+     */
+    bool isUnchanged(const MsfLayout& layout = MsfLayout()) const;
 };
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msf/patched_stream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+MsfPatchedStream::MsfPatchedStream(MsfStreamRef base) : _base(base), _pos(0) {}
+
+void MsfPatchedStream::patch(size_t offset, size_t length, const void* data) {
+    assert(offset + length <= _base->length());
+
+    const uint8_t* p = (const uint8_t*)data;
+    _patches[offset].assign(p, p + length);
+}
+
+size_t MsfPatchedStream::length() const { return _base->length(); }
+
+size_t MsfPatchedStream::getPos() const { return _pos; }
+
+void MsfPatchedStream::setPos(size_t pos) {
+    // Don't allow setting the position past the end of the stream.
+    _pos = std::min(length(), pos);
+}
+
+size_t MsfPatchedStream::read(size_t length, void* buf) {
+    _base->setPos(_pos);
+
+    const size_t bytesRead = _base->read(length, buf);
+
+    const size_t begin = _pos;
+    const size_t end   = _pos + bytesRead;
+
+    // Since patches don't overlap, only the last patch starting at or before
+    // this range can reach into it.
+    auto it = _patches.upper_bound(begin);
+    if (it != _patches.begin()) --it;
+
+    for (; it != _patches.end() && it->first < end; ++it) {
+        const size_t patchBegin = it->first;
+        const size_t patchEnd   = patchBegin + it->second.size();
+
+        const size_t from = std::max(begin, patchBegin);
+        const size_t to   = std::min(end, patchEnd);
+
+        if (from >= to) continue;
+
+        memcpy((uint8_t*)buf + (from - begin),
+               it->second.data() + (from - patchBegin), to - from);
+    }
+
+    _pos = end;
+
+    return bytesRead;
+}
+
+size_t MsfPatchedStream::read(void* buf) { return read(length() - _pos, buf); }
+
+size_t MsfPatchedStream::write(size_t length, const void* buf) {
+    (void)length;
+    (void)buf;
+
+    return 0;
+}
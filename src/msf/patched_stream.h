@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "msf/msf.h"
+#include "msf/stream.h"
+
+/**
+ * A read-only stream that overlays a set of patches on top of another stream.
+ *
+ * This lets a few bytes of a large stream be changed without copying the whole
+ * stream into memory. The underlying stream is read through as this one is
+ * read.
+ */
+class MsfPatchedStream : public MsfStream {
+   private:
+    MsfStreamRef _base;
+    size_t _pos;
+
+    // Patches keyed by their offset into the stream.
+    std::map<size_t, std::vector<uint8_t>> _patches;
+
+   public:
+    MsfPatchedStream(MsfStreamRef base);
+
+    /**
+     * Replaces the bytes at the given offset. The patch must not extend past the
+     * end of the stream or overlap another patch.
+     */
+    void patch(size_t offset, size_t length, const void* data);
+
+    /**
+     * Returns the number of patches.
+     */
+    size_t patchCount() const { return _patches.size(); }
+
+    size_t length() const;
+
+    size_t getPos() const;
+
+    void setPos(size_t p);
+
+    size_t read(size_t length, void* buf);
+
+    size_t read(void* buf);
+
+    /**
+     * Writing is not supported.
+     */
+    size_t write(size_t length, const void* buf);
+};
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msf/stream_sums.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "msf/stream.h"
+#include "util/crc32.h"
+
+void MsfStreamSums::update(size_t index, const void* data, size_t length) {
+    if (index >= _sums.size()) _sums.resize(index + 1);
+
+    Sum& sum = _sums[index];
+
+    sum.crc = crc32(sum.crc, data, length);
+
+    if (_blocks) {
+        const uint8_t* p = (const uint8_t*)data;
+        size_t offset    = sum.length % kMsfSumsBlockSize;
+
+        while (length > 0) {
+            const size_t n = std::min(length, kMsfSumsBlockSize - offset);
+
+            sum.blockCrc = crc32(sum.blockCrc, p, n);
+            sum.length += (uint32_t)n;
+
+            if (offset + n == kMsfSumsBlockSize) {
+                sum.blocks.push_back(sum.blockCrc);
+                sum.blockCrc = 0;
+            }
+
+            p += n;
+            length -= n;
+            offset = 0;
+        }
+    } else {
+        sum.length += (uint32_t)length;
+    }
+}
+
+void MsfStreamSums::update(size_t index, MsfStream* stream) {
+    if (index >= _sums.size()) _sums.resize(index + 1);
+
+    std::vector<uint8_t> buf(kMsfSumsBlockSize);
+
+    stream->setPos(0);
+
+    while (size_t n = stream->read(buf.size(), buf.data()))
+        update(index, buf.data(), n);
+}
+
+std::vector<uint8_t> MsfStreamSums::serialize() const {
+    std::vector<MsfStreamSum> streams;
+    std::vector<uint32_t> blocks;
+
+    for (auto&& sum : _sums) {
+        MsfStreamSum s;
+        s.length     = sum.length;
+        s.crc        = sum.crc;
+        s.firstBlock = (uint32_t)blocks.size();
+        streams.push_back(s);
+
+        if (_blocks) {
+            blocks.insert(blocks.end(), sum.blocks.begin(), sum.blocks.end());
+
+            // The last block is usually partial.
+            if (sum.length % kMsfSumsBlockSize != 0)
+                blocks.push_back(sum.blockCrc);
+        }
+    }
+
+    MsfSumsHeader header;
+    memcpy(header.magic, kMsfSumsMagic, sizeof(kMsfSumsMagic));
+    header.version     = kMsfSumsVersion;
+    header.streamCount = (uint32_t)streams.size();
+    header.blockSize   = _blocks ? kMsfSumsBlockSize : 0;
+    header.blockCount  = (uint32_t)blocks.size();
+
+    const size_t streamsLength = streams.size() * sizeof(MsfStreamSum);
+    const size_t blocksLength  = blocks.size() * sizeof(uint32_t);
+
+    std::vector<uint8_t> data(sizeof(header) + streamsLength + blocksLength);
+
+    uint8_t* p = data.data();
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    if (streamsLength > 0) memcpy(p, streams.data(), streamsLength);
+    p += streamsLength;
+
+    if (blocksLength > 0) memcpy(p, blocks.data(), blocksLength);
+
+    return data;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * Checksums of the streams of an MSF file.
+ *
+ * Writing out an MSF file already goes through every byte of every stream, so
+ * the checksums are computed on the way. They are saved next to the PDB in a
+ * small sidecar file. Tools that want to verify or diff a PDB, build a delta,
+ * or look it up in a cache can then start from the sidecar instead of reading
+ * the whole PDB again.
+ *
+ * Each stream gets a CRC-32 of its contents. Optionally, each 64 KiB block of
+ * a stream gets one too, so that the changed parts of a large stream can be
+ * found. CRC-32 is fast enough not to slow down the write, but it is only
+ * meant for spotting changes, not for security.
+ *
+ * The layout of the sidecar is:
+ *
+ *     MsfSumsHeader
+ *     MsfStreamSum[streamCount]
+ *     uint32_t blocks[blockCount]     CRC-32 of each block of each stream
+ *
+ * All integers are little endian.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class MsfStream;
+
+const char kMsfSumsMagic[8]    = {'D', 'U', 'C', 'I', 'S', 'U', 'M', 'S'};
+const uint32_t kMsfSumsVersion = 1;
+
+// Size of the blocks that are checksummed on their own.
+const uint32_t kMsfSumsBlockSize = 64 * 1024;
+
+struct MsfSumsHeader {
+    char magic[8];  // "DUCISUMS"
+    uint32_t version;
+
+    uint32_t streamCount;
+
+    // Zero if there are no block checksums.
+    uint32_t blockSize;
+    uint32_t blockCount;
+};
+
+static_assert(sizeof(MsfSumsHeader) == 24, "invalid struct size");
+
+struct MsfStreamSum {
+    uint32_t length;
+    uint32_t crc;
+
+    // Index of the stream's first block checksum. A stream has
+    // ceil(length / blockSize) blocks.
+    uint32_t firstBlock;
+};
+
+/**
+ * Accumulates the checksums of each stream as it is read or written.
+ *
+ * The data of each stream must be given in order, but streams can be given in
+ * any order.
+ */
+class MsfStreamSums {
+   private:
+    struct Sum {
+        uint32_t length;
+        uint32_t crc;
+
+        std::vector<uint32_t> blocks;
+
+        // Checksum of the block that isn't finished yet.
+        uint32_t blockCrc;
+
+        Sum() : length(0), crc(0), blockCrc(0) {}
+    };
+
+    std::vector<Sum> _sums;
+    bool _blocks;
+
+   public:
+    /**
+     * Params:
+     *   blocks = If true, each 64 KiB block is checksummed on its own as well.
+     */
+    MsfStreamSums(bool blocks = false) : _blocks(blocks) {}
+
+    /**
+     * Adds the next piece of the stream with the given index.
+     */
+    void update(size_t index, const void* data, size_t length);
+
+    /**
+     * Reads a whole stream and adds it.
+     */
+    void update(size_t index, MsfStream* stream);
+
+    /**
+     * Sets the number of streams. Streams that were never given are empty.
+     */
+    void setStreamCount(size_t count) { _sums.resize(count); }
+
+    /**
+     * Returns the sidecar file contents.
+     */
+    std::vector<uint8_t> serialize() const;
+};
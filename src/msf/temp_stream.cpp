@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msf/temp_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+MsfTempStream::MsfTempStream() : _pos(0), _length(0) {
+    _f = FileRef(tmpfile(), fclose);
+
+    if (!_f) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to create temporary file");
+    }
+}
+
+void MsfTempStream::_seek() {
+    // Switching between reading and writing requires a seek anyway.
+    if (fseek(_f.get(), (long)_pos, SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to seek in temporary file");
+    }
+}
+
+size_t MsfTempStream::length() const { return _length; }
+
+size_t MsfTempStream::getPos() const { return _pos; }
+
+void MsfTempStream::setPos(size_t pos) { _pos = std::min(_length, pos); }
+
+size_t MsfTempStream::read(size_t length, void* buf) {
+    if (_pos >= _length) return 0;
+
+    length = std::min(_length - _pos, length);
+
+    _seek();
+
+    const size_t n = fread(buf, 1, length, _f.get());
+    _pos += n;
+
+    if (n != length) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to read temporary file");
+    }
+
+    return n;
+}
+
+size_t MsfTempStream::read(void* buf) { return read(_length - _pos, buf); }
+
+size_t MsfTempStream::write(size_t length, const void* buf) {
+    _seek();
+
+    const size_t n = fwrite(buf, 1, length, _f.get());
+    _pos += n;
+    _length = std::max(_length, _pos);
+
+    if (n != length) {
+        throw std::system_error(errno, std::system_category(),
+                                "Failed to write temporary file");
+    }
+
+    return n;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "msf/trace.h"
+
+#include <map>
+#include <mutex>
+#include <system_error>
+
+#include "util/file.h"
+
+namespace {
+
+FileRef traceFile;
+
+// Passes on different MSF files can run at the same time.
+std::mutex traceLock;
+
+// Numbers assigned to the MSF files seen so far.
+std::map<const FILE*, size_t> traceFiles;
+
+template <typename CharT>
+void msfTraceStartImpl(const CharT* path) {
+    traceFile = openFile(path, FileMode<CharT>::writeEmpty);
+    traceFiles.clear();
+
+    fputs("T msftrace 1\n", traceFile.get());
+}
+
+}  // namespace
+
+bool msfTraceEnabled() { return (bool)traceFile; }
+
+void msfTraceStart(const char* path) { msfTraceStartImpl(path); }
+
+#ifdef _WIN32
+void msfTraceStart(const wchar_t* path) { msfTraceStartImpl(path); }
+#endif
+
+void msfTraceStop() {
+    std::lock_guard<std::mutex> lock(traceLock);
+
+    if (traceFile && fflush(traceFile.get()) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing MSF trace");
+    }
+
+    traceFile.reset();
+}
+
+void msfTrace(MsfTraceOp op, const FILE* f, size_t pageSize, size_t stream,
+              size_t streamPage, size_t page, size_t offset, size_t length) {
+    std::lock_guard<std::mutex> lock(traceLock);
+
+    if (!traceFile) return;
+
+    auto it = traceFiles.find(f);
+    if (it == traceFiles.end()) {
+        it = traceFiles.insert(std::make_pair(f, traceFiles.size())).first;
+        fprintf(traceFile.get(), "F %llu %llu\n",
+                (unsigned long long)it->second, (unsigned long long)pageSize);
+    }
+
+    fprintf(traceFile.get(), "%c %llu %lld %llu %llu %llu %llu\n", (char)op,
+            (unsigned long long)it->second,
+            stream == kMsfTraceNoStream ? -1LL : (long long)stream,
+            (unsigned long long)streamPage, (unsigned long long)page,
+            (unsigned long long)offset, (unsigned long long)length);
+}
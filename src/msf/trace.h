@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstdio>
+
+/**
+ * Page-level tracing of MSF file I/O.
+ *
+ * When enabled, every read from and write to an MSF file is recorded as one
+ * line of text in a trace file. This shows the actual access pattern: which
+ * pages are touched, in what order, and how often. The trace is meant to be
+ * analyzed offline with `scripts/msftrace.py`.
+ *
+ * The trace starts with a "T" line giving the format version. Each MSF file is
+ * introduced with an "F" line the first time it is seen:
+ *
+ *     F <file> <page size>
+ *
+ * and each access is then one line:
+ *
+ *     R|W <file> <stream> <stream page> <page> <offset> <length>
+ *
+ * where `stream` is the stream index, or -1 for pages that don't belong to a
+ * stream (the header, the free page map, and the stream table), `stream page`
+ * is the index of the page within the stream, `page` is the page in the file,
+ * and `offset` is the offset within that page.
+ *
+ * Tracing is off by default and costs one check per page when it is off.
+ */
+
+enum class MsfTraceOp : char {
+    read  = 'R',
+    write = 'W',
+};
+
+/**
+ * Stream index used for pages that don't belong to any stream.
+ */
+const size_t kMsfTraceNoStream = (size_t)-1;
+
+/**
+ * Returns true if MSF I/O is being traced.
+ */
+bool msfTraceEnabled();
+
+/**
+ * Starts tracing MSF I/O to the given file. The file is overwritten. This must
+ * be called before any MSF files are opened.
+ *
+ * Throws std::system_error if the file could not be opened.
+ */
+void msfTraceStart(const char* path);
+
+#ifdef _WIN32
+void msfTraceStart(const wchar_t* path);
+#endif
+
+/**
+ * Stops tracing and flushes the trace file.
+ */
+void msfTraceStop();
+
+/**
+ * Records an access to an MSF file. Only call this if tracing is enabled.
+ *
+ * Params:
+ *   op         = Whether this was a read or a write.
+ *   f          = The MSF file. Files are numbered in the order they are seen.
+ *   pageSize   = The page size of the MSF file.
+ *   stream     = The stream index or kMsfTraceNoStream.
+ *   streamPage = The index of the page within the stream.
+ *   page       = The page in the file.
+ *   offset     = The offset within the page.
+ *   length     = The number of bytes read or written.
+ */
+void msfTrace(MsfTraceOp op, const FILE* f, size_t pageSize, size_t stream,
+              size_t streamPage, size_t page, size_t offset, size_t length);
@@ -104,6 +104,59 @@ struct PdbStream70 : public PdbStream {
 
 static_assert(sizeof(PdbStream70) == 28, "invalid struct size");
 
+/**
+ * Implementation version of the TPI and IPI streams.
+ */
+enum class TpiVersion : uint32_t {
+    v40 = 19950410,
+    v41 = 19951122,
+    v50 = 19961031,
+    v70 = 19990903,
+    v80 = 20040203,
+};
+
+/**
+ * An offset and length into the hash stream of a TPI or IPI stream.
+ */
+struct TpiBuffer {
+    int32_t offset;
+    uint32_t length;
+};
+
+/**
+ * Header of the type info (TPI) and ID info (IPI) streams. The type records
+ * follow the header.
+ */
+struct TpiHeader {
+    TpiVersion version;
+
+    // Size of this header.
+    uint32_t headerSize;
+
+    // Range of type indices in this stream. The first index is usually 0x1000
+    // since lower indices are reserved for built-in types.
+    uint32_t typeIndexBegin;
+    uint32_t typeIndexEnd;
+
+    // Number of bytes of type records following the header.
+    uint32_t typeRecordBytes;
+
+    // Streams with the hash table and auxiliary hash table.
+    uint16_t hashStreamIndex;
+    uint16_t hashAuxStreamIndex;
+
+    uint32_t hashKeySize;
+    uint32_t numHashBuckets;
+
+    // Locations of the hash values, type index offsets, and hash adjustments
+    // in the hash stream.
+    TpiBuffer hashValueBuffer;
+    TpiBuffer indexOffsetBuffer;
+    TpiBuffer hashAdjBuffer;
+};
+
+static_assert(sizeof(TpiHeader) == 56, "invalid struct size");
+
 /**
  * The DBI header signature.
  */
@@ -340,6 +393,13 @@ struct GsiHashHeader {
     uint32_t bucketsSize;
 };
 
+/**
+ * Size of the bitmap of non-empty buckets at the start of the GSI hash buckets,
+ * in bytes. There are 4096 buckets plus one, rounded up to 32-bit words. The
+ * bitmap is followed by an offset for each non-empty bucket.
+ */
+const size_t gsiHashBitmapSize = (4096 + 1 + 31) / 32 * 4;
+
 /**
  * A single hash record.
  */
@@ -499,6 +559,29 @@ struct StringTableHeader {
 
 static_assert(sizeof(StringTableHeader) == 12, "invalid struct size");
 
+/**
+ * Header of the "/src/headerblock" stream. This is present if source files
+ * have been embedded in the PDB. Each embedded file is stored verbatim in its
+ * own named stream, "/src/files/<path>".
+ */
+struct SrcHeaderBlock {
+    // Should be 19991026
+    uint32_t version;
+
+    // Size of the whole stream
+    uint32_t size;
+
+    // Time (as a FILETIME) the source files were last embedded
+    uint64_t fileTime;
+
+    // Number of times the source files have been embedded
+    uint32_t age;
+
+    uint8_t padding[44];
+};
+
+static_assert(sizeof(SrcHeaderBlock) == 64, "invalid struct size");
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pdbdump/address_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "msf/stream.h"
+#include "pdb/cvinfo.h"
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "pe/format.h"
+#include "util/file.h"
+#include "util/output_file.h"
+
+namespace {
+
+const char kIndexMagic[8]    = {'D', 'U', 'C', 'I', 'A', 'D', 'D', 'R'};
+const uint32_t kIndexVersion = 1;
+
+/**
+ * Orders ranges and publics by address.
+ */
+template <typename T>
+bool addressLess(const T& a, const T& b) {
+    if (a.section != b.section) return a.section < b.section;
+    return a.offset < b.offset;
+}
+
+/**
+ * Collects everything that goes into the index.
+ */
+class IndexBuilder {
+   public:
+    AddressIndexHeader header;
+    std::vector<AddressIndexSection> sections;
+    std::vector<AddressIndexModule> modules;
+    std::vector<AddressIndexRange> ranges;
+    std::vector<AddressIndexPublic> publics;
+    std::string strings;
+
+    IndexBuilder() : header(), strings(1, '\0') {}
+
+    /**
+     * Adds a string and returns its offset. The empty string is at offset 0.
+     */
+    uint32_t addString(const char* s, size_t length) {
+        if (length == 0) return 0;
+
+        const uint32_t offset = (uint32_t)strings.size();
+        strings.append(s, length);
+        strings.push_back('\0');
+        return offset;
+    }
+
+    void write(FILE* f);
+};
+
+template <typename T>
+void writeTable(FILE* f, const std::vector<T>& table) {
+    if (table.empty()) return;
+
+    if (fwrite(table.data(), sizeof(T), table.size(), f) != table.size()) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing address index");
+    }
+}
+
+void IndexBuilder::write(FILE* f) {
+    std::stable_sort(ranges.begin(), ranges.end(),
+                     addressLess<AddressIndexRange>);
+    std::stable_sort(publics.begin(), publics.end(),
+                     addressLess<AddressIndexPublic>);
+
+    memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.version       = kIndexVersion;
+    header.sectionCount  = (uint32_t)sections.size();
+    header.moduleCount   = (uint32_t)modules.size();
+    header.rangeCount    = (uint32_t)ranges.size();
+    header.publicCount   = (uint32_t)publics.size();
+    header.stringsLength = (uint32_t)strings.size();
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing address index");
+    }
+
+    writeTable(f, sections);
+    writeTable(f, modules);
+    writeTable(f, ranges);
+    writeTable(f, publics);
+
+    if (fwrite(strings.data(), 1, strings.size(), f) != strings.size()) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing address index");
+    }
+}
+
+/**
+ * Reads a whole stream into memory. Returns null if it doesn't exist.
+ */
+std::unique_ptr<MsfMemoryStream> readStream(MsfFile& msf, size_t index) {
+    auto stream = msf.getStream(index);
+    if (!stream) return nullptr;
+
+    return std::unique_ptr<MsfMemoryStream>(new MsfMemoryStream(stream.get()));
+}
+
+void addPdbInfo(MsfFile& msf, IndexBuilder& index) {
+    auto stream = readStream(msf, (size_t)PdbStreamType::header);
+    if (!stream || stream->length() < sizeof(PdbStream70))
+        throw InvalidPdb("missing PDB 7.0 header");
+
+    const PdbStream70* header = (const PdbStream70*)stream->data();
+
+    memcpy(index.header.signature, header->sig70, sizeof(header->sig70));
+    index.header.age = header->age;
+}
+
+/**
+ * Adds the sections from the section header stream, if there is one.
+ */
+void addSections(MsfFile& msf, const uint8_t* debugHeader, size_t length,
+                 IndexBuilder& index) {
+    if (length / sizeof(int16_t) <= DebugTypes::sectionHdr) return;
+
+    int16_t streamIndex;
+    memcpy(&streamIndex, debugHeader + DebugTypes::sectionHdr * sizeof(int16_t),
+           sizeof(streamIndex));
+
+    if (streamIndex < 0) return;
+
+    auto stream = readStream(msf, (size_t)streamIndex);
+    if (!stream) return;
+
+    const size_t count = stream->length() / sizeof(IMAGE_SECTION_HEADER);
+    const IMAGE_SECTION_HEADER* headers =
+        (const IMAGE_SECTION_HEADER*)stream->data();
+
+    for (size_t i = 0; i < count; ++i) {
+        AddressIndexSection section;
+        section.rva  = headers[i].VirtualAddress;
+        section.size = headers[i].Misc.VirtualSize;
+        index.sections.push_back(section);
+    }
+}
+
+/**
+ * Adds the modules and their section contributions from the DBI stream.
+ * Returns the index of the symbol records stream.
+ */
+uint16_t addModules(MsfFile& msf, IndexBuilder& index) {
+    auto stream = readStream(msf, (size_t)PdbStreamType::dbi);
+    if (!stream || stream->length() < sizeof(DbiHeader))
+        throw InvalidPdb("missing DBI stream");
+
+    const uint8_t* data  = stream->data();
+    const size_t length  = stream->length();
+    const DbiHeader* dbi = (const DbiHeader*)data;
+    size_t offset        = sizeof(DbiHeader);
+
+    if (length - offset < dbi->gpModInfoSize)
+        throw InvalidPdb("got partial DBI module info");
+
+    for (size_t i = 0; i < dbi->gpModInfoSize;) {
+        if (dbi->gpModInfoSize - i < sizeof(ModuleInfo))
+            throw InvalidPdb("got partial DBI module info");
+
+        const ModuleInfo* info = (const ModuleInfo*)(data + offset + i);
+
+        const char* name = info->moduleName();
+        const size_t maxLength =
+            dbi->gpModInfoSize - i - offsetof(ModuleInfo, names);
+
+        AddressIndexModule module;
+        module.name = index.addString(name, strnlen(name, maxLength));
+        index.modules.push_back(module);
+
+        i += info->size();
+    }
+
+    offset += dbi->gpModInfoSize;
+
+    if (dbi->sectionContributionSize > 0) {
+        if (length - offset < dbi->sectionContributionSize ||
+            dbi->sectionContributionSize < sizeof(SectionContribVersion))
+            throw InvalidPdb("got partial section contributions");
+
+        SectionContribVersion version;
+        memcpy(&version, data + offset, sizeof(version));
+
+        size_t entrySize;
+        if (version == SectionContribVersion::v1)
+            entrySize = sizeof(SectionContribution);
+        else if (version == SectionContribVersion::v2)
+            entrySize = sizeof(SectionContribution) + sizeof(uint32_t);
+        else
+            throw InvalidPdb("got invalid section contribution version");
+
+        const size_t count =
+            (dbi->sectionContributionSize - sizeof(version)) / entrySize;
+        const uint8_t* p = data + offset + sizeof(version);
+
+        for (size_t i = 0; i < count; ++i, p += entrySize) {
+            SectionContribution sc;
+            memcpy(&sc, p, sizeof(sc));
+
+            if (sc.size == 0 || sc.section == 0) continue;
+
+            AddressIndexRange range;
+            range.section  = sc.section;
+            range.reserved = 0;
+            range.offset   = (uint32_t)sc.offset;
+            range.size     = sc.size;
+            range.module   = sc.imod;
+            index.ranges.push_back(range);
+        }
+    }
+
+    offset += dbi->sectionContributionSize;
+
+    // Skip to the debug header at the end.
+    offset += dbi->sectionMapSize + dbi->fileInfoSize +
+              dbi->typeServerMapSize + dbi->ecInfoSize;
+
+    if (offset <= length && length - offset >= dbi->debugHeaderSize)
+        addSections(msf, data + offset, dbi->debugHeaderSize, index);
+
+    return dbi->symbolRecordsStream;
+}
+
+/**
+ * Adds the public symbols from the symbol record stream.
+ */
+void addPublics(MsfFile& msf, uint16_t streamIndex, IndexBuilder& index) {
+    auto stream = readStream(msf, streamIndex);
+    if (!stream) return;
+
+    const uint8_t* data = stream->data();
+    const size_t length = stream->length();
+
+    for (size_t i = 0; i + sizeof(SymbolRecord) <= length;) {
+        const SymbolRecord* rec = (const SymbolRecord*)(data + i);
+
+        const size_t recordLength = sizeof(rec->length) + rec->length;
+        if (rec->length < sizeof(rec->type) || recordLength > length - i)
+            throw InvalidPdb("invalid symbol record size");
+
+        if (rec->type == S_PUB32 &&
+            recordLength >= offsetof(PUBSYM32, name)) {
+            const PUBSYM32* pub = (const PUBSYM32*)rec;
+
+            const char* name = (const char*)pub->name;
+            const size_t maxLength = recordLength - offsetof(PUBSYM32, name);
+
+            AddressIndexPublic sym;
+            sym.section  = pub->seg;
+            sym.reserved = 0;
+            sym.offset   = pub->off;
+            sym.name     = index.addString(name, strnlen(name, maxLength));
+            index.publics.push_back(sym);
+        }
+
+        i += recordLength;
+    }
+}
+
+template <typename CharT>
+void buildAddressIndexImpl(const CharT* pdbPath, const CharT* indexPath) {
+    IndexBuilder index;
+
+    {
+        auto pdb = openFile(pdbPath, FileMode<CharT>::readExisting);
+
+        MsfFile msf(pdb);
+
+        addPdbInfo(msf, index);
+
+        const uint16_t symbolRecords = addModules(msf, index);
+        if (symbolRecords != (uint16_t)-1)
+            addPublics(msf, symbolRecords, index);
+    }
+
+    OutputFile output(indexPath);
+    index.write(output.file().get());
+    output.commit();
+}
+
+MemMapOptions indexMapOptions() {
+    MemMapOptions options;
+    options.readOnly = true;
+    return options;
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+void buildAddressIndex(const wchar_t* pdbPath, const wchar_t* indexPath) {
+    buildAddressIndexImpl(pdbPath, indexPath);
+}
+
+#else
+
+void buildAddressIndex(const char* pdbPath, const char* indexPath) {
+    buildAddressIndexImpl(pdbPath, indexPath);
+}
+
+#endif
+
+AddressIndex::AddressIndex(const char* path)
+    : _map(path, 0, indexMapOptions()) {
+    _init();
+}
+
+#ifdef _WIN32
+
+AddressIndex::AddressIndex(const wchar_t* path)
+    : _map(path, 0, indexMapOptions()) {
+    _init();
+}
+
+#endif
+
+void AddressIndex::_init() {
+    const uint8_t* data = (const uint8_t*)_map.buf();
+    const size_t length = _map.length();
+
+    if (length < sizeof(AddressIndexHeader))
+        throw InvalidIndex("missing header");
+
+    _header = (const AddressIndexHeader*)data;
+
+    if (memcmp(_header->magic, kIndexMagic, sizeof(kIndexMagic)) != 0)
+        throw InvalidIndex("not an address index");
+
+    if (_header->version != kIndexVersion)
+        throw InvalidIndex("unsupported version");
+
+    const uint64_t expected =
+        sizeof(AddressIndexHeader) +
+        (uint64_t)_header->sectionCount * sizeof(AddressIndexSection) +
+        (uint64_t)_header->moduleCount * sizeof(AddressIndexModule) +
+        (uint64_t)_header->rangeCount * sizeof(AddressIndexRange) +
+        (uint64_t)_header->publicCount * sizeof(AddressIndexPublic) +
+        _header->stringsLength;
+
+    if (expected != length) throw InvalidIndex("invalid length");
+
+    if (_header->stringsLength == 0 || data[length - 1] != 0)
+        throw InvalidIndex("unterminated strings");
+
+    const uint8_t* p = data + sizeof(AddressIndexHeader);
+
+    _sections = (const AddressIndexSection*)p;
+    p += _header->sectionCount * sizeof(AddressIndexSection);
+
+    _modules = (const AddressIndexModule*)p;
+    p += _header->moduleCount * sizeof(AddressIndexModule);
+
+    _ranges = (const AddressIndexRange*)p;
+    p += _header->rangeCount * sizeof(AddressIndexRange);
+
+    _publics = (const AddressIndexPublic*)p;
+    p += _header->publicCount * sizeof(AddressIndexPublic);
+
+    _strings = (const char*)p;
+}
+
+const char* AddressIndex::_string(uint32_t offset) const {
+    if (offset == 0 || offset >= _header->stringsLength) return nullptr;
+    return _strings + offset;
+}
+
+bool AddressIndex::toSectionOffset(uint32_t rva, uint16_t& section,
+                                   uint32_t& offset) const {
+    // There are only ever a few dozen sections.
+    for (uint32_t i = 0; i < _header->sectionCount; ++i) {
+        const AddressIndexSection& s = _sections[i];
+        if (rva >= s.rva && rva - s.rva < s.size) {
+            section = (uint16_t)(i + 1);
+            offset  = rva - s.rva;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+ResolvedAddress AddressIndex::resolve(uint16_t section, uint32_t offset) const {
+    ResolvedAddress result;
+    result.section      = section;
+    result.offset       = offset;
+    result.module       = nullptr;
+    result.symbol       = nullptr;
+    result.displacement = 0;
+
+    // Find the last range starting at or before the address.
+    AddressIndexRange key;
+    key.section = section;
+    key.offset  = offset;
+
+    const AddressIndexRange* rangesEnd = _ranges + _header->rangeCount;
+    const AddressIndexRange* range = std::upper_bound(
+        _ranges, rangesEnd, key, addressLess<AddressIndexRange>);
+
+    if (range != _ranges) {
+        --range;
+        if (range->section == section && offset - range->offset < range->size &&
+            range->module < _header->moduleCount)
+            result.module = _string(_modules[range->module].name);
+    }
+
+    // Same for the nearest public symbol.
+    AddressIndexPublic pubKey;
+    pubKey.section = section;
+    pubKey.offset  = offset;
+
+    const AddressIndexPublic* publicsEnd = _publics + _header->publicCount;
+    const AddressIndexPublic* pub = std::upper_bound(
+        _publics, publicsEnd, pubKey, addressLess<AddressIndexPublic>);
+
+    if (pub != _publics) {
+        --pub;
+        if (pub->section == section) {
+            result.symbol       = _string(pub->name);
+            result.displacement = offset - pub->offset;
+        }
+    }
+
+    return result;
+}
+
+bool resolveAddress(const AddressIndex& index, const char* address,
+                    std::ostream& os) {
+    uint16_t section = 0;
+    uint32_t offset  = 0;
+    bool found       = true;
+
+    char* end;
+    const unsigned long first = strtoul(address, &end, 16);
+    if (end == address) return false;
+
+    if (*end == ':') {
+        const char* rest = end + 1;
+        offset           = (uint32_t)strtoul(rest, &end, 16);
+        if (end == rest || *end != 0 || first > 0xFFFF) return false;
+        section = (uint16_t)first;
+    } else {
+        if (*end != 0) return false;
+        found = index.toSectionOffset((uint32_t)first, section, offset);
+    }
+
+    os << address << "\t";
+
+    if (!found) {
+        os << "?\t?\t?\n";
+        return true;
+    }
+
+    const ResolvedAddress r = index.resolve(section, offset);
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%04X:%08X\t", r.section, r.offset);
+    os << buf << (r.module ? r.module : "?") << "\t";
+
+    if (r.symbol) {
+        os << r.symbol;
+        if (r.displacement) {
+            snprintf(buf, sizeof(buf), "+0x%x", r.displacement);
+            os << buf;
+        }
+    } else {
+        os << "?";
+    }
+
+    os << "\n";
+    return true;
+}
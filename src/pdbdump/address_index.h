@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An index for resolving addresses to modules and public symbols without
+ * parsing the PDB.
+ *
+ * Resolving a crash address against a PDB normally means reading the DBI
+ * stream and the symbol records every time. Instead, the index is built once
+ * from the PDB and saved to a file. It holds the section contributions and
+ * the public symbols sorted by address, so each lookup is a binary search in a
+ * memory mapped file.
+ *
+ * The layout of the file is:
+ *
+ *     AddressIndexHeader
+ *     AddressIndexSection[sectionCount]
+ *     AddressIndexModule[moduleCount]
+ *     AddressIndexRange[rangeCount]      Sorted by (section, offset)
+ *     AddressIndexPublic[publicCount]    Sorted by (section, offset)
+ *     char strings[stringsLength]        NUL-terminated names
+ *
+ * All integers are little endian.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <iosfwd>
+
+#include "util/memmap.h"
+
+/**
+ * Thrown when an index file is invalid.
+ */
+class InvalidIndex {
+   private:
+    const char* _why;
+
+   public:
+    InvalidIndex(const char* why) : _why(why) {}
+
+    const char* why() const { return _why; }
+};
+
+struct AddressIndexHeader {
+    char magic[8];  // "DUCIADDR"
+    uint32_t version;
+
+    // Identifies the PDB the index was built from.
+    uint8_t signature[16];
+    uint32_t age;
+
+    uint32_t sectionCount;
+    uint32_t moduleCount;
+    uint32_t rangeCount;
+    uint32_t publicCount;
+    uint32_t stringsLength;
+};
+
+static_assert(sizeof(AddressIndexHeader) == 52, "invalid struct size");
+
+/**
+ * A section of the image. This is used to turn RVAs into section offsets.
+ */
+struct AddressIndexSection {
+    uint32_t rva;
+    uint32_t size;
+};
+
+struct AddressIndexModule {
+    uint32_t name;  // Offset into the strings
+};
+
+/**
+ * A range of a section contributed by a module. Sections are numbered from 1.
+ */
+struct AddressIndexRange {
+    uint16_t section;
+    uint16_t reserved;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t module;
+};
+
+struct AddressIndexPublic {
+    uint16_t section;
+    uint16_t reserved;
+    uint32_t offset;
+    uint32_t name;  // Offset into the strings
+};
+
+/**
+ * Result of resolving an address. Names are null if they are unknown.
+ */
+struct ResolvedAddress {
+    uint16_t section;
+    uint32_t offset;
+
+    // The module whose contribution contains the address.
+    const char* module;
+
+    // The nearest public symbol at or before the address in the same section
+    // and how far past it the address is.
+    const char* symbol;
+    uint32_t displacement;
+};
+
+/**
+ * A memory mapped address index.
+ */
+class AddressIndex {
+   private:
+    MemMap _map;
+
+    const AddressIndexHeader* _header;
+    const AddressIndexSection* _sections;
+    const AddressIndexModule* _modules;
+    const AddressIndexRange* _ranges;
+    const AddressIndexPublic* _publics;
+    const char* _strings;
+
+    void _init();
+
+    const char* _string(uint32_t offset) const;
+
+   public:
+    /**
+     * Maps the index. Only the header is checked, so this is cheap.
+     *
+     * Throws InvalidIndex if it isn't a valid index file.
+     */
+    AddressIndex(const char* path);
+
+#ifdef _WIN32
+    AddressIndex(const wchar_t* path);
+#endif
+
+    const AddressIndexHeader& header() const { return *_header; }
+
+    /**
+     * Converts an RVA to a section and offset. Returns false if the RVA isn't
+     * in any section.
+     */
+    bool toSectionOffset(uint32_t rva, uint16_t& section,
+                         uint32_t& offset) const;
+
+    /**
+     * Resolves a section and offset.
+     */
+    ResolvedAddress resolve(uint16_t section, uint32_t offset) const;
+};
+
+/**
+ * Builds an address index from a PDB.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void buildAddressIndex(const wchar_t* pdbPath, const wchar_t* indexPath);
+
+#else
+
+void buildAddressIndex(const char* pdbPath, const char* indexPath);
+
+#endif
+
+/**
+ * Resolves an address and prints a line with the address, the module, and the
+ * nearest public symbol, separated by tabs. Unknown names are printed as "?".
+ * The address is either "section:offset", both in hex (as printed by
+ * debuggers), or an RVA in hex.
+ *
+ * Returns false if the address couldn't be parsed.
+ */
+bool resolveAddress(const AddressIndex& index, const char* address,
+                    std::ostream& os);
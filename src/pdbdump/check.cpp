@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "pdbdump/check.h"
+
+#include "msf/format.h"
+#include "msf/stream.h"
+#include "util/file.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+// Owners of pages that don't belong to a stream.
+const uint32_t kOwnerHeader    = 0xFFFFFFFF;
+const uint32_t kOwnerFpm       = 0xFFFFFFFE;
+const uint32_t kOwnerDirectory = 0xFFFFFFFD;
+
+// Maximum number of each kind of problem to print. The rest are only counted.
+const size_t kMaxExamples = 10;
+
+/**
+ * A set of pages that can be added to from multiple threads at once.
+ */
+class PageSet {
+   private:
+    std::vector<std::atomic<uint64_t>> _words;
+
+   public:
+    PageSet(size_t pageCount) : _words((pageCount + 63) / 64) {}
+
+    /**
+     * Adds a page to the set. Returns false if it was already in the set.
+     */
+    bool insert(size_t page) {
+        const uint64_t bit = (uint64_t)1 << (page % 64);
+        return (_words[page / 64].fetch_or(bit, std::memory_order_relaxed) &
+                bit) == 0;
+    }
+
+    /**
+     * Returns 64 pages worth of the set, starting at page `i*64`.
+     */
+    uint64_t word(size_t i) const {
+        return _words[i].load(std::memory_order_relaxed);
+    }
+};
+
+std::string ownerName(uint32_t owner) {
+    switch (owner) {
+        case kOwnerHeader:
+            return "the MSF header";
+        case kOwnerFpm:
+            return "the free page map";
+        case kOwnerDirectory:
+            return "the stream table";
+        default:
+            return "stream " + std::to_string(owner);
+    }
+}
+
+/**
+ * A page that was found to be a problem by a worker thread. These are turned
+ * into messages once all the workers are done.
+ */
+struct BadPage {
+    uint32_t page;
+    uint32_t stream;
+};
+
+/**
+ * What each worker thread found while checking a range of streams.
+ */
+struct StreamCheck {
+    std::vector<BadPage> outOfRange;
+    std::vector<BadPage> shared;
+    size_t outOfRangeCount;
+    size_t sharedCount;
+
+    StreamCheck() : outOfRangeCount(0), sharedCount(0) {}
+};
+
+/**
+ * What each worker thread found while comparing a range of the free page map
+ * against the pages that are actually used.
+ */
+struct FpmCheck {
+    // Pages that are used but marked as free. These would be handed out again
+    // by anything that updates the PDB.
+    std::vector<uint32_t> usedButFree;
+    size_t usedButFreeCount;
+
+    // Pages that are marked as used, but aren't used by anything. These are
+    // only wasted space.
+    size_t leakedCount;
+
+    FpmCheck() : usedButFreeCount(0), leakedCount(0) {}
+};
+
+class MsfChecker {
+   private:
+    FileRef _f;
+    ThreadPool& _pool;
+    std::ostream& _os;
+
+    MSF_HEADER _header;
+
+    size_t _errors;
+    size_t _warnings;
+
+    // The pages that are used by something and what they are used by.
+    PageSet _used;
+    std::vector<uint32_t> _owners;
+
+    // The stream table: the stream count, the stream sizes, then the pages of
+    // each stream.
+    std::vector<uint32_t> _directory;
+
+    // Where each stream's pages start in the stream table.
+    std::vector<size_t> _pageOffsets;
+
+    void _error(const std::string& what) {
+        _os << "error: " << what << std::endl;
+        ++_errors;
+    }
+
+    void _warning(const std::string& what) {
+        _os << "warning: " << what << std::endl;
+        ++_warnings;
+    }
+
+    void _readPage(size_t page, void* buf);
+    bool _claim(uint32_t page, uint32_t owner);
+
+    bool _checkHeader();
+    bool _checkDirectory();
+    void _checkStreams();
+    void _checkFpm();
+
+   public:
+    MsfChecker(FileRef f, ThreadPool& pool, std::ostream& os)
+        : _f(f), _pool(pool), _os(os), _errors(0), _warnings(0), _used(0) {}
+
+    /**
+     * Runs all of the checks and returns the number of errors.
+     */
+    size_t check();
+};
+
+void MsfChecker::_readPage(size_t page, void* buf) {
+    const size_t pageSize = _header.pageSize;
+
+    if (fseek(_f.get(), (long)(page * pageSize), SEEK_SET) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "fseek() failed");
+    }
+
+    // The file length was already checked, so this can only fail with an I/O
+    // error.
+    if (fread(buf, 1, pageSize, _f.get()) != pageSize) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed reading page");
+    }
+}
+
+/**
+ * Marks a page that doesn't belong to a stream as used.
+ */
+bool MsfChecker::_claim(uint32_t page, uint32_t owner) {
+    if (!_used.insert(page)) {
+        _error("page " + std::to_string(page) + " is used by both " +
+               ownerName(_owners[page]) + " and " + ownerName(owner));
+        return false;
+    }
+
+    _owners[page] = owner;
+    return true;
+}
+
+bool MsfChecker::_checkHeader() {
+    if (fread(&_header, sizeof(_header), 1, _f.get()) != 1) {
+        _error("missing MSF header");
+        return false;
+    }
+
+    if (memcmp(_header.magic, kMsfHeaderMagic, sizeof(kMsfHeaderMagic)) != 0) {
+        _error("invalid MSF header magic");
+        return false;
+    }
+
+    const uint32_t pageSize = _header.pageSize;
+
+    if (pageSize < 512 || (pageSize & (pageSize - 1)) != 0) {
+        _error("invalid page size " + std::to_string(pageSize));
+        return false;
+    }
+
+    if (_header.pageCount < 3) {
+        _error("too few pages for the MSF header and free page map");
+        return false;
+    }
+
+    if (fseek(_f.get(), 0, SEEK_END) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "fseek() failed");
+    }
+
+    const uint64_t fileLength = (uint64_t)ftell(_f.get());
+    const uint64_t expected   = (uint64_t)pageSize * _header.pageCount;
+
+    if (fileLength != expected) {
+        _error("file is " + std::to_string(fileLength) + " bytes long, but " +
+               std::to_string(_header.pageCount) + " pages of " +
+               std::to_string(pageSize) + " bytes need " +
+               std::to_string(expected) + " bytes");
+
+        // Pages past the end of the file can't be read.
+        if (fileLength < expected) return false;
+    }
+
+    _used = PageSet(_header.pageCount);
+    _owners.resize(_header.pageCount);
+
+    _claim(0, kOwnerHeader);
+
+    // There are two FPM pages at the start of every interval of `pageSize`
+    // pages, whether or not they are needed.
+    for (size_t page = 1; page < _header.pageCount; page += pageSize) {
+        _claim((uint32_t)page, kOwnerFpm);
+        if (page + 1 < _header.pageCount) _claim((uint32_t)page + 1, kOwnerFpm);
+    }
+
+    return true;
+}
+
+bool MsfChecker::_checkDirectory() {
+    const size_t pageSize        = _header.pageSize;
+    const uint32_t pageCount     = _header.pageCount;
+    const uint32_t directorySize = _header.streamTableInfo.size;
+
+    if (directorySize == 0 || directorySize % sizeof(uint32_t) != 0) {
+        _error("invalid stream table size " + std::to_string(directorySize));
+        return false;
+    }
+
+    // The stream table's pages are listed in pages that are in turn listed
+    // after the MSF header.
+    const size_t directoryPageCount =
+        ::pageCount(pageSize, (size_t)directorySize);
+    const size_t rootPageCount =
+        ::pageCount(pageSize, directoryPageCount * sizeof(uint32_t));
+
+    if (sizeof(_header) + rootPageCount * sizeof(uint32_t) > pageSize) {
+        _error("stream table is too large for its page list to fit in the "
+               "MSF header page");
+        return false;
+    }
+
+    std::vector<uint8_t> page(pageSize);
+    _readPage(0, page.data());
+
+    std::vector<uint32_t> rootPages(rootPageCount);
+    memcpy(rootPages.data(), page.data() + sizeof(_header),
+           rootPageCount * sizeof(uint32_t));
+
+    std::vector<uint32_t> directoryPages(rootPageCount * pageSize /
+                                         sizeof(uint32_t));
+
+    for (size_t i = 0; i < rootPageCount; ++i) {
+        const uint32_t p = rootPages[i];
+        if (p >= pageCount) {
+            _error("stream table page list is on page " + std::to_string(p) +
+                   ", past the last page");
+            return false;
+        }
+
+        _claim(p, kOwnerDirectory);
+        _readPage(p, (uint8_t*)directoryPages.data() + i * pageSize);
+    }
+
+    directoryPages.resize(directoryPageCount);
+
+    _directory.resize(directoryPageCount * pageSize / sizeof(uint32_t));
+
+    for (size_t i = 0; i < directoryPageCount; ++i) {
+        const uint32_t p = directoryPages[i];
+        if (p >= pageCount) {
+            _error("stream table is on page " + std::to_string(p) +
+                   ", past the last page");
+            return false;
+        }
+
+        _claim(p, kOwnerDirectory);
+        _readPage(p, (uint8_t*)_directory.data() + i * pageSize);
+    }
+
+    _directory.resize(directorySize / sizeof(uint32_t));
+
+    const size_t streamCount = _directory[0];
+
+    if (1 + streamCount > _directory.size()) {
+        _error("stream table is too small for " + std::to_string(streamCount) +
+               " streams");
+        return false;
+    }
+
+    // Find where the page list of each stream starts.
+    _pageOffsets.resize(streamCount + 1);
+
+    size_t offset = 1 + streamCount;
+
+    for (size_t i = 0; i < streamCount; ++i) {
+        uint32_t size = _directory[1 + i];
+
+        // Microsoft's PDB implementation sometimes sets the size of a stream
+        // to -1.
+        if (size == (uint32_t)-1) size = 0;
+
+        _pageOffsets[i] = offset;
+        offset += ::pageCount(pageSize, (size_t)size);
+    }
+
+    _pageOffsets[streamCount] = offset;
+
+    if (offset != _directory.size()) {
+        _error("stream sizes need " + std::to_string(offset - 1 - streamCount) +
+               " pages, but the stream table lists " +
+               std::to_string(_directory.size() - 1 - streamCount));
+
+        if (offset > _directory.size()) return false;
+    }
+
+    return true;
+}
+
+void MsfChecker::_checkStreams() {
+    const size_t streamCount = _pageOffsets.size() - 1;
+    const uint32_t pageCount = _header.pageCount;
+
+    if (streamCount == 0) return;
+
+    // Stream 0 holds the previous stream table. Its pages are free, so it only
+    // needs to be in bounds.
+    for (size_t i = _pageOffsets[0]; i < _pageOffsets[1]; ++i) {
+        if (_directory[i] >= pageCount) {
+            _error("stream 0 has page " + std::to_string(_directory[i]) +
+                   ", past the last page");
+        }
+    }
+
+    if (streamCount == 1) return;
+
+    // Split the streams into about as many pages per task as there are
+    // threads.
+    const size_t totalPages   = _pageOffsets[streamCount] - _pageOffsets[1];
+    const size_t taskCount    = _pool.size() * 4;
+    const size_t pagesPerTask = std::max<size_t>(1, totalPages / taskCount);
+
+    std::vector<size_t> bounds;
+    bounds.push_back(1);
+
+    for (size_t i = 2; i < streamCount; ++i) {
+        if (_pageOffsets[i] - _pageOffsets[bounds.back()] >= pagesPerTask)
+            bounds.push_back(i);
+    }
+
+    bounds.push_back(streamCount);
+
+    std::vector<StreamCheck> results(bounds.size() - 1);
+
+    for (size_t t = 0; t + 1 < bounds.size(); ++t) {
+        _pool.run([this, t, pageCount, &bounds, &results] {
+            StreamCheck& result = results[t];
+
+            for (size_t s = bounds[t]; s < bounds[t + 1]; ++s) {
+                for (size_t i = _pageOffsets[s]; i < _pageOffsets[s + 1];
+                     ++i) {
+                    const uint32_t page = _directory[i];
+
+                    if (page >= pageCount) {
+                        if (result.outOfRangeCount++ < kMaxExamples)
+                            result.outOfRange.push_back({page, (uint32_t)s});
+                    } else if (!_used.insert(page)) {
+                        if (result.sharedCount++ < kMaxExamples)
+                            result.shared.push_back({page, (uint32_t)s});
+                    } else {
+                        _owners[page] = (uint32_t)s;
+                    }
+                }
+            }
+        });
+    }
+
+    _pool.wait();
+
+    size_t outOfRange = 0, shared = 0;
+
+    for (auto&& result : results) {
+        for (auto&& bad : result.outOfRange) {
+            if (outOfRange++ < kMaxExamples)
+                _error("stream " + std::to_string(bad.stream) + " has page " +
+                       std::to_string(bad.page) + ", past the last page");
+        }
+
+        for (auto&& bad : result.shared) {
+            if (shared++ < kMaxExamples)
+                _error("page " + std::to_string(bad.page) +
+                       " is used by both " + ownerName(_owners[bad.page]) +
+                       " and stream " + std::to_string(bad.stream));
+        }
+
+        outOfRange += result.outOfRangeCount - result.outOfRange.size();
+        shared += result.sharedCount - result.shared.size();
+    }
+
+    if (outOfRange > kMaxExamples) {
+        _errors += outOfRange - kMaxExamples;
+        _os << "error: ... and " << outOfRange - kMaxExamples
+            << " more pages past the last page" << std::endl;
+    }
+
+    if (shared > kMaxExamples) {
+        _errors += shared - kMaxExamples;
+        _os << "error: ... and " << shared - kMaxExamples
+            << " more pages used more than once" << std::endl;
+    }
+}
+
+void MsfChecker::_checkFpm() {
+    const size_t pageSize    = _header.pageSize;
+    const uint32_t pageCount = _header.pageCount;
+
+    if (_header.freePageMap != 1 && _header.freePageMap != 2) {
+        _error("free page map is on invalid page " +
+               std::to_string(_header.freePageMap));
+        return;
+    }
+
+    // Each FPM page covers the next `pageSize * 8` pages, even though it sits
+    // at the start of an interval of only `pageSize` pages.
+    const size_t pagesPerFpmPage = pageSize * 8;
+    const size_t fpmPageCount =
+        ::pageCount(pagesPerFpmPage, (size_t)pageCount);
+
+    std::vector<uint8_t> fpm(fpmPageCount * pageSize);
+
+    for (size_t i = 0; i < fpmPageCount; ++i)
+        _readPage(i * pageSize + _header.freePageMap, &fpm[i * pageSize]);
+
+    const size_t wordCount    = (pageCount + 63) / 64;
+    const size_t taskCount    = _pool.size() * 4;
+    const size_t wordsPerTask = std::max<size_t>(1024, wordCount / taskCount);
+
+    std::vector<FpmCheck> results((wordCount + wordsPerTask - 1) /
+                                  wordsPerTask);
+
+    for (size_t t = 0; t < results.size(); ++t) {
+        _pool.run([this, t, wordCount, wordsPerTask, pageCount, &fpm,
+                   &results] {
+            FpmCheck& result = results[t];
+
+            const size_t end = std::min(wordCount, (t + 1) * wordsPerTask);
+
+            for (size_t w = t * wordsPerTask; w < end; ++w) {
+                uint64_t free;
+                memcpy(&free, &fpm[w * sizeof(free)], sizeof(free));
+
+                // The FPM is little-endian, so this only works on a
+                // little-endian machine. So does everything else.
+                uint64_t used = _used.word(w);
+
+                // Ignore bits past the last page.
+                uint64_t valid = ~(uint64_t)0;
+                if ((w + 1) * 64 > pageCount)
+                    valid = ((uint64_t)1 << (pageCount % 64)) - 1;
+
+                const uint64_t usedButFree = used & free & valid;
+                const uint64_t leaked      = ~used & ~free & valid;
+
+                if (usedButFree) {
+                    for (size_t bit = 0; bit < 64; ++bit) {
+                        if (!(usedButFree & ((uint64_t)1 << bit))) continue;
+
+                        if (result.usedButFreeCount++ < kMaxExamples)
+                            result.usedButFree.push_back(
+                                (uint32_t)(w * 64 + bit));
+                    }
+                }
+
+                for (uint64_t x = leaked; x; x &= x - 1) ++result.leakedCount;
+            }
+        });
+    }
+
+    _pool.wait();
+
+    size_t usedButFree = 0, leaked = 0;
+
+    for (auto&& result : results) {
+        for (uint32_t page : result.usedButFree) {
+            if (usedButFree++ < kMaxExamples)
+                _error("page " + std::to_string(page) + " is used by " +
+                       ownerName(_owners[page]) +
+                       " but is marked as free in the free page map");
+        }
+
+        usedButFree += result.usedButFreeCount - result.usedButFree.size();
+        leaked += result.leakedCount;
+    }
+
+    if (usedButFree > kMaxExamples) {
+        _errors += usedButFree - kMaxExamples;
+        _os << "error: ... and " << usedButFree - kMaxExamples
+            << " more used pages marked as free" << std::endl;
+    }
+
+    if (leaked > 0) {
+        _warning(std::to_string(leaked) +
+                 " pages are marked as used in the free page map, but are not "
+                 "used by anything");
+    }
+}
+
+size_t MsfChecker::check() {
+    if (_checkHeader() && _checkDirectory()) {
+        _checkStreams();
+        _checkFpm();
+    }
+
+    if (_errors == 0) {
+        _os << "OK: " << _header.pageCount << " pages, "
+            << _pageOffsets.size() - 1 << " streams";
+        if (_warnings > 0) _os << ", " << _warnings << " warnings";
+        _os << std::endl;
+    } else {
+        _os << _errors << " errors, " << _warnings << " warnings" << std::endl;
+    }
+
+    return _errors;
+}
+
+template <typename CharT>
+size_t checkPdbImpl(const CharT* path) {
+    auto f = openFile(path, FileMode<CharT>::readExisting);
+
+    ThreadPool pool;
+
+    MsfChecker checker(f, pool, std::cout);
+    return checker.check();
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+size_t checkPdb(const wchar_t* path) { return checkPdbImpl(path); }
+
+#else
+
+size_t checkPdb(const char* path) { return checkPdbImpl(path); }
+
+#endif
@@ -53,10 +53,11 @@ void printLinkInfoStream(MsfMemoryStream* stream, std::ostream& os);
  *
  *    [0-4, 6-9, 20]
  */
-void printPageSequences(const std::vector<uint32_t>& pages, std::ostream& os) {
+void printPageSequences(const uint32_t* pages, size_t pageCount,
+                        std::ostream& os) {
     os << "[";
 
-    for (size_t i = 0; i < pages.size();) {
+    for (size_t i = 0; i < pageCount;) {
         if (i > 0) os << ", ";
 
         uint32_t start = pages[i];
@@ -65,7 +66,7 @@ void printPageSequences(const std::vector<uint32_t>& pages, std::ostream& os) {
         ++i;
 
         // Find how long a run of pages is.
-        for (; i < pages.size() && pages[i] == pages[i - 1] + 1; ++i) ++count;
+        for (; i < pageCount && pages[i] == pages[i - 1] + 1; ++i) ++count;
 
         if (count == 0) {
             os << start << " (0x" << std::hex << (uint64_t)start * 4096 << "-0x"
@@ -93,12 +94,10 @@ void printStreamTable(MsfFile& msf, std::ostream& os) {
         auto stream =
             std::dynamic_pointer_cast<MsfFileStream>(msf.getStream(i));
 
-        const auto& pages = stream->pages();
-
         os << std::setw(5) << i << ": " << std::setw(8) << stream->length()
-           << " bytes, " << std::setw(4) << pages.size() << " pages ";
+           << " bytes, " << std::setw(4) << stream->pageCount() << " pages ";
 
-        printPageSequences(pages, os);
+        printPageSequences(stream->pages(), stream->pageCount(), os);
 
         std::cout << std::endl;
     }
@@ -27,7 +27,10 @@
 #include "msf/msf.h"
 #include "pdb/format.h"
 #include "pdb/pdb.h"
+#include "pdbdump/address_index.h"
+#include "pdbdump/check.h"
 #include "pdbdump/dump.h"
+#include "pdbdump/symbols.h"
 
 #include "version.h"
 
@@ -83,6 +86,10 @@ struct OptionNames<char> {
     const char* versionLong  = "--version";
     const char* verboseLong  = "--verbose";
     const char* verboseShort = "-v";
+    const char* checkLong    = "--check";
+    const char* symbolsLong  = "--symbols";
+    const char* indexLong    = "--index";
+    const char* resolveLong  = "--resolve";
     const char* dashDash     = "--";
 };
 
@@ -93,6 +100,10 @@ struct OptionNames<wchar_t> {
     const wchar_t* versionLong  = L"--version";
     const wchar_t* verboseLong  = L"--verbose";
     const wchar_t* verboseShort = L"-v";
+    const wchar_t* checkLong    = L"--check";
+    const wchar_t* symbolsLong  = L"--symbols";
+    const wchar_t* indexLong    = L"--index";
+    const wchar_t* resolveLong  = L"--resolve";
     const wchar_t* dashDash     = L"--";
 };
 
@@ -108,8 +119,24 @@ class CommandOptions {
     const CharT* pdb;
 
     bool verbose;
+    bool check;
+    bool symbols;
 
-    CommandOptions() : pdb(NULL), verbose(false) {}
+    // With --index, the address index to build from the PDB.
+    const CharT* index;
+
+    // With --resolve, the address index to resolve addresses against. The
+    // positional arguments are then the addresses.
+    const CharT* resolve;
+    std::vector<const CharT*> addresses;
+
+    CommandOptions()
+        : pdb(NULL),
+          verbose(false),
+          check(false),
+          symbols(false),
+          index(NULL),
+          resolve(NULL) {}
 
     /**
      * Parses the command line arguments.
@@ -152,6 +179,18 @@ class CommandOptions {
                 onlyPositional = true;
             } else if (arg == opt.verboseLong || arg == opt.verboseShort) {
                 verbose = true;
+            } else if (arg == opt.checkLong) {
+                check = true;
+            } else if (arg == opt.symbolsLong) {
+                symbols = true;
+            } else if (arg == opt.indexLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--index requires a path");
+                index = argv[i];
+            } else if (arg == opt.resolveLong) {
+                if (++i == argc)
+                    throw InvalidCommandLine("--resolve requires a path");
+                resolve = argv[i];
             } else if (arg.length() > 0 && arg.front() == '-') {
                 throw UnknownOption<CharT>(argv[i]);
             } else {
@@ -159,6 +198,11 @@ class CommandOptions {
             }
         }
 
+        if (resolve) {
+            addresses = positional;
+            return;
+        }
+
         switch (positional.size()) {
             case 1:
                 pdb = positional[0];
@@ -176,7 +220,10 @@ class CommandOptions {
 template <typename CharT>
 const OptionNames<CharT> CommandOptions<CharT>::opt = OptionNames<CharT>();
 
-const char* usage = "Usage: pdbdump pdb [--help] [--verbose]";
+const char* usage =
+    "Usage: pdbdump pdb [--help] [--verbose] [--check] [--symbols]\n"
+    "                   [--index INDEX]\n"
+    "       pdbdump --resolve INDEX [address...]";
 
 const char* help =
     R"(
@@ -189,8 +236,74 @@ Optional arguments:
   --help, -h     Prints this help.
   --version      Prints version information.
   --verbose, -v  Prints extra information about the PDB.
+  --check        Checks the integrity of the MSF structure instead of dumping
+                 the PDB. Every page must belong to at most one stream, page
+                 numbers must be in bounds, stream sizes must agree with their
+                 page lists, and the free page map must agree with the pages
+                 that are in use. Exits with 1 if there are any errors.
+  --symbols      Prints the global symbol records and the symbols of each
+                 module instead of dumping the PDB. Records are decoded on
+                 all cores and printed in the order they appear.
+  --index INDEX  Builds an address index from the PDB instead of dumping it.
+                 The index maps addresses to modules and public symbols
+                 without having to parse the PDB again.
+  --resolve INDEX
+                 Resolves addresses against an index built with --index. The
+                 addresses are taken from the command line or, if there are
+                 none, one per line from standard input. An address is either
+                 "section:offset" or an RVA, in hex. For each one, a line with
+                 the address, its section and offset, the module, and the
+                 nearest public symbol is printed, separated by tabs.
 )";
 
+/**
+ * Converts an address from the command line to a narrow string. Addresses
+ * are plain hex, so nothing is lost.
+ */
+template <typename CharT>
+std::string narrow(const CharT* s) {
+    std::string result;
+    for (; *s; ++s) result.push_back((char)*s);
+    return result;
+}
+
+/**
+ * Resolves the addresses given on the command line or on standard input.
+ * Returns 1 if any address couldn't be parsed.
+ */
+template <typename CharT>
+int resolveAddresses(const CommandOptions<CharT>& opts) {
+    const AddressIndex index(opts.resolve);
+
+    // There can be millions of addresses. Don't flush after each one.
+    std::ios_base::sync_with_stdio(false);
+
+    size_t invalid = 0;
+
+    auto resolve = [&](const std::string& address) {
+        if (!resolveAddress(index, address.c_str(), std::cout)) {
+            std::cerr << "Error: Invalid address '" << address << "'\n";
+            ++invalid;
+        }
+    };
+
+    if (opts.addresses.empty()) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            // Ignore blank lines and Windows line endings.
+            const size_t end = line.find_last_not_of(" \t\r");
+            if (end == std::string::npos) continue;
+            line.erase(end + 1);
+
+            resolve(line.substr(line.find_first_not_of(" \t")));
+        }
+    } else {
+        for (auto address : opts.addresses) resolve(narrow(address));
+    }
+
+    return invalid == 0 ? 0 : 1;
+}
+
 template <typename CharT = char>
 int pdbdump(int argc, CharT** argv) {
     CommandOptions<CharT> opts;
@@ -216,7 +329,19 @@ int pdbdump(int argc, CharT** argv) {
     }
 
     try {
-        dumpPdb(opts.pdb, opts.verbose);
+        if (opts.resolve) return resolveAddresses(opts);
+
+        if (opts.check) return checkPdb(opts.pdb) == 0 ? 0 : 1;
+
+        if (opts.index)
+            buildAddressIndex(opts.pdb, opts.index);
+        else if (opts.symbols)
+            dumpSymbols(opts.pdb);
+        else
+            dumpPdb(opts.pdb, opts.verbose);
+    } catch (const InvalidIndex& error) {
+        std::cerr << "Error: Invalid address index (" << error.why() << ")\n";
+        return 1;
     } catch (const InvalidMsf& error) {
         std::cerr << "Error: Invalid PDB MSF format (" << error.why() << ")\n";
         return 1;
@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pdbdump/symbols.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "msf/memory_stream.h"
+#include "msf/msf.h"
+#include "pdb/cvinfo.h"
+#include "pdb/format.h"
+#include "pdb/pdb.h"
+#include "util/file.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+// Number of bytes of records decoded by each task. This is large enough that
+// scheduling a task costs next to nothing in comparison, but small enough to
+// keep every thread busy on small streams.
+const size_t kChunkSize = 1 << 20;
+
+// Maximum number of chunks in flight per thread. Decoded text is held in
+// memory until all of the chunks before it have been printed.
+const size_t kChunksPerThread = 4;
+
+/**
+ * Returns the name of a symbol record type, or null if it isn't known.
+ */
+const char* symbolTypeName(uint16_t type) {
+#define SYMBOL_TYPE(t) \
+    case t:            \
+        return #t;
+
+    switch (type) {
+        SYMBOL_TYPE(S_END)
+        SYMBOL_TYPE(S_SKIP)
+        SYMBOL_TYPE(S_ALIGN)
+        SYMBOL_TYPE(S_FRAMEPROC)
+        SYMBOL_TYPE(S_ANNOTATION)
+        SYMBOL_TYPE(S_OBJNAME)
+        SYMBOL_TYPE(S_THUNK32)
+        SYMBOL_TYPE(S_BLOCK32)
+        SYMBOL_TYPE(S_LABEL32)
+        SYMBOL_TYPE(S_REGISTER)
+        SYMBOL_TYPE(S_CONSTANT)
+        SYMBOL_TYPE(S_UDT)
+        SYMBOL_TYPE(S_BPREL32)
+        SYMBOL_TYPE(S_LDATA32)
+        SYMBOL_TYPE(S_GDATA32)
+        SYMBOL_TYPE(S_PUB32)
+        SYMBOL_TYPE(S_LPROC32)
+        SYMBOL_TYPE(S_GPROC32)
+        SYMBOL_TYPE(S_REGREL32)
+        SYMBOL_TYPE(S_LTHREAD32)
+        SYMBOL_TYPE(S_GTHREAD32)
+        SYMBOL_TYPE(S_COMPILE2)
+        SYMBOL_TYPE(S_UNAMESPACE)
+        SYMBOL_TYPE(S_PROCREF)
+        SYMBOL_TYPE(S_DATAREF)
+        SYMBOL_TYPE(S_LPROCREF)
+        SYMBOL_TYPE(S_ANNOTATIONREF)
+        SYMBOL_TYPE(S_TOKENREF)
+        SYMBOL_TYPE(S_TRAMPOLINE)
+        SYMBOL_TYPE(S_SECTION)
+        SYMBOL_TYPE(S_COFFGROUP)
+        SYMBOL_TYPE(S_EXPORT)
+        SYMBOL_TYPE(S_CALLSITEINFO)
+        SYMBOL_TYPE(S_FRAMECOOKIE)
+        SYMBOL_TYPE(S_COMPILE3)
+        SYMBOL_TYPE(S_ENVBLOCK)
+        SYMBOL_TYPE(S_LOCAL)
+        SYMBOL_TYPE(S_DEFRANGE_REGISTER)
+        SYMBOL_TYPE(S_DEFRANGE_FRAMEPOINTER_REL)
+        SYMBOL_TYPE(S_DEFRANGE_SUBFIELD_REGISTER)
+        SYMBOL_TYPE(S_DEFRANGE_FRAMEPOINTER_REL_FULL_SCOPE)
+        SYMBOL_TYPE(S_DEFRANGE_REGISTER_REL)
+        SYMBOL_TYPE(S_LPROC32_ID)
+        SYMBOL_TYPE(S_GPROC32_ID)
+        SYMBOL_TYPE(S_BUILDINFO)
+        SYMBOL_TYPE(S_INLINESITE)
+        SYMBOL_TYPE(S_INLINESITE_END)
+        SYMBOL_TYPE(S_PROC_ID_END)
+        SYMBOL_TYPE(S_FILESTATIC)
+        SYMBOL_TYPE(S_CALLEES)
+        SYMBOL_TYPE(S_CALLERS)
+        SYMBOL_TYPE(S_HEAPALLOCSITE)
+        SYMBOL_TYPE(S_INLINESITE2)
+    }
+
+#undef SYMBOL_TYPE
+
+    return nullptr;
+}
+
+/**
+ * Decodes a numeric leaf. Returns the number of bytes it takes up, or 0 if it
+ * is invalid or of a kind that isn't handled.
+ */
+size_t readNumeric(const uint8_t* p, size_t length, uint64_t& value) {
+    if (length < sizeof(uint16_t)) return 0;
+
+    uint16_t leaf;
+    memcpy(&leaf, p, sizeof(leaf));
+
+    if (leaf < LF_NUMERIC) {
+        value = leaf;
+        return sizeof(leaf);
+    }
+
+    size_t size;
+    switch (leaf) {
+        case LF_CHAR:
+            size = 1;
+            break;
+        case LF_SHORT:
+        case LF_USHORT:
+            size = 2;
+            break;
+        case LF_LONG:
+        case LF_ULONG:
+            size = 4;
+            break;
+        case LF_QUADWORD:
+        case LF_UQUADWORD:
+            size = 8;
+            break;
+        default:
+            return 0;
+    }
+
+    if (length - sizeof(leaf) < size) return 0;
+
+    value = 0;
+    memcpy(&value, p + sizeof(leaf), size);
+    return sizeof(leaf) + size;
+}
+
+/**
+ * Appends a printf-style formatted string.
+ */
+template <typename... Args>
+void appendf(std::string& out, const char* format, Args... args) {
+    char buf[128];
+    const int n = snprintf(buf, sizeof(buf), format, args...);
+    if (n > 0) out.append(buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+/**
+ * Appends a NUL-terminated name that must not run past the end of the record.
+ */
+void appendName(std::string& out, const uint8_t* name, const uint8_t* end) {
+    out.push_back(' ');
+    out.append((const char*)name, strnlen((const char*)name, end - name));
+}
+
+/**
+ * Decodes one record. The record type and its offset have already been
+ * printed. Records that are too short for their type are printed as unknown.
+ */
+void decodeRecord(const SymbolRecord* rec, size_t length, std::string& out) {
+    const uint8_t* p   = (const uint8_t*)rec;
+    const uint8_t* end = p + length;
+
+    switch (rec->type) {
+        case S_PUB32: {
+            if (length < offsetof(PUBSYM32, name)) break;
+            const PUBSYM32* sym = (const PUBSYM32*)rec;
+            uint32_t flags;
+            memcpy(&flags, &sym->pubsymflags, sizeof(flags));
+            appendf(out, " [%04x:%08x] flags=0x%x", sym->seg, sym->off, flags);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_LDATA32:
+        case S_GDATA32:
+        case S_LTHREAD32:
+        case S_GTHREAD32: {
+            // Thread storage symbols have the same layout as data symbols.
+            if (length < offsetof(DATASYM32, name)) break;
+            const DATASYM32* sym = (const DATASYM32*)rec;
+            appendf(out, " [%04x:%08x] type=0x%x", sym->seg, sym->off,
+                    sym->typind);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_LPROC32:
+        case S_GPROC32:
+        case S_LPROC32_ID:
+        case S_GPROC32_ID: {
+            if (length < offsetof(PROCSYM32, name)) break;
+            const PROCSYM32* sym = (const PROCSYM32*)rec;
+            appendf(out,
+                    " [%04x:%08x] len=0x%x type=0x%x parent=0x%x end=0x%x "
+                    "next=0x%x",
+                    sym->seg, sym->off, sym->len, sym->typind, sym->pParent,
+                    sym->pEnd, sym->pNext);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_BLOCK32: {
+            if (length < offsetof(BLOCKSYM32, name)) break;
+            const BLOCKSYM32* sym = (const BLOCKSYM32*)rec;
+            appendf(out, " [%04x:%08x] len=0x%x parent=0x%x end=0x%x",
+                    sym->seg, sym->off, sym->len, sym->pParent, sym->pEnd);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_LABEL32: {
+            if (length < offsetof(LABELSYM32, name)) break;
+            const LABELSYM32* sym = (const LABELSYM32*)rec;
+            appendf(out, " [%04x:%08x]", sym->seg, sym->off);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_PROCREF:
+        case S_DATAREF:
+        case S_LPROCREF:
+        case S_ANNOTATIONREF: {
+            if (length < offsetof(REFSYM2, name)) break;
+            const REFSYM2* sym = (const REFSYM2*)rec;
+            appendf(out, " module=%u offset=0x%x", sym->imod, sym->ibSym);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_UDT: {
+            if (length < offsetof(UDTSYM, name)) break;
+            const UDTSYM* sym = (const UDTSYM*)rec;
+            appendf(out, " type=0x%x", sym->typind);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_CONSTANT: {
+            if (length < offsetof(CONSTSYM, value)) break;
+            const CONSTSYM* sym = (const CONSTSYM*)rec;
+            const uint8_t* value = p + offsetof(CONSTSYM, value);
+
+            uint64_t n;
+            const size_t size = readNumeric(value, end - value, n);
+            if (size == 0) break;
+
+            appendf(out, " type=0x%x value=%llu", sym->typind,
+                    (unsigned long long)n);
+            appendName(out, value + size, end);
+            return;
+        }
+
+        case S_REGREL32: {
+            if (length < offsetof(REGREL32, name)) break;
+            const REGREL32* sym = (const REGREL32*)rec;
+            appendf(out, " reg=%u offset=0x%x type=0x%x", sym->reg, sym->off,
+                    sym->typind);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_BPREL32: {
+            if (length < offsetof(BPRELSYM32, name)) break;
+            const BPRELSYM32* sym = (const BPRELSYM32*)rec;
+            appendf(out, " offset=%d type=0x%x", sym->off, sym->typind);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_OBJNAME: {
+            if (length < offsetof(OBJNAMESYM, name)) break;
+            const OBJNAMESYM* sym = (const OBJNAMESYM*)rec;
+            appendf(out, " signature=0x%x", sym->signature);
+            appendName(out, sym->name, end);
+            return;
+        }
+
+        case S_END:
+        case S_PROC_ID_END:
+        case S_INLINESITE_END:
+            return;
+    }
+
+    appendf(out, " length=%u", (unsigned)length);
+}
+
+/**
+ * Decodes the records in [begin, end) of a stream. The record lengths must
+ * have already been checked.
+ */
+void decodeRecords(const uint8_t* data, size_t begin, size_t end,
+                   std::string& out) {
+    // Most records are short. This avoids most of the reallocations.
+    out.reserve((end - begin) * 2);
+
+    for (size_t i = begin; i < end;) {
+        const SymbolRecord* rec = (const SymbolRecord*)(data + i);
+        const size_t length     = sizeof(rec->length) + rec->length;
+
+        appendf(out, "0x%08llx ", (unsigned long long)i);
+
+        if (const char* name = symbolTypeName(rec->type))
+            out.append(name);
+        else
+            appendf(out, "0x%04x", rec->type);
+
+        decodeRecord(rec, length, out);
+        out.push_back('\n');
+
+        i += length;
+    }
+}
+
+/**
+ * A piece of the output. Either text that is ready to print or a range of
+ * records that is being decoded.
+ */
+struct SymbolChunk {
+    // Keeps the records alive until they are decoded.
+    std::shared_ptr<MsfMemoryStream> stream;
+    size_t begin, end;
+
+    std::string text;
+    std::exception_ptr error;
+    bool done;
+
+    SymbolChunk() : begin(0), end(0), done(false) {}
+};
+
+/**
+ * Decodes chunks of records on a thread pool and prints them in order.
+ */
+class SymbolPrinter {
+   private:
+    ThreadPool& _pool;
+    std::ostream& _os;
+
+    std::mutex _mutex;
+    std::condition_variable _finished;
+
+    // Chunks that haven't been printed yet, in order.
+    std::deque<std::unique_ptr<SymbolChunk>> _pending;
+    size_t _window;
+
+    void _push(std::unique_ptr<SymbolChunk> chunk);
+    void _decode(std::shared_ptr<MsfMemoryStream> stream, size_t begin,
+                 size_t end);
+    void _printFront();
+
+   public:
+    SymbolPrinter(ThreadPool& pool, std::ostream& os)
+        : _pool(pool), _os(os), _window(pool.size() * kChunksPerThread) {}
+
+    /**
+     * Waits for chunks that are still being decoded. They can only be left
+     * over if an exception was thrown.
+     */
+    ~SymbolPrinter();
+
+    /**
+     * Prints text after everything before it has been printed.
+     */
+    void print(std::string text);
+
+    /**
+     * Decodes the records in [begin, end) of a stream. This only walks the
+     * record lengths to find where to split the stream. The records themselves
+     * are decoded on the thread pool.
+     */
+    void records(std::shared_ptr<MsfMemoryStream> stream, size_t begin,
+                 size_t end);
+
+    /**
+     * Prints everything that is left.
+     */
+    void finish();
+};
+
+SymbolPrinter::~SymbolPrinter() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (auto&& chunk : _pending) {
+        SymbolChunk* c = chunk.get();
+        _finished.wait(lock, [c] { return c->done; });
+    }
+}
+
+void SymbolPrinter::_push(std::unique_ptr<SymbolChunk> chunk) {
+    while (_pending.size() >= _window) _printFront();
+    _pending.push_back(std::move(chunk));
+}
+
+void SymbolPrinter::_decode(std::shared_ptr<MsfMemoryStream> stream,
+                            size_t begin, size_t end) {
+    std::unique_ptr<SymbolChunk> chunk(new SymbolChunk());
+    chunk->stream = stream;
+    chunk->begin  = begin;
+    chunk->end    = end;
+
+    SymbolChunk* c = chunk.get();
+    _push(std::move(chunk));
+
+    _pool.run([this, c] {
+        try {
+            decodeRecords(c->stream->data(), c->begin, c->end, c->text);
+        } catch (...) {
+            c->error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            c->done = true;
+        }
+
+        _finished.notify_all();
+    });
+}
+
+void SymbolPrinter::_printFront() {
+    SymbolChunk* chunk = _pending.front().get();
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished.wait(lock, [chunk] { return chunk->done; });
+    }
+
+    if (chunk->error) std::rethrow_exception(chunk->error);
+
+    _os.write(chunk->text.data(), chunk->text.size());
+    _pending.pop_front();
+}
+
+void SymbolPrinter::print(std::string text) {
+    std::unique_ptr<SymbolChunk> chunk(new SymbolChunk());
+    chunk->text = std::move(text);
+    chunk->done = true;
+    _push(std::move(chunk));
+}
+
+void SymbolPrinter::records(std::shared_ptr<MsfMemoryStream> stream,
+                            size_t begin, size_t end) {
+    const uint8_t* data = stream->data();
+
+    size_t start = begin;
+    size_t i     = begin;
+
+    while (end - i >= sizeof(SymbolRecord)) {
+        uint16_t length;
+        memcpy(&length, data + i, sizeof(length));
+
+        if (length < sizeof(uint16_t) || length > end - i - sizeof(length))
+            throw InvalidPdb("invalid symbol record size");
+
+        i += sizeof(length) + length;
+
+        if (i - start >= kChunkSize) {
+            _decode(stream, start, i);
+            start = i;
+        }
+    }
+
+    if (i > start) _decode(stream, start, i);
+}
+
+void SymbolPrinter::finish() {
+    while (!_pending.empty()) _printFront();
+}
+
+/**
+ * Reads a whole stream into memory. Returns null if it doesn't exist.
+ */
+std::shared_ptr<MsfMemoryStream> readStream(MsfFile& msf, size_t index) {
+    auto stream = msf.getStream(index);
+    if (!stream) return nullptr;
+
+    return std::make_shared<MsfMemoryStream>(stream.get());
+}
+
+/**
+ * Prints the symbols of each module in the module info sub-stream.
+ */
+void printModuleSymbols(MsfFile& msf, const uint8_t* modInfo, size_t length,
+                        SymbolPrinter& printer) {
+    size_t moduleCount = 0;
+
+    for (size_t i = 0; i < length; ++moduleCount) {
+        if (length - i < sizeof(ModuleInfo))
+            throw InvalidPdb("got partial DBI module info");
+
+        const ModuleInfo* info = (const ModuleInfo*)(modInfo + i);
+        i += info->size();
+
+        printer.print("\nModule Symbols\n"
+                      "--------------\n"
+                      "Module ID:   " +
+                      std::to_string(moduleCount) + "\n" +
+                      "Module Name: '" + info->moduleName() + "'\n" +
+                      "Stream ID:   " + std::to_string(info->stream) +
+                      "\n\n");
+
+        if (info->stream == (uint16_t)-1) continue;
+
+        auto stream = readStream(msf, info->stream);
+        if (!stream) continue;
+
+        // The symbols start after a 4-byte signature.
+        const size_t end =
+            std::min<size_t>(info->symbolsSize, stream->length());
+        if (end > sizeof(uint32_t))
+            printer.records(stream, sizeof(uint32_t), end);
+    }
+}
+
+void dumpSymbols(MsfFile& msf, ThreadPool& pool, std::ostream& os) {
+    auto dbiStream = readStream(msf, (size_t)PdbStreamType::dbi);
+    if (!dbiStream || dbiStream->length() < sizeof(DbiHeader))
+        throw InvalidPdb("missing DBI stream");
+
+    const DbiHeader* dbi = (const DbiHeader*)dbiStream->data();
+    if (dbiStream->length() - sizeof(DbiHeader) < dbi->gpModInfoSize)
+        throw InvalidPdb("got partial DBI module info");
+
+    SymbolPrinter printer(pool, os);
+
+    printer.print("Symbol Records\n"
+                  "==============\n"
+                  "Stream ID: " +
+                  std::to_string(dbi->symbolRecordsStream) + "\n\n");
+
+    if (dbi->symbolRecordsStream != (uint16_t)-1) {
+        if (auto stream = readStream(msf, dbi->symbolRecordsStream))
+            printer.records(stream, 0, stream->length());
+    }
+
+    printModuleSymbols(msf, dbiStream->data() + sizeof(DbiHeader),
+                       dbi->gpModInfoSize, printer);
+
+    printer.finish();
+}
+
+template <typename CharT>
+void dumpSymbolsImpl(const CharT* path) {
+    auto pdb = openFile(path, FileMode<CharT>::readExisting);
+
+    MsfFile msf(pdb);
+
+    ThreadPool pool;
+
+    dumpSymbols(msf, pool, std::cout);
+}
+
+}  // namespace
+
+#if defined(_WIN32) && defined(UNICODE)
+
+void dumpSymbols(const wchar_t* path) { dumpSymbolsImpl(path); }
+
+#else
+
+void dumpSymbols(const char* path) { dumpSymbolsImpl(path); }
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+/**
+ * Prints the global symbol records and the symbols of each module.
+ *
+ * The symbol record stream of a large PDB can hold tens of millions of
+ * records, so they are decoded in parallel. Streams are split into chunks at
+ * record boundaries by walking the chain of record lengths, each chunk is
+ * decoded on the thread pool into its own buffer, and the buffers are printed
+ * in order. Only a bounded number of chunks are in flight at any one time, so
+ * memory use doesn't grow with the size of the PDB.
+ */
+#if defined(_WIN32) && defined(UNICODE)
+
+void dumpSymbols(const wchar_t* path);
+
+#else
+
+void dumpSymbols(const char* path);
+
+#endif
@@ -145,6 +145,7 @@ typedef struct _IMAGE_FILE_HEADER {
 #define IMAGE_FILE_MACHINE_AMD64 0x8664  // AMD64 (K8)
 #define IMAGE_FILE_MACHINE_M32R 0x9041   // M32R little-endian
 #define IMAGE_FILE_MACHINE_CEE 0xC0EE
+#define IMAGE_FILE_MACHINE_ARM64 0xAA64  // ARM64 Little-Endian
 
 //
 // Directory format.
@@ -392,6 +393,65 @@ typedef struct _IMAGE_SECTION_HEADER {
 
 #define IMAGE_SIZEOF_SECTION_HEADER 40
 
+//
+// Archive format.
+//
+
+#define IMAGE_ARCHIVE_START_SIZE 8
+#define IMAGE_ARCHIVE_START "!<arch>\n"
+#define IMAGE_ARCHIVE_END "`\n"
+#define IMAGE_ARCHIVE_PAD "\n"
+#define IMAGE_ARCHIVE_LINKER_MEMBER "/               "
+#define IMAGE_ARCHIVE_LONGNAMES_MEMBER "//              "
+#define IMAGE_ARCHIVE_HYBRIDMAP_MEMBER "/<HYBRIDMAP>/   "
+
+typedef struct _IMAGE_ARCHIVE_MEMBER_HEADER {
+    uint8_t Name[16];      // File member name - `/' terminated.
+    uint8_t Date[12];      // File member date - decimal.
+    uint8_t UserID[6];     // File member user id - decimal.
+    uint8_t GroupID[6];    // File member group id - decimal.
+    uint8_t Mode[8];       // File member mode - octal.
+    uint8_t Size[10];      // File member size - decimal.
+    uint8_t EndHeader[2];  // String to end header.
+} IMAGE_ARCHIVE_MEMBER_HEADER, *PIMAGE_ARCHIVE_MEMBER_HEADER;
+
+#define IMAGE_SIZEOF_ARCHIVE_MEMBER_HDR 60
+
+//
+// Headers of archive members that aren't regular COFF objects: import
+// descriptions of import libraries, and anonymous objects such as /bigobj and
+// /GL objects. Both start with Sig1 == IMAGE_FILE_MACHINE_UNKNOWN and
+// Sig2 == 0xFFFF.
+//
+
+typedef struct _IMPORT_OBJECT_HEADER {
+    uint16_t Sig1;  // Must be IMAGE_FILE_MACHINE_UNKNOWN
+    uint16_t Sig2;  // Must be IMPORT_OBJECT_HDR_SIG2.
+    uint16_t Version;
+    uint16_t Machine;
+    uint32_t TimeDateStamp;  // Time/date stamp
+    uint32_t SizeOfData;     // particularly useful for incremental links
+
+    union {
+        uint16_t Ordinal;  // if grf & IMPORT_OBJECT_ORDINAL
+        uint16_t Hint;
+    };
+
+    uint16_t Flags;  // Type, name type, and reserved bits.
+} IMPORT_OBJECT_HEADER;
+
+#define IMPORT_OBJECT_HDR_SIG2 0xffff
+
+typedef struct _ANON_OBJECT_HEADER {
+    uint16_t Sig1;  // Must be IMAGE_FILE_MACHINE_UNKNOWN
+    uint16_t Sig2;  // Must be 0xffff
+    uint16_t Version;
+    uint16_t Machine;
+    uint32_t TimeDateStamp;
+    uint8_t ClassID[16];
+    uint32_t SizeOfData;  // Size of data that follows the header
+} ANON_OBJECT_HEADER;
+
 //
 // CodeView Info
 //
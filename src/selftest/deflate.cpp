@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "selftest/selftest.h"
+
+#include "util/deflate.h"
+
+namespace {
+
+// Block types, from the BTYPE field of a block header.
+const unsigned kStoredBlock  = 0;
+const unsigned kFixedBlock   = 1;
+const unsigned kDynamicBlock = 2;
+
+// Streams made with zlib, one for each kind of block. See referenceText().
+const uint8_t kZlibStored[] = {
+    0x01, 0x1f, 0x00, 0xe0, 0xff, 0x53, 0x74, 0x6f, 0x72, 0x65, 0x64, 0x20,
+    0x62, 0x6c, 0x6f, 0x63, 0x6b, 0x73, 0x20, 0x61, 0x72, 0x65, 0x20, 0x63,
+    0x6f, 0x70, 0x69, 0x65, 0x64, 0x20, 0x61, 0x73, 0x20, 0x69, 0x73, 0x2e,
+};
+
+const uint8_t kZlibFixed[] = {
+    0x4b, 0x4c, 0x4a, 0x4e, 0x84, 0x21, 0x1d, 0x85, 0xb4, 0xcc, 0x8a,
+    0xd4, 0x14, 0x05, 0x8f, 0xd2, 0xb4, 0xb4, 0xdc, 0xc4, 0x3c, 0x85,
+    0xe4, 0xfc, 0x94, 0xd4, 0x62, 0x1d, 0x85, 0x44, 0x24, 0x25, 0x00,
+};
+
+const uint8_t kZlibDynamic[] = {
+    0x85, 0xd1, 0x4b, 0x0a, 0x80, 0x30, 0x0c, 0x45, 0xd1, 0xad, 0x64, 0x01,
+    0x22, 0x8d, 0xfd, 0x2f, 0x47, 0x21, 0xe2, 0xa0, 0x58, 0xd0, 0x82, 0xdb,
+    0x77, 0x01, 0xaf, 0x24, 0xe3, 0xcb, 0x19, 0x5d, 0xde, 0xe8, 0xe8, 0x63,
+    0x34, 0x79, 0xa9, 0x9f, 0x74, 0x88, 0x3c, 0xd4, 0x6f, 0x1a, 0x97, 0xd0,
+    0xb7, 0xb7, 0xb6, 0x10, 0x43, 0x5f, 0x89, 0xd9, 0x30, 0x3c, 0x31, 0xce,
+    0x30, 0x0e, 0x4d, 0xd5, 0x49, 0x45, 0x51, 0x74, 0x51, 0x50, 0x64, 0x5d,
+    0x64, 0x14, 0x49, 0x17, 0x09, 0x45, 0xd4, 0x45, 0x44, 0x11, 0x74, 0x11,
+    0x50, 0x78, 0x5d, 0x78, 0x14, 0xc6, 0xf8, 0xd9, 0x77, 0x63, 0x21, 0x8a,
+    0x1f,
+};
+
+/**
+ * Text that compresses well with a Huffman code of its own.
+ */
+std::string referenceText() {
+    std::string text;
+
+    for (int i = 12; i > 0; --i) {
+        char line[64];
+        snprintf(line, sizeof(line),
+                 "%d bottles of beer on the wall, %d bottles of beer. ", i, i);
+        text += line;
+    }
+
+    return text;
+}
+
+std::vector<uint8_t> bytes(const std::string& s) {
+    return std::vector<uint8_t>(s.begin(), s.end());
+}
+
+/**
+ * Bytes that don't compress at all.
+ */
+std::vector<uint8_t> noise(size_t length) {
+    std::vector<uint8_t> data(length);
+
+    // Any fixed generator will do. This is the one from Numerical Recipes.
+    uint32_t x = 12345;
+    for (auto&& b : data) {
+        x = x * 1664525 + 1013904223;
+        b = (uint8_t)(x >> 24);
+    }
+
+    return data;
+}
+
+std::vector<uint8_t> inflated(const uint8_t* data, size_t length) {
+    std::vector<uint8_t> out;
+    inflate(data, length, out);
+    return out;
+}
+
+/**
+ * Compresses and decompresses the data, checking that it comes back the same.
+ * Returns the type of the first block.
+ */
+unsigned roundTrip(const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> compressed;
+    deflate(data.data(), data.size(), compressed);
+
+    CHECK(!compressed.empty());
+    CHECK(inflated(compressed.data(), compressed.size()) == data);
+
+    return (compressed[0] >> 1) & 3;
+}
+
+void checkInflateZlib() {
+    CHECK((kZlibStored[0] >> 1 & 3) == kStoredBlock);
+    CHECK(inflated(kZlibStored, sizeof(kZlibStored)) ==
+          bytes("Stored blocks are copied as is."));
+
+    CHECK((kZlibFixed[0] >> 1 & 3) == kFixedBlock);
+    CHECK(inflated(kZlibFixed, sizeof(kZlibFixed)) ==
+          bytes("abcabcabcabc, fixed Huffman codes, abcabcabcabc"));
+
+    CHECK((kZlibDynamic[0] >> 1 & 3) == kDynamicBlock);
+    CHECK(inflated(kZlibDynamic, sizeof(kZlibDynamic)) ==
+          bytes(referenceText()));
+}
+
+void checkRoundTrip() {
+    CHECK(roundTrip(std::vector<uint8_t>()) != 3);
+
+    CHECK(roundTrip(noise(1000)) == kStoredBlock);
+
+    // Stored blocks hold at most 64 KiB, so this takes several.
+    CHECK(roundTrip(noise(200000)) == kStoredBlock);
+
+    CHECK(roundTrip(bytes("abcabcabcabc, fixed Huffman codes, abcabcabcabc")) ==
+          kFixedBlock);
+
+    CHECK(roundTrip(bytes(referenceText())) == kDynamicBlock);
+
+    // Long runs need matches at the maximum length and distance.
+    std::vector<uint8_t> runs(100000, 'a');
+    for (size_t i = 0; i < runs.size(); i += 40000) runs[i] = 'b';
+    roundTrip(runs);
+
+    // A mix of everything, across many blocks.
+    std::vector<uint8_t> mixed;
+    for (int i = 0; i < 50; ++i) {
+        const auto n = noise(1000 + i);
+        const auto t = bytes(referenceText());
+        mixed.insert(mixed.end(), n.begin(), n.end());
+        mixed.insert(mixed.end(), t.begin(), t.end());
+    }
+    roundTrip(mixed);
+}
+
+void checkInvalid() {
+    std::vector<uint8_t> out;
+
+    // Block type 3 is reserved.
+    const uint8_t reserved[] = {0x07, 0x00};
+    CHECK_THROWS(inflate(reserved, sizeof(reserved), out), InvalidDeflate);
+
+    // The length of a stored block must match its complement.
+    const uint8_t badLength[] = {0x01, 0x01, 0x00, 0x00, 0x00, 'x'};
+    CHECK_THROWS(inflate(badLength, sizeof(badLength), out), InvalidDeflate);
+
+    CHECK_THROWS(inflate(kZlibStored, sizeof(kZlibStored) - 1, out),
+                 InvalidDeflate);
+    CHECK_THROWS(inflate(kZlibDynamic, sizeof(kZlibDynamic) / 2, out),
+                 InvalidDeflate);
+}
+
+}  // namespace
+
+void checkDeflate() {
+    checkInflateZlib();
+    checkRoundTrip();
+    checkInvalid();
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <iostream>
+#include <system_error>
+
+#include "selftest/selftest.h"
+
+#include "util/deflate.h"
+#include "util/zip.h"
+
+namespace {
+
+struct Check {
+    const char* name;
+    void (*run)();
+};
+
+const Check checks[] = {
+    {"deflate", checkDeflate},
+    {"zip", checkZip},
+};
+
+/**
+ * Runs one check. Returns false and prints why if it failed.
+ */
+bool run(const Check& check) {
+    try {
+        check.run();
+        std::cout << "ok      " << check.name << "\n";
+        return true;
+    } catch (const CheckFailed& error) {
+        std::cout << "FAILED  " << check.name << ": " << error.file() << ":"
+                  << error.line() << ": CHECK(" << error.what() << ")\n";
+    } catch (const InvalidDeflate& error) {
+        std::cout << "FAILED  " << check.name << ": Invalid deflate data ("
+                  << error.why() << ")\n";
+    } catch (const InvalidZip& error) {
+        std::cout << "FAILED  " << check.name << ": Invalid zip archive ("
+                  << error.why() << ")\n";
+    } catch (const std::system_error& error) {
+        std::cout << "FAILED  " << check.name << ": " << error.what() << "\n";
+    }
+
+    return false;
+}
+
+}  // namespace
+
+int main() {
+    size_t failed = 0;
+
+    for (auto&& check : checks) {
+        if (!run(check)) ++failed;
+    }
+
+    if (failed > 0) {
+        std::cout << failed << " check(s) failed\n";
+        return 1;
+    }
+
+    return 0;
+}
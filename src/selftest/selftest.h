@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Self-checks for the parts of ducible that can be tested on their own. Unlike
+ * the tests in tests/, these don't need a compiler toolchain and run wherever
+ * `make check` does.
+ */
+
+#pragma once
+
+/**
+ * Thrown when a check fails.
+ */
+class CheckFailed {
+   private:
+    const char* _what;
+    const char* _file;
+    int _line;
+
+   public:
+    CheckFailed(const char* what, const char* file, int line)
+        : _what(what), _file(file), _line(line) {}
+
+    const char* what() const { return _what; }
+    const char* file() const { return _file; }
+    int line() const { return _line; }
+};
+
+#define CHECK(cond)                                                \
+    do {                                                           \
+        if (!(cond)) throw CheckFailed(#cond, __FILE__, __LINE__); \
+    } while (0)
+
+/**
+ * Checks that `expr` throws an exception of the given type.
+ */
+#define CHECK_THROWS(expr, Exception)                                \
+    do {                                                             \
+        bool thrown = false;                                         \
+        try {                                                        \
+            expr;                                                    \
+        } catch (const Exception&) {                                 \
+            thrown = true;                                           \
+        }                                                            \
+        if (!thrown)                                                 \
+            throw CheckFailed(#expr " throws " #Exception, __FILE__, \
+                              __LINE__);                             \
+    } while (0)
+
+void checkDeflate();
+void checkZip();
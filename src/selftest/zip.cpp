@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "selftest/selftest.h"
+
+#include "util/crc32.h"
+#include "util/deflate.h"
+#include "util/zip.h"
+
+namespace {
+
+struct Member {
+    std::string name;
+    std::string contents;
+    uint16_t method;
+};
+
+ZipEntry makeEntry(const Member& member, std::vector<uint8_t>& data) {
+    const uint8_t* contents = (const uint8_t*)member.contents.data();
+    const size_t length     = member.contents.size();
+
+    data.clear();
+    if (member.method == kZipDeflated)
+        deflate(contents, length, data);
+    else
+        data.assign(contents, contents + length);
+
+    ZipEntry entry;
+    entry.name             = member.name;
+    entry.method           = member.method;
+    entry.crc32            = crc32(0, contents, length);
+    entry.compressedSize   = (uint32_t)data.size();
+    entry.uncompressedSize = (uint32_t)length;
+    return entry;
+}
+
+/**
+ * Writes an archive with the given members and returns its bytes.
+ */
+std::vector<uint8_t> writeArchive(const std::vector<Member>& members,
+                                  const std::string& comment) {
+    FileRef f(tmpfile(), [](FILE* f) {
+        if (f) fclose(f);
+    });
+    if (!f) {
+        throw std::system_error(errno, std::system_category(),
+                                "tmpfile() failed");
+    }
+
+    ZipWriter writer(f);
+
+    for (auto&& member : members) {
+        std::vector<uint8_t> data;
+        const ZipEntry entry = makeEntry(member, data);
+        writer.add(entry, data.data());
+    }
+
+    writer.finish(comment);
+
+    std::vector<uint8_t> buf;
+
+    rewind(f.get());
+
+    uint8_t chunk[4096];
+    while (size_t n = fread(chunk, 1, sizeof(chunk), f.get()))
+        buf.insert(buf.end(), chunk, chunk + n);
+
+    return buf;
+}
+
+void checkCrc32() {
+    CHECK(crc32(0, "123456789", 9) == 0xCBF43926);
+
+    // The CRC can be computed in pieces.
+    CHECK(crc32(crc32(0, "1234", 4), "56789", 5) == 0xCBF43926);
+}
+
+void checkRoundTrip() {
+    std::string big;
+    for (int i = 0; i < 1000; ++i) big += "lib/net45/Package.dll ";
+
+    const std::vector<Member> members = {
+        {"empty.txt", "", kZipStored},
+        {"stored.txt", "Stored as is.", kZipStored},
+        {"lib/net45/deflated.txt", big, kZipDeflated},
+    };
+
+    const std::vector<uint8_t> archive = writeArchive(members, "comment");
+
+    std::string comment;
+    const std::vector<ZipEntry> entries =
+        readZipDirectory(archive.data(), archive.size(), &comment);
+
+    CHECK(comment == "comment");
+    CHECK(entries.size() == members.size());
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        CHECK(entries[i].name == members[i].name);
+        CHECK(entries[i].method == members[i].method);
+
+        // This also checks the CRC.
+        std::vector<uint8_t> contents;
+        extractZipEntry(archive.data(), entries[i], contents);
+
+        CHECK(std::string(contents.begin(), contents.end()) ==
+              members[i].contents);
+    }
+
+    // The archive is the same every time it is written.
+    CHECK(writeArchive(members, "comment") == archive);
+}
+
+void checkCorrupt() {
+    const std::vector<Member> members = {
+        {"stored.txt", "Stored as is.", kZipStored},
+    };
+
+    std::vector<uint8_t> archive = writeArchive(members, "");
+
+    std::vector<ZipEntry> entries =
+        readZipDirectory(archive.data(), archive.size());
+    CHECK(entries.size() == 1);
+
+    // A flipped bit in the member's data is caught by the CRC.
+    archive[entries[0].dataOffset] ^= 1;
+
+    std::vector<uint8_t> contents;
+    CHECK_THROWS(extractZipEntry(archive.data(), entries[0], contents),
+                 InvalidZip);
+
+    // Without the end of central directory record, it isn't an archive.
+    CHECK_THROWS(readZipDirectory(archive.data(), archive.size() - 1),
+                 InvalidZip);
+    CHECK_THROWS(readZipDirectory(archive.data(), 10), InvalidZip);
+}
+
+}  // namespace
+
+void checkZip() {
+    checkCrc32();
+    checkRoundTrip();
+    checkCorrupt();
+}
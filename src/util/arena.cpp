@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/arena.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <new>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+// Chunks are a multiple of this size. On Linux, this lets the kernel back them
+// with transparent huge pages.
+const size_t kChunkAlignment = 2 * 1024 * 1024;
+
+// Minimum size of a chunk.
+const size_t kMinChunkSize = 4 * kChunkAlignment;
+
+}  // namespace
+
+Arena::Arena() : _current(0), _offset(0), _used(0), _peak(0) {}
+
+Arena::~Arena() {
+    for (auto&& chunk : _chunks) _unmapChunk(chunk);
+}
+
+Arena::Chunk Arena::_mapChunk(size_t size) {
+    Chunk chunk;
+    chunk.size = size;
+
+#if defined(_WIN32)
+    chunk.base =
+        VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!chunk.base) throw std::bad_alloc();
+#else
+    chunk.base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk.base == MAP_FAILED) throw std::bad_alloc();
+
+#if defined(MADV_HUGEPAGE)
+    // This is only a hint. It is fine if it fails.
+    madvise(chunk.base, size, MADV_HUGEPAGE);
+#endif
+#endif
+
+    return chunk;
+}
+
+void Arena::_unmapChunk(const Chunk& chunk) {
+#if defined(_WIN32)
+    VirtualFree(chunk.base, 0, MEM_RELEASE);
+#else
+    munmap(chunk.base, chunk.size);
+#endif
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Try the current chunk first.
+    if (_current < _chunks.size()) {
+        const size_t offset = (_offset + alignment - 1) & ~(alignment - 1);
+        if (offset <= _chunks[_current].size &&
+            size <= _chunks[_current].size - offset) {
+            _offset = offset + size;
+            _used += size;
+            _peak = std::max(_peak, _used);
+            return (uint8_t*)_chunks[_current].base + offset;
+        }
+    }
+
+    // Find a following chunk that is large enough. Chunks are aligned to at
+    // least a page, so no alignment is needed at the start of one.
+    size_t i = (_current < _chunks.size()) ? _current + 1 : 0;
+    for (; i < _chunks.size(); ++i) {
+        if (_chunks[i].size >= size) break;
+    }
+
+    if (i == _chunks.size()) {
+        const size_t chunkSize =
+            std::max(kMinChunkSize, (size + kChunkAlignment - 1) &
+                                        ~(kChunkAlignment - 1));
+        _chunks.push_back(_mapChunk(chunkSize));
+    }
+
+    _current = i;
+    _offset  = size;
+    _used += size;
+    _peak = std::max(_peak, _used);
+
+    return _chunks[_current].base;
+}
+
+void Arena::reset() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _current = 0;
+    _offset  = 0;
+    _used    = 0;
+}
+
+size_t Arena::reserved() const {
+    size_t total = 0;
+    for (auto&& chunk : _chunks) total += chunk.size;
+    return total;
+}
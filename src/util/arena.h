@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A simple region-based allocator.
+ *
+ * Memory is handed out from large chunks and is only ever freed all at once.
+ * This is used for stream buffers and scratch space while rewriting a PDB. All
+ * of that memory has the same lifetime, so there is no need to pay for
+ * individual allocations or to fragment the heap when rewriting many PDBs back
+ * to back.
+ */
+
+#pragma once
+
+#include <stdlib.h>  // For size_t
+
+#include <mutex>
+#include <vector>
+
+class Arena {
+   private:
+    struct Chunk {
+        void* base;
+        size_t size;
+    };
+
+    std::vector<Chunk> _chunks;
+
+    // Index of the chunk currently being allocated from.
+    size_t _current;
+
+    // Offset of the next free byte in the current chunk.
+    size_t _offset;
+
+    // Number of bytes handed out since the last reset.
+    size_t _used;
+
+    // Highest value of `_used` ever seen.
+    size_t _peak;
+
+    std::mutex _mutex;
+
+    static Chunk _mapChunk(size_t size);
+    static void _unmapChunk(const Chunk& chunk);
+
+   public:
+    Arena();
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Allocates a block of memory. The memory is *not* initialized. It stays
+     * valid until `reset()` is called or the arena is destroyed.
+     *
+     * This is thread safe.
+     *
+     * Throws: std::bad_alloc if the memory could not be allocated.
+     */
+    void* allocate(size_t size, size_t alignment = 16);
+
+    /**
+     * Frees everything that has been allocated. The chunks are kept around to
+     * be reused by future allocations.
+     */
+    void reset();
+
+    /**
+     * Returns the number of bytes allocated since the last reset.
+     */
+    size_t used() const { return _used; }
+
+    /**
+     * Returns the most bytes that were ever in use at one time.
+     */
+    size_t peak() const { return _peak; }
+
+    /**
+     * Returns the number of bytes reserved from the operating system.
+     */
+    size_t reserved() const;
+};
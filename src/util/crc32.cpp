@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/crc32.h"
+
+namespace {
+
+/**
+ * Lookup tables for processing 8 bytes at a time ("slicing-by-8"). Table 0 is
+ * the usual byte-at-a-time table.
+ */
+class Crc32Tables {
+   public:
+    uint32_t t[8][256];
+
+    Crc32Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            t[0][i] = c;
+        }
+
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+        }
+    }
+};
+
+const Crc32Tables tables;
+
+}  // namespace
+
+uint32_t crc32(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    const auto& t    = tables.t;
+
+    crc = ~crc;
+
+    // The bytes are assembled into words by hand, so this doesn't depend on
+    // the byte order of the host.
+    for (; length >= 8; length -= 8, p += 8) {
+        const uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) |
+                                   ((uint32_t)p[3] << 24));
+        const uint32_t hi =
+            p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+              t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^ t[3][hi & 0xFF] ^
+              t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+
+    for (; length > 0; --length, ++p)
+        crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
@@ -0,0 +1,947 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/deflate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <utility>
+
+namespace {
+
+// Maximum length of a literal/length or distance code.
+const size_t kMaxCodeBits = 15;
+
+// Maximum length of a code length code.
+const size_t kMaxCodeLengthBits = 7;
+
+// Number of literal/length and distance codes that can actually occur. The
+// fixed code has a couple more that are never used.
+const size_t kLitLenCodes   = 286;
+const size_t kDistCodes     = 30;
+const size_t kFixedLitCodes = 288;
+
+const uint16_t kEndOfBlock = 256;
+
+const uint16_t kLengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                  15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                  67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+const uint16_t kDistBase[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t kDistExtra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// The order that the code length code's lengths are stored in.
+const uint8_t kCodeLengthOrder[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                      11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+/**
+ * Reverses the lowest `length` bits of a code. Huffman codes are packed
+ * starting with their most significant bit, but everything else is packed
+ * starting with the least significant bit.
+ */
+uint32_t reverseBits(uint32_t code, size_t length) {
+    uint32_t reversed = 0;
+    for (size_t i = 0; i < length; ++i) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+/**
+ * Code lengths of the fixed Huffman code.
+ */
+void fixedLengths(uint8_t litLen[kFixedLitCodes], uint8_t dist[kDistCodes]) {
+    for (size_t i = 0; i < 144; ++i) litLen[i] = 8;
+    for (size_t i = 144; i < 256; ++i) litLen[i] = 9;
+    for (size_t i = 256; i < 280; ++i) litLen[i] = 7;
+    for (size_t i = 280; i < kFixedLitCodes; ++i) litLen[i] = 8;
+    for (size_t i = 0; i < kDistCodes; ++i) dist[i] = 5;
+}
+
+/*
+ * Decompression
+ */
+
+class BitReader {
+   private:
+    const uint8_t* _p;
+    const uint8_t* _end;
+
+    uint64_t _bits;
+    size_t _count;
+
+    // Number of zero bytes fed in after the end of the input. Running out of
+    // input is only an error if any of them are actually consumed.
+    size_t _padding;
+
+    void _refill() {
+        while (_count <= 56) {
+            uint64_t byte = 0;
+            if (_p < _end)
+                byte = *_p++;
+            else
+                ++_padding;
+
+            _bits |= byte << _count;
+            _count += 8;
+        }
+    }
+
+   public:
+    BitReader(const uint8_t* data, size_t length)
+        : _p(data), _end(data + length), _bits(0), _count(0), _padding(0) {}
+
+    /**
+     * Returns the next `n` bits without consuming them. `n` must be at most 32.
+     */
+    uint32_t peek(size_t n) {
+        if (_count < n) _refill();
+        return (uint32_t)(_bits & (((uint64_t)1 << n) - 1));
+    }
+
+    void consume(size_t n) {
+        _bits >>= n;
+        _count -= n;
+
+        if (_padding * 8 > _count)
+            throw InvalidDeflate("unexpected end of data");
+    }
+
+    uint32_t bits(size_t n) {
+        const uint32_t value = peek(n);
+        consume(n);
+        return value;
+    }
+
+    void alignToByte() { consume(_count % 8); }
+
+    /**
+     * Copies whole bytes out. Must be aligned to a byte first.
+     */
+    void readBytes(uint8_t* out, size_t n) {
+        // Bytes already in the bit buffer come first.
+        for (; n > 0 && _count >= 8; --n) *out++ = (uint8_t)bits(8);
+
+        if (n > (size_t)(_end - _p))
+            throw InvalidDeflate("unexpected end of data");
+
+        memcpy(out, _p, n);
+        _p += n;
+    }
+};
+
+class HuffmanDecoder {
+   private:
+    // Codes up to this long are decoded with a single table lookup.
+    static const size_t kFastBits = 10;
+
+    // Indexed by the next `kFastBits` bits of input. Each entry holds the
+    // symbol in the upper bits and the length of its code in the lowest 4 bits,
+    // or 0 if the code is longer than `kFastBits`.
+    uint16_t _fast[1 << kFastBits];
+
+    // Number of codes of each length and the symbols ordered by code.
+    uint16_t _counts[kMaxCodeBits + 1];
+    uint16_t _symbols[kFixedLitCodes];
+
+   public:
+    void build(const uint8_t* lengths, size_t n);
+    uint32_t decode(BitReader& in) const;
+};
+
+void HuffmanDecoder::build(const uint8_t* lengths, size_t n) {
+    memset(_counts, 0, sizeof(_counts));
+    for (size_t i = 0; i < n; ++i) ++_counts[lengths[i]];
+    _counts[0] = 0;
+
+    int left = 1;
+    for (size_t len = 1; len <= kMaxCodeBits; ++len) {
+        left = (left << 1) - _counts[len];
+        if (left < 0) throw InvalidDeflate("over-subscribed Huffman code");
+    }
+
+    uint16_t offsets[kMaxCodeBits + 2] = {0};
+    for (size_t len = 1; len <= kMaxCodeBits; ++len)
+        offsets[len + 1] = offsets[len] + _counts[len];
+
+    for (size_t i = 0; i < n; ++i) {
+        if (lengths[i]) _symbols[offsets[lengths[i]]++] = (uint16_t)i;
+    }
+
+    memset(_fast, 0, sizeof(_fast));
+
+    // Assign canonical codes in order and fill in every table entry that
+    // starts with each short code.
+    uint32_t code = 0;
+    size_t index  = 0;
+    for (size_t len = 1; len <= kMaxCodeBits; ++len) {
+        for (size_t i = 0; i < _counts[len]; ++i, ++code, ++index) {
+            if (len > kFastBits) continue;
+
+            const uint16_t entry = (uint16_t)((_symbols[index] << 4) | len);
+            for (uint32_t fill = reverseBits(code, len);
+                 fill < (1u << kFastBits); fill += 1u << len)
+                _fast[fill] = entry;
+        }
+
+        code <<= 1;
+    }
+}
+
+uint32_t HuffmanDecoder::decode(BitReader& in) const {
+    const uint16_t entry = _fast[in.peek(kFastBits)];
+    if (entry) {
+        in.consume(entry & 15);
+        return entry >> 4;
+    }
+
+    // Long codes are rare. Walk them a bit at a time.
+    int code  = 0;
+    int first = 0;
+    int index = 0;
+
+    for (size_t len = 1; len <= kMaxCodeBits; ++len) {
+        code |= in.bits(1);
+
+        const int count = _counts[len];
+        if (code - first < count) return _symbols[index + (code - first)];
+
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    throw InvalidDeflate("invalid Huffman code");
+}
+
+void inflateCodes(BitReader& in, const HuffmanDecoder& litLen,
+                  const HuffmanDecoder& dist, size_t start,
+                  std::vector<uint8_t>& out) {
+    while (true) {
+        uint32_t sym = litLen.decode(in);
+
+        if (sym < 256) {
+            out.push_back((uint8_t)sym);
+            continue;
+        }
+
+        if (sym == kEndOfBlock) return;
+
+        sym -= 257;
+        if (sym >= 29) throw InvalidDeflate("invalid length code");
+
+        const size_t length = kLengthBase[sym] + in.bits(kLengthExtra[sym]);
+
+        sym = dist.decode(in);
+        if (sym >= kDistCodes) throw InvalidDeflate("invalid distance code");
+
+        const size_t distance = kDistBase[sym] + in.bits(kDistExtra[sym]);
+
+        const size_t pos = out.size();
+        if (distance > pos - start)
+            throw InvalidDeflate("distance is too far back");
+
+        // The source and destination can overlap, so this must go forward a
+        // byte at a time.
+        out.resize(pos + length);
+        uint8_t* dest      = out.data() + pos;
+        const uint8_t* src = dest - distance;
+        for (size_t i = 0; i < length; ++i) dest[i] = src[i];
+    }
+}
+
+void inflateDynamic(BitReader& in, HuffmanDecoder& litLen,
+                    HuffmanDecoder& dist) {
+    const size_t hlit  = in.bits(5) + 257;
+    const size_t hdist = in.bits(5) + 1;
+    const size_t hclen = in.bits(4) + 4;
+
+    if (hlit > kLitLenCodes || hdist > kDistCodes)
+        throw InvalidDeflate("too many length or distance codes");
+
+    uint8_t codeLengthLengths[19] = {0};
+    for (size_t i = 0; i < hclen; ++i)
+        codeLengthLengths[kCodeLengthOrder[i]] = (uint8_t)in.bits(3);
+
+    HuffmanDecoder codeLengths;
+    codeLengths.build(codeLengthLengths, 19);
+
+    uint8_t lengths[kLitLenCodes + kDistCodes];
+
+    for (size_t i = 0; i < hlit + hdist;) {
+        const uint32_t sym = codeLengths.decode(in);
+
+        if (sym < 16) {
+            lengths[i++] = (uint8_t)sym;
+            continue;
+        }
+
+        uint8_t value = 0;
+        size_t repeat;
+
+        if (sym == 16) {
+            if (i == 0) throw InvalidDeflate("repeated length with no length");
+            value  = lengths[i - 1];
+            repeat = 3 + in.bits(2);
+        } else if (sym == 17) {
+            repeat = 3 + in.bits(3);
+        } else {
+            repeat = 11 + in.bits(7);
+        }
+
+        if (i + repeat > hlit + hdist)
+            throw InvalidDeflate("too many code lengths");
+
+        for (; repeat > 0; --repeat) lengths[i++] = value;
+    }
+
+    if (lengths[kEndOfBlock] == 0)
+        throw InvalidDeflate("missing end-of-block code");
+
+    litLen.build(lengths, hlit);
+    dist.build(lengths + hlit, hdist);
+}
+
+/*
+ * Compression
+ */
+
+const size_t kWindowSize = 32768;
+const size_t kMinMatch   = 3;
+const size_t kMaxMatch   = 258;
+
+const size_t kHashBits = 15;
+
+// How many earlier positions with the same hash to try before giving up.
+const size_t kMaxChain = 128;
+
+// Stop looking once a match is at least this long.
+const size_t kNiceMatch = 128;
+
+// Don't bother looking for a better match at the next position if the current
+// one is at least this long.
+const size_t kMaxLazy = 32;
+
+// Number of literals and matches to collect before writing out a block.
+const size_t kBlockTokens = 16384;
+
+class BitWriter {
+   private:
+    std::vector<uint8_t>& _out;
+    uint64_t _bits;
+    size_t _count;
+
+   public:
+    BitWriter(std::vector<uint8_t>& out) : _out(out), _bits(0), _count(0) {}
+
+    void write(uint32_t value, size_t n) {
+        _bits |= (uint64_t)value << _count;
+        _count += n;
+
+        while (_count >= 8) {
+            _out.push_back((uint8_t)_bits);
+            _bits >>= 8;
+            _count -= 8;
+        }
+    }
+
+    /**
+     * Pads with zero bits up to the next byte.
+     */
+    void alignToByte() {
+        if (_count > 0) write(0, 8 - _count);
+    }
+
+    void writeBytes(const uint8_t* data, size_t n) {
+        _out.insert(_out.end(), data, data + n);
+    }
+};
+
+/**
+ * Maps lengths and distances to their codes.
+ */
+class CodeTables {
+   public:
+    uint8_t lengthCode[kMaxMatch + 1];
+    uint8_t distCode[kWindowSize + 1];
+
+    CodeTables() {
+        for (size_t code = 0; code < 29; ++code) {
+            const size_t end = code + 1 < 29 ? kLengthBase[code + 1] : 259;
+            for (size_t len = kLengthBase[code]; len < end; ++len)
+                lengthCode[len] = (uint8_t)code;
+        }
+
+        for (size_t code = 0; code < kDistCodes; ++code) {
+            const size_t end =
+                code + 1 < kDistCodes ? kDistBase[code + 1] : kWindowSize + 1;
+            for (size_t d = kDistBase[code]; d < end; ++d)
+                distCode[d] = (uint8_t)code;
+        }
+    }
+};
+
+const CodeTables codeTables;
+
+/**
+ * A literal byte or a match with an earlier part of the input.
+ */
+struct Token {
+    // 0 for a literal.
+    uint16_t length;
+
+    // The literal or the distance of the match.
+    uint16_t value;
+};
+
+/**
+ * Computes length-limited Huffman code lengths for the given symbol
+ * frequencies.
+ *
+ * A plain Huffman code is built first. Codes that come out too long are then
+ * shortened to the limit and other codes are lengthened until the code is
+ * valid again. Finally, the code is filled out so that it is complete, which
+ * is required by zlib's decoder.
+ */
+void buildLengths(const uint32_t* freqs, size_t n, size_t limit,
+                  uint8_t* lengths) {
+    memset(lengths, 0, n);
+
+    struct Node {
+        uint64_t freq;
+        int parent;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<size_t> symbols;
+
+    typedef std::pair<uint64_t, int> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+
+    for (size_t i = 0; i < n; ++i) {
+        if (freqs[i] == 0) continue;
+        heap.push(Entry(freqs[i], (int)nodes.size()));
+        nodes.push_back({freqs[i], -1});
+        symbols.push_back(i);
+    }
+
+    const size_t leaves = nodes.size();
+
+    if (leaves == 0) return;
+
+    if (leaves == 1) {
+        lengths[symbols[0]] = 1;
+        return;
+    }
+
+    while (heap.size() > 1) {
+        const Entry a = heap.top();
+        heap.pop();
+        const Entry b = heap.top();
+        heap.pop();
+
+        const int parent = (int)nodes.size();
+        nodes.push_back({a.first + b.first, -1});
+        nodes[a.second].parent = parent;
+        nodes[b.second].parent = parent;
+        heap.push(Entry(a.first + b.first, parent));
+    }
+
+    // Parents always come after their children, so depths can be filled in
+    // going backwards from the root.
+    std::vector<size_t> depth(nodes.size(), 0);
+    for (size_t i = nodes.size() - 1; i-- > 0;)
+        depth[i] = depth[nodes[i].parent] + 1;
+
+    // Kraft sum in units of 2^-limit. The code is valid if this is at most
+    // 2^limit and complete if it is exactly that.
+    const uint64_t full = (uint64_t)1 << limit;
+    uint64_t kraft      = 0;
+
+    for (size_t i = 0; i < leaves; ++i) {
+        const size_t len    = std::min(depth[i], limit);
+        lengths[symbols[i]] = (uint8_t)len;
+        kraft += full >> len;
+    }
+
+    // Lengthen the least frequent of the longest codes that can still grow
+    // until the code is no longer over-subscribed.
+    while (kraft > full) {
+        size_t best = leaves;
+        for (size_t i = 0; i < leaves; ++i) {
+            const size_t len = lengths[symbols[i]];
+            if (len >= limit) continue;
+            if (best == leaves || len > lengths[symbols[best]] ||
+                (len == lengths[symbols[best]] &&
+                 nodes[i].freq < nodes[best].freq))
+                best = i;
+        }
+
+        const size_t len = lengths[symbols[best]]++;
+        kraft -= full >> (len + 1);
+    }
+
+    // Shorten the most frequent of the longest codes until there are no gaps
+    // left in the code.
+    while (kraft < full) {
+        size_t best = leaves;
+        for (size_t i = 0; i < leaves; ++i) {
+            const size_t len = lengths[symbols[i]];
+            if (best == leaves || len > lengths[symbols[best]] ||
+                (len == lengths[symbols[best]] &&
+                 nodes[i].freq > nodes[best].freq))
+                best = i;
+        }
+
+        const size_t len = lengths[symbols[best]]--;
+        kraft += full >> len;
+    }
+}
+
+/**
+ * Assigns canonical codes from code lengths. The codes are bit-reversed so
+ * that they can be written out directly.
+ */
+void buildCodes(const uint8_t* lengths, size_t n, uint16_t* codes) {
+    uint16_t counts[kMaxCodeBits + 1] = {0};
+    for (size_t i = 0; i < n; ++i) ++counts[lengths[i]];
+    counts[0] = 0;
+
+    uint32_t next[kMaxCodeBits + 2] = {0};
+    uint32_t code = 0;
+    for (size_t len = 1; len <= kMaxCodeBits; ++len) {
+        code      = (code + counts[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (lengths[i])
+            codes[i] =
+                (uint16_t)reverseBits(next[lengths[i]]++, lengths[i]);
+    }
+}
+
+/**
+ * Finds matches with earlier parts of the input using hash chains.
+ */
+class Matcher {
+   private:
+    const uint8_t* _data;
+    const size_t _length;
+
+    // Most recent position for each hash and, for each position in the
+    // window, the position before it with the same hash. -1 if there is none.
+    std::vector<int64_t> _head;
+    std::vector<int64_t> _prev;
+
+    size_t _hash(size_t pos) const {
+        const uint32_t v =
+            _data[pos] | (_data[pos + 1] << 8) | (_data[pos + 2] << 16);
+        return (v * 2654435761u) >> (32 - kHashBits);
+    }
+
+   public:
+    Matcher(const uint8_t* data, size_t length)
+        : _data(data),
+          _length(length),
+          _head((size_t)1 << kHashBits, -1),
+          _prev(kWindowSize, -1) {}
+
+    /**
+     * Makes a position available for later matches.
+     */
+    void insert(size_t pos) {
+        if (pos + kMinMatch > _length) return;
+
+        const size_t h                 = _hash(pos);
+        _prev[pos & (kWindowSize - 1)] = _head[h];
+        _head[h]                       = (int64_t)pos;
+    }
+
+    /**
+     * Returns the length of the longest match for the given position, or 0 if
+     * there isn't one.
+     */
+    size_t longestMatch(size_t pos, size_t& distance) const;
+};
+
+size_t Matcher::longestMatch(size_t pos, size_t& distance) const {
+    if (pos + kMinMatch > _length) return 0;
+
+    const size_t maxLength = std::min(kMaxMatch, _length - pos);
+    const uint8_t* target  = _data + pos;
+
+    size_t best = kMinMatch - 1;
+
+    int64_t candidate = _head[_hash(pos)];
+
+    for (size_t chain = 0; chain < kMaxChain && candidate >= 0; ++chain) {
+        if (pos - (size_t)candidate > kWindowSize) break;
+
+        const uint8_t* p = _data + candidate;
+
+        // Quick check against the byte that would make this match better.
+        if (p[best] == target[best]) {
+            size_t len = 0;
+            while (len < maxLength && p[len] == target[len]) ++len;
+
+            if (len > best) {
+                best     = len;
+                distance = pos - (size_t)candidate;
+                if (len >= kNiceMatch || len == maxLength) break;
+            }
+        }
+
+        const int64_t next = _prev[candidate & (kWindowSize - 1)];
+
+        // The slot may have been reused by a newer position.
+        if (next >= candidate) break;
+
+        candidate = next;
+    }
+
+    return best >= kMinMatch ? best : 0;
+}
+
+/**
+ * Number of bits needed to write the tokens with the given code lengths.
+ */
+uint64_t tokenBits(const std::vector<Token>& tokens, const uint8_t* litLen,
+                   const uint8_t* dist) {
+    uint64_t bits = litLen[kEndOfBlock];
+
+    for (auto&& t : tokens) {
+        if (t.length == 0) {
+            bits += litLen[t.value];
+        } else {
+            const size_t lc = codeTables.lengthCode[t.length];
+            const size_t dc = codeTables.distCode[t.value];
+            bits += litLen[257 + lc] + kLengthExtra[lc] + dist[dc] +
+                    kDistExtra[dc];
+        }
+    }
+
+    return bits;
+}
+
+void writeTokens(BitWriter& out, const std::vector<Token>& tokens,
+                 const uint8_t* litLenLengths, const uint8_t* distLengths) {
+    uint16_t litLen[kFixedLitCodes];
+    uint16_t dist[kDistCodes];
+    buildCodes(litLenLengths, kFixedLitCodes, litLen);
+    buildCodes(distLengths, kDistCodes, dist);
+
+    for (auto&& t : tokens) {
+        if (t.length == 0) {
+            out.write(litLen[t.value], litLenLengths[t.value]);
+            continue;
+        }
+
+        const size_t lc = codeTables.lengthCode[t.length];
+        const size_t dc = codeTables.distCode[t.value];
+
+        out.write(litLen[257 + lc], litLenLengths[257 + lc]);
+        out.write(t.length - kLengthBase[lc], kLengthExtra[lc]);
+        out.write(dist[dc], distLengths[dc]);
+        out.write(t.value - kDistBase[dc], kDistExtra[dc]);
+    }
+
+    out.write(litLen[kEndOfBlock], litLenLengths[kEndOfBlock]);
+}
+
+/**
+ * Writes a block in whichever of the three block types is smallest.
+ */
+void writeBlock(BitWriter& out, const std::vector<Token>& tokens,
+                const uint8_t* raw, size_t rawLength, bool last) {
+    uint32_t litLenFreqs[kLitLenCodes] = {0};
+    uint32_t distFreqs[kDistCodes]     = {0};
+
+    litLenFreqs[kEndOfBlock] = 1;
+
+    for (auto&& t : tokens) {
+        if (t.length == 0) {
+            ++litLenFreqs[t.value];
+        } else {
+            ++litLenFreqs[257 + codeTables.lengthCode[t.length]];
+            ++distFreqs[codeTables.distCode[t.value]];
+        }
+    }
+
+    // Give each code at least two symbols so that it can be complete.
+    if (std::count_if(litLenFreqs, litLenFreqs + kLitLenCodes,
+                      [](uint32_t f) { return f != 0; }) < 2)
+        litLenFreqs[0] = std::max<uint32_t>(litLenFreqs[0], 1);
+
+    for (size_t i = 0; i < 2; ++i) {
+        if (std::count_if(distFreqs, distFreqs + kDistCodes,
+                          [](uint32_t f) { return f != 0; }) < 2)
+            distFreqs[i] = std::max<uint32_t>(distFreqs[i], 1);
+    }
+
+    uint8_t litLen[kFixedLitCodes] = {0};
+    uint8_t dist[kDistCodes]       = {0};
+    buildLengths(litLenFreqs, kLitLenCodes, kMaxCodeBits, litLen);
+    buildLengths(distFreqs, kDistCodes, kMaxCodeBits, dist);
+
+    size_t hlit = kLitLenCodes;
+    while (hlit > 257 && litLen[hlit - 1] == 0) --hlit;
+
+    size_t hdist = kDistCodes;
+    while (hdist > 1 && dist[hdist - 1] == 0) --hdist;
+
+    // Run-length encode the code lengths. Runs may cross over from the
+    // literal/length code into the distance code.
+    uint8_t all[kLitLenCodes + kDistCodes];
+    memcpy(all, litLen, hlit);
+    memcpy(all + hlit, dist, hdist);
+
+    const size_t count = hlit + hdist;
+
+    std::vector<std::pair<uint8_t, uint8_t>> rle;  // Symbol and extra bits
+    uint32_t codeLengthFreqs[19] = {0};
+
+    for (size_t i = 0; i < count;) {
+        const uint8_t len = all[i];
+
+        size_t run = 1;
+        while (i + run < count && all[i + run] == len) ++run;
+        i += run;
+
+        if (len == 0) {
+            for (; run >= 11; run -= std::min<size_t>(run, 138)) {
+                const size_t n = std::min<size_t>(run, 138);
+                rle.push_back(std::make_pair(18, (uint8_t)(n - 11)));
+            }
+            if (run >= 3) {
+                rle.push_back(std::make_pair(17, (uint8_t)(run - 3)));
+                run = 0;
+            }
+        } else {
+            rle.push_back(std::make_pair(len, 0));
+            --run;
+            for (; run >= 3; run -= std::min<size_t>(run, 6)) {
+                const size_t n = std::min<size_t>(run, 6);
+                rle.push_back(std::make_pair(16, (uint8_t)(n - 3)));
+            }
+        }
+
+        for (; run > 0; --run) rle.push_back(std::make_pair(len, 0));
+    }
+
+    for (auto&& r : rle) ++codeLengthFreqs[r.first];
+
+    uint8_t codeLengthLengths[19] = {0};
+    buildLengths(codeLengthFreqs, 19, kMaxCodeLengthBits, codeLengthLengths);
+
+    size_t hclen = 19;
+    while (hclen > 4 && codeLengthLengths[kCodeLengthOrder[hclen - 1]] == 0)
+        --hclen;
+
+    // Figure out how big each kind of block would be.
+    uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * hclen;
+    for (auto&& r : rle) {
+        dynamicBits += codeLengthLengths[r.first];
+        if (r.first == 16) dynamicBits += 2;
+        if (r.first == 17) dynamicBits += 3;
+        if (r.first == 18) dynamicBits += 7;
+    }
+    dynamicBits += tokenBits(tokens, litLen, dist);
+
+    uint8_t fixedLitLen[kFixedLitCodes];
+    uint8_t fixedDist[kDistCodes];
+    fixedLengths(fixedLitLen, fixedDist);
+
+    const uint64_t fixedBits = 3 + tokenBits(tokens, fixedLitLen, fixedDist);
+
+    // Stored blocks can only hold 64 KiB each, and each has a 5 byte header.
+    const size_t storedBlocks =
+        std::max<size_t>(1, (rawLength + 65534) / 65535);
+    const uint64_t storedBits = (storedBlocks * 5 + rawLength) * 8 + 7;
+
+    if (storedBits <= fixedBits && storedBits <= dynamicBits) {
+        for (size_t i = 0; i < storedBlocks; ++i) {
+            const size_t offset = i * 65535;
+            const size_t n      = std::min<size_t>(65535, rawLength - offset);
+
+            out.write(last && i + 1 == storedBlocks, 1);
+            out.write(0, 2);
+            out.alignToByte();
+            out.write((uint32_t)n, 16);
+            out.write((uint32_t)~n & 0xFFFF, 16);
+            out.writeBytes(raw + offset, n);
+        }
+    } else if (fixedBits <= dynamicBits) {
+        out.write(last, 1);
+        out.write(1, 2);
+        writeTokens(out, tokens, fixedLitLen, fixedDist);
+    } else {
+        out.write(last, 1);
+        out.write(2, 2);
+        out.write((uint32_t)(hlit - 257), 5);
+        out.write((uint32_t)(hdist - 1), 5);
+        out.write((uint32_t)(hclen - 4), 4);
+
+        for (size_t i = 0; i < hclen; ++i)
+            out.write(codeLengthLengths[kCodeLengthOrder[i]], 3);
+
+        uint16_t codeLengthCodes[19];
+        buildCodes(codeLengthLengths, 19, codeLengthCodes);
+
+        for (auto&& r : rle) {
+            out.write(codeLengthCodes[r.first], codeLengthLengths[r.first]);
+            if (r.first == 16) out.write(r.second, 2);
+            if (r.first == 17) out.write(r.second, 3);
+            if (r.first == 18) out.write(r.second, 7);
+        }
+
+        writeTokens(out, tokens, litLen, dist);
+    }
+}
+
+}  // namespace
+
+void inflate(const uint8_t* data, size_t length, std::vector<uint8_t>& out) {
+    BitReader in(data, length);
+
+    const size_t start = out.size();
+
+    HuffmanDecoder litLen, dist;
+
+    bool last;
+
+    do {
+        last = in.bits(1) != 0;
+
+        switch (in.bits(2)) {
+            case 0: {
+                in.alignToByte();
+
+                const uint32_t n    = in.bits(16);
+                const uint32_t nlen = in.bits(16);
+                if (n != (~nlen & 0xFFFF))
+                    throw InvalidDeflate("stored block length is corrupt");
+
+                const size_t pos = out.size();
+                out.resize(pos + n);
+                in.readBytes(out.data() + pos, n);
+                break;
+            }
+
+            case 1: {
+                uint8_t litLenLengths[kFixedLitCodes];
+                uint8_t distLengths[kDistCodes];
+                fixedLengths(litLenLengths, distLengths);
+
+                litLen.build(litLenLengths, kFixedLitCodes);
+                dist.build(distLengths, kDistCodes);
+
+                inflateCodes(in, litLen, dist, start, out);
+                break;
+            }
+
+            case 2:
+                inflateDynamic(in, litLen, dist);
+                inflateCodes(in, litLen, dist, start, out);
+                break;
+
+            default:
+                throw InvalidDeflate("invalid block type");
+        }
+    } while (!last);
+}
+
+void deflate(const uint8_t* data, size_t length, std::vector<uint8_t>& out) {
+    BitWriter writer(out);
+    Matcher matcher(data, length);
+
+    std::vector<Token> tokens;
+    tokens.reserve(kBlockTokens + 1);
+
+    size_t blockStart = 0;
+
+    // A match found at the previous position that hasn't been written out yet
+    // in case the current position has a better one.
+    size_t prevLength   = 0;
+    size_t prevDistance = 0;
+
+    size_t pos = 0;
+
+    while (pos < length) {
+        size_t distance = 0;
+        size_t len      = 0;
+
+        if (prevLength < kMaxLazy) len = matcher.longestMatch(pos, distance);
+
+        matcher.insert(pos);
+
+        if (prevLength > 0) {
+            if (len > prevLength) {
+                // The match here is better. Give up on the previous one.
+                tokens.push_back({0, data[pos - 1]});
+                prevLength   = len;
+                prevDistance = distance;
+                ++pos;
+            } else {
+                tokens.push_back(
+                    {(uint16_t)prevLength, (uint16_t)prevDistance});
+
+                // The previous match started one byte back, and this position
+                // has already been inserted.
+                const size_t end = pos - 1 + prevLength;
+                for (++pos; pos < end; ++pos) matcher.insert(pos);
+
+                prevLength = 0;
+            }
+        } else if (len > 0) {
+            prevLength   = len;
+            prevDistance = distance;
+            ++pos;
+        } else {
+            tokens.push_back({0, data[pos]});
+            ++pos;
+        }
+
+        if (prevLength == 0 && tokens.size() >= kBlockTokens) {
+            writeBlock(writer, tokens, data + blockStart, pos - blockStart,
+                       false);
+            tokens.clear();
+            blockStart = pos;
+        }
+    }
+
+    // A match always ends at or before the end of the input, so there is
+    // never one left over here.
+
+    writeBlock(writer, tokens, data + blockStart, pos - blockStart, true);
+    writer.alignToByte();
+}
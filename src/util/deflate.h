@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A small implementation of raw DEFLATE (RFC 1951) as used by zip archives.
+ *
+ * The compressor is deliberately simple: one fixed set of parameters, greedy
+ * matching with one step of lazy evaluation, and a choice between stored,
+ * fixed, and dynamic Huffman blocks. Its output only depends on its input, so
+ * it is the same on every platform and with every build of this program.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>  // For size_t
+
+#include <vector>
+
+/**
+ * Thrown when compressed data is malformed.
+ */
+class InvalidDeflate {
+   private:
+    const char* _why;
+
+   public:
+    InvalidDeflate(const char* why) : _why(why) {}
+
+    const char* why() const { return _why; }
+};
+
+/**
+ * Decompresses raw DEFLATE data and appends it to `out`.
+ *
+ * Throws: InvalidDeflate if the data is malformed or truncated.
+ */
+void inflate(const uint8_t* data, size_t length, std::vector<uint8_t>& out);
+
+/**
+ * Compresses data with raw DEFLATE and appends it to `out`.
+ */
+void deflate(const uint8_t* data, size_t length, std::vector<uint8_t>& out);
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/io_policy.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#endif
+
+namespace {
+
+IoPolicy policy = IoPolicy::normal;
+
+}  // namespace
+
+void setIoPolicy(IoPolicy p) { policy = p; }
+
+IoPolicy ioPolicy() { return policy; }
+
+void doneWithFile(int fd) {
+    if (policy != IoPolicy::dontNeed || fd == -1) return;
+
+#if defined(POSIX_FADV_DONTNEED)
+    // This is only a hint. It is fine if it fails.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+void doneWithFile(FILE* f) {
+    if (policy != IoPolicy::dontNeed || !f) return;
+
+#if defined(_WIN32)
+    doneWithFile(_fileno(f));
+#else
+    doneWithFile(fileno(f));
+#endif
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Controls how much of the files we process stays in the OS page cache.
+ *
+ * By default, files that are read and written stay cached after we are done
+ * with them, like any other file. When patching a large number of PDBs in bulk,
+ * that pushes the working sets of everything else on the machine out of the
+ * cache, such as the compilers and linkers of neighboring build jobs. With the
+ * `dontNeed` policy, the OS is told to drop each file from the cache once we
+ * are done with it instead.
+ *
+ * The policy applies to the whole process. It is only a hint and is ignored
+ * where it isn't supported (e.g., on Windows and macOS).
+ */
+
+#pragma once
+
+#include <cstdio>
+
+enum class IoPolicy {
+    // Leave caching up to the OS.
+    normal,
+
+    // Drop files from the page cache once we are done with them.
+    dontNeed,
+};
+
+/**
+ * Sets the I/O policy. This should be done before any files are opened.
+ */
+void setIoPolicy(IoPolicy policy);
+
+/**
+ * Returns the I/O policy.
+ */
+IoPolicy ioPolicy();
+
+/**
+ * Tells the OS that we are done with a file. If the policy says so, its pages
+ * are dropped from the page cache. Pages that haven't been written back yet
+ * can't be dropped, so output files should be synced first.
+ */
+void doneWithFile(int fd);
+void doneWithFile(FILE* f);
@@ -22,27 +22,81 @@
 
 #include "util/memmap.h"
 
+#include <stdint.h>
+
 #if defined(_WIN32)
 
 #include <windows.h>
 #include <limits>
 #include <system_error>
 
-MemMap::MemMap(const char* path, size_t length)
+namespace {
+
+/**
+ * Returns the flags to open the file with.
+ */
+DWORD fileFlags(const MemMapOptions& options) {
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (options.sequential) flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    return flags;
+}
+
+/**
+ * Returns the access to open the file with.
+ */
+DWORD fileAccess(const MemMapOptions& options) {
+    return options.readOnly ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+}
+
+/**
+ * Returns the sharing mode to open the file with. Others can still read a file
+ * that is only being read.
+ */
+DWORD fileShareMode(const MemMapOptions& options) {
+    return options.readOnly ? FILE_SHARE_READ : 0;
+}
+
+/**
+ * Same layout as WIN32_MEMORY_RANGE_ENTRY. That is only declared when
+ * targeting Windows 8 or later.
+ */
+struct MemoryRange {
+    PVOID VirtualAddress;
+    SIZE_T NumberOfBytes;
+};
+
+typedef BOOL(WINAPI* PrefetchVirtualMemoryFn)(HANDLE, ULONG_PTR, MemoryRange*,
+                                              ULONG);
+
+/**
+ * PrefetchVirtualMemory() only exists on Windows 8 and later. Look it up at
+ * runtime so that we still work on older versions.
+ */
+PrefetchVirtualMemoryFn prefetchVirtualMemory() {
+    static const PrefetchVirtualMemoryFn fn =
+        (PrefetchVirtualMemoryFn)GetProcAddress(
+            GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+    return fn;
+}
+
+}  // namespace
+
+MemMap::MemMap(const char* path, size_t length, const MemMapOptions& options)
     : _buf(NULL), _length(0), _fileMap(NULL) {
-    _init(CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL),
-          length);
+    _init(CreateFileA(path, fileAccess(options), fileShareMode(options), NULL,
+                      OPEN_EXISTING, fileFlags(options), NULL),
+          length, options);
 }
 
-MemMap::MemMap(const wchar_t* path, size_t length)
+MemMap::MemMap(const wchar_t* path, size_t length,
+               const MemMapOptions& options)
     : _buf(NULL), _length(0), _fileMap(NULL) {
-    _init(CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
-                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL),
-          length);
+    _init(CreateFileW(path, fileAccess(options), fileShareMode(options), NULL,
+                      OPEN_EXISTING, fileFlags(options), NULL),
+          length, options);
 }
 
-void MemMap::_init(HANDLE hFile, size_t length) {
+void MemMap::_init(HANDLE hFile, size_t length, const MemMapOptions& options) {
     if (hFile == INVALID_HANDLE_VALUE) {
         throw std::system_error(GetLastError(), std::system_category(),
                                 "Failed to open file");
@@ -51,10 +105,14 @@ void MemMap::_init(HANDLE hFile, size_t length) {
     ULARGE_INTEGER maxSize;
     maxSize.QuadPart = length;
 
+    const DWORD protect = options.readOnly ? PAGE_READONLY : PAGE_READWRITE;
+    const DWORD access =
+        options.readOnly ? FILE_MAP_READ : FILE_MAP_READ | FILE_MAP_WRITE;
+
     _fileMap =
         CreateFileMappingW(hFile,             // File handle
                            NULL,              // Security attributes
-                           PAGE_READWRITE,    // Page protection flags
+                           protect,           // Page protection flags
                            maxSize.HighPart,  // Maximum size (high-order bytes)
                            maxSize.LowPart,   // Maximum size (low-order bytes)
                            NULL  // Optional name to give the object
@@ -85,8 +143,8 @@ void MemMap::_init(HANDLE hFile, size_t length) {
 
     // Create a view into the file mapping
     _buf = MapViewOfFileEx(_fileMap,  // File mapping object
-                           FILE_MAP_READ | FILE_MAP_WRITE,  // Desired access
-                           0, 0,                            // File offset
+                           access,    // Desired access
+                           0, 0,      // File offset
                            length,  // Number of bytes to map
                            NULL     // Preferred base address
     );
@@ -97,6 +155,10 @@ void MemMap::_init(HANDLE hFile, size_t length) {
     }
 
     _length = length;
+
+    // Windows has no huge pages for file mappings. The closest thing to
+    // populating the mapping is prefetching all of it.
+    if (options.populate || options.willNeed) prefetch(0, _length);
 }
 
 MemMap::~MemMap() {
@@ -104,6 +166,20 @@ MemMap::~MemMap() {
     if (_fileMap) CloseHandle(_fileMap);
 }
 
+void MemMap::prefetch(size_t offset, size_t length) {
+    if (offset >= _length) return;
+    if (length > _length - offset) length = _length - offset;
+
+    if (auto fn = prefetchVirtualMemory()) {
+        MemoryRange range;
+        range.VirtualAddress = (uint8_t*)_buf + offset;
+        range.NumberOfBytes  = length;
+
+        // This is only a hint. It is fine if it fails.
+        fn(GetCurrentProcess(), 1, &range, 0);
+    }
+}
+
 #else
 
 #include <errno.h>
@@ -113,8 +189,23 @@ MemMap::~MemMap() {
 #include <unistd.h>
 #include <system_error>
 
-MemMap::MemMap(const char* path, size_t length) : _buf(NULL), _length(0) {
-    int fd = open(path, O_RDWR);
+#include "util/io_policy.h"
+
+namespace {
+
+/**
+ * Returns the system page size.
+ */
+size_t pageSize() {
+    static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+}  // namespace
+
+MemMap::MemMap(const char* path, size_t length, const MemMapOptions& options)
+    : _buf(NULL), _length(0), _fd(-1) {
+    int fd = open(path, options.readOnly ? O_RDONLY : O_RDWR);
     if (fd == -1) {
         throw std::system_error(errno, std::system_category(),
                                 "Failed to open file");
@@ -123,23 +214,35 @@ MemMap::MemMap(const char* path, size_t length) : _buf(NULL), _length(0) {
     if (length == 0) {
         struct stat stbuf;
         if (fstat(fd, &stbuf) == -1) {
-            throw std::system_error(errno, std::system_category(),
+            const int error = errno;
+            close(fd);
+            throw std::system_error(error, std::system_category(),
                                     "Failed to stat file");
         }
 
         length = stbuf.st_size;
     }
 
+    int flags = MAP_SHARED;
+
+#if defined(MAP_POPULATE)
+    if (options.populate) flags |= MAP_POPULATE;
+#endif
+
+    const int prot = options.readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+
     void* p = mmap(NULL,    // Preferred base address (don't care)
                    length,  // Length of the memory map
-                   PROT_READ | PROT_WRITE,  // Protection flags
-                   MAP_SHARED,
+                   prot,    // Protection flags
+                   flags,
                    fd,  // File descriptor
                    0    // Offset within the file
     );
 
     if (p == MAP_FAILED) {
-        throw std::system_error(errno, std::system_category(),
+        const int error = errno;
+        close(fd);
+        throw std::system_error(error, std::system_category(),
                                 "Failed to map file");
     }
 
@@ -147,16 +250,45 @@ MemMap::MemMap(const char* path, size_t length) : _buf(NULL), _length(0) {
     _length = length;
 
     // We don't need this open in order to keep the file mapped.
-    if (close(fd) == -1) {
+    if (ioPolicy() == IoPolicy::dontNeed) {
+        _fd = fd;
+    } else if (close(fd) == -1) {
         throw std::system_error(errno, std::system_category(),
                                 "Failed to close file");
     }
+
+    // These are only hints. It is fine if they fail.
+#if defined(MADV_HUGEPAGE)
+    if (options.hugePages) madvise(_buf, _length, MADV_HUGEPAGE);
+#endif
+
+    if (options.sequential) madvise(_buf, _length, MADV_SEQUENTIAL);
+
+    if (options.willNeed) madvise(_buf, _length, MADV_WILLNEED);
 }
 
 MemMap::~MemMap() {
     if (_buf) {
         munmap(_buf, _length);
     }
+
+    if (_fd != -1) {
+        // Pages that were changed stay until they are written back.
+        doneWithFile(_fd);
+        close(_fd);
+    }
+}
+
+void MemMap::prefetch(size_t offset, size_t length) {
+    if (offset >= _length) return;
+    if (length > _length - offset) length = _length - offset;
+
+    // madvise() needs a page-aligned address.
+    const size_t aligned = offset & ~(pageSize() - 1);
+
+    // This is only a hint. It is fine if it fails.
+    madvise((uint8_t*)_buf + aligned, length + (offset - aligned),
+            MADV_WILLNEED);
 }
 
 #endif
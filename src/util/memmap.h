@@ -36,6 +36,39 @@
 typedef void* HANDLE;
 #endif
 
+/**
+ * Hints about how a memory map is going to be accessed. These are only hints.
+ * Options that aren't supported by the platform are ignored.
+ */
+struct MemMapOptions {
+    // Fault in the whole file when it is mapped instead of one page at a time
+    // as it is accessed. Good if the whole file is going to be read anyway.
+    bool populate;
+
+    // Back the mapping with huge pages. For file mappings, this only has an
+    // effect if the file system supports huge pages in the page cache.
+    bool hugePages;
+
+    // The file will be read from start to finish. The OS can read ahead more
+    // aggressively and drop pages that have already been read.
+    bool sequential;
+
+    // The whole file will be needed soon. Starts reading it in without
+    // waiting for it.
+    bool willNeed;
+
+    // The file is only read. It is opened and mapped read-only, so it doesn't
+    // need to be writable.
+    bool readOnly;
+
+    MemMapOptions()
+        : populate(false),
+          hugePages(false),
+          sequential(false),
+          willNeed(false),
+          readOnly(false) {}
+};
+
 /**
  * Maps a file into memory.
  */
@@ -46,17 +79,29 @@ class MemMap {
 
 #ifdef _WIN32
     HANDLE _fileMap;
-    void _init(HANDLE hFile, size_t length = 0);
+    void _init(HANDLE hFile, size_t length, const MemMapOptions& options);
+#else
+    // Only kept open to drop the file from the page cache when it is unmapped.
+    // See util/io_policy.h.
+    int _fd;
 #endif
 
    public:
-    MemMap(const char* path, size_t length = 0);
+    MemMap(const char* path, size_t length = 0,
+           const MemMapOptions& options = MemMapOptions());
     ~MemMap();
 
 #ifdef _WIN32
-    MemMap(const wchar_t* path, size_t length = 0);
+    MemMap(const wchar_t* path, size_t length = 0,
+           const MemMapOptions& options = MemMapOptions());
 #endif
 
+    /**
+     * Asks the OS to start reading in the given range of the file. This
+     * returns right away. The range is clamped to the length of the file.
+     */
+    void prefetch(size_t offset, size_t length);
+
     /**
      * Returns the size of the file.
      */
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/output_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <sstream>
+#include <system_error>
+
+#include "util/io_policy.h"
+#include "util/probes.h"
+#include "util/thread_pool.h"
+
+namespace {
+
+// Used to make temporary file names unique within this process.
+std::atomic<unsigned> tmpCounter(0);
+
+/**
+ * Throws a std::system_error with the given message and path.
+ */
+template <typename String>
+void throwFileError(int err, const char* what, const String& path);
+
+}  // namespace
+
+#if defined(_WIN32)
+
+#include <fcntl.h>
+#include <io.h>
+#include <windows.h>
+
+#include <codecvt>
+#include <locale>
+
+namespace {
+
+template <>
+void throwFileError(int err, const char* what, const std::wstring& path) {
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+
+    std::stringbuf buf;
+    std::ostream msg(&buf);
+
+    msg << what << " '" << converter.to_bytes(path) << "'";
+
+    throw std::system_error(err, std::system_category(), buf.str());
+}
+
+std::wstring widen(const char* path) {
+    const int length = MultiByteToWideChar(CP_ACP, 0, path, -1, NULL, 0);
+    if (length == 0) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "failed to convert path");
+    }
+
+    std::wstring wide(length, L'\0');
+    MultiByteToWideChar(CP_ACP, 0, path, -1, &wide[0], length);
+    wide.resize(length - 1);
+    return wide;
+}
+
+}  // namespace
+
+OutputFile::OutputFile(const char* path) : _path(widen(path)), _done(false) {
+    _open();
+}
+
+OutputFile::OutputFile(const wchar_t* path) : _path(path), _done(false) {
+    _open();
+}
+
+void OutputFile::_open() {
+    while (true) {
+        std::wostringstream tmp;
+        tmp << _path << L"." << GetCurrentProcessId() << L"." << tmpCounter++
+            << L".tmp";
+        _tmpPath = tmp.str();
+
+        HANDLE h = CreateFileW(_tmpPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+                               0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+        if (h == INVALID_HANDLE_VALUE) {
+            const DWORD err = GetLastError();
+            if (err == ERROR_FILE_EXISTS) continue;
+            throwFileError((int)err, "Failed to create file", _tmpPath);
+        }
+
+        const int fd = _open_osfhandle((intptr_t)h, _O_BINARY);
+        if (fd == -1) {
+            CloseHandle(h);
+            DeleteFileW(_tmpPath.c_str());
+            throwFileError(errno, "Failed to open file", _tmpPath);
+        }
+
+        FILE* f = _fdopen(fd, "w+b");
+        if (!f) {
+            const int err = errno;
+            _close(fd);
+            DeleteFileW(_tmpPath.c_str());
+            throwFileError(err, "Failed to open file", _tmpPath);
+        }
+
+        _f = FileRef(f, [](FILE* f) { fclose(f); });
+        return;
+    }
+}
+
+OutputFile::~OutputFile() {
+    try {
+        discard();
+    } catch (...) {
+        // Nothing else we can do.
+    }
+}
+
+int OutputFile::fd() const { return _fileno(_f.get()); }
+
+void OutputFile::flush() {
+    if (fflush(_f.get()) != 0)
+        throwFileError(errno, "Failed to write file", _tmpPath);
+}
+
+void OutputFile::sync() {
+    HANDLE h = (HANDLE)_get_osfhandle(fd());
+    if (!FlushFileBuffers(h))
+        throwFileError((int)GetLastError(), "Failed to sync file", _tmpPath);
+}
+
+void OutputFile::publish() {
+    // The file must be closed before it can be moved.
+    _f.reset();
+
+    if (!MoveFileExW(_tmpPath.c_str(), _path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        const DWORD err = GetLastError();
+        DeleteFileW(_tmpPath.c_str());
+        _done = true;
+        throwFileError((int)err, "Failed to replace file", _path);
+    }
+
+    _done = true;
+}
+
+void OutputFile::discard() {
+    if (_done) return;
+
+    _done = true;
+    _f.reset();
+    DeleteFileW(_tmpPath.c_str());
+}
+
+std::wstring OutputFile::directory() const {
+    const size_t sep = _path.find_last_of(L"\\/");
+    if (sep == std::wstring::npos) return L".";
+    return _path.substr(0, sep);
+}
+
+void OutputFile::commit() {
+    flush();
+    sync();
+    doneWithFile(fd());
+
+    // MOVEFILE_WRITE_THROUGH makes the rename itself durable. There is no
+    // directory to sync on Windows.
+    publish();
+}
+
+namespace {
+
+void syncDirectory(const std::wstring& dir) { (void)dir; }
+
+}  // namespace
+
+#else  // !_WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+template <>
+void throwFileError(int err, const char* what, const std::string& path) {
+    std::stringbuf buf;
+    std::ostream msg(&buf);
+
+    msg << what << " '" << path << "'";
+
+    throw std::system_error(err, std::system_category(), buf.str());
+}
+
+#if defined(O_TMPFILE)
+
+/**
+ * Returns true if /proc/self/fd is available. A file created with O_TMPFILE
+ * can only be given a name by linking to it through there, so it is no use
+ * without it (e.g., in a chroot or container without /proc).
+ */
+bool canLinkTmpFile() {
+    static const bool available = access("/proc/self/fd", X_OK) == 0;
+    return available;
+}
+
+#endif
+
+/**
+ * Returns a new unique temporary path next to the given one.
+ */
+std::string uniqueTmpPath(const std::string& path) {
+    std::ostringstream tmp;
+    tmp << path << "." << getpid() << "." << tmpCounter++ << ".tmp";
+    return tmp.str();
+}
+
+}  // namespace
+
+OutputFile::OutputFile(const char* path)
+    : _path(path), _anonymous(false), _done(false) {
+    _open();
+}
+
+void OutputFile::_open() {
+    int fd = -1;
+
+#if defined(O_TMPFILE)
+    // Not every file system supports this. If it doesn't, fall back to a
+    // named temporary file.
+    if (canLinkTmpFile()) {
+        fd = open(directory().c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0666);
+        if (fd != -1) _anonymous = true;
+    }
+#endif
+
+    while (fd == -1) {
+        _tmpPath = uniqueTmpPath(_path);
+
+        fd = open(_tmpPath.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC,
+                  0666);
+        if (fd == -1 && errno != EEXIST)
+            throwFileError(errno, "Failed to create file", _tmpPath);
+    }
+
+    FILE* f = fdopen(fd, "w+b");
+    if (!f) {
+        const int err = errno;
+        close(fd);
+        if (!_anonymous) unlink(_tmpPath.c_str());
+        throwFileError(err, "Failed to open file", _path);
+    }
+
+    _f = FileRef(f, [](FILE* f) { fclose(f); });
+}
+
+OutputFile::~OutputFile() {
+    try {
+        discard();
+    } catch (...) {
+        // Nothing else we can do.
+    }
+}
+
+int OutputFile::fd() const { return fileno(_f.get()); }
+
+void OutputFile::flush() {
+    if (fflush(_f.get()) != 0)
+        throwFileError(errno, "Failed to write file", _path);
+}
+
+void OutputFile::sync() {
+#if defined(__APPLE__)
+    // fsync() on macOS doesn't actually flush the disk's cache.
+    if (fcntl(fd(), F_FULLFSYNC) == -1)
+        throwFileError(errno, "Failed to sync file", _path);
+#elif defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    if (fdatasync(fd()) == -1)
+        throwFileError(errno, "Failed to sync file", _path);
+#else
+    if (fsync(fd()) == -1) throwFileError(errno, "Failed to sync file", _path);
+#endif
+}
+
+void OutputFile::publish() {
+#if defined(O_TMPFILE)
+    if (_anonymous) {
+        // Give the file a name. linkat() can't replace an existing file, so
+        // link it to a unique name first and then rename that over the
+        // destination.
+        std::ostringstream procPath;
+        procPath << "/proc/self/fd/" << fd();
+
+        while (true) {
+            _tmpPath = uniqueTmpPath(_path);
+
+            if (linkat(AT_FDCWD, procPath.str().c_str(), AT_FDCWD,
+                       _tmpPath.c_str(), AT_SYMLINK_FOLLOW) == 0)
+                break;
+
+            if (errno != EEXIST) {
+                const int err = errno;
+                discard();
+                throwFileError(err, "Failed to link file", _tmpPath);
+            }
+        }
+
+        _anonymous = false;
+    }
+#endif
+
+    _f.reset();
+
+    DUCIBLE_PROBE2(rename_start, _tmpPath.c_str(), _path.c_str());
+
+    if (rename(_tmpPath.c_str(), _path.c_str()) != 0) {
+        const int err = errno;
+        unlink(_tmpPath.c_str());
+        _done = true;
+        throwFileError(err, "Failed to replace file", _path);
+    }
+
+    DUCIBLE_PROBE1(rename_done, _path.c_str());
+
+    _done = true;
+}
+
+void OutputFile::discard() {
+    if (_done) return;
+
+    _done = true;
+    _f.reset();
+
+    if (!_anonymous) unlink(_tmpPath.c_str());
+}
+
+std::string OutputFile::directory() const {
+    const size_t sep = _path.find_last_of('/');
+    if (sep == std::string::npos) return ".";
+    if (sep == 0) return "/";
+    return _path.substr(0, sep);
+}
+
+namespace {
+
+/**
+ * Syncs a directory so that renames within it are durable.
+ */
+void syncDirectory(const std::string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) throwFileError(errno, "Failed to open directory", dir);
+
+    // Some file systems don't support syncing directories. There is nothing
+    // more we can do for those.
+    if (fsync(fd) == -1 && errno != EINVAL) {
+        const int err = errno;
+        close(fd);
+        throwFileError(err, "Failed to sync directory", dir);
+    }
+
+    close(fd);
+}
+
+}  // namespace
+
+void OutputFile::commit() {
+    flush();
+    sync();
+    doneWithFile(fd());
+    publish();
+    syncDirectory(directory());
+}
+
+#endif  // _WIN32
+
+void OutputBatch::add(std::unique_ptr<OutputFile> file) {
+    _files.push_back(std::move(file));
+}
+
+void OutputBatch::commit() {
+    if (_files.empty()) return;
+
+    try {
+        for (auto&& file : _files) file->flush();
+
+        if (_files.size() == 1) {
+            _files[0]->sync();
+        } else {
+            // Syncing files one after another leaves the disk idle while we
+            // wait. Doing several at once lets the I/O scheduler merge them.
+            ThreadPool pool(std::min<size_t>(_files.size(), 8));
+
+            for (auto&& file : _files) {
+                OutputFile* f = file.get();
+                pool.run([f] { f->sync(); });
+            }
+
+            pool.wait();
+        }
+
+        for (auto&& file : _files) doneWithFile(file->fd());
+
+        // Only now that all of the data is on disk is it safe to move the
+        // files into place.
+#ifdef _WIN32
+        std::set<std::wstring> dirs;
+#else
+        std::set<std::string> dirs;
+#endif
+
+        for (auto&& file : _files) {
+            file->publish();
+            dirs.insert(file->directory());
+        }
+
+        for (auto&& dir : dirs) syncDirectory(dir);
+    } catch (...) {
+        discard();
+        throw;
+    }
+
+    _files.clear();
+}
+
+void OutputBatch::discard() { _files.clear(); }
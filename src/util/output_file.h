@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Atomic, durable replacement of output files.
+ *
+ * An output file is written to a hidden location first. When it is committed,
+ * its data is flushed to disk and only then is it moved over the destination.
+ * Thus, after a crash, the destination is either the old file or the new one,
+ * never something in between.
+ *
+ * On Linux, the file is created with O_TMPFILE so that it has no name until it
+ * is committed. If we crash before then, nothing is left behind. Elsewhere, or
+ * if /proc isn't mounted, it gets a unique temporary name next to the
+ * destination.
+ *
+ * Syncing each file on its own is slow when writing many files. An
+ * OutputBatch holds on to output files and commits them all at once so that
+ * the cost of the durability barriers is shared.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/file.h"
+
+class OutputFile {
+   private:
+#ifdef _WIN32
+    std::wstring _path;
+    std::wstring _tmpPath;
+#else
+    std::string _path;
+    std::string _tmpPath;
+
+    // True if the file was created with O_TMPFILE and has no name yet.
+    bool _anonymous;
+#endif
+
+    FileRef _f;
+    bool _done;
+
+    void _open();
+
+   public:
+    /**
+     * Creates a new output file that will replace the given path.
+     *
+     * Throws: std::system_error if the file could not be created.
+     */
+    OutputFile(const char* path);
+
+#ifdef _WIN32
+    OutputFile(const wchar_t* path);
+#endif
+
+    /**
+     * Discards the file if it hasn't been committed.
+     */
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    /**
+     * Returns the file to write to.
+     */
+    FileRef file() { return _f; }
+
+    /**
+     * Flushes buffered writes to the OS.
+     */
+    void flush();
+
+    /**
+     * Waits for the file's data to reach the disk.
+     */
+    void sync();
+
+    /**
+     * Moves the file over the destination. The file can't be written to after
+     * this. This does not sync the containing directory.
+     */
+    void publish();
+
+    /**
+     * Flushes, syncs, and publishes the file, and then syncs the directory it
+     * is in.
+     */
+    void commit();
+
+    /**
+     * Throws away the file. The destination is left untouched.
+     */
+    void discard();
+
+    /**
+     * Returns the directory that the file will be placed in.
+     */
+#ifdef _WIN32
+    std::wstring directory() const;
+#else
+    std::string directory() const;
+#endif
+
+    /**
+     * Returns the OS file descriptor. Only valid until the file is published.
+     */
+    int fd() const;
+};
+
+/**
+ * Commits many output files together.
+ */
+class OutputBatch {
+   private:
+    std::vector<std::unique_ptr<OutputFile>> _files;
+
+   public:
+    /**
+     * Adds a file to be committed later.
+     */
+    void add(std::unique_ptr<OutputFile> file);
+
+    /**
+     * Returns the number of files waiting to be committed.
+     */
+    size_t size() const { return _files.size(); }
+
+    /**
+     * Commits all of the files. First, every file is flushed and synced. Then,
+     * they are all moved into place. Finally, each directory that was touched
+     * is synced once.
+     *
+     * Throws: std::system_error if anything fails. Files that were not yet
+     * moved into place are discarded.
+     */
+    void commit();
+
+    /**
+     * Discards all of the files.
+     */
+    void discard();
+};
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/perf_counters.h"
+
+#include <mutex>
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#endif
+
+namespace {
+
+bool enabled = false;
+
+// Regions in the order that they first ran. There are only ever a handful of
+// them, so a linear search is fine.
+std::mutex regionLock;
+std::vector<PerfRegionStats> regions;
+
+void add(uint64_t& total, uint64_t start, uint64_t end) {
+    if (total == kPerfNotCounted) return;
+
+    if (start == kPerfNotCounted || end == kPerfNotCounted)
+        total = kPerfNotCounted;
+    else
+        total += end - start;
+}
+
+#if defined(__linux__)
+
+struct CounterConfig {
+    uint32_t type;
+    uint64_t config;
+};
+
+// In the same order as the fields of PerfSample.
+const CounterConfig counterConfigs[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+const size_t counterCount = sizeof(counterConfigs) / sizeof(counterConfigs[0]);
+
+int openCounter(const CounterConfig& c, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = c.type;
+    attr.config         = c.config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    // Count the calling thread on any CPU.
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/**
+ * The counters of one thread. They are opened the first time a region runs on
+ * the thread and closed when the thread exits.
+ */
+class ThreadCounters {
+   private:
+    int _fds[counterCount];
+
+   public:
+    ThreadCounters() {
+        // The hardware counters are put in a group so that they are scheduled
+        // onto the PMU together. Software counters can't lead a group of
+        // hardware counters, so the page fault counter is on its own.
+        int leader = -1;
+
+        for (size_t i = 0; i < counterCount; ++i) {
+            const bool hardware = counterConfigs[i].type == PERF_TYPE_HARDWARE;
+            _fds[i] = openCounter(counterConfigs[i], hardware ? leader : -1);
+            if (hardware && leader == -1) leader = _fds[i];
+        }
+    }
+
+    ~ThreadCounters() {
+        for (int fd : _fds) {
+            if (fd != -1) close(fd);
+        }
+    }
+
+    /**
+     * Returns true if any counter could be opened.
+     */
+    bool available() const {
+        for (int fd : _fds) {
+            if (fd != -1) return true;
+        }
+
+        return false;
+    }
+
+    PerfSample read() const {
+        uint64_t values[counterCount];
+
+        for (size_t i = 0; i < counterCount; ++i) {
+            if (_fds[i] == -1 ||
+                ::read(_fds[i], &values[i], sizeof(values[i])) !=
+                    sizeof(values[i]))
+                values[i] = kPerfNotCounted;
+        }
+
+        PerfSample sample;
+        sample.cycles       = values[0];
+        sample.instructions = values[1];
+        sample.branchMisses = values[2];
+        sample.cacheMisses  = values[3];
+        sample.pageFaults   = values[4];
+        return sample;
+    }
+};
+
+ThreadCounters& threadCounters() {
+    thread_local ThreadCounters counters;
+    return counters;
+}
+
+PerfSample readCounters() { return threadCounters().read(); }
+
+#else
+
+PerfSample readCounters() {
+    PerfSample sample;
+    sample.cycles       = kPerfNotCounted;
+    sample.instructions = kPerfNotCounted;
+    sample.branchMisses = kPerfNotCounted;
+    sample.cacheMisses  = kPerfNotCounted;
+    sample.pageFaults   = kPerfNotCounted;
+    return sample;
+}
+
+#endif
+
+}  // namespace
+
+bool perfCountersEnable(std::string& why) {
+#if defined(__linux__)
+    // Opening the counters sets errno on failure.
+    errno = 0;
+
+    if (!threadCounters().available()) {
+        why = errno ? strerror(errno) : "no counters";
+        return false;
+    }
+
+    enabled = true;
+    return true;
+#else
+    why = "not supported on this platform";
+    return false;
+#endif
+}
+
+bool perfCountersEnabled() { return enabled; }
+
+std::vector<PerfRegionStats> perfRegionStats() {
+    std::lock_guard<std::mutex> lock(regionLock);
+    return regions;
+}
+
+PerfRegion::PerfRegion(const char* name, uint64_t bytes)
+    : _name(name), _bytes(bytes), _active(enabled) {
+    if (_active) _start = readCounters();
+}
+
+PerfRegion::~PerfRegion() {
+    if (!_active) return;
+
+    const PerfSample end = readCounters();
+
+    std::lock_guard<std::mutex> lock(regionLock);
+
+    PerfRegionStats* stats = nullptr;
+    for (auto&& r : regions) {
+        if (r.name == _name) {
+            stats = &r;
+            break;
+        }
+    }
+
+    if (!stats) {
+        PerfRegionStats r = {_name, 0, 0, {0, 0, 0, 0, 0}};
+        regions.push_back(r);
+        stats = &regions.back();
+    }
+
+    ++stats->calls;
+    stats->bytes += _bytes;
+
+    add(stats->counters.cycles, _start.cycles, end.cycles);
+    add(stats->counters.instructions, _start.instructions, end.instructions);
+    add(stats->counters.branchMisses, _start.branchMisses, end.branchMisses);
+    add(stats->counters.cacheMisses, _start.cacheMisses, end.cacheMisses);
+    add(stats->counters.pageFaults, _start.pageFaults, end.pageFaults);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Hardware performance counters around regions of code.
+ *
+ * Wall time alone doesn't say why a region runs at the speed it does. When
+ * enabled, each region samples cycles, instructions, branch misses, last level
+ * cache misses, and page faults of the thread it runs on. The samples of all
+ * runs of a region are added up so that they can be reported at the end.
+ *
+ * On Linux, the counters are read with perf_event_open() directly. Counters
+ * that the kernel or the hardware doesn't provide (e.g., in a virtual machine
+ * or with a restrictive perf_event_paranoid setting) are skipped. Elsewhere,
+ * counters are never available.
+ */
+
+/**
+ * Counter values. A value of `kPerfNotCounted` means that the counter is not
+ * available.
+ */
+struct PerfSample {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t branchMisses;
+    uint64_t cacheMisses;
+    uint64_t pageFaults;
+};
+
+const uint64_t kPerfNotCounted = (uint64_t)-1;
+
+/**
+ * The counters of all runs of a region, added up.
+ */
+struct PerfRegionStats {
+    std::string name;
+
+    // Number of times the region ran.
+    uint64_t calls;
+
+    // Bytes processed by the region.
+    uint64_t bytes;
+
+    PerfSample counters;
+};
+
+/**
+ * Enables counting in regions. Returns false if no counters are available, in
+ * which case `why` is set to the reason. Regions are not counted until this is
+ * called.
+ */
+bool perfCountersEnable(std::string& why);
+
+/**
+ * Returns true if regions are being counted.
+ */
+bool perfCountersEnabled();
+
+/**
+ * Returns the counters of each region, in the order that the regions first
+ * ran.
+ */
+std::vector<PerfRegionStats> perfRegionStats();
+
+/**
+ * Counts a region of code from construction to destruction. The region must
+ * start and end on the same thread. Regions may nest, in which case the
+ * counters of the inner region are also included in the outer region.
+ */
+class PerfRegion {
+   private:
+    const char* _name;
+    uint64_t _bytes;
+    bool _active;
+    PerfSample _start;
+
+   public:
+    /**
+     * Params:
+     *   name  = Name of the region. This must be a string literal.
+     *   bytes = Number of bytes processed by the region, for calculating
+     *           throughput.
+     */
+    PerfRegion(const char* name, uint64_t bytes = 0);
+    ~PerfRegion();
+
+    PerfRegion(const PerfRegion&) = delete;
+    PerfRegion& operator=(const PerfRegion&) = delete;
+};
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+/**
+ * Static tracepoints (USDT probes) on the boundaries of ducible's phases.
+ *
+ * These let tools like bpftrace, perf, and SystemTap attach to a running
+ * ducible without rebuilding it. For example:
+ *
+ *     bpftrace -e 'usdt:./ducible:ducible:pass_start { printf("%s\n",
+ *         str(arg0)); }'
+ *
+ * A probe is a single `nop` instruction plus an ELF note describing where its
+ * arguments live, so it costs next to nothing when nothing is attached. The
+ * probes are:
+ *
+ *     image_map_start(path)              image_map_done(path, length)
+ *     pe_parse_start(length)             pe_parse_done(length)
+ *     hash_start(length)                 hash_done(length)
+ *     pdb_open_start()                   pdb_open_done(length, streams)
+ *     pass_start(name, stream)           pass_done(name, stream)
+ *     msf_write_start(streams)           msf_write_done(pages)
+ *     rename_start(from, to)             rename_done(to)
+ *
+ * where paths and names are C strings, `stream` is the index of the first
+ * stream the pass writes, and everything else is an integer.
+ *
+ * If <sys/sdt.h> is available, it is used. Otherwise, the notes are emitted
+ * here in the same format, which works on x86-64 and AArch64 ELF targets. On
+ * other targets, or if DUCIBLE_NO_PROBES is defined, the probes compile to
+ * nothing.
+ */
+
+#include <stdint.h>
+
+#if !defined(DUCIBLE_NO_PROBES) && defined(__ELF__) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define DUCIBLE_HAVE_SDT_H
+#endif
+#endif
+
+#if defined(DUCIBLE_HAVE_SDT_H)
+
+#include <sys/sdt.h>
+
+#define DUCIBLE_PROBE(name) STAP_PROBE(ducible, name)
+#define DUCIBLE_PROBE1(name, a) \
+    STAP_PROBE1(ducible, name, ducibleProbeArg(a))
+#define DUCIBLE_PROBE2(name, a, b) \
+    STAP_PROBE2(ducible, name, ducibleProbeArg(a), ducibleProbeArg(b))
+
+#else
+
+// The layout of the note matches what <sys/sdt.h> emits (version 3): the
+// address of the probe, the address of the .stapsdt.base section (so that
+// tools can tell if the binary was prelinked), the address of a semaphore
+// (none here), and then the provider, the probe name, and the locations of
+// the arguments. Every argument is passed as a signed 64-bit integer.
+#define DUCIBLE_PROBE_ASM(name, args, ...)                                \
+    __asm__ __volatile__(                                                 \
+        "990: nop\n"                                                      \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                     \
+        ".balign 4\n"                                                     \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                \
+        "991: .asciz \"stapsdt\"\n"                                       \
+        "992: .balign 4\n"                                                \
+        "993: .8byte 990b\n"                                              \
+        ".8byte _.stapsdt.base\n"                                         \
+        ".8byte 0\n"                                                      \
+        ".asciz \"ducible\"\n"                                            \
+        ".asciz \"" #name "\"\n"                                          \
+        ".asciz \"" args "\"\n"                                           \
+        "994: .balign 4\n"                                                \
+        ".popsection\n"                                                   \
+        ".ifndef _.stapsdt.base\n"                                        \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,"   \
+        "comdat\n"                                                        \
+        ".weak _.stapsdt.base\n"                                          \
+        ".hidden _.stapsdt.base\n"                                        \
+        "_.stapsdt.base: .space 1\n"                                      \
+        ".size _.stapsdt.base, 1\n"                                       \
+        ".popsection\n"                                                   \
+        ".endif\n"                                                        \
+        :                                                                 \
+        : __VA_ARGS__)
+
+#define DUCIBLE_PROBE(name) DUCIBLE_PROBE_ASM(name, "", )
+#define DUCIBLE_PROBE1(name, a) \
+    DUCIBLE_PROBE_ASM(name, "-8@%0", "nor"(ducibleProbeArg(a)))
+#define DUCIBLE_PROBE2(name, a, b)                                  \
+    DUCIBLE_PROBE_ASM(name, "-8@%0 -8@%1", "nor"(ducibleProbeArg(a)), \
+                      "nor"(ducibleProbeArg(b)))
+
+#endif  // DUCIBLE_HAVE_SDT_H
+
+/**
+ * Converts a probe argument to an integer. Pointers (e.g., strings) are passed
+ * by address.
+ */
+template <typename T>
+inline int64_t ducibleProbeArg(T* p) {
+    return (int64_t)(intptr_t)p;
+}
+
+template <typename T>
+inline int64_t ducibleProbeArg(T x) {
+    return (int64_t)x;
+}
+
+#else
+
+#define DUCIBLE_PROBE(name) \
+    do {                    \
+    } while (0)
+#define DUCIBLE_PROBE1(name, a) \
+    do {                        \
+    } while (0)
+#define DUCIBLE_PROBE2(name, a, b) \
+    do {                           \
+    } while (0)
+
+#endif
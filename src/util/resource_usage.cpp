@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/resource_usage.h"
+
+#include <system_error>
+
+#if defined(_WIN32)
+
+#include <windows.h>
+
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+ResourceUsage getResourceUsage() {
+    PROCESS_MEMORY_COUNTERS counters;
+
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters))) {
+        throw std::system_error(GetLastError(), std::system_category(),
+                                "GetProcessMemoryInfo() failed");
+    }
+
+    ResourceUsage usage;
+    usage.peakRss     = counters.PeakWorkingSetSize;
+    usage.minorFaults = counters.PageFaultCount;
+    usage.majorFaults = 0;
+    return usage;
+}
+
+#else
+
+#include <errno.h>
+#include <sys/resource.h>
+
+ResourceUsage getResourceUsage() {
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        throw std::system_error(errno, std::system_category(),
+                                "getrusage() failed");
+    }
+
+    ResourceUsage usage;
+
+#if defined(__APPLE__)
+    // macOS reports this in bytes.
+    usage.peakRss = (size_t)ru.ru_maxrss;
+#else
+    // Everyone else reports this in kilobytes.
+    usage.peakRss = (size_t)ru.ru_maxrss * 1024;
+#endif
+
+    usage.minorFaults = (uint64_t)ru.ru_minflt;
+    usage.majorFaults = (uint64_t)ru.ru_majflt;
+    return usage;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) : _active(0), _stopping(false) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+
+    // hardware_concurrency() is allowed to return 0 if it doesn't know.
+    if (threads == 0) threads = 1;
+
+    for (size_t i = 0; i < threads; ++i)
+        _threads.push_back(std::thread(&ThreadPool::_worker, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+
+    _work.notify_all();
+
+    for (auto&& t : _threads) t.join();
+}
+
+void ThreadPool::run(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(std::move(task));
+    }
+
+    _work.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _idle.wait(lock, [this] { return _queue.empty() && _active == 0; });
+
+    if (_error) {
+        std::exception_ptr error = _error;
+        _error                   = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::_worker() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _work.wait(lock, [this] { return _stopping || !_queue.empty(); });
+
+        if (_queue.empty()) {
+            // Only reachable when stopping.
+            return;
+        }
+
+        std::function<void()> task = std::move(_queue.front());
+        _queue.pop_front();
+        ++_active;
+
+        lock.unlock();
+
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> errorLock(_mutex);
+            if (!_error) _error = std::current_exception();
+        }
+
+        lock.lock();
+
+        --_active;
+
+        if (_queue.empty() && _active == 0) _idle.notify_all();
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed-size pool of worker threads.
+ *
+ * Tasks are run in the order they are submitted, but may complete in any
+ * order. Tasks are allowed to submit more tasks. If a task throws an exception,
+ * the first one is saved and rethrown by `wait()`.
+ */
+class ThreadPool {
+   private:
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _queue;
+
+    std::mutex _mutex;
+
+    // Signaled when there is more work to do or when shutting down.
+    std::condition_variable _work;
+
+    // Signaled when the pool becomes idle.
+    std::condition_variable _idle;
+
+    // Number of tasks currently running.
+    size_t _active;
+
+    bool _stopping;
+
+    // The first exception thrown by a task.
+    std::exception_ptr _error;
+
+    void _worker();
+
+   public:
+    /**
+     * Params:
+     *   threads = Number of worker threads. If 0, the number of hardware
+     *             threads is used.
+     */
+    explicit ThreadPool(size_t threads = 0);
+
+    ~ThreadPool();
+
+    /**
+     * Returns the number of worker threads.
+     */
+    size_t size() const { return _threads.size(); }
+
+    /**
+     * Submits a task to the pool.
+     */
+    void run(std::function<void()> task);
+
+    /**
+     * Waits for all submitted tasks to finish. If any task threw an exception,
+     * the first one is rethrown here.
+     *
+     * This must not be called from inside a task.
+     */
+    void wait();
+};
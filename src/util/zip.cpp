@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "util/zip.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include "util/crc32.h"
+#include "util/deflate.h"
+
+namespace {
+
+const uint32_t kCentralHeaderSignature = 0x02014b50;
+const uint32_t kEndOfDirSignature      = 0x06054b50;
+const uint32_t kZip64LocatorSignature  = 0x07064b50;
+
+const size_t kLocalHeaderSize   = 30;
+const size_t kCentralHeaderSize = 46;
+const size_t kEndOfDirSize      = 22;
+const size_t kZip64LocatorSize  = 20;
+
+// Flag bits.
+const uint16_t kFlagEncrypted = 1 << 0;
+const uint16_t kFlagUtf8      = 1 << 11;
+
+// Every member is given this timestamp. In MS-DOS format, this is Jan 1,
+// 2010, 0:00:00, the same date that images are given.
+const uint16_t kZipTime = 0;
+const uint16_t kZipDate = ((2010 - 1980) << 9) | (1 << 5) | 1;
+
+uint16_t read16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+uint32_t read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void put16(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back((uint8_t)v);
+    out.push_back((uint8_t)(v >> 8));
+}
+
+void put32(std::vector<uint8_t>& out, uint32_t v) {
+    put16(out, v & 0xFFFF);
+    put16(out, v >> 16);
+}
+
+void putString(std::vector<uint8_t>& out, const std::string& s) {
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+/**
+ * Finds the end of central directory record. It is at the end of the file,
+ * followed only by the archive comment.
+ */
+size_t findEndOfDir(const uint8_t* buf, size_t length) {
+    if (length < kEndOfDirSize) throw InvalidZip("file is too small");
+
+    const size_t last  = length - kEndOfDirSize;
+    const size_t first = last > 0xFFFF ? last - 0xFFFF : 0;
+
+    for (size_t i = last + 1; i-- > first;) {
+        if (read32(buf + i) == kEndOfDirSignature &&
+            i + kEndOfDirSize + read16(buf + i + 20) == length)
+            return i;
+    }
+
+    throw InvalidZip("missing end of central directory record");
+}
+
+}  // namespace
+
+std::vector<ZipEntry> readZipDirectory(const uint8_t* buf, size_t length,
+                                       std::string* comment) {
+    const size_t eod = findEndOfDir(buf, length);
+    const uint8_t* p = buf + eod;
+
+    if (eod >= kZip64LocatorSize &&
+        read32(buf + eod - kZip64LocatorSize) == kZip64LocatorSignature)
+        throw InvalidZip("ZIP64 archives are not supported");
+
+    if (read16(p + 4) != 0 || read16(p + 6) != 0)
+        throw InvalidZip("multi-disk archives are not supported");
+
+    const size_t count     = read16(p + 10);
+    const size_t dirSize   = read32(p + 12);
+    const size_t dirOffset = read32(p + 16);
+
+    if (dirOffset > eod || dirSize > eod - dirOffset)
+        throw InvalidZip("central directory is out of bounds");
+
+    if (comment)
+        comment->assign((const char*)p + kEndOfDirSize, read16(p + 20));
+
+    std::vector<ZipEntry> entries;
+    entries.reserve(count);
+
+    const uint8_t* dir    = buf + dirOffset;
+    const uint8_t* dirEnd = dir + dirSize;
+
+    for (size_t i = 0; i < count; ++i) {
+        if ((size_t)(dirEnd - dir) < kCentralHeaderSize ||
+            read32(dir) != kCentralHeaderSignature)
+            throw InvalidZip("invalid central directory header");
+
+        const size_t nameLength    = read16(dir + 28);
+        const size_t extraLength   = read16(dir + 30);
+        const size_t commentLength = read16(dir + 32);
+
+        const size_t headerLength =
+            kCentralHeaderSize + nameLength + extraLength + commentLength;
+
+        if ((size_t)(dirEnd - dir) < headerLength)
+            throw InvalidZip("central directory header is truncated");
+
+        ZipEntry entry;
+        entry.versionMadeBy      = read16(dir + 4);
+        entry.flags              = read16(dir + 8);
+        entry.method             = read16(dir + 10);
+        entry.crc32              = read32(dir + 16);
+        entry.compressedSize     = read32(dir + 20);
+        entry.uncompressedSize   = read32(dir + 24);
+        entry.internalAttributes = read16(dir + 36);
+        entry.externalAttributes = read32(dir + 38);
+
+        entry.name.assign((const char*)dir + kCentralHeaderSize, nameLength);
+        entry.comment.assign(
+            (const char*)dir + kCentralHeaderSize + nameLength + extraLength,
+            commentLength);
+
+        if (entry.flags & kFlagEncrypted)
+            throw InvalidZip("encrypted members are not supported");
+
+        if (entry.compressedSize == 0xFFFFFFFF ||
+            entry.uncompressedSize == 0xFFFFFFFF)
+            throw InvalidZip("ZIP64 archives are not supported");
+
+        // The local header can have a different amount of extra data, so its
+        // length has to be read from the local header itself.
+        const size_t localOffset = read32(dir + 42);
+
+        if (localOffset > eod || eod - localOffset < kLocalHeaderSize ||
+            read32(buf + localOffset) != kZipLocalHeaderSignature)
+            throw InvalidZip("invalid local header");
+
+        entry.dataOffset = localOffset + kLocalHeaderSize +
+                           read16(buf + localOffset + 26) +
+                           read16(buf + localOffset + 28);
+
+        if (entry.dataOffset > eod ||
+            entry.compressedSize > eod - entry.dataOffset)
+            throw InvalidZip("member data is out of bounds");
+
+        entries.push_back(entry);
+
+        dir += headerLength;
+    }
+
+    return entries;
+}
+
+void extractZipEntry(const uint8_t* buf, const ZipEntry& entry,
+                     std::vector<uint8_t>& out) {
+    const uint8_t* data = buf + entry.dataOffset;
+
+    out.clear();
+
+    switch (entry.method) {
+        case kZipStored:
+            out.assign(data, data + entry.compressedSize);
+            break;
+
+        case kZipDeflated:
+            // Don't trust the size too much; it only saves reallocating.
+            out.reserve(std::min<size_t>(
+                entry.uncompressedSize,
+                (size_t)entry.compressedSize * 1032 + 64));
+            inflate(data, entry.compressedSize, out);
+            break;
+
+        default:
+            throw InvalidZip("unsupported compression method");
+    }
+
+    if (out.size() != entry.uncompressedSize)
+        throw InvalidZip("member size does not match the central directory");
+
+    if (crc32(0, out.data(), out.size()) != entry.crc32)
+        throw InvalidZip("member CRC does not match the central directory");
+}
+
+ZipWriter::ZipWriter(FileRef f) : _f(f), _offset(0), _count(0) {}
+
+void ZipWriter::_write(const void* data, size_t length) {
+    if (fwrite(data, 1, length, _f.get()) != length) {
+        throw std::system_error(errno, std::system_category(),
+                                "failed writing zip archive");
+    }
+
+    _offset += length;
+}
+
+void ZipWriter::add(const ZipEntry& entry, const uint8_t* data) {
+    if (_offset > 0xFFFFFFFF || _count == 0xFFFF)
+        throw InvalidZip("archive is too large without ZIP64");
+
+    const uint16_t versionNeeded = entry.method == kZipDeflated ? 20 : 10;
+
+    // Keep only the flag that says how to interpret the name. The rest are
+    // about things that are never written (data descriptors, encryption) or
+    // are only hints.
+    const uint16_t flags = entry.flags & kFlagUtf8;
+
+    std::vector<uint8_t> header;
+    put32(header, kZipLocalHeaderSignature);
+    put16(header, versionNeeded);
+    put16(header, flags);
+    put16(header, entry.method);
+    put16(header, kZipTime);
+    put16(header, kZipDate);
+    put32(header, entry.crc32);
+    put32(header, entry.compressedSize);
+    put32(header, entry.uncompressedSize);
+    put16(header, (uint32_t)entry.name.size());
+    put16(header, 0);  // Extra field length
+    putString(header, entry.name);
+
+    // Keep the host system so that the file attributes mean the same thing.
+    put32(_directory, kCentralHeaderSignature);
+    put16(_directory, (entry.versionMadeBy & 0xFF00) | 20);
+    put16(_directory, versionNeeded);
+    put16(_directory, flags);
+    put16(_directory, entry.method);
+    put16(_directory, kZipTime);
+    put16(_directory, kZipDate);
+    put32(_directory, entry.crc32);
+    put32(_directory, entry.compressedSize);
+    put32(_directory, entry.uncompressedSize);
+    put16(_directory, (uint32_t)entry.name.size());
+    put16(_directory, 0);  // Extra field length
+    put16(_directory, (uint32_t)entry.comment.size());
+    put16(_directory, 0);  // Disk number
+    put16(_directory, entry.internalAttributes);
+    put32(_directory, entry.externalAttributes);
+    put32(_directory, (uint32_t)_offset);
+    putString(_directory, entry.name);
+    putString(_directory, entry.comment);
+
+    _write(header.data(), header.size());
+    _write(data, entry.compressedSize);
+
+    ++_count;
+}
+
+void ZipWriter::finish(const std::string& comment) {
+    if (_offset > 0xFFFFFFFF || _directory.size() > 0xFFFFFFFF)
+        throw InvalidZip("archive is too large without ZIP64");
+
+    const uint32_t dirOffset = (uint32_t)_offset;
+
+    std::vector<uint8_t> end;
+    put32(end, kEndOfDirSignature);
+    put16(end, 0);  // Disk number
+    put16(end, 0);  // Disk with the central directory
+    put16(end, (uint32_t)_count);
+    put16(end, (uint32_t)_count);
+    put32(end, (uint32_t)_directory.size());
+    put32(end, dirOffset);
+    put16(end, (uint32_t)std::min<size_t>(comment.size(), 0xFFFF));
+    end.insert(end.end(), comment.begin(),
+               comment.begin() + std::min<size_t>(comment.size(), 0xFFFF));
+
+    _write(_directory.data(), _directory.size());
+    _write(end.data(), end.size());
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2016 Jason White
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Reading and writing zip archives.
+ *
+ * Only what is needed to rewrite packages (e.g., NuGet packages) is supported:
+ * stored and deflated members in a single-disk archive. ZIP64 and encryption
+ * are not supported.
+ *
+ * Archives are written deterministically. Every member gets the same fixed
+ * timestamp, extra fields (which mostly hold more timestamps) are dropped, and
+ * data descriptors are never used.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>  // For size_t
+
+#include <string>
+#include <vector>
+
+#include "util/file.h"
+
+/**
+ * Thrown when a zip archive is malformed or uses a feature that isn't
+ * supported.
+ */
+class InvalidZip {
+   private:
+    const char* _why;
+
+   public:
+    InvalidZip(const char* why) : _why(why) {}
+
+    const char* why() const { return _why; }
+};
+
+// Compression methods.
+const uint16_t kZipStored   = 0;
+const uint16_t kZipDeflated = 8;
+
+// Magic number at the start of every local file header, and thus at the start
+// of nearly every zip archive.
+const uint32_t kZipLocalHeaderSignature = 0x04034b50;
+
+/**
+ * A member of a zip archive as described by the central directory.
+ */
+struct ZipEntry {
+    std::string name;
+    std::string comment;
+
+    uint16_t versionMadeBy;
+    uint16_t flags;
+    uint16_t method;
+    uint32_t crc32;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint16_t internalAttributes;
+    uint32_t externalAttributes;
+
+    // Offset of the member's data in the archive, just past its local header.
+    // Only set for entries that were read from an archive.
+    size_t dataOffset;
+
+    ZipEntry()
+        : versionMadeBy(0),
+          flags(0),
+          method(kZipStored),
+          crc32(0),
+          compressedSize(0),
+          uncompressedSize(0),
+          internalAttributes(0),
+          externalAttributes(0),
+          dataOffset(0) {}
+};
+
+/**
+ * Reads the central directory of an archive that is in memory. The archive
+ * comment is stored in `comment` if it isn't null.
+ *
+ * Throws: InvalidZip
+ */
+std::vector<ZipEntry> readZipDirectory(const uint8_t* buf, size_t length,
+                                       std::string* comment = nullptr);
+
+/**
+ * Decompresses a member of an archive that is in memory and checks its CRC.
+ *
+ * Throws: InvalidZip or InvalidDeflate
+ */
+void extractZipEntry(const uint8_t* buf, const ZipEntry& entry,
+                     std::vector<uint8_t>& out);
+
+/**
+ * Writes out an archive one member at a time.
+ */
+class ZipWriter {
+   private:
+    FileRef _f;
+
+    // Where the next local header goes.
+    uint64_t _offset;
+
+    // The central directory, built up as members are added.
+    std::vector<uint8_t> _directory;
+    size_t _count;
+
+    void _write(const void* data, size_t length);
+
+   public:
+    ZipWriter(FileRef f);
+
+    /**
+     * Adds a member. `data` must already be compressed with `entry.method`,
+     * and the entry's sizes and CRC must describe it.
+     *
+     * Throws: InvalidZip if the archive gets too large.
+     */
+    void add(const ZipEntry& entry, const uint8_t* data);
+
+    /**
+     * Writes out the central directory. Nothing can be added after this.
+     */
+    void finish(const std::string& comment);
+};